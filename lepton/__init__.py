@@ -3,7 +3,7 @@
 __version__ = "1.0"
 
 from .system import ParticleSystem
-from .group import ParticleGroup
+from .group import ParticleGroup, simd_level
 from .particle_struct import Particle
 
 # Init default particle system for convenience
@@ -21,6 +21,8 @@
 #include "compat.h"
 #include "group.h"
 #include "vector.h"
+#include "domain.h"
+#include "simd.h"
 
 static PyTypeObject GravityController_Type;
 
@@ -43,31 +45,40 @@ GravityController_init(GravityControllerObject *self, PyObject *args)
 	return 0;
 }
 
+static void
+GravityController_update_range(GravityControllerObject *self, GroupObject *pgroup, float td,
+	unsigned long start, unsigned long end)
+{
+	Vec3 g;
+
+	g.x = self->gravity.x * td;
+	g.y = self->gravity.y * td;
+	g.z = self->gravity.z * td;
+	Simd_kernels()->vec3_add(Group_column(pgroup, PATTR_VELOCITY), &g,
+		start, end);
+}
+
+static ControllerNative GravityController_native = {
+	NULL,
+	(void (*)(PyObject *, GroupObject *, float, unsigned long, unsigned long))
+		GravityController_update_range,
+	NULL,
+	PATTR_BIT(PATTR_VELOCITY),
+	"Gravity controller"
+};
+
 static PyObject *
 GravityController_call(GravityControllerObject *self, PyObject *args)
 {
 	float td;
 	GroupObject *pgroup;
-	register Particle *p;
-	Vec3 g;
-	register unsigned long count;
+	ControllerNative *native = &GravityController_native;
 
-	if (!PyArg_ParseTuple(args, "fO:__init__", &td, &pgroup))
+	if (!PyArg_ParseTuple(args, "fO:__call__", &td, &pgroup))
 		return NULL;
-
-	if (!GroupObject_Check(pgroup))
+	if (!GroupObject_Check(pgroup)
+		|| Controller_run_fused(pgroup, td, (PyObject **)&self, &native, 1) < 0)
 		return NULL;
-
-	p = pgroup->plist->p;
-	g.x = self->gravity.x * td;
-	g.y = self->gravity.y * td;
-	g.z = self->gravity.z * td;
-	count = GroupObject_ActiveCount(pgroup);
-	while (count--) {
-		Vec3_add(&p->velocity, &p->velocity, &g);
-		p++;
-	}
-
 	Py_INCREF(Py_None);
 	return Py_None;
 }
@@ -197,23 +208,23 @@ MovementController_init(MovementControllerObject *self, PyObject *args, PyObject
 	return 0;
 }
 
-static PyObject *
-MovementController_call(MovementControllerObject *self, PyObject *args)
+static void
+MovementController_update_range(MovementControllerObject *self, GroupObject *pgroup, float td,
+	unsigned long start, unsigned long end)
 {
-	float td;
-	GroupObject *pgroup;
-	register Particle *p;
-	Vec3 v;
+	ParticleColumn position, velocity, up, rotation;
+	const SimdKernels *simd = Simd_kernels();
+	Vec3 v, *vel;
 	float min_v, min_v_sq, max_v, max_v_sq, v_sq, v_adj;
-	register unsigned long count;
-
-	if (!PyArg_ParseTuple(args, "fO:__init__", &td, &pgroup))
-		return NULL;
-
-	if (!GroupObject_Check(pgroup))
-		return NULL;
-
-	p = pgroup->plist->p;
+	int spin;
+	register unsigned long i;
+
+	position = Group_column(pgroup, PATTR_POSITION);
+	velocity = Group_column(pgroup, PATTR_VELOCITY);
+	up = Group_column(pgroup, PATTR_UP);
+	rotation = Group_column(pgroup, PATTR_ROTATION);
+	/* Rotation is only applied if the group stores it */
+	spin = up.base != NULL && rotation.base != NULL;
 	min_v = self->min_velocity;
 	min_v_sq = min_v * min_v;
 	max_v = self->max_velocity;
@@ -221,39 +232,61 @@ MovementController_call(MovementControllerObject *self, PyObject *args)
 		max_v_sq = max_v * max_v;
 	else
 		max_v_sq = FLT_MAX;
-	count = GroupObject_ActiveCount(pgroup);
 
-	if (self->damping.x == 1.0f &&
-		self->damping.y == 1.0f &&
-		self->damping.z == 1.0f &&
-		max_v == FLT_MAX && min_v == 0) {
-		/* simple case, no damping or velocity bounds */
-		while (count--) {
-			Vec3_scalar_mul(&v, &p->velocity, td);
-			Vec3_addi(&p->position, &v);
-			Vec3_scalar_mul(&v, &p->rotation, td);
-			Vec3_addi(&p->up, &v);
-			p++;
-		}
+	if (max_v == FLT_MAX && min_v == 0) {
+		/* simple cases without velocity bounds, one vector kernel each */
+		if (self->damping.x == 1.0f &&
+			self->damping.y == 1.0f &&
+			self->damping.z == 1.0f)
+			simd->vec3_add_scaled(position, velocity, td, start, end);
+		else
+			simd->vec3_damp_add(position, velocity, &self->damping, td,
+				start, end);
+		if (spin)
+			simd->vec3_add_scaled(up, rotation, td, start, end);
 	} else {
-		while (count--) {
-			Vec3_mul(&p->velocity, &p->velocity, &self->damping);
-			v_sq = Vec3_len_sq(&p->velocity);
+		for (i = start; i < end; i++) {
+			vel = Column_ptr(velocity, Vec3, i);
+			Vec3_mul(vel, vel, &self->damping);
+			v_sq = Vec3_len_sq(vel);
 			if (v_sq > max_v_sq) {
 				v_adj = max_v * InvSqrt(v_sq);
-				Vec3_scalar_mul(&p->velocity, &p->velocity, v_adj);
+				Vec3_scalar_mul(vel, vel, v_adj);
 			} else if (v_sq < min_v_sq && v_sq > 0) {
 				v_adj = min_v * InvSqrt(v_sq);
-				Vec3_scalar_mul(&p->velocity, &p->velocity, v_adj);
+				Vec3_scalar_mul(vel, vel, v_adj);
+			}
+			Vec3_scalar_mul(&v, vel, td);
+			Vec3_addi(Column_ptr(position, Vec3, i), &v);
+			if (spin) {
+				Vec3_scalar_mul(&v, Column_ptr(rotation, Vec3, i), td);
+				Vec3_addi(Column_ptr(up, Vec3, i), &v);
 			}
-			Vec3_scalar_mul(&v, &p->velocity, td);
-			Vec3_addi(&p->position, &v);
-			Vec3_scalar_mul(&v, &p->rotation, td);
-			Vec3_addi(&p->up, &v);
-			p++;
 		}
 	}
+}
+
+static ControllerNative MovementController_native = {
+	NULL,
+	(void (*)(PyObject *, GroupObject *, float, unsigned long, unsigned long))
+		MovementController_update_range,
+	NULL,
+	PATTR_BIT(PATTR_POSITION) | PATTR_BIT(PATTR_VELOCITY),
+	"Movement controller"
+};
+
+static PyObject *
+MovementController_call(MovementControllerObject *self, PyObject *args)
+{
+	float td;
+	GroupObject *pgroup;
+	ControllerNative *native = &MovementController_native;
 
+	if (!PyArg_ParseTuple(args, "fO:__call__", &td, &pgroup))
+		return NULL;
+	if (!GroupObject_Check(pgroup)
+		|| Controller_run_fused(pgroup, td, (PyObject **)&self, &native, 1) < 0)
+		return NULL;
 	Py_INCREF(Py_None);
 	return Py_None;
 }
@@ -397,22 +430,17 @@ PyDoc_STRVAR(FaderController__doc__,
 	"fade_out_end -- Time when alpha reaches end.\n"
 	"end_alpha -- Ending alpha level.\n");
 
-static PyObject *
-FaderController_call(FaderControllerObject *self, PyObject *args)
+static void
+FaderController_update_range(FaderControllerObject *self, GroupObject *pgroup, float td,
+	unsigned long start, unsigned long end)
 {
-	float td;
-	GroupObject *pgroup;
-	register Particle *p;
+	ParticleColumn color, age_col;
 	float in_start, in_end, in_time, in_alpha, out_start, out_end, out_time, out_alpha;
-	register unsigned long count;
-
-	if (!PyArg_ParseTuple(args, "fO:__init__", &td, &pgroup))
-		return NULL;
-
-	if (!GroupObject_Check(pgroup))
-		return NULL;
+	float age, *alpha;
+	register unsigned long i;
 
-	p = pgroup->plist->p;
+	color = Group_column(pgroup, PATTR_COLOR);
+	age_col = Group_column(pgroup, PATTR_AGE);
 	in_start = self->fade_in_start;
 	in_end = self->fade_in_end;
 	in_time = in_end - in_start;
@@ -421,19 +449,42 @@ FaderController_call(FaderControllerObject *self, PyObject *args)
 	out_end = self->fade_out_end;
 	out_time = out_end - out_start;
 	out_alpha = self->end_alpha - self->max_alpha;
-	count = GroupObject_ActiveCount(pgroup);
-	while (count--) {
-		if ((p->age > in_end) && (p->age <= out_start)) {
-			p->color.a = self->max_alpha;
-		} else if ( (p->age > in_start) && (p->age < in_end)) {
-			p->color.a = self->start_alpha + in_alpha * ((p->age - in_start) / in_time);
-		} else if ((p->age >= out_start) && (p->age < out_end)) {
-			p->color.a = self->max_alpha + out_alpha * ((p->age - out_start) / out_time);
-		} else if (p->age >= out_end) {
-			p->color.a = self->end_alpha;
+	for (i = start; i < end; i++) {
+		age = *Column_ptr(age_col, float, i);
+		alpha = &Column_ptr(color, Color, i)->a;
+		if ((age > in_end) && (age <= out_start)) {
+			*alpha = self->max_alpha;
+		} else if ( (age > in_start) && (age < in_end)) {
+			*alpha = self->start_alpha + in_alpha * ((age - in_start) / in_time);
+		} else if ((age >= out_start) && (age < out_end)) {
+			*alpha = self->max_alpha + out_alpha * ((age - out_start) / out_time);
+		} else if (age >= out_end) {
+			*alpha = self->end_alpha;
 		}
-		p++;
 	}
+}
+
+static ControllerNative FaderController_native = {
+	NULL,
+	(void (*)(PyObject *, GroupObject *, float, unsigned long, unsigned long))
+		FaderController_update_range,
+	NULL,
+	PATTR_BIT(PATTR_COLOR),
+	"Fader controller"
+};
+
+static PyObject *
+FaderController_call(FaderControllerObject *self, PyObject *args)
+{
+	float td;
+	GroupObject *pgroup;
+	ControllerNative *native = &FaderController_native;
+
+	if (!PyArg_ParseTuple(args, "fO:__call__", &td, &pgroup))
+		return NULL;
+	if (!GroupObject_Check(pgroup)
+		|| Controller_run_fused(pgroup, td, (PyObject **)&self, &native, 1) < 0)
+		return NULL;
 	Py_INCREF(Py_None);
 	return Py_None;
 }
@@ -509,29 +560,44 @@ LifetimeController_init(LifetimeControllerObject *self, PyObject *args, PyObject
 	return 0;
 }
 
+static void
+LifetimeController_update_range(LifetimeControllerObject *self, GroupObject *pgroup, float td,
+	unsigned long start, unsigned long end)
+{
+	float max_age;
+	ParticleColumn age;
+	register unsigned long i;
+
+	age = Group_column(pgroup, PATTR_AGE);
+	max_age = self->max_age;
+	for (i = start; i < end; i++) {
+		if (*Column_ptr(age, float, i) > max_age)
+			Group_kill_p(pgroup, i);
+	}
+}
+
+static ControllerNative LifetimeController_native = {
+	NULL,
+	(void (*)(PyObject *, GroupObject *, float, unsigned long, unsigned long))
+		LifetimeController_update_range,
+	NULL,
+	0,
+	"Lifetime controller",
+	1 /* killing particles changes the group's counts */
+};
+
 static PyObject *
 LifetimeController_call(LifetimeControllerObject *self, PyObject *args)
 {
-	float td, max_age;
+	float td;
 	GroupObject *pgroup;
-	register Particle *p;
-	register unsigned long count;
+	ControllerNative *native = &LifetimeController_native;
 
-	if (!PyArg_ParseTuple(args, "fO:__init__", &td, &pgroup))
+	if (!PyArg_ParseTuple(args, "fO:__call__", &td, &pgroup))
 		return NULL;
-
-	if (!GroupObject_Check(pgroup))
+	if (!GroupObject_Check(pgroup)
+		|| Controller_run_fused(pgroup, td, (PyObject **)&self, &native, 1) < 0)
 		return NULL;
-
-	p = pgroup->plist->p;
-	max_age = self->max_age;
-	count = GroupObject_ActiveCount(pgroup);
-	while (count--) {
-		if (p->age > max_age)
-			Group_kill_p(pgroup, p);
-		p++;
-	}
-
 	Py_INCREF(Py_None);
 	return Py_None;
 }
@@ -743,39 +809,57 @@ error:
 	return -1;
 }
 
-static PyObject *
-ColorBlenderController_call(ColorBlenderControllerObject *self, PyObject *args)
+static void
+ColorBlenderController_update_range(ColorBlenderControllerObject *self, GroupObject *pgroup, float td,
+	unsigned long start, unsigned long end)
 {
-	float td, min_age, max_age;
+	float min_age, max_age;
 	unsigned long resolution;
-	GroupObject *pgroup;
-	Color *gradient;
-	register Particle *p;
-	register unsigned long count, g;
-
-	if (!PyArg_ParseTuple(args, "fO:__init__", &td, &pgroup))
-		return NULL;
-
-	if (!GroupObject_Check(pgroup))
-		return NULL;
+	Color *gradient, *c;
+	ParticleColumn color, age_col;
+	float age;
+	register unsigned long i, g;
 
-	p = pgroup->plist->p;
+	color = Group_column(pgroup, PATTR_COLOR);
+	age_col = Group_column(pgroup, PATTR_AGE);
 	min_age = self->min_age;
 	max_age = self->max_age;
 	resolution = self->resolution;
 	gradient = self->gradient;
-	count = GroupObject_ActiveCount(pgroup);
-	while (count--) {
-		if (p->age >= min_age && p->age <= max_age) {
-			g = (unsigned long)((p->age - min_age) * resolution);
-			p->color.r = gradient[g].r;
-			p->color.g = gradient[g].g;
-			p->color.b = gradient[g].b;
-			p->color.a = gradient[g].a;
+	for (i = start; i < end; i++) {
+		age = *Column_ptr(age_col, float, i);
+		if (age >= min_age && age <= max_age) {
+			g = (unsigned long)((age - min_age) * resolution);
+			c = Column_ptr(color, Color, i);
+			c->r = gradient[g].r;
+			c->g = gradient[g].g;
+			c->b = gradient[g].b;
+			c->a = gradient[g].a;
 		}
-		p++;
 	}
+}
+
+static ControllerNative ColorBlenderController_native = {
+	NULL,
+	(void (*)(PyObject *, GroupObject *, float, unsigned long, unsigned long))
+		ColorBlenderController_update_range,
+	NULL,
+	PATTR_BIT(PATTR_COLOR),
+	"ColorBlender controller"
+};
+
+static PyObject *
+ColorBlenderController_call(ColorBlenderControllerObject *self, PyObject *args)
+{
+	float td;
+	GroupObject *pgroup;
+	ControllerNative *native = &ColorBlenderController_native;
 
+	if (!PyArg_ParseTuple(args, "fO:__call__", &td, &pgroup))
+		return NULL;
+	if (!GroupObject_Check(pgroup)
+		|| Controller_run_fused(pgroup, td, (PyObject **)&self, &native, 1) < 0)
+		return NULL;
 	Py_INCREF(Py_None);
 	return Py_None;
 }
@@ -927,32 +1011,46 @@ GrowthController_init(GrowthControllerObject *self, PyObject *args, PyObject *kw
 	return 0;
 }
 
-static PyObject *
-GrowthController_call(GrowthControllerObject *self, PyObject *args)
+static void
+GrowthController_update_range(GrowthControllerObject *self, GroupObject *pgroup, float td,
+	unsigned long start, unsigned long end)
 {
-	float td;
-	GroupObject *pgroup;
-	register Particle *p;
 	Vec3 g;
-	register unsigned long count;
 
-	if (!PyArg_ParseTuple(args, "fO:__init__", &td, &pgroup))
-		return NULL;
-
-	if (!GroupObject_Check(pgroup))
-		return NULL;
-
-	p = pgroup->plist->p;
 	g.x = self->growth.x * td;
 	g.y = self->growth.y * td;
 	g.z = self->growth.z * td;
-	count = GroupObject_ActiveCount(pgroup);
-	while (count--) {
-		Vec3_addi(&p->size, &g);
-		p++;
-	}
+	Simd_kernels()->vec3_add(Group_column(pgroup, PATTR_SIZE), &g, start, end);
+}
+
+static void
+GrowthController_finish(GrowthControllerObject *self, GroupObject *pgroup,
+	float td)
+{
 	Vec3_muli(&self->growth, &self->damping);
+}
+
+static ControllerNative GrowthController_native = {
+	NULL,
+	(void (*)(PyObject *, GroupObject *, float, unsigned long, unsigned long))
+		GrowthController_update_range,
+	(void (*)(PyObject *, GroupObject *, float))GrowthController_finish,
+	PATTR_BIT(PATTR_SIZE),
+	"Growth controller"
+};
+
+static PyObject *
+GrowthController_call(GrowthControllerObject *self, PyObject *args)
+{
+	float td;
+	GroupObject *pgroup;
+	ControllerNative *native = &GrowthController_native;
 
+	if (!PyArg_ParseTuple(args, "fO:__call__", &td, &pgroup))
+		return NULL;
+	if (!GroupObject_Check(pgroup)
+		|| Controller_run_fused(pgroup, td, (PyObject **)&self, &native, 1) < 0)
+		return NULL;
 	Py_INCREF(Py_None);
 	return Py_None;
 }
@@ -1049,39 +1147,141 @@ CollectorController_init(CollectorControllerObject *self, PyObject *args, PyObje
 	return 0;
 }
 
-static PyObject *
-CollectorController_call(CollectorControllerObject *self, PyObject *args)
+typedef struct {
+	PyObject *domain;
+	DomainNative *native;
+	int collect_inside;
+	ParticleColumn position;
+	unsigned char *hit; /* set for each live particle to collect */
+} CollectorPass;
+
+/* Find the live particles in [start, end) to collect from a native domain */
+static void
+CollectorController_test_range(GroupObject *pgroup, void *arg,
+	unsigned long start, unsigned long end)
 {
-	float td;
-	GroupObject *pgroup;
-	VectorObject *vector = NULL;
-	ParticleRefObject *particleref = NULL;
+	CollectorPass *pass = (CollectorPass *)arg;
+	register unsigned long i;
+
+	for (i = start; i < end; i++) {
+		pass->hit[i] = Group_IsAlive(pgroup, i)
+			&& (pass->native->contains(pass->domain,
+				Column_ptr(pass->position, Vec3, i)) != 0)
+				== pass->collect_inside;
+	}
+}
+
+/* Update with a built-in domain. The domain is tested with the GIL released
+ * for large groups, which is only reacquired to call the callback for the
+ * particles collected
+ */
+static int
+CollectorController_update_native(CollectorControllerObject *self,
+	GroupObject *pgroup, PyObject *domain, DomainNative *native)
+{
+	CollectorPass pass;
+	ParticleRefObject *particleref;
 	PyObject *result;
-	int in_domain, collect_inside;
-	register Particle *p;
-	register unsigned long count;
+	PyThreadState *state;
+	int callback;
+	register unsigned long i, count, collected = 0;
+
+	pass.domain = domain;
+	pass.native = native;
+	pass.collect_inside = self->collect_inside ? 1 : 0;
+	pass.position = Group_column(pgroup, PATTR_POSITION);
+	callback = self->callback != NULL && self->callback != Py_None;
+	count = GroupObject_ActiveCount(pgroup);
+	if (count == 0)
+		return 0;
+	pass.hit = (unsigned char *)PyMem_Malloc(count);
+	if (pass.hit == NULL) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	state = Group_begin_nogil(pgroup, count);
+	Group_parallel_for(pgroup, count, CollectorController_test_range, &pass);
+	if (!callback) {
+		for (i = 0; i < count; i++) {
+			if (pass.hit[i]) {
+				Group_kill_p(pgroup, i);
+				collected++;
+			}
+		}
+	}
+	Group_end_nogil(pgroup, state);
 
-	if (!PyArg_ParseTuple(args, "fO:__init__", &td, &pgroup))
-		return NULL;
+	if (callback) {
+		particleref = ParticleRefObject_New((PyObject *)pgroup, 0);
+		if (particleref == NULL) {
+			PyMem_Free(pass.hit);
+			return -1;
+		}
+		for (i = 0; i < count; i++) {
+			/* The callback may kill particles itself */
+			if (!pass.hit[i] || !Group_IsAlive(pgroup, i))
+				continue;
+			particleref->index = i;
+			result = PyObject_CallFunctionObjArgs(
+				self->callback, (PyObject *)particleref, (PyObject *)pgroup,
+				(PyObject *)self, NULL);
+			if (result == NULL) {
+				Py_DECREF(particleref);
+				PyMem_Free(pass.hit);
+				self->collected_count += collected;
+				return -1;
+			}
+			Py_DECREF(result);
+			Group_lock(pgroup);
+			Group_kill_p(pgroup, i);
+			Group_unlock(pgroup);
+			collected++;
+		}
+		Py_DECREF(particleref);
+	}
+	PyMem_Free(pass.hit);
+	self->collected_count += collected;
+	return 0;
+}
 
-	if (!GroupObject_Check(pgroup))
-		return NULL;
+static int
+CollectorController_update(CollectorControllerObject *self, GroupObject *pgroup, float td)
+{
+	VectorObject *vector = NULL;
+	ParticleRefObject *particleref = NULL;
+	PyObject *result, *domain;
+	DomainNative *native;
+	int in_domain, collect_inside, status;
+	ParticleColumn position;
+	register unsigned long i, count;
+
+	if (!Group_require(pgroup, PATTR_BIT(PATTR_POSITION), "Collector controller"))
+		return -1;
 
+	/* Hold the domain in case the callback replaces it */
+	domain = self->domain;
+	Py_INCREF(domain);
+	native = Domain_get_native(domain);
+	if (native != NULL) {
+		status = CollectorController_update_native(self, pgroup, domain, native);
+		Py_DECREF(domain);
+		return status;
+	}
 	collect_inside = self->collect_inside ? 1 : 0;
-	p = pgroup->plist->p;
+	position = Group_column(pgroup, PATTR_POSITION);
 	count = GroupObject_ActiveCount(pgroup);
-	vector = Vector_new(NULL, &p->position, 3);
-	particleref = ParticleRefObject_New((PyObject *)pgroup, p);
+	vector = Vector_new(NULL, Column_ptr(position, Vec3, 0), 3);
+	particleref = ParticleRefObject_New((PyObject *)pgroup, 0);
 	if (vector == NULL || particleref == NULL)
 		goto error;
-	while (count--) {
-		vector->vec = &p->position;
-		in_domain = PySequence_Contains(self->domain, (PyObject *)vector);
+	for (i = 0; i < count; i++) {
+		vector->vec = Column_ptr(position, Vec3, i);
+		in_domain = PySequence_Contains(domain, (PyObject *)vector);
 		if (in_domain == -1)
 			goto error;
-		if (Particle_IsAlive(*p) && (in_domain == collect_inside)) {
+		if (Group_IsAlive(pgroup, i) && (in_domain == collect_inside)) {
 			if (self->callback != NULL && self->callback != Py_None) {
-				particleref->p = p;
+				particleref->index = i;
 				result = PyObject_CallFunctionObjArgs(
 					self->callback, (PyObject *)particleref, (PyObject *)pgroup,
 					(PyObject *)self, NULL);
@@ -1090,23 +1290,43 @@ CollectorController_call(CollectorControllerObject *self, PyObject *args)
 				}
 				Py_DECREF(result);
 			}
-			Group_kill_p(pgroup, p);
+			Group_lock(pgroup);
+			Group_kill_p(pgroup, i);
+			Group_unlock(pgroup);
 			self->collected_count++;
 		}
-		p++;
 	}
 	Py_DECREF(particleref);
 	Py_DECREF(vector);
+	Py_DECREF(domain);
 
-	Py_INCREF(Py_None);
-	return Py_None;
+	return 0;
 
 error:
 	Py_XDECREF(particleref);
 	Py_XDECREF(vector);
-	return NULL;
+	Py_DECREF(domain);
+	return -1;
 }
 
+static PyObject *
+CollectorController_call(CollectorControllerObject *self, PyObject *args)
+{
+	float td;
+	GroupObject *pgroup;
+
+	if (!PyArg_ParseTuple(args, "fO:__call__", &td, &pgroup))
+		return NULL;
+	if (!GroupObject_Check(pgroup) || CollectorController_update(self, pgroup, td) < 0)
+		return NULL;
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static ControllerNative CollectorController_native = {
+	(int (*)(PyObject *, GroupObject *, float))CollectorController_update
+};
+
 static struct PyMemberDef CollectorController_members[] = {
     {"collect_inside", T_INT, offsetof(CollectorControllerObject, collect_inside), 0,
         "True to collect particles inside the domain, False "
@@ -1218,49 +1438,256 @@ BounceController_init(BounceControllerObject *self, PyObject *args, PyObject *kw
 	return 0;
 }
 
-static PyObject *
-BounceController_call(BounceControllerObject *self, PyObject *args)
+/* Deflect the position and velocity of a particle that crossed the domain's
+ * surface at collide_point
+ */
+static void
+Bounce_deflect(Vec3 *position, Vec3 *velocity, Vec3 *collide_point,
+	Vec3 *normal, float bounce, float tangent_scale)
 {
-	float td;
-	GroupObject *pgroup;
-	VectorObject *start_pos = NULL, *end_pos = NULL;
-	PyObject *collide_vec = NULL, *normal_vec = NULL;
-	ParticleRefObject *particleref = NULL;
-	PyObject *result = NULL, *t = NULL, *intersect_str = NULL;
-	float tangent_scale, d;
-	Vec3 collide_point, normal, penetration, deflect, slide;
+	Vec3 penetration, deflect, slide;
+	float d;
+
+	Vec3_sub(&penetration, position, collide_point);
+	d = Vec3_dot(&penetration, normal);
+	Vec3_scalar_mul(&deflect, normal, d);
+	Vec3_sub(&slide, &penetration, &deflect);
+	Vec3_scalar_muli(&deflect, bounce);
+	Vec3_scalar_muli(&slide, tangent_scale);
+	Vec3_sub(position, collide_point, &deflect);
+	Vec3_addi(position, &slide);
+	d = Vec3_dot(velocity, normal);
+	Vec3_scalar_mul(&deflect, normal, d);
+	Vec3_sub(&slide, velocity, &deflect);
+	Vec3_scalar_muli(&deflect, bounce);
+	Vec3_scalar_muli(&slide, tangent_scale);
+	Vec3_sub(velocity, &slide, &deflect);
+}
+
+/* Call the controller's callback for a collision of the particle at index
+ * i. Return 0 on success, -1 with an exception set on failure
+ */
+static int
+BounceController_callback(BounceControllerObject *self, GroupObject *pgroup,
+	unsigned long i, Vec3 *collide_point, Vec3 *normal)
+{
+	ParticleRefObject *particleref;
+	PyObject *collide_vec, *normal_vec, *result = NULL;
+
+	particleref = ParticleRefObject_New((PyObject *)pgroup, i);
+	collide_vec = Py_BuildValue(
+		"(fff)", collide_point->x, collide_point->y, collide_point->z);
+	normal_vec = Py_BuildValue("(fff)", normal->x, normal->y, normal->z);
+	if (particleref != NULL && collide_vec != NULL && normal_vec != NULL)
+		result = PyObject_CallFunctionObjArgs(
+			self->callback, (PyObject *)particleref, (PyObject *)pgroup,
+			(PyObject *)self, collide_vec, normal_vec, NULL);
+	Py_XDECREF(particleref);
+	Py_XDECREF(collide_vec);
+	Py_XDECREF(normal_vec);
+	if (result == NULL)
+		return -1;
+	Py_DECREF(result);
+	return 0;
+}
+
+typedef struct {
+	BounceControllerObject *self;
+	GroupObject *group;
+	PyObject *domain;
+	DomainNative *native;
+	float bounce;
+	float tangent_scale;
+	int bounce_limit;
+	int callback; /* True to call the controller's callback */
+	int failed; /* Set if the domain could not find an intersection */
+	ParticleColumn position, velocity, last_position;
+	unsigned char *hit; /* set for each live particle that may bounce */
+} BouncePass;
+
+/* Bounce the live particle at index i off a native domain. Return 0 on
+ * success, or -1 if the domain or callback fails. Only uses the Python API
+ * when calling the callback
+ */
+static int
+BounceController_bounce(BouncePass *pass, unsigned long i)
+{
+	Vec3 start, collide_point, normal;
+	Vec3 *position, *velocity;
 	int bounces, started_inside, inside;
-	register Particle *p;
-	register unsigned long count;
 
-	if (!PyArg_ParseTuple(args, "fO:__init__", &td, &pgroup))
-		return NULL;
+	position = Column_ptr(pass->position, Vec3, i);
+	velocity = Column_ptr(pass->velocity, Vec3, i);
+	Vec3_copy(&start, Column_ptr(pass->last_position, Vec3, i));
+	started_inside = pass->native->contains(pass->domain, &start) != 0;
+	bounces = pass->bounce_limit;
+	while (bounces--) {
+		switch (pass->native->intersect(pass->domain, &start, position,
+			&collide_point, &normal)) {
+		case 0:
+			/* No collision */
+			return 0;
+		case -1:
+			pass->failed = 1;
+			return -1;
+		}
+		Bounce_deflect(position, velocity, &collide_point, &normal,
+			pass->bounce, pass->tangent_scale);
+		Vec3_copy(&start, &collide_point);
+		if (pass->callback && BounceController_callback(
+			pass->self, pass->group, i, &collide_point, &normal) < 0)
+			return -1;
+		inside = pass->native->contains(pass->domain, position) != 0;
+		if ((started_inside == inside) | (pass->bounce <= 0))
+			break;
+	}
+	return 0;
+}
 
-	if (!GroupObject_Check(pgroup))
-		return NULL;
+/* Bounce the live particles in [start, end) off a native domain, without a
+ * callback
+ */
+static void
+BounceController_update_range(GroupObject *pgroup, void *arg,
+	unsigned long start, unsigned long end)
+{
+	register unsigned long i;
+
+	for (i = start; i < end; i++) {
+		if (Group_IsAlive(pgroup, i))
+			BounceController_bounce((BouncePass *)arg, i);
+	}
+}
+
+/* Find the live particles in [start, end) whose last step crosses the
+ * surface of a native domain, or could not be tested, so that only those
+ * are bounced with the GIL held to call the callback
+ */
+static void
+BounceController_test_range(GroupObject *pgroup, void *arg,
+	unsigned long start, unsigned long end)
+{
+	BouncePass *pass = (BouncePass *)arg;
+	Vec3 collide_point, normal;
+	register unsigned long i;
+
+	for (i = start; i < end; i++) {
+		pass->hit[i] = Group_IsAlive(pgroup, i)
+			&& pass->native->intersect(pass->domain,
+				Column_ptr(pass->last_position, Vec3, i),
+				Column_ptr(pass->position, Vec3, i),
+				&collide_point, &normal) != 0;
+	}
+}
+
+/* Update with a built-in domain, calling its native interface directly */
+static int
+BounceController_update_native(BounceControllerObject *self,
+	GroupObject *pgroup, PyObject *domain, DomainNative *native)
+{
+	BouncePass pass;
+	PyThreadState *state;
+	int status = 0;
+	register unsigned long i, count;
+
+	pass.self = self;
+	pass.group = pgroup;
+	pass.domain = domain;
+	pass.native = native;
+	pass.bounce = self->bounce;
+	pass.tangent_scale = 1.0f - self->friction;
+	pass.bounce_limit = self->bounce_limit;
+	pass.callback = self->callback != NULL && self->callback != Py_None;
+	pass.failed = 0;
+	pass.position = Group_column(pgroup, PATTR_POSITION);
+	pass.velocity = Group_column(pgroup, PATTR_VELOCITY);
+	pass.last_position = Group_column(pgroup, PATTR_LAST_POSITION);
+	count = GroupObject_ActiveCount(pgroup);
+	if (!pass.callback) {
+		/* Without a callback to call, large groups are updated in parallel */
+		state = Group_begin_nogil(pgroup, count);
+		Group_parallel_for(pgroup, count, BounceController_update_range, &pass);
+		Group_end_nogil(pgroup, state);
+	} else if (count > 0) {
+		/* The GIL is only held to bounce the particles that collide */
+		pass.hit = (unsigned char *)PyMem_Malloc(count);
+		if (pass.hit == NULL) {
+			PyErr_NoMemory();
+			return -1;
+		}
+		state = Group_begin_nogil(pgroup, count);
+		Group_parallel_for(pgroup, count, BounceController_test_range, &pass);
+		Group_end_nogil(pgroup, state);
+		for (i = 0; i < count; i++) {
+			if (pass.hit[i] && Group_IsAlive(pgroup, i)
+				&& BounceController_bounce(&pass, i) < 0) {
+				status = -1;
+				break;
+			}
+		}
+		PyMem_Free(pass.hit);
+	}
+	if (pass.failed) {
+		PyErr_Format(PyExc_RuntimeError,
+			"%s.intersect could not determine the intersection", native->name);
+		return -1;
+	}
+	return status;
+}
+
+static int
+BounceController_update(BounceControllerObject *self, GroupObject *pgroup, float td)
+{
+	VectorObject *start_pos = NULL, *end_pos = NULL;
+	PyObject *result = NULL, *t = NULL, *intersect_str = NULL, *domain;
+	DomainNative *native;
+	float tangent_scale;
+	Vec3 collide_point, normal;
+	int bounces, started_inside, inside, status;
+	ParticleColumn position_col, velocity_col, last_position_col;
+	Vec3 *position, *velocity;
+	register unsigned long i, count;
+
+	if (!Group_require(pgroup, PATTR_BIT(PATTR_POSITION) | PATTR_BIT(PATTR_VELOCITY)
+		| PATTR_BIT(PATTR_LAST_POSITION), "Bounce controller"))
+		return -1;
+
+	/* Hold the domain in case the callback replaces it */
+	domain = self->domain;
+	Py_INCREF(domain);
+	native = Domain_get_native(domain);
+	if (native != NULL) {
+		status = BounceController_update_native(self, pgroup, domain, native);
+		Py_DECREF(domain);
+		return status;
+	}
 
 	intersect_str = PyString_InternFromString("intersect");
 	if (intersect_str == NULL)
 		goto error;
 
-	p = pgroup->plist->p;
+	position_col = Group_column(pgroup, PATTR_POSITION);
+	velocity_col = Group_column(pgroup, PATTR_VELOCITY);
+	last_position_col = Group_column(pgroup, PATTR_LAST_POSITION);
 	tangent_scale = 1.0f - self->friction;
 	count = GroupObject_ActiveCount(pgroup);
-	start_pos = Vector_new(NULL, &p->last_position, 3);
-	end_pos = Vector_new(NULL, &p->position, 3);
+	start_pos = Vector_new(NULL, Column_ptr(last_position_col, Vec3, 0), 3);
+	end_pos = Vector_new(NULL, Column_ptr(position_col, Vec3, 0), 3);
 	if (start_pos == NULL || end_pos == NULL)
 		goto error;
-	while (count--) {
-		if (Particle_IsAlive(*p)) {
-			start_pos->vec = &p->last_position;
-			end_pos->vec = &p->position;
-			started_inside = PySequence_Contains((PyObject *)self->domain, (PyObject *)start_pos);
+	for (i = 0; i < count; i++) {
+		if (Group_IsAlive(pgroup, i)) {
+			position = Column_ptr(position_col, Vec3, i);
+			velocity = Column_ptr(velocity_col, Vec3, i);
+			start_pos->vec = Column_ptr(last_position_col, Vec3, i);
+			end_pos->vec = position;
+			started_inside = PySequence_Contains(domain, (PyObject *)start_pos);
 			if (started_inside == -1)
 				goto error;
 			bounces = self->bounce_limit;
 			while (bounces--) {
-				end_pos->vec = &p->position;
-				result = PyObject_CallMethodObjArgs(self->domain, intersect_str,
+				end_pos->vec = position;
+				result = PyObject_CallMethodObjArgs(domain, intersect_str,
 					(PyObject *)start_pos, (PyObject *)end_pos, NULL);
 				if (result == NULL)
 					goto error;
@@ -1273,40 +1700,14 @@ BounceController_call(BounceControllerObject *self, PyObject *args)
 						&collide_point.x, &collide_point.y, &collide_point.z,
 						&normal.x, &normal.y, &normal.z))
 						goto error;
-					Vec3_sub(&penetration, &p->position, &collide_point);
-					d = Vec3_dot(&penetration, &normal);
-					Vec3_scalar_mul(&deflect, &normal, d);
-					Vec3_sub(&slide, &penetration, &deflect);
-					Vec3_scalar_muli(&deflect, self->bounce);
-					Vec3_scalar_muli(&slide, tangent_scale);
-					Vec3_sub(&p->position, &collide_point, &deflect);
-					Vec3_addi(&p->position, &slide);
-					d = Vec3_dot(&p->velocity, &normal);
-					Vec3_scalar_mul(&deflect, &normal, d);
-					Vec3_sub(&slide, &p->velocity, &deflect);
-					Vec3_scalar_muli(&deflect, self->bounce);
-					Vec3_scalar_muli(&slide, tangent_scale);
-					Vec3_sub(&p->velocity, &slide, &deflect);
+					Bounce_deflect(position, velocity, &collide_point, &normal,
+						self->bounce, tangent_scale);
 					start_pos->vec = &collide_point;
-					if (self->callback != NULL && self->callback != Py_None) {
-						particleref = ParticleRefObject_New((PyObject *)pgroup, p);
-						collide_vec = Py_BuildValue(
-							"(fff)", collide_point.x, collide_point.y, collide_point.z);
-						normal_vec = Py_BuildValue("(fff)", normal.x, normal.y, normal.z);
-						if (particleref == NULL || collide_vec == NULL || normal_vec == NULL)
-							goto error;
-						result = PyObject_CallFunctionObjArgs(
-							self->callback, (PyObject *)particleref, (PyObject *)pgroup,
-							(PyObject *)self, collide_vec, normal_vec, NULL);
-						if (result == NULL) {
-							goto error;
-						}
-						Py_CLEAR(result);
-						Py_CLEAR(particleref);
-						Py_CLEAR(collide_vec);
-						Py_CLEAR(normal_vec);
-					}
-					inside = PySequence_Contains((PyObject *)self->domain, (PyObject *)end_pos);
+					if (self->callback != NULL && self->callback != Py_None
+						&& BounceController_callback(
+							self, pgroup, i, &collide_point, &normal) < 0)
+						goto error;
+					inside = PySequence_Contains(domain, (PyObject *)end_pos);
 					if (inside == -1)
 						goto error;
 					if ((started_inside == inside) | (self->bounce <= 0)) {
@@ -1323,27 +1724,42 @@ BounceController_call(BounceControllerObject *self, PyObject *args)
 			}
 			Py_CLEAR(t);
 		}
-		p++;
 	}
 	Py_DECREF(intersect_str);
 	Py_DECREF(start_pos);
 	Py_DECREF(end_pos);
+	Py_DECREF(domain);
 
-	Py_INCREF(Py_None);
-	return Py_None;
+	return 0;
 
 error:
 	Py_XDECREF(result);
 	Py_XDECREF(t);
 	Py_XDECREF(intersect_str);
-	Py_XDECREF(particleref);
 	Py_XDECREF(start_pos);
 	Py_XDECREF(end_pos);
-	Py_XDECREF(collide_vec);
-	Py_XDECREF(normal_vec);
-	return NULL;
+	Py_DECREF(domain);
+	return -1;
 }
 
+static PyObject *
+BounceController_call(BounceControllerObject *self, PyObject *args)
+{
+	float td;
+	GroupObject *pgroup;
+
+	if (!PyArg_ParseTuple(args, "fO:__call__", &td, &pgroup))
+		return NULL;
+	if (!GroupObject_Check(pgroup) || BounceController_update(self, pgroup, td) < 0)
+		return NULL;
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static ControllerNative BounceController_native = {
+	(int (*)(PyObject *, GroupObject *, float))BounceController_update
+};
+
 static struct PyMemberDef BounceController_members[] = {
     {"domain", T_OBJECT, offsetof(BounceControllerObject, domain), 0,
         "Particles are deflected when they collide with the domain boundary"},
@@ -1482,35 +1898,93 @@ MagnetController_init(MagnetControllerObject *self, PyObject *args, PyObject *kw
 	return 0;
 }
 
-static PyObject *
-MagnetController_call(MagnetControllerObject *self, PyObject *args)
+typedef struct {
+	PyObject *domain;
+	DomainNative *native;
+	float k; /* charge scaled by td */
+	float a_plus_1;
+	float epsilon;
+	float outer_co2;
+	ParticleColumn position, velocity;
+} MagnetPass;
+
+/* Accelerate the particle at index i toward closest, the closest point of
+ * the domain to it
+ */
+static void
+MagnetController_attract(MagnetPass *pass, unsigned long i, Vec3 *closest)
 {
-	float k, a_plus_1, d, td, dist2, mag_over_dist, outer_co2;
-	GroupObject *pgroup;
+	float d, dist2, mag_over_dist;
+	Vec3 vec;
+
+	Vec3_sub(&vec, closest, Column_ptr(pass->position, Vec3, i));
+	dist2 = Vec3_len_sq(&vec);
+	if (dist2 <= pass->outer_co2) {
+		d = sqrtf(dist2) + pass->epsilon;
+		mag_over_dist = pass->k / powf(d, pass->a_plus_1);
+		Vec3_scalar_muli(&vec, mag_over_dist);
+		Vec3_addi(Column_ptr(pass->velocity, Vec3, i), &vec);
+	}
+}
+
+/* Attract the live particles in [start, end) to a native domain */
+static void
+MagnetController_update_range(GroupObject *pgroup, void *arg,
+	unsigned long start, unsigned long end)
+{
+	MagnetPass *pass = (MagnetPass *)arg;
+	Vec3 closest, normal;
+	register unsigned long i;
+
+	for (i = start; i < end; i++) {
+		if (Group_IsAlive(pgroup, i)) {
+			pass->native->closest_point_to(pass->domain,
+				Column_ptr(pass->position, Vec3, i), &closest, &normal);
+			MagnetController_attract(pass, i, &closest);
+		}
+	}
+}
+
+static int
+MagnetController_update(MagnetControllerObject *self, GroupObject *pgroup, float td)
+{
+	MagnetPass pass;
+	PyThreadState *state;
 	VectorObject *position = NULL;
 	PyObject *closest_pt_to = NULL, *res = NULL, *pt = NULL;
 	Vec3 vec;
-	register Particle *p;
-	register unsigned long count;
-
-	if (!PyArg_ParseTuple(args, "fO:__call__", &td, &pgroup))
-		return NULL;
+	register unsigned long i, count;
 
-	if (!GroupObject_Check(pgroup))
-		return NULL;
+	if (!Group_require(pgroup, PATTR_BIT(PATTR_POSITION) | PATTR_BIT(PATTR_VELOCITY), "Magnet controller"))
+		return -1;
 
-	outer_co2 = self->outer_cutoff*self->outer_cutoff;
-	k = self->charge * td;
-	a_plus_1 = self->exponent + 1.0f;
-	p = pgroup->plist->p;
+	pass.domain = self->domain;
+	pass.native = Domain_get_native(self->domain);
+	pass.outer_co2 = self->outer_cutoff*self->outer_cutoff;
+	pass.k = self->charge * td;
+	pass.a_plus_1 = self->exponent + 1.0f;
+	pass.epsilon = self->epsilon;
+	pass.position = Group_column(pgroup, PATTR_POSITION);
+	pass.velocity = Group_column(pgroup, PATTR_VELOCITY);
 	count = GroupObject_ActiveCount(pgroup);
-	position = Vector_new(NULL, &p->position, 3);
+	if (pass.native != NULL) {
+		/* Built-in domains are called natively, updating large groups in
+		 * parallel. The domain is held in case another thread replaces it */
+		Py_INCREF(pass.domain);
+		state = Group_begin_nogil(pgroup, count);
+		Group_parallel_for(pgroup, count, MagnetController_update_range, &pass);
+		Group_end_nogil(pgroup, state);
+		Py_DECREF(pass.domain);
+		return 0;
+	}
+
+	position = Vector_new(NULL, Column_ptr(pass.position, Vec3, 0), 3);
 	closest_pt_to = PyObject_GetAttrString(self->domain, "closest_point_to");
 	if (position == NULL || closest_pt_to == NULL)
 		goto error;
-	while (count--) {
-		if (Particle_IsAlive(*p)) {
-			position->vec = &p->position;
+	for (i = 0; i < count; i++) {
+		if (Group_IsAlive(pgroup, i)) {
+			position->vec = Column_ptr(pass.position, Vec3, i);
 			res = PyObject_CallFunctionObjArgs(closest_pt_to, position, NULL);
 			if (res == NULL)
 				goto error;
@@ -1519,31 +1993,40 @@ MagnetController_call(MagnetControllerObject *self, PyObject *args)
 				goto error;
 			Py_CLEAR(res);
 			Py_CLEAR(pt);
-			Vec3_subi(&vec, &p->position);
-			dist2 = Vec3_len_sq(&vec);
-			if (dist2 <= outer_co2) {
-				d = sqrtf(dist2) + self->epsilon;
-				mag_over_dist = k / powf(d, a_plus_1);
-				Vec3_scalar_muli(&vec, mag_over_dist);
-				Vec3_addi(&p->velocity, &vec);
-			}
+			MagnetController_attract(&pass, i, &vec);
 		}
-		p++;
 	}
 	Py_DECREF(position);
 	Py_DECREF(closest_pt_to);
 
-	Py_INCREF(Py_None);
-	return Py_None;
+	return 0;
 
 error:
 	Py_XDECREF(position);
 	Py_XDECREF(res);
 	Py_XDECREF(pt);
 	Py_XDECREF(closest_pt_to);
-	return NULL;
+	return -1;
+}
+
+static PyObject *
+MagnetController_call(MagnetControllerObject *self, PyObject *args)
+{
+	float td;
+	GroupObject *pgroup;
+
+	if (!PyArg_ParseTuple(args, "fO:__call__", &td, &pgroup))
+		return NULL;
+	if (!GroupObject_Check(pgroup) || MagnetController_update(self, pgroup, td) < 0)
+		return NULL;
+	Py_INCREF(Py_None);
+	return Py_None;
 }
 
+static ControllerNative MagnetController_native = {
+	(int (*)(PyObject *, GroupObject *, float))MagnetController_update
+};
+
 static struct PyMemberDef MagnetController_members[] = {
     {"domain", T_OBJECT, offsetof(MagnetControllerObject, domain), 0,
         "Particles are attracted or repulsed from the domain's surface."},
@@ -1659,61 +2142,144 @@ DragController_init(DragControllerObject *self, PyObject *args, PyObject *kwargs
 	return 0;
 }
 
-static PyObject *
-DragController_call(DragControllerObject *self, PyObject *args)
+typedef struct {
+	DragControllerObject *self;
+	PyObject *domain;
+	DomainNative *native;
+	float td;
+	Vec3 fvel; /* fluid velocity scaled by td */
+	ParticleColumn position, velocity, last_velocity, mass;
+} DragPass;
+
+/* Apply drag to the live particle at index i */
+static void
+DragController_drag(DragPass *pass, unsigned long i)
+{
+	float rmag, drag;
+	Vec3 rvel, force;
+
+	/* Use the last velocity so controller order doesn't matter */
+	Vec3_scalar_mul(&rvel, Column_ptr(pass->last_velocity, Vec3, i), pass->td);
+	Vec3_subi(&rvel, &pass->fvel);
+	rmag = Vec3_len_sq(&rvel);
+	if (rmag > EPSILON) {
+		Vec3_scalar_div(&force, &rvel, rmag);
+		drag = pass->self->c1*rmag + pass->self->c2*rmag*rmag;
+		Vec3_scalar_muli(&force, drag);
+		Vec3_scalar_div(&force, &force, *Column_ptr(pass->mass, float, i));
+		Vec3_subi(Column_ptr(pass->velocity, Vec3, i), &force);
+	}
+}
+
+/* Apply drag to the live particles in [start, end), for drag everywhere */
+static void
+DragController_update_range(GroupObject *pgroup, void *arg,
+	unsigned long start, unsigned long end)
+{
+	register unsigned long i;
+
+	for (i = start; i < end; i++) {
+		if (Group_IsAlive(pgroup, i))
+			DragController_drag((DragPass *)arg, i);
+	}
+}
+
+/* Apply drag to the live particles in [start, end) inside a native domain */
+static void
+DragController_update_domain_range(GroupObject *pgroup, void *arg,
+	unsigned long start, unsigned long end)
 {
-	float td, rmag, drag;
-	Vec3 fvel, rvel, force;
+	DragPass *pass = (DragPass *)arg;
+	register unsigned long i;
+
+	for (i = start; i < end; i++) {
+		if (Group_IsAlive(pgroup, i) && pass->native->contains(
+			pass->domain, Column_ptr(pass->position, Vec3, i)))
+			DragController_drag(pass, i);
+	}
+}
+
+static int
+DragController_update(DragControllerObject *self, GroupObject *pgroup, float td)
+{
+	DragPass pass;
+	PyThreadState *state;
 	VectorObject *position = NULL;
 	int in_domain;
-	GroupObject *pgroup;
-	register Particle *p;
-	register unsigned long count;
+	register unsigned long i, count;
 
-	if (!PyArg_ParseTuple(args, "fO:__init__", &td, &pgroup))
-		return NULL;
+	if (!Group_require(pgroup, PATTR_BIT(PATTR_POSITION) | PATTR_BIT(PATTR_VELOCITY)
+		| PATTR_BIT(PATTR_LAST_VELOCITY) | PATTR_BIT(PATTR_MASS), "Drag controller"))
+		return -1;
 
-	if (!GroupObject_Check(pgroup))
-		return NULL;
+	pass.self = self;
+	pass.domain = self->domain;
+	pass.native = NULL;
+	pass.td = td;
+	Vec3_scalar_mul(&pass.fvel, &self->fluid_velocity, td);
+	pass.position = Group_column(pgroup, PATTR_POSITION);
+	pass.velocity = Group_column(pgroup, PATTR_VELOCITY);
+	pass.last_velocity = Group_column(pgroup, PATTR_LAST_VELOCITY);
+	pass.mass = Group_column(pgroup, PATTR_MASS);
+	count = GroupObject_ActiveCount(pgroup);
+	if (self->domain == NULL) {
+		/* Without a domain to call, large groups are updated in parallel */
+		state = Group_begin_nogil(pgroup, count);
+		Group_parallel_for(pgroup, count, DragController_update_range, &pass);
+		Group_end_nogil(pgroup, state);
+		return 0;
+	}
+	pass.native = Domain_get_native(self->domain);
+	if (pass.native != NULL) {
+		/* Built-in domains are called natively, so the same goes for them.
+		 * The domain is held in case another thread replaces it */
+		Py_INCREF(pass.domain);
+		state = Group_begin_nogil(pgroup, count);
+		Group_parallel_for(pgroup, count, DragController_update_domain_range, &pass);
+		Group_end_nogil(pgroup, state);
+		Py_DECREF(pass.domain);
+		return 0;
+	}
 
-	Vec3_scalar_mul(&fvel, &self->fluid_velocity, td);
-	p = pgroup->plist->p;
-	position = Vector_new(NULL, &p->position, 3);
+	position = Vector_new(NULL, Group_Vec3(pgroup, PATTR_POSITION, 0), 3);
 	if (position == NULL)
 		goto error;
 
-	count = GroupObject_ActiveCount(pgroup);
-	while (count--) {
-		position->vec = &p->position;
-		in_domain = self->domain == NULL || PySequence_Contains(
-			self->domain, (PyObject *)position);
+	for (i = 0; i < count; i++) {
+		position->vec = Group_Vec3(pgroup, PATTR_POSITION, i);
+		in_domain = PySequence_Contains(self->domain, (PyObject *)position);
 		if (in_domain == -1)
 			goto error;
 
-		if (Particle_IsAlive(*p) && in_domain) {
-			/* Use the last velocity so controller order doesn't matter */
-			Vec3_scalar_mul(&rvel, &p->last_velocity, td);
-			Vec3_subi(&rvel, &fvel);
-			rmag = Vec3_len_sq(&rvel);
-			if (rmag > EPSILON) {
-				Vec3_scalar_div(&force, &rvel, rmag);
-				drag = self->c1*rmag + self->c2*rmag*rmag;
-				Vec3_scalar_muli(&force, drag);
-				Vec3_scalar_div(&force, &force, p->mass);
-				Vec3_subi(&p->velocity, &force);
-			}
-		}
-		p++;
+		if (Group_IsAlive(pgroup, i) && in_domain)
+			DragController_drag(&pass, i);
 	}
 
 	Py_DECREF(position);
-	Py_INCREF(Py_None);
-	return Py_None;
+	return 0;
 error:
 	Py_XDECREF(position);
-	return NULL;
+	return -1;
 }
 
+static PyObject *
+DragController_call(DragControllerObject *self, PyObject *args)
+{
+	float td;
+	GroupObject *pgroup;
+
+	if (!PyArg_ParseTuple(args, "fO:__call__", &td, &pgroup))
+		return NULL;
+	if (!GroupObject_Check(pgroup) || DragController_update(self, pgroup, td) < 0)
+		return NULL;
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static ControllerNative DragController_native = {
+	(int (*)(PyObject *, GroupObject *, float))DragController_update
+};
+
 static struct PyMemberDef DragController_members[] = {
     {"domain", T_OBJECT, offsetof(DragControllerObject, domain), 0,
         "Only particles contained in this domain are affected by the controller"},
@@ -1794,34 +2360,44 @@ MOD_INIT(_controller)
 {
 	PyObject *m;
 
-    if (!prepare_type(&GravityController_Type))
+    if (!prepare_type(&GravityController_Type)
+        || !Controller_set_native(&GravityController_Type, &GravityController_native))
         return MOD_ERROR_VAL;
 
-    if (!prepare_type(&MovementController_Type))
+    if (!prepare_type(&MovementController_Type)
+        || !Controller_set_native(&MovementController_Type, &MovementController_native))
         return MOD_ERROR_VAL;
 
-    if (!prepare_type(&FaderController_Type))
+    if (!prepare_type(&FaderController_Type)
+        || !Controller_set_native(&FaderController_Type, &FaderController_native))
         return MOD_ERROR_VAL;
 
-    if (!prepare_type(&LifetimeController_Type))
+    if (!prepare_type(&LifetimeController_Type)
+        || !Controller_set_native(&LifetimeController_Type, &LifetimeController_native))
         return MOD_ERROR_VAL;
 
-    if (!prepare_type(&ColorBlenderController_Type))
+    if (!prepare_type(&ColorBlenderController_Type)
+        || !Controller_set_native(&ColorBlenderController_Type, &ColorBlenderController_native))
         return MOD_ERROR_VAL;
 
-    if (!prepare_type(&GrowthController_Type))
+    if (!prepare_type(&GrowthController_Type)
+        || !Controller_set_native(&GrowthController_Type, &GrowthController_native))
         return MOD_ERROR_VAL;
 
-    if (!prepare_type(&CollectorController_Type))
+    if (!prepare_type(&CollectorController_Type)
+        || !Controller_set_native(&CollectorController_Type, &CollectorController_native))
         return MOD_ERROR_VAL;
 
-    if (!prepare_type(&BounceController_Type))
+    if (!prepare_type(&BounceController_Type)
+        || !Controller_set_native(&BounceController_Type, &BounceController_native))
         return MOD_ERROR_VAL;
 
-    if (!prepare_type(&MagnetController_Type))
+    if (!prepare_type(&MagnetController_Type)
+        || !Controller_set_native(&MagnetController_Type, &MagnetController_native))
         return MOD_ERROR_VAL;
 
-    if (!prepare_type(&DragController_Type))
+    if (!prepare_type(&DragController_Type)
+        || !Controller_set_native(&DragController_Type, &DragController_native))
         return MOD_ERROR_VAL;
 
 	/* Create the module and add the types */
@@ -0,0 +1,88 @@
+/* Native domain protocol
+ *
+ * Built-in domain types store a capsule named DOMAIN_NATIVE_CAPSULE holding
+ * a DomainNative as the DOMAIN_NATIVE_ATTR attribute of the type. Emitters
+ * and controllers call it directly on Vec3 structs, rather than calling the
+ * domain's methods with tuples of Python floats. Domains without it, such as
+ * those defined in Python, are used through their methods.
+ *
+ * None of the functions use the Python API, or can fail.
+ *
+ * $Id$
+ */
+
+#include <Python.h>
+#include "vector.h"
+#include "fastrng.h"
+
+#ifndef _DOMAIN_H_
+#define _DOMAIN_H_
+
+#define DOMAIN_NATIVE_ATTR "_native_domain"
+#define DOMAIN_NATIVE_CAPSULE "lepton.domain.native"
+
+typedef struct {
+	/* Store a random point in the domain, drawing from rng */
+	void (*generate)(PyObject *domain, Vec3 *point, RandState *rng);
+	/* Return true if the point is in the domain */
+	int (*contains)(PyObject *domain, Vec3 *point);
+	/* Store the point where the segment from start to end first
+	 * intersects the domain's surface, and the surface normal facing the
+	 * start point. Return 1 if they intersect, 0 if not, or -1 if the
+	 * intersection could not be determined */
+	int (*intersect)(PyObject *domain, Vec3 *start, Vec3 *end,
+		Vec3 *point, Vec3 *normal);
+	/* Store the closest point of the domain to point, and the surface
+	 * normal there, or a zero normal if point is in the domain */
+	void (*closest_point_to)(PyObject *domain, Vec3 *point,
+		Vec3 *closest, Vec3 *normal);
+	const char *name; /* Used in error messages */
+	/* Optional batch queries, NULL if the domain does not implement them.
+	 * They read n points of 3 floats, each stride floats after the last,
+	 * and are written so that the compiler can vectorize them */
+	/* Set mask[i] to whether the point i is in the domain */
+	void (*contains_many)(PyObject *domain, const float *points,
+		Py_ssize_t stride, Py_ssize_t n, unsigned char *mask);
+	/* Clear mask[i] if the segment from start i to end i cannot intersect
+	 * the domain's surface, otherwise set it. intersect() is then only
+	 * called for the segments which may intersect */
+	void (*may_intersect_many)(PyObject *domain,
+		const float *starts, Py_ssize_t start_stride,
+		const float *ends, Py_ssize_t end_stride,
+		Py_ssize_t n, unsigned char *mask);
+	/* Optional, NULL for unbounded domains. Store the corners of an
+	 * axis-aligned box containing the domain */
+	void (*bounds)(PyObject *domain, Vec3 *min, Vec3 *max);
+	/* Optional, NULL for domains without volume. Return the volume of the
+	 * domain, which weights the points composite domains generate in it */
+	float (*volume)(PyObject *domain);
+	/* Optional, NULL for domains that are always usable. Return false if
+	 * the domain holds no data yet, such as one created without calling
+	 * __init__, which must not be used natively */
+	int (*initialized)(PyObject *domain);
+} DomainNative;
+
+/* Return the native protocol of domain's type, or NULL if it does not
+ * implement it or the domain is not initialized. Never sets an exception
+ */
+static inline DomainNative *
+Domain_get_native(PyObject *domain)
+{
+	PyObject *capsule;
+	DomainNative *native = NULL;
+
+	capsule = PyObject_GetAttrString((PyObject *)Py_TYPE(domain),
+		DOMAIN_NATIVE_ATTR);
+	if (capsule != NULL && PyCapsule_IsValid(capsule, DOMAIN_NATIVE_CAPSULE))
+		native = (DomainNative *)PyCapsule_GetPointer(capsule,
+			DOMAIN_NATIVE_CAPSULE);
+	else
+		PyErr_Clear();
+	Py_XDECREF(capsule);
+	if (native != NULL && native->initialized != NULL
+		&& !native->initialized(domain))
+		return NULL;
+	return native;
+}
+
+#endif
@@ -19,7 +19,26 @@ behavior
 __version__ = '$Id$'
 
 from .particle_struct import Vec3
-from ._domain import Line, Plane, AABox, Sphere, Disc, Cylinder, Cone
+from ._domain import Line, Plane, AABox, Sphere, Disc, Cylinder, Cone, seed
+from ._domain import Union, Intersection, Difference, ObstacleSet, TriangleMesh
+from ._domain import SDFVolume
+
+
+def _points(name, points):
+    """Return the points in a buffer of floats, either an (n, 3) array or a
+    flat array of 3n floats, as a list of 3-tuples
+    """
+    view = memoryview(points)
+    if view.format.lstrip('@=') != 'f':
+        raise TypeError(
+            "%s: unsupported buffer format '%s'" % (name, view.format))
+    if view.ndim == 2 and view.shape[1] == 3:
+        return [tuple(row) for row in view.tolist()]
+    if view.ndim == 1 and len(view) % 3 == 0:
+        values = view.tolist()
+        return [tuple(values[i:i + 3]) for i in range(0, len(values), 3)]
+    raise ValueError(
+        "%s: expected an (n, 3) array or a flat array of 3n floats" % name)
 
 
 class Domain(object):
@@ -31,10 +50,77 @@ class Domain(object):
         """
         raise NotImplementedError
 
+    def generate_many(self, n, out=None):
+        """Return n points generated by generate() in an (n, 3) array of
+        floats. If out is specified, it must be a writable buffer of floats
+        or doubles with room for the points, and is returned. Otherwise a new
+        memoryview is returned.
+        """
+        if out is None:
+            values = memoryview(bytearray(12 * n)).cast('f')
+            # memoryviews cannot be cast to (0, 3)
+            result = values.cast('B').cast('f', (n, 3)) if n else values
+        else:
+            result = out
+            values = memoryview(out)
+            fmt = values.format.lstrip('@=')
+            if fmt not in ('f', 'd'):
+                raise TypeError(
+                    "generate_many: unsupported buffer format '%s'" % values.format)
+            values = values.cast('B').cast(fmt)
+            if len(values) < n * 3:
+                raise ValueError(
+                    "generate_many: out must have room for %d values" % (n * 3))
+        for i in range(n):
+            x, y, z = self.generate()
+            values[i * 3] = x
+            values[i * 3 + 1] = y
+            values[i * 3 + 2] = z
+        return result
+
     def __contains__(self, point):
         """Return true if point is inside the domain, false if not."""
         raise NotImplementedError
 
+    def contains_many(self, points):
+        """Return a memoryview of bools, true for each of the points in the
+        domain, tested with 'point in domain'. points is an (n, 3) array of
+        floats, such as a view of the particles' positions, or a flat array
+        of 3n floats.
+        """
+        points = _points('contains_many', points)
+        return memoryview(bytearray(
+            point in self for point in points)).cast('?')
+
+    def intersect_many(self, starts, ends):
+        """Intersect each of the segments between the start and end points
+        with the domain using intersect(). starts and ends are arrays of
+        points like those of contains_many(). Return a memoryview of bools,
+        true for each segment intersecting the domain, and (n, 3) arrays of
+        the intersection points and normals, which are zero where there is
+        no intersection.
+        """
+        starts = _points('intersect_many', starts)
+        ends = _points('intersect_many', ends)
+        if len(starts) != len(ends):
+            raise ValueError(
+                "intersect_many: expected as many start as end points")
+        n = len(starts)
+        hits = memoryview(bytearray(n)).cast('?')
+        points = memoryview(bytearray(12 * n)).cast('f')
+        normals = memoryview(bytearray(12 * n)).cast('f')
+        for i in range(n):
+            point, normal = self.intersect(starts[i], ends[i])
+            if point is not None:
+                hits[i] = True
+                points[i * 3], points[i * 3 + 1], points[i * 3 + 2] = point
+                normals[i * 3], normals[i * 3 + 1], normals[i * 3 + 2] = normal
+        if n:
+            # memoryviews cannot be cast to (0, 3)
+            points = points.cast('B').cast('f', (n, 3))
+            normals = normals.cast('B').cast('f', (n, 3))
+        return hits, points, normals
+
     def closest_point_to(self, point):
         """Return the closest point in the domain to the given point
         and the surface normal vector at that point. If the given
@@ -67,7 +153,7 @@ class Domain(object):
 EPSILON = 0.00001
 
 
-class Point(object):
+class Point(Domain):
     """Simple single point domain"""
 
     def __init__(self, point):
@@ -111,3 +197,25 @@ def Box(*args, **kw):
                   "This domain class will mean something different in future versions of lepton",
                   stacklevel=2)
     return AABox(*args, **kw)
+
+
+def load_sdf(filename, shape, origin=(0, 0, 0), cell_size=1.0, offset=0):
+    """Return an SDFVolume sampling the signed distances in a raw file of
+    native 32-bit floats, indexed by x, y and z samples with z varying
+    fastest. shape is the number of samples along each axis, and offset the
+    number of bytes before the first one.
+
+    The file is mapped into memory rather than read, so only the parts of
+    the grid that particles visit are loaded.
+    """
+    import mmap
+    nx, ny, nz = shape
+    size = nx * ny * nz * 4
+    with open(filename, 'rb') as f:
+        mapped = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    if len(mapped) < offset + size:
+        mapped.close()
+        raise ValueError("load_sdf: %s holds fewer than %d distances"
+                         % (filename, nx * ny * nz))
+    distances = memoryview(mapped)[offset:offset + size].cast('f')
+    return SDFVolume(distances, origin, cell_size, shape)
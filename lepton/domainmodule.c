@@ -24,6 +24,7 @@
 #include "vector.h"
 #include "fastrng.h"
 #include "group.h"
+#include "domain.h"
 
 /* Base domain methods and helper functions */
 
@@ -56,6 +57,435 @@ pack_vectors(Vec3 *pt, Vec3 *norm)
 		pt->x, pt->y, pt->z, norm->x, norm->y, norm->z);
 }
 
+/* Store an intersection point and normal, and return true */
+static inline int
+sect_result(Vec3 *point, Vec3 *normal, Vec3 *sect_pt, Vec3 *sect_norm)
+{
+	Vec3_copy(point, sect_pt);
+	Vec3_copy(normal, sect_norm);
+	return 1;
+}
+
+/* Publish the native protocol of a ready domain type. Return true on
+ * success, otherwise set an exception and return false
+ */
+static int
+Domain_set_native(PyTypeObject *type, DomainNative *native)
+{
+	PyObject *capsule;
+	int result;
+
+	capsule = PyCapsule_New(native, DOMAIN_NATIVE_CAPSULE, NULL);
+	if (capsule == NULL)
+		return 0;
+	result = PyDict_SetItemString(type->tp_dict, DOMAIN_NATIVE_ATTR, capsule);
+	Py_DECREF(capsule);
+	PyType_Modified(type);
+	return result == 0;
+}
+
+/* The methods of the built-in domains wrap their native protocol */
+
+/* Return the native protocol of a built-in domain, or NULL with a
+ * ValueError set if the domain was never initialized
+ */
+static DomainNative *
+Domain_native(PyObject *self)
+{
+	DomainNative *native = Domain_get_native(self);
+
+	if (native == NULL)
+		PyErr_Format(PyExc_ValueError, "%s: not initialized",
+			Py_TYPE(self)->tp_name);
+	return native;
+}
+
+static PyObject *
+Domain_generate(PyObject *self)
+{
+	DomainNative *native = Domain_native(self);
+	Vec3 point;
+
+	if (native == NULL)
+		return NULL;
+	native->generate(self, &point, rand_default_state());
+	return Py_BuildValue("(fff)", point.x, point.y, point.z);
+}
+
+static int
+Domain_contains(PyObject *self, PyObject *pt)
+{
+	DomainNative *native = Domain_native(self);
+	Vec3 point;
+
+	if (native == NULL)
+		return -1;
+	pt = PySequence_Tuple(pt);
+	if (pt == NULL)
+		return -1;
+	if (!PyArg_ParseTuple(pt, "fff:__contains__", &point.x, &point.y, &point.z)) {
+		Py_DECREF(pt);
+		return -1;
+	}
+	Py_DECREF(pt);
+	return native->contains(self, &point);
+}
+
+/* Raise the error for a segment the domain failed to intersect */
+static PyObject *
+Domain_intersect_error(DomainNative *native, Vec3 *start, Vec3 *end)
+{
+	char *buf;
+
+	buf = PyMem_Malloc(256 * sizeof(char));
+	PyOS_snprintf(buf, 256, "%s.intersect BUG: Intersect face not identified "
+		"start=(%f, %f, %f) end=(%f, %f, %f)", native->name,
+		start->x, start->y, start->z, end->x, end->y, end->z);
+	PyErr_SetString(PyExc_RuntimeError, buf);
+	PyMem_Free(buf);
+	return NULL;
+}
+
+static PyObject *
+Domain_intersect(PyObject *self, PyObject *args)
+{
+	DomainNative *native = Domain_native(self);
+	Vec3 start, end, point, normal;
+
+	if (native == NULL)
+		return NULL;
+	if (!PyArg_ParseTuple(args, "(fff)(fff):intersect",
+		&start.x, &start.y, &start.z,
+		&end.x, &end.y, &end.z))
+		return NULL;
+
+	switch (native->intersect(self, &start, &end, &point, &normal)) {
+	case 1:
+		return pack_vectors(&point, &normal);
+	case 0:
+		Py_INCREF(NO_INTERSECTION);
+		return NO_INTERSECTION;
+	}
+	/* We should never get here */
+	return Domain_intersect_error(native, &start, &end);
+}
+
+#if PY_MAJOR_VERSION >= 3
+/* Return a memoryview of the bytearray bytes as n rows of 3 floats if rows
+ * is true, otherwise as n bools. Steals the reference to bytes
+ */
+static PyObject *
+Domain_array_view(PyObject *bytes, Py_ssize_t n, int rows)
+{
+	PyObject *view, *result;
+
+	if (bytes == NULL)
+		return NULL;
+	view = PyMemoryView_FromObject(bytes);
+	Py_DECREF(bytes);
+	if (view == NULL)
+		return NULL;
+	if (!rows)
+		result = PyObject_CallMethod(view, "cast", "s", "?");
+	else if (n > 0) /* memoryviews cannot be cast to (0, 3) */
+		result = PyObject_CallMethod(view, "cast", "s(ni)", "f", n, 3);
+	else
+		result = PyObject_CallMethod(view, "cast", "s", "f");
+	Py_DECREF(view);
+	return result;
+}
+
+/* Fill an (n, 3) buffer of floats or doubles with generated points */
+static PyObject *
+Domain_generate_many(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	DomainNative *native = Domain_native(self);
+	RandState *rng = rand_default_state();
+	PyObject *out = NULL, *bytes = NULL;
+	Py_ssize_t n, i;
+	Py_buffer buf;
+	const char *format;
+	int is_double;
+	Vec3 point;
+
+	static char *kwlist[] = {"n", "out", NULL};
+
+	if (native == NULL)
+		return NULL;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|O:generate_many", kwlist,
+		&n, &out))
+		return NULL;
+	if (n < 0) {
+		PyErr_SetString(PyExc_ValueError, "generate_many: expected n >= 0");
+		return NULL;
+	}
+	if (out == NULL || out == Py_None) {
+		bytes = PyByteArray_FromStringAndSize(NULL, n * 3 * sizeof(float));
+		if (bytes == NULL)
+			return NULL;
+		out = bytes;
+	}
+	if (PyObject_GetBuffer(out, &buf,
+		PyBUF_WRITABLE | PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) < 0)
+		goto error;
+	format = buf.format;
+	if (format != NULL && (*format == '@' || *format == '='))
+		format++;
+	if (bytes != NULL) {
+		is_double = 0;
+	} else if (format != NULL && (!strcmp(format, "f") || !strcmp(format, "d"))) {
+		is_double = *format == 'd';
+	} else {
+		PyErr_Format(PyExc_TypeError,
+			"generate_many: unsupported buffer format '%s'", buf.format);
+		PyBuffer_Release(&buf);
+		goto error;
+	}
+	if (buf.len / (is_double ? sizeof(double) : sizeof(float)) < (size_t)n * 3) {
+		PyErr_Format(PyExc_ValueError,
+			"generate_many: out must have room for %zd values", n * 3);
+		PyBuffer_Release(&buf);
+		goto error;
+	}
+
+	for (i = 0; i < n; i++) {
+		native->generate(self, &point, rng);
+		if (is_double) {
+			((double *)buf.buf)[i * 3] = point.x;
+			((double *)buf.buf)[i * 3 + 1] = point.y;
+			((double *)buf.buf)[i * 3 + 2] = point.z;
+		} else {
+			((float *)buf.buf)[i * 3] = point.x;
+			((float *)buf.buf)[i * 3 + 1] = point.y;
+			((float *)buf.buf)[i * 3 + 2] = point.z;
+		}
+	}
+	PyBuffer_Release(&buf);
+
+	if (bytes != NULL)
+		return Domain_array_view(bytes, n, 1);
+	Py_INCREF(out);
+	return out;
+
+error:
+	Py_XDECREF(bytes);
+	return NULL;
+}
+
+/* Get the points in obj, either an (n, 3) array of floats with any row
+ * stride, as the view of a particle attribute has, or a flat array of 3n
+ * floats. Store the first point, the stride between points in floats and
+ * their number. Return true on success, false with an exception set on
+ * failure. The buffer must be released on success
+ */
+static int
+Domain_get_points(PyObject *obj, Py_buffer *buf, const char *fname,
+	const float **points, Py_ssize_t *stride, Py_ssize_t *n)
+{
+	const char *format;
+
+	if (PyObject_GetBuffer(obj, buf, PyBUF_RECORDS_RO) < 0)
+		return 0;
+	format = buf->format;
+	if (format != NULL && (*format == '@' || *format == '='))
+		format++;
+	if (format == NULL || strcmp(format, "f")) {
+		PyErr_Format(PyExc_TypeError,
+			"%s: unsupported buffer format '%s'", fname, buf->format);
+		goto error;
+	}
+	if (buf->ndim == 2 && buf->shape[1] == 3
+		&& buf->strides[1] == sizeof(float)
+		&& buf->strides[0] % (Py_ssize_t)sizeof(float) == 0) {
+		*n = buf->shape[0];
+		*stride = buf->strides[0] / (Py_ssize_t)sizeof(float);
+	} else if (buf->ndim == 1 && buf->shape[0] % 3 == 0
+		&& buf->strides[0] == sizeof(float)) {
+		*n = buf->shape[0] / 3;
+		*stride = 3;
+	} else {
+		PyErr_Format(PyExc_ValueError,
+			"%s: expected an (n, 3) array or a flat array of 3n floats", fname);
+		goto error;
+	}
+	*points = (const float *)buf->buf;
+	return 1;
+
+error:
+	PyBuffer_Release(buf);
+	return 0;
+}
+
+static inline void
+load_vec3(Vec3 *vec, const float *p)
+{
+	vec->x = p[0];
+	vec->y = p[1];
+	vec->z = p[2];
+}
+
+static PyObject *
+Domain_contains_many(PyObject *self, PyObject *args)
+{
+	DomainNative *native = Domain_native(self);
+	PyObject *obj, *bytes;
+	const float *points;
+	unsigned char *mask;
+	Py_ssize_t stride, n, i;
+	Py_buffer buf;
+	Vec3 point;
+
+	if (native == NULL)
+		return NULL;
+	if (!PyArg_ParseTuple(args, "O:contains_many", &obj))
+		return NULL;
+	if (!Domain_get_points(obj, &buf, "contains_many", &points, &stride, &n))
+		return NULL;
+	bytes = PyByteArray_FromStringAndSize(NULL, n);
+	if (bytes == NULL) {
+		PyBuffer_Release(&buf);
+		return NULL;
+	}
+	mask = (unsigned char *)PyByteArray_AS_STRING(bytes);
+	if (native->contains_many != NULL) {
+		native->contains_many(self, points, stride, n, mask);
+	} else {
+		for (i = 0; i < n; i++) {
+			load_vec3(&point, points + i * stride);
+			mask[i] = native->contains(self, &point) != 0;
+		}
+	}
+	PyBuffer_Release(&buf);
+	return Domain_array_view(bytes, n, 0);
+}
+
+static PyObject *
+Domain_intersect_many(PyObject *self, PyObject *args)
+{
+	DomainNative *native = Domain_native(self);
+	PyObject *start_obj, *end_obj;
+	PyObject *hits = NULL, *sect_points = NULL, *sect_normals = NULL;
+	const float *starts, *ends;
+	unsigned char *mask;
+	float *pt, *norm;
+	Py_ssize_t start_stride, end_stride, n, end_n, i;
+	Py_buffer start_buf, end_buf;
+	Vec3 start, end, point, normal;
+
+	if (native == NULL)
+		return NULL;
+	if (!PyArg_ParseTuple(args, "OO:intersect_many", &start_obj, &end_obj))
+		return NULL;
+	if (!Domain_get_points(start_obj, &start_buf, "intersect_many",
+		&starts, &start_stride, &n))
+		return NULL;
+	if (!Domain_get_points(end_obj, &end_buf, "intersect_many",
+		&ends, &end_stride, &end_n)) {
+		PyBuffer_Release(&start_buf);
+		return NULL;
+	}
+	if (end_n != n) {
+		PyErr_SetString(PyExc_ValueError,
+			"intersect_many: expected as many start as end points");
+		goto error;
+	}
+	hits = PyByteArray_FromStringAndSize(NULL, n);
+	sect_points = PyByteArray_FromStringAndSize(NULL, n * 3 * sizeof(float));
+	sect_normals = PyByteArray_FromStringAndSize(NULL, n * 3 * sizeof(float));
+	if (hits == NULL || sect_points == NULL || sect_normals == NULL)
+		goto error;
+	mask = (unsigned char *)PyByteArray_AS_STRING(hits);
+	pt = (float *)PyByteArray_AS_STRING(sect_points);
+	norm = (float *)PyByteArray_AS_STRING(sect_normals);
+	memset(pt, 0, n * 3 * sizeof(float));
+	memset(norm, 0, n * 3 * sizeof(float));
+	if (native->may_intersect_many != NULL)
+		native->may_intersect_many(self, starts, start_stride,
+			ends, end_stride, n, mask);
+	else
+		memset(mask, 1, n);
+
+	for (i = 0; i < n; i++) {
+		if (!mask[i])
+			continue;
+		load_vec3(&start, starts + i * start_stride);
+		load_vec3(&end, ends + i * end_stride);
+		switch (native->intersect(self, &start, &end, &point, &normal)) {
+		case 1:
+			pt[i * 3] = point.x;
+			pt[i * 3 + 1] = point.y;
+			pt[i * 3 + 2] = point.z;
+			norm[i * 3] = normal.x;
+			norm[i * 3 + 1] = normal.y;
+			norm[i * 3 + 2] = normal.z;
+			break;
+		case 0:
+			mask[i] = 0;
+			break;
+		default:
+			Domain_intersect_error(native, &start, &end);
+			goto error;
+		}
+	}
+	PyBuffer_Release(&start_buf);
+	PyBuffer_Release(&end_buf);
+	return Py_BuildValue("(NNN)", Domain_array_view(hits, n, 0),
+		Domain_array_view(sect_points, n, 1),
+		Domain_array_view(sect_normals, n, 1));
+
+error:
+	PyBuffer_Release(&start_buf);
+	PyBuffer_Release(&end_buf);
+	Py_XDECREF(hits);
+	Py_XDECREF(sect_points);
+	Py_XDECREF(sect_normals);
+	return NULL;
+}
+
+#define DOMAIN_GENERATE_MANY_METHOD \
+	{"generate_many", (PyCFunction)Domain_generate_many, \
+		METH_VARARGS | METH_KEYWORDS, \
+		PyDoc_STR("generate_many(n, out=None) -> array\n" \
+			"Generate n random points in the domain into an (n, 3)\n" \
+			"array of floats. If out is specified it must be a writable\n" \
+			"buffer of floats or doubles with room for the points, and\n" \
+			"is returned. Otherwise a new memoryview is returned.")},
+
+#define DOMAIN_QUERY_MANY_METHODS \
+	{"contains_many", (PyCFunction)Domain_contains_many, METH_VARARGS, \
+		PyDoc_STR("contains_many(points) -> mask\n" \
+			"Return a memoryview of bools, true for each of the points\n" \
+			"in the domain. points is an (n, 3) array of floats, such as\n" \
+			"a view of the particles' positions, or a flat array of 3n\n" \
+			"floats.")}, \
+	{"intersect_many", (PyCFunction)Domain_intersect_many, METH_VARARGS, \
+		PyDoc_STR("intersect_many(starts, ends) -> hits, points, normals\n" \
+			"Intersect each of the segments between the start and end\n" \
+			"points with the domain, as intersect() does. starts and ends\n" \
+			"are arrays of points like those of contains_many(). Return\n" \
+			"a memoryview of bools, true for each segment intersecting\n" \
+			"the domain, and (n, 3) arrays of the intersection points and\n" \
+			"normals, which are zero where there is no intersection.")},
+#else
+#define DOMAIN_GENERATE_MANY_METHOD
+#define DOMAIN_QUERY_MANY_METHODS
+#endif
+
+static PyObject *
+Domain_closest_point_to(PyObject *self, PyObject *args)
+{
+	DomainNative *native = Domain_native(self);
+	Vec3 point, closest, normal;
+
+	if (native == NULL)
+		return NULL;
+	if (!PyArg_ParseTuple(args, "(fff):closest_point_to",
+		&point.x, &point.y, &point.z))
+		return NULL;
+	native->closest_point_to(self, &point, &closest, &normal);
+	return pack_vectors(&closest, &normal);
+}
+
 /* --------------------------------------------------------------------- */
 
 static PyTypeObject LineDomain_Type;
@@ -79,75 +509,97 @@ LineDomain_init(LineDomainObject *self, PyObject *args)
 	return 0;
 }
 
-static PyObject *
-LineDomain_generate(LineDomainObject *self)
+static void
+Line_generate(LineDomainObject *self, Vec3 *point, RandState *rng)
 {
-	float d;
-	PyObject *x, *y, *z, *pt;
 	Vec3 direction;
+	float d;
 
 	Vec3_sub(&direction, &self->end_point, &self->start_point);
-	d = rand_uni();
-	x = PyFloat_FromDouble(self->start_point.x + direction.x * d);
-	y = PyFloat_FromDouble(self->start_point.y + direction.y * d);
-	z = PyFloat_FromDouble(self->start_point.z + direction.z * d);
-	if (x == NULL || y == NULL || z == NULL) {
-		Py_XDECREF(x);
-		Py_XDECREF(y);
-		Py_XDECREF(z);
-		return NULL;
-	}
+	d = rand_state_uni(rng);
+	point->x = self->start_point.x + direction.x * d;
+	point->y = self->start_point.y + direction.y * d;
+	point->z = self->start_point.z + direction.z * d;
+}
 
-	pt = PyTuple_Pack(3, x, y, z);
-	Py_DECREF(x);
-	Py_DECREF(y);
-	Py_DECREF(z);
-	return pt;
+static int
+Line_contains(LineDomainObject *self, Vec3 *point)
+{
+	return 0;
 }
 
-static PyObject *
-LineDomain_closest_point_to(LineDomainObject *self, PyObject *args)
+static int
+Line_intersect(LineDomainObject *self, Vec3 *start, Vec3 *end,
+	Vec3 *point, Vec3 *normal)
 {
-	Vec3 point, closest, norm, tp, lv;
-	float mag2;
+	/* You cannot intersect a line segment */
+	return 0;
+}
 
-	if (!PyArg_ParseTuple(args, "(fff):closest_point_to",
-		&point.x, &point.y, &point.z))
-		return NULL;
+static void
+Line_closest_pt_to(LineDomainObject *self, Vec3 *point,
+	Vec3 *closest, Vec3 *norm)
+{
+	Vec3 tp, lv;
+	float mag2;
 
 	Vec3_sub(&lv, &self->end_point, &self->start_point);
-	Vec3_sub(&tp, &point, &self->start_point);
+	Vec3_sub(&tp, point, &self->start_point);
 	mag2 = Vec3_len_sq(&lv);
 	if (mag2 > EPSILON) {
 		float t = Vec3_dot(&tp, &lv) / mag2;
 		/* Use the closest point along the infinite line to calc the normal */
-		Vec3_scalar_mul(&closest, &lv, t);
-		Vec3_add(&closest, &self->start_point, &closest);
-		Vec3_sub(&norm, &point, &closest);
-		Vec3_normalize(&norm, &norm);
+		Vec3_scalar_mul(closest, &lv, t);
+		Vec3_add(closest, &self->start_point, closest);
+		Vec3_sub(norm, point, closest);
+		Vec3_normalize(norm, norm);
 		/* Find the closest point actually on the segment */
 		t = clamp(t, 0.0f, 1.0f);
 		Vec3_scalar_muli(&lv, t);
-		Vec3_add(&closest, &self->start_point, &lv);
+		Vec3_add(closest, &self->start_point, &lv);
 	} else {
 		/* zero-length line */
-		Vec3_copy(&closest, &self->start_point);
-		norm.x = norm.y = norm.z = 0.0f;
+		Vec3_copy(closest, &self->start_point);
+		norm->x = norm->y = norm->z = 0.0f;
 	}
-	return pack_vectors(&closest, &norm);
 }
 
+static void
+Line_bounds(LineDomainObject *self, Vec3 *min, Vec3 *max)
+{
+	min->x = fminf(self->start_point.x, self->end_point.x);
+	min->y = fminf(self->start_point.y, self->end_point.y);
+	min->z = fminf(self->start_point.z, self->end_point.z);
+	max->x = fmaxf(self->start_point.x, self->end_point.x);
+	max->y = fmaxf(self->start_point.y, self->end_point.y);
+	max->z = fmaxf(self->start_point.z, self->end_point.z);
+}
+
+static DomainNative LineDomain_native = {
+	(void (*)(PyObject *, Vec3 *, RandState *))Line_generate,
+	(int (*)(PyObject *, Vec3 *))Line_contains,
+	(int (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *, Vec3 *))Line_intersect,
+	(void (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *))Line_closest_pt_to,
+	"Line",
+	NULL,
+	NULL,
+	(void (*)(PyObject *, Vec3 *, Vec3 *))Line_bounds,
+	NULL
+};
+
 static PyMethodDef LineDomain_methods[] = {
-	{"generate", (PyCFunction)LineDomain_generate, METH_NOARGS,
+	{"generate", (PyCFunction)Domain_generate, METH_NOARGS,
 		PyDoc_STR("generate() -> Vector\n"
 			"Return a random point along the line segment domain")},
 	{"intersect", (PyCFunction)Domain_never_intersects, METH_VARARGS,
 		PyDoc_STR("intersect(seg_start, seg_end) -> point, normal\n"
 			"You cannot intersect a line segment")},
-	{"closest_point_to", (PyCFunction)LineDomain_closest_point_to, METH_VARARGS,
+	{"closest_point_to", (PyCFunction)Domain_closest_point_to, METH_VARARGS,
 		PyDoc_STR("closest_point_to(point) -> point, normal\n"
 			"Returns the closest point and normal on the line\n"
 			"to the supplied point.")},
+	DOMAIN_GENERATE_MANY_METHOD
+	DOMAIN_QUERY_MANY_METHODS
 	{NULL,		NULL}		/* sentinel */
 };
 
@@ -286,98 +738,133 @@ PlaneDomain_init(PlaneDomainObject *self, PyObject *args)
 	return 0;
 }
 
-static PyObject *
-PlaneDomain_generate(PlaneDomainObject *self)
+static void
+Plane_generate(PlaneDomainObject *self, Vec3 *point, RandState *rng)
 {
-	PyObject *x, *y, *z, *pt;
+	Vec3_copy(point, &self->point);
+}
 
-	x = PyFloat_FromDouble(self->point.x);
-	y = PyFloat_FromDouble(self->point.y);
-	z = PyFloat_FromDouble(self->point.z);
-	if (x == NULL || y == NULL || z == NULL) {
-		Py_XDECREF(x);
-		Py_XDECREF(y);
-		Py_XDECREF(z);
-		return NULL;
-	}
+static int
+Plane_contains(PlaneDomainObject *self, Vec3 *point)
+{
+	Vec3 from_plane;
 
-	pt = PyTuple_Pack(3, x, y, z);
-	Py_DECREF(x);
-	Py_DECREF(y);
-	Py_DECREF(z);
-	return pt;
+	Vec3_sub(&from_plane, point, &self->point);
+	return Vec3_dot(&from_plane, &self->normal) < EPSILON;
 }
 
-static PyObject *
-PlaneDomain_intersect(PlaneDomainObject *self, PyObject *args)
+static int
+Plane_intersect(PlaneDomainObject *self, Vec3 *start, Vec3 *end,
+	Vec3 *point, Vec3 *norm)
 {
-	Vec3 norm, start, end, vec;
+	Vec3 vec;
 	float ndotv, t, dist;
 
-	if (!PyArg_ParseTuple(args, "(fff)(fff):intersect",
-		&start.x, &start.y, &start.z,
-		&end.x, &end.y, &end.z))
-		return NULL;
-
-	Vec3_copy(&norm, &self->normal);
-	Vec3_sub(&vec, &end, &start);
-	ndotv = Vec3_dot(&norm, &vec);
+	Vec3_copy(norm, &self->normal);
+	Vec3_sub(&vec, end, start);
+	ndotv = Vec3_dot(norm, &vec);
 	if (ndotv) {
-		t = (self->d - norm.x*start.x - norm.y*start.y - norm.z*start.z) / ndotv;
+		t = (self->d - norm->x*start->x - norm->y*start->y - norm->z*start->z) / ndotv;
 		if (t >= 0.0f && t <= 1.0f) {
 			/* calculate intersection point */
 			Vec3_scalar_muli(&vec, t);
-			Vec3_add(&end, &start, &vec);
+			Vec3_add(point, start, &vec);
 			/* Calculate the distance from the plane to the start point */
-			dist = Vec3_dot(&norm, &vec);
+			dist = Vec3_dot(norm, &vec);
 			if (dist > 0.0f) {
 				/* start point is on opposite side of normal */
-				Vec3_neg(&norm, &norm);
+				Vec3_neg(norm, norm);
 			}
-			return pack_vectors(&end, &norm);
+			return 1;
 		}
 	}
-	Py_INCREF(NO_INTERSECTION);
-	return NO_INTERSECTION;
+	return 0;
 }
 
-static PyObject *
-PlaneDomain_closest_point_to(PlaneDomainObject *self, PyObject *args)
+static void
+Plane_closest_pt_to(PlaneDomainObject *self, Vec3 *point,
+	Vec3 *closest, Vec3 *norm)
 {
-	Vec3 point, closest, norm, tp;
+	Vec3 tp;
 	float t;
 
-	if (!PyArg_ParseTuple(args, "(fff):closest_point_to",
-		&point.x, &point.y, &point.z))
-		return NULL;
-
-	Vec3_sub(&tp, &point, &self->point);
+	Vec3_sub(&tp, point, &self->point);
 	t = Vec3_dot(&tp, &self->normal);
 	Vec3_scalar_mul(&tp, &self->normal, t);
-	Vec3_sub(&closest, &point, &tp);
+	Vec3_sub(closest, point, &tp);
 	if (t >= 0.0f) {
-		Vec3_copy(&norm, &self->normal);
+		Vec3_copy(norm, &self->normal);
 	} else {
-		Vec3_neg(&norm, &self->normal);
+		Vec3_neg(norm, &self->normal);
+	}
+}
+
+static void
+Plane_contains_many(PlaneDomainObject *self, const float *points,
+	Py_ssize_t stride, Py_ssize_t n, unsigned char *mask)
+{
+	const float px = self->point.x, py = self->point.y, pz = self->point.z;
+	const float nx = self->normal.x, ny = self->normal.y, nz = self->normal.z;
+	Py_ssize_t i;
+
+	for (i = 0; i < n; i++) {
+		const float *p = points + i * stride;
+		mask[i] = ((p[0] - px)*nx + (p[1] - py)*ny + (p[2] - pz)*nz) < EPSILON;
+	}
+}
+
+static void
+Plane_may_intersect_many(PlaneDomainObject *self,
+	const float *starts, Py_ssize_t start_stride,
+	const float *ends, Py_ssize_t end_stride,
+	Py_ssize_t n, unsigned char *mask)
+{
+	const float nx = self->normal.x, ny = self->normal.y, nz = self->normal.z;
+	const float d = self->d;
+	float ndotv, t;
+	Py_ssize_t i;
+
+	for (i = 0; i < n; i++) {
+		const float *s = starts + i * start_stride;
+		const float *e = ends + i * end_stride;
+		ndotv = nx*(e[0] - s[0]) + ny*(e[1] - s[1]) + nz*(e[2] - s[2]);
+		t = (d - nx*s[0] - ny*s[1] - nz*s[2]) / ndotv;
+		/* Allow some slack for the rounding of intersect() */
+		mask[i] = (ndotv != 0.0f) & (t >= -EPSILON) & (t <= 1.0f + EPSILON);
 	}
-	return pack_vectors(&closest, &norm);
 }
 
+static DomainNative PlaneDomain_native = {
+	(void (*)(PyObject *, Vec3 *, RandState *))Plane_generate,
+	(int (*)(PyObject *, Vec3 *))Plane_contains,
+	(int (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *, Vec3 *))Plane_intersect,
+	(void (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *))Plane_closest_pt_to,
+	"Plane",
+	(void (*)(PyObject *, const float *, Py_ssize_t, Py_ssize_t,
+		unsigned char *))Plane_contains_many,
+	(void (*)(PyObject *, const float *, Py_ssize_t, const float *,
+		Py_ssize_t, Py_ssize_t, unsigned char *))Plane_may_intersect_many,
+	NULL,
+	NULL
+};
+
 static PyMethodDef PlaneDomain_methods[] = {
-	{"generate", (PyCFunction)PlaneDomain_generate, METH_NOARGS,
+	{"generate", (PyCFunction)Domain_generate, METH_NOARGS,
 		PyDoc_STR("generate() -> Vector\n"
 			"Aways return the provided point on the plane")},
-	{"intersect", (PyCFunction)PlaneDomain_intersect, METH_VARARGS,
+	{"intersect", (PyCFunction)Domain_intersect, METH_VARARGS,
 		PyDoc_STR("intersect(seg_start, seg_end) -> point, normal\n"
 			"Intersect the line segment with the plane return the intersection\n"
 			"point and normal vector pointing into space on the same side of the\n"
 			"plane as the start point.\n\n"
 			"If the line does not intersect, or lies completely in the plane\n"
 			"return (None, None)")},
-	{"closest_point_to", (PyCFunction)PlaneDomain_closest_point_to, METH_VARARGS,
+	{"closest_point_to", (PyCFunction)Domain_closest_point_to, METH_VARARGS,
 		PyDoc_STR("closest_point_to(point) -> point, normal\n"
 			"Returns the closest point and normal on the plane\n"
 			"to the supplied point.")},
+	DOMAIN_GENERATE_MANY_METHOD
+	DOMAIN_QUERY_MANY_METHODS
 	{NULL,		NULL}		/* sentinel */
 };
 
@@ -415,25 +902,6 @@ PlaneDomain_setattr(PlaneDomainObject *self, PyObject *name_str, PyObject *v)
 	return result;
 }
 
-static int
-PlaneDomain_contains(PlaneDomainObject *self, PyObject *pt)
-{
-	Vec3 point, from_plane;
-
-	pt = PySequence_Tuple(pt);
-	if (pt == NULL)
-		return -1;
-	if (!PyArg_ParseTuple(pt, "fff:__contains__", &point.x, &point.y, &point.z)) {
-		Py_DECREF(pt);
-		return -1;
-	}
-	Py_DECREF(pt);
-
-	Vec3_sub(&from_plane, &point, &self->point);
-	return Vec3_dot(&from_plane, &self->normal) < EPSILON;
-}
-
-
 static PySequenceMethods PlaneDomain_as_sequence = {
 	0,		/* sq_length */
 	0,		/* sq_concat */
@@ -442,7 +910,7 @@ static PySequenceMethods PlaneDomain_as_sequence = {
 	0,		/* sq_slice */
 	0,		/* sq_ass_item */
 	0,	    /* sq_ass_slice */
-	(objobjproc)PlaneDomain_contains,	/* sq_contains */
+	(objobjproc)Domain_contains,	/* sq_contains */
 };
 
 PyDoc_STRVAR(PlaneDomain__doc__,
@@ -535,29 +1003,15 @@ AABoxDomain_init(AABoxDomainObject *self, PyObject *args)
 	return 0;
 }
 
-static PyObject *
-AABoxDomain_generate(AABoxDomainObject *self)
+static void
+AABox_generate(AABoxDomainObject *self, Vec3 *point, RandState *rng)
 {
-	PyObject *x, *y, *z, *pt;
 	Vec3 size;
 
 	Vec3_sub(&size, &self->max, &self->min);
-
-	x = PyFloat_FromDouble(self->min.x + size.x * rand_uni());
-	y = PyFloat_FromDouble(self->min.y + size.y * rand_uni());
-	z = PyFloat_FromDouble(self->min.z + size.z * rand_uni());
-	if (x == NULL || y == NULL || z == NULL) {
-		Py_XDECREF(x);
-		Py_XDECREF(y);
-		Py_XDECREF(z);
-		return NULL;
-	}
-
-	pt = PyTuple_Pack(3, x, y, z);
-	Py_DECREF(x);
-	Py_DECREF(y);
-	Py_DECREF(z);
-	return pt;
+	point->x = self->min.x + size.x * rand_state_uni(rng);
+	point->y = self->min.y + size.y * rand_state_uni(rng);
+	point->z = self->min.z + size.z * rand_state_uni(rng);
 }
 
 #define pt_in_box(box, px, py, pz) \
@@ -566,35 +1020,28 @@ AABoxDomain_generate(AABoxDomainObject *self)
 	 & ((pz) >= (box)->min.z) & ((pz) <= (box)->max.z))
 
 static int
-AABoxDomain_contains(AABoxDomainObject *self, PyObject *pt)
+AABox_contains(AABoxDomainObject *self, Vec3 *point)
 {
-	float x, y, z;
-
-	pt = PySequence_Tuple(pt);
-	if (pt == NULL)
-		return -1;
-	if (!PyArg_ParseTuple(pt, "fff:__contains__", &x, &y, &z)) {
-		Py_DECREF(pt);
-		return -1;
-	}
-	Py_DECREF(pt);
-
-	return pt_in_box(self, x, y, z);
+	return pt_in_box(self, point->x, point->y, point->z);
 }
 
-static PyObject *
-AABoxDomain_intersect(AABoxDomainObject *self, PyObject *args)
+/* Store the intersection point and normal, return true if the point is on
+ * the box face */
+#define box_face_sect(box, pt, n, ix, iy, iz, nx, ny, nz) \
+	((pt)->x = (ix), (pt)->y = (iy), (pt)->z = (iz), \
+	 (n)->x = (nx), (n)->y = (ny), (n)->z = (nz), \
+	 pt_in_box(box, (pt)->x, (pt)->y, (pt)->z))
+
+static int
+AABox_intersect(AABoxDomainObject *self, Vec3 *seg_start, Vec3 *seg_end,
+	Vec3 *point, Vec3 *norm)
 {
 	Vec3 start, end;
-	float t, ix, iy, iz;
+	float t;
 	int start_in, end_in;
-	char* buf;
-
-	if (!PyArg_ParseTuple(args, "(fff)(fff):intersect",
-		&start.x, &start.y, &start.z,
-		&end.x, &end.y, &end.z))
-		return NULL;
 
+	Vec3_copy(&start, seg_start);
+	Vec3_copy(&end, seg_end);
 	start_in = pt_in_box(self, start.x, start.y, start.z);
 	end_in = pt_in_box(self, end.x, end.y, end.z);
 	if (!(start_in | end_in)) {
@@ -607,100 +1054,189 @@ AABoxDomain_intersect(AABoxDomainObject *self, PyObject *args)
 		end_in = pt_in_box(self, end.x, end.y, end.z);
 	}
 
-	if (start_in == end_in) {
-		Py_INCREF(NO_INTERSECTION);
-		return NO_INTERSECTION;
-	}
+	if (start_in == end_in)
+		return 0;
 
 	/* top face */
 	if ((start.y > self->max.y) | (end.y > self->max.y)) {
 		t = (self->max.y - start.y) / (end.y - start.y);
-		ix = (end.x - start.x) * t + start.x;
-		iy = self->max.y;
-		iz = (end.z - start.z) * t + start.z;
-		// printf("top (%f, %f, %f) (%f, %f, %f)\n", start.x, start.y, start.z, ix, iy, iz);
-		if (pt_in_box(self, ix, iy, iz))
-			return Py_BuildValue("((fff)(fff))",
-				ix, iy, iz, 0.0, (start.y > self->max.y) ? 1.0 : -1.0, 0.0);
+		if (box_face_sect(self, point, norm,
+			(end.x - start.x) * t + start.x, self->max.y,
+			(end.z - start.z) * t + start.z,
+			0.0f, (start.y > self->max.y) ? 1.0f : -1.0f, 0.0f))
+			return 1;
 	}
 	/* right face */
 	if ((start.x > self->max.x) | (end.x > self->max.x)) {
 		t = (self->max.x - start.x) / (end.x - start.x);
-		ix = self->max.x;
-		iy = (end.y - start.y) * t + start.y;
-		iz = (end.z - start.z) * t + start.z;
-		// printf("right (%f, %f, %f) (%f, %f, %f)\n", start.x, start.y, start.z, ix, iy, iz);
-		if (pt_in_box(self, ix, iy, iz))
-			return Py_BuildValue("((fff)(fff))",
-				ix, iy, iz, (start.x > self->max.x) ? 1.0 : -1.0, 0.0, 0.0);
+		if (box_face_sect(self, point, norm,
+			self->max.x, (end.y - start.y) * t + start.y,
+			(end.z - start.z) * t + start.z,
+			(start.x > self->max.x) ? 1.0f : -1.0f, 0.0f, 0.0f))
+			return 1;
 	}
 	/* bottom face */
 	if ((start.y < self->min.y) | (end.y < self->min.y)) {
 		t = (self->min.y - start.y) / (end.y - start.y);
-		ix = (end.x - start.x) * t + start.x;
-		iy = self->min.y;
-		iz = (end.z - start.z) * t + start.z;
-		// printf("bottom (%f, %f, %f) (%f, %f, %f)\n", start.x, start.y, start.z, ix, iy, iz);
-		if (pt_in_box(self, ix, iy, iz))
-			return Py_BuildValue("((fff)(fff))",
-				ix, iy, iz, 0.0, (start.y < self->min.y) ? -1.0 : 1.0, 0.0);
+		if (box_face_sect(self, point, norm,
+			(end.x - start.x) * t + start.x, self->min.y,
+			(end.z - start.z) * t + start.z,
+			0.0f, (start.y < self->min.y) ? -1.0f : 1.0f, 0.0f))
+			return 1;
 	}
 	/* left face */
 	if ((start.x < self->min.x) | (end.x < self->min.x)) {
 		t = (self->min.x - start.x) / (end.x - start.x);
-		ix = self->min.x;
-		iy = (end.y - start.y) * t + start.y;
-		iz = (end.z - start.z) * t + start.z;
-		// printf("left (%f, %f, %f) (%f, %f, %f)\n", start.x, start.y, start.z, ix, iy, iz);
-		if (pt_in_box(self, ix, iy, iz))
-			return Py_BuildValue("((fff)(fff))",
-				ix, iy, iz, (start.x < self->min.x) ? -1.0 : 1.0, 0.0, 0.0);
+		if (box_face_sect(self, point, norm,
+			self->min.x, (end.y - start.y) * t + start.y,
+			(end.z - start.z) * t + start.z,
+			(start.x < self->min.x) ? -1.0f : 1.0f, 0.0f, 0.0f))
+			return 1;
 	}
 	/* far face */
 	if ((start.z < self->min.z) | (end.z < self->min.z)) {
 		t = (self->min.z - start.z) / (end.z - start.z);
-		ix = (end.x - start.x) * t + start.x;
-		iy = (end.y - start.y) * t + start.y;
-		iz = self->min.z;
-		// printf("far (%f, %f, %f) (%f, %f, %f)\n", start.x, start.y, start.z, ix, iy, iz);
-		if (pt_in_box(self, ix, iy, iz))
-			return Py_BuildValue("((fff)(fff))",
-				ix, iy, iz, 0.0, 0.0, (start.z < self->min.z) ? -1.0 : 1.0);
+		if (box_face_sect(self, point, norm,
+			(end.x - start.x) * t + start.x,
+			(end.y - start.y) * t + start.y, self->min.z,
+			0.0f, 0.0f, (start.z < self->min.z) ? -1.0f : 1.0f))
+			return 1;
 	}
 	/* near face */
 	if ((start.z > self->max.z) | (end.z > self->max.z)) {
 		t = (self->max.z - start.z) / (end.z - start.z);
-		ix = (end.x - start.x) * t + start.x;
-		iy = (end.y - start.y) * t + start.y;
-		iz = self->max.z;
-		// printf("near (%f, %f, %f) (%f, %f, %f)\n", start.x, start.y, start.z, ix, iy, iz);
-		if (pt_in_box(self, ix, iy, iz))
-			return Py_BuildValue("((fff)(fff))",
-				ix, iy, iz, 0.0, 0.0, (start.z > self->max.z) ? 1.0 : -1.0);
+		if (box_face_sect(self, point, norm,
+			(end.x - start.x) * t + start.x,
+			(end.y - start.y) * t + start.y, self->max.z,
+			0.0f, 0.0f, (start.z > self->max.z) ? 1.0f : -1.0f))
+			return 1;
 	}
-
 	/* We should never get here */
-	buf = PyMem_Malloc(256 * sizeof(char));
-	PyOS_snprintf(buf, 256, "AABox.intersect BUG: Intersect face not identified "
-		"min=(%f, %f, %f) max=(%f, %f, %f) start=(%f, %f, %f) end=(%f, %f, %f)",
-		self->min.x, self->min.y, self->min.z, self->max.x, self->max.y, self->max.z,
-		start.x, start.y, start.z, end.x, end.y, end.z);
-	PyErr_SetString(PyExc_RuntimeError, buf);
-	PyMem_Free(buf);
-	return NULL;
+	return -1;
+}
+
+static void
+AABox_closest_pt_to(AABoxDomainObject *self, Vec3 *point,
+	Vec3 *closest, Vec3 *norm)
+{
+	closest->x = clamp(point->x, self->min.x, self->max.x);
+	closest->y = clamp(point->y, self->min.y, self->max.y);
+	closest->z = clamp(point->z, self->min.z, self->max.z);
+	/* The normal is zero for points inside the box */
+	Vec3_sub(norm, point, closest);
+	Vec3_normalize(norm, norm);
+}
+
+static void
+AABox_contains_many(AABoxDomainObject *self, const float *points,
+	Py_ssize_t stride, Py_ssize_t n, unsigned char *mask)
+{
+	Py_ssize_t i;
+
+	for (i = 0; i < n; i++) {
+		const float *p = points + i * stride;
+		mask[i] = pt_in_box(self, p[0], p[1], p[2]);
+	}
+}
+
+static void
+AABox_may_intersect_many(AABoxDomainObject *self,
+	const float *starts, Py_ssize_t start_stride,
+	const float *ends, Py_ssize_t end_stride,
+	Py_ssize_t n, unsigned char *mask)
+{
+	/* A copy of the bounds, which the compiler cannot assume are not
+	 * changed by stores to mask */
+	const struct {Vec3 min, max;} box = {self->min, self->max};
+	float m, cx, cy, cz, hx, hy, hz, mx, my, mz, dx, dy, dz, ax, ay, az;
+	int misses, inside;
+	Py_ssize_t i;
+
+	/* The box is grown enough to cover the rounding of intersect(), so
+	 * that a segment that intersects it is never rejected */
+	m = fmaxf(fmaxf(fmaxf(fabsf(self->min.x), fabsf(self->min.y)),
+		fmaxf(fabsf(self->min.z), fabsf(self->max.x))),
+		fmaxf(fabsf(self->max.y), fabsf(self->max.z)));
+	m = EPSILON + m * 1e-5f;
+	cx = (self->min.x + self->max.x) * 0.5f;
+	cy = (self->min.y + self->max.y) * 0.5f;
+	cz = (self->min.z + self->max.z) * 0.5f;
+	hx = (self->max.x - self->min.x) * 0.5f + m;
+	hy = (self->max.y - self->min.y) * 0.5f + m;
+	hz = (self->max.z - self->min.z) * 0.5f + m;
+	for (i = 0; i < n; i++) {
+		const float *s = starts + i * start_stride;
+		const float *e = ends + i * end_stride;
+		/* Half the segment, and its midpoint relative to the box center */
+		dx = (e[0] - s[0]) * 0.5f;
+		dy = (e[1] - s[1]) * 0.5f;
+		dz = (e[2] - s[2]) * 0.5f;
+		mx = s[0] + dx - cx;
+		my = s[1] + dy - cy;
+		mz = s[2] + dz - cz;
+		ax = fabsf(dx) + EPSILON;
+		ay = fabsf(dy) + EPSILON;
+		az = fabsf(dz) + EPSILON;
+		/* The segment misses the box if they are separated along one of
+		 * the box's slabs, or an axis perpendicular to the segment and a
+		 * box edge. Each test is done for every segment, without branches */
+		misses = (fabsf(mx) > hx + ax) | (fabsf(my) > hy + ay)
+			| (fabsf(mz) > hz + az)
+			| (fabsf(my*dz - mz*dy) > hy*az + hz*ay)
+			| (fabsf(mz*dx - mx*dz) > hx*az + hz*ax)
+			| (fabsf(mx*dy - my*dx) > hx*ay + hy*ax);
+		/* Segments entirely inside the box never intersect its surface */
+		inside = pt_in_box(&box, s[0], s[1], s[2])
+			& pt_in_box(&box, e[0], e[1], e[2]);
+		mask[i] = !(misses | inside);
+	}
+}
+
+static void
+AABox_bounds(AABoxDomainObject *self, Vec3 *min, Vec3 *max)
+{
+	Vec3_copy(min, &self->min);
+	Vec3_copy(max, &self->max);
+}
+
+static float
+AABox_volume(AABoxDomainObject *self)
+{
+	return (self->max.x - self->min.x) * (self->max.y - self->min.y)
+		* (self->max.z - self->min.z);
 }
 
+static DomainNative AABoxDomain_native = {
+	(void (*)(PyObject *, Vec3 *, RandState *))AABox_generate,
+	(int (*)(PyObject *, Vec3 *))AABox_contains,
+	(int (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *, Vec3 *))AABox_intersect,
+	(void (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *))AABox_closest_pt_to,
+	"AABox",
+	(void (*)(PyObject *, const float *, Py_ssize_t, Py_ssize_t,
+		unsigned char *))AABox_contains_many,
+	(void (*)(PyObject *, const float *, Py_ssize_t, const float *,
+		Py_ssize_t, Py_ssize_t, unsigned char *))AABox_may_intersect_many,
+	(void (*)(PyObject *, Vec3 *, Vec3 *))AABox_bounds,
+	(float (*)(PyObject *))AABox_volume
+};
+
 static PyMethodDef AABoxDomain_methods[] = {
-	{"generate", (PyCFunction)AABoxDomain_generate, METH_NOARGS,
+	{"generate", (PyCFunction)Domain_generate, METH_NOARGS,
 		PyDoc_STR("generate() -> Vector\n"
 			"Return a random point inside the box")},
-	{"intersect", (PyCFunction)AABoxDomain_intersect, METH_VARARGS,
+	{"intersect", (PyCFunction)Domain_intersect, METH_VARARGS,
 		PyDoc_STR("intersect(seg_start, seg_end) -> point, normal\n"
 			"Intersect the line segment with the box return the first\n"
 			"intersection point and normal vector pointing into space from\n"
 			"the box side intersected.\n\n"
 			"If the line does not intersect, or lies completely in one side\n"
 			"of the box return (None, None)")},
+	{"closest_point_to", (PyCFunction)Domain_closest_point_to, METH_VARARGS,
+		PyDoc_STR("closest_point_to(point) -> point, normal\n"
+			"Returns the closest point in the box to the supplied\n"
+			"point, and a null normal if the point is inside the box")},
+	DOMAIN_GENERATE_MANY_METHOD
+	DOMAIN_QUERY_MANY_METHODS
 	{NULL,		NULL}		/* sentinel */
 };
 
@@ -746,7 +1282,7 @@ static PySequenceMethods AABoxDomain_as_sequence = {
 	0,		/* sq_slice */
 	0,		/* sq_ass_item */
 	0,	    /* sq_ass_slice */
-	(objobjproc)AABoxDomain_contains,	/* sq_contains */
+	(objobjproc)Domain_contains,	/* sq_contains */
 };
 
 PyDoc_STRVAR(AABoxDomain__doc__,
@@ -834,78 +1370,49 @@ SphereDomain_init(SphereDomainObject *self, PyObject *args)
 	return 0;
 }
 
-static PyObject *
-SphereDomain_generate(SphereDomainObject *self)
+static void
+Sphere_generate(SphereDomainObject *self, Vec3 *point, RandState *rng)
 {
-	PyObject *x, *y, *z, *pt;
 	float dist, mag2;
-	Vec3 point;
 
 	/* Generate a random unit vector */
 	do {
-		point.x = rand_norm(0.0f, 1.0f);
-		point.y = rand_norm(0.0f, 1.0f);
-		point.z = rand_norm(0.0f, 1.0f);
-		mag2 = Vec3_len_sq(&point);
+		point->x = rand_state_norm(rng, 0.0f, 1.0f);
+		point->y = rand_state_norm(rng, 0.0f, 1.0f);
+		point->z = rand_state_norm(rng, 0.0f, 1.0f);
+		mag2 = Vec3_len_sq(point);
 	} while (mag2 < EPSILON);
-	Vec3_normalize(&point, &point);
+	Vec3_normalize(point, point);
 
-	dist = self->inner_radius + sqrtf(rand_uni()) * (
+	dist = self->inner_radius + sqrtf(rand_state_uni(rng)) * (
 		self->outer_radius - self->inner_radius);
-	Vec3_scalar_muli(&point, dist);
-
-	x = PyFloat_FromDouble(point.x + self->center.x);
-	y = PyFloat_FromDouble(point.y + self->center.y);
-	z = PyFloat_FromDouble(point.z + self->center.z);
-	if (x == NULL || y == NULL || z == NULL) {
-		Py_XDECREF(x);
-		Py_XDECREF(y);
-		Py_XDECREF(z);
-		return NULL;
-	}
-
-	pt = PyTuple_Pack(3, x, y, z);
-	Py_DECREF(x);
-	Py_DECREF(y);
-	Py_DECREF(z);
-	return pt;
+	Vec3_scalar_muli(point, dist);
+	Vec3_addi(point, &self->center);
 }
 
 static int
-SphereDomain_contains(SphereDomainObject *self, PyObject *pt)
+Sphere_contains(SphereDomainObject *self, Vec3 *point)
 {
-	Vec3 point, from_center;
+	Vec3 from_center;
 	float dist2;
 
-	pt = PySequence_Tuple(pt);
-	if (pt == NULL)
-		return -1;
-	if (!PyArg_ParseTuple(pt, "fff:__contains__",
-		&point.x, &point.y, &point.z)) {
-		Py_DECREF(pt);
-		return -1;
-	}
-	Py_DECREF(pt);
-
-	Vec3_sub(&from_center, &point, &self->center);
+	Vec3_sub(&from_center, point, &self->center);
 	dist2 = Vec3_len_sq(&from_center);
 	return ((dist2 <= self->outer_radius*self->outer_radius)
 		& (dist2 >= self->inner_radius*self->inner_radius));
 }
 
-static PyObject *
-SphereDomain_intersect(SphereDomainObject *self, PyObject *args)
+static int
+Sphere_intersect(SphereDomainObject *self, Vec3 *seg_start, Vec3 *seg_end,
+	Vec3 *point, Vec3 *norm)
 {
-	Vec3 start, end, seg, vec, norm;
+	Vec3 start, end, seg, vec;
 	float start_dist2, end_dist2, cmag2, r2, a, b, c, bb4ac, t1, t2, t;
 	float inner_r2 = self->inner_radius*self->inner_radius;
 	float outer_r2 = self->outer_radius*self->outer_radius;
 
-	if (!PyArg_ParseTuple(args, "(fff)(fff):intersect",
-		&start.x, &start.y, &start.z,
-		&end.x, &end.y, &end.z))
-		return NULL;
-
+	Vec3_copy(&start, seg_start);
+	Vec3_copy(&end, seg_end);
 	Vec3_sub(&vec, &start, &self->center);
 	start_dist2 = Vec3_len_sq(&vec);
 	Vec3_sub(&vec, &end, &self->center);
@@ -929,8 +1436,7 @@ SphereDomain_intersect(SphereDomainObject *self, PyObject *args)
 	if (((start_dist2 > outer_r2) & (end_dist2 > outer_r2))
 		| ((start_dist2 <= inner_r2) & (end_dist2 <= inner_r2))
 		| ((start.x == end.x) & (start.y == end.y) & (start.z == end.z))) {
-		Py_INCREF(NO_INTERSECTION);
-		return NO_INTERSECTION;
+		return 0;
 	}
 
 	cmag2 = Vec3_len_sq(&self->center);
@@ -957,8 +1463,7 @@ SphereDomain_intersect(SphereDomainObject *self, PyObject *args)
 			min(t1, t2);
 		// printf("t1 = %f, t2 = %f\n", t1, t2);
 	} else {
-		Py_INCREF(NO_INTERSECTION);
-		return NO_INTERSECTION;
+		return 0;
 	}
 	// printf("t = %f\n", t);
 	Vec3_scalar_muli(&seg, t);
@@ -967,15 +1472,16 @@ SphereDomain_intersect(SphereDomainObject *self, PyObject *args)
 	t = (start_dist2 <= r2) ? 1.0f : -1.0f;
 	Vec3_sub(&vec, &self->center, &end);
 	Vec3_scalar_muli(&vec, t);
-	Vec3_normalize(&norm, &vec);
-	return pack_vectors(&end, &norm);
+	Vec3_normalize(norm, &vec);
+	Vec3_copy(point, &end);
+	return 1;
 }
 
-static PyObject *
-SphereDomain_closest_point_to(SphereDomainObject *self, PyObject *args)
+static void
+Sphere_closest_pt_to(SphereDomainObject *self, Vec3 *pt,
+	Vec3 *closest, Vec3 *norm)
 {
-
-	Vec3 point, norm, vec;
+	Vec3 point, vec;
 	float dist2, inner_r2, outer_r2;
 
 	/* point: input point transformed to closest point on the sphere
@@ -983,10 +1489,7 @@ SphereDomain_closest_point_to(SphereDomainObject *self, PyObject *args)
 	   vec: vector between point and center
 		     then scaled to become vector between point and closest */
 
-	if (!PyArg_ParseTuple(args, "(fff):closest_point_to",
-		&point.x, &point.y, &point.z))
-		return NULL;
-
+	Vec3_copy(&point, pt);
 	inner_r2 = self->inner_radius*self->inner_radius;
 	outer_r2 = self->outer_radius*self->outer_radius;
 	Vec3_sub(&vec, &point, &self->center);
@@ -994,39 +1497,136 @@ SphereDomain_closest_point_to(SphereDomainObject *self, PyObject *args)
 
 	if (dist2 > outer_r2) {
 		/* common case,  point outside sphere */
-		Vec3_normalize(&norm, &vec);
-		Vec3_copy(&vec, &norm);
+		Vec3_normalize(norm, &vec);
+		Vec3_copy(&vec, norm);
 		Vec3_scalar_muli(&vec, self->outer_radius);
 		Vec3_add(&point, &vec, &self->center);
-    } else if ((dist2 < inner_r2) & (dist2 > EPSILON)) {
+	} else if ((dist2 < inner_r2) & (dist2 > EPSILON)) {
 		/* point inside the inner radius */
-		Vec3_normalize(&norm, &vec);
-		Vec3_copy(&vec, &norm);
+		Vec3_normalize(norm, &vec);
+		Vec3_copy(&vec, norm);
 		Vec3_scalar_muli(&vec, self->inner_radius);
 		Vec3_add(&point, &vec, &self->center);
-		Vec3_neg(&norm, &norm);
+		Vec3_neg(norm, norm);
 	} else {
 		/* point inside sphere volume or at dead center */
-		norm.x = norm.y = norm.z = 0.0f;
+		norm->x = norm->y = norm->z = 0.0f;
+	}
+	Vec3_copy(closest, &point);
+}
+
+static void
+Sphere_contains_many(SphereDomainObject *self, const float *points,
+	Py_ssize_t stride, Py_ssize_t n, unsigned char *mask)
+{
+	const float cx = self->center.x, cy = self->center.y, cz = self->center.z;
+	const float inner_r2 = self->inner_radius*self->inner_radius;
+	const float outer_r2 = self->outer_radius*self->outer_radius;
+	float dx, dy, dz, dist2;
+	Py_ssize_t i;
+
+	for (i = 0; i < n; i++) {
+		const float *p = points + i * stride;
+		dx = p[0] - cx;
+		dy = p[1] - cy;
+		dz = p[2] - cz;
+		dist2 = dx*dx + dy*dy + dz*dz;
+		mask[i] = (dist2 <= outer_r2) & (dist2 >= inner_r2);
+	}
+}
+
+static void
+Sphere_may_intersect_many(SphereDomainObject *self,
+	const float *starts, Py_ssize_t start_stride,
+	const float *ends, Py_ssize_t end_stride,
+	Py_ssize_t n, unsigned char *mask)
+{
+	const float cx = self->center.x, cy = self->center.y, cz = self->center.z;
+	/* Slack covering the rounding of intersect() */
+	const float m = EPSILON + self->outer_radius*self->outer_radius * 1e-5f;
+	const float outer_r2 = self->outer_radius*self->outer_radius + m;
+	const float inner_r2 = self->inner_radius*self->inner_radius - m;
+	float sx, sy, sz, vx, vy, vz, mag2, dot, start_d2, end_d2;
+	int misses, hollow;
+	Py_ssize_t i;
+
+	for (i = 0; i < n; i++) {
+		const float *s = starts + i * start_stride;
+		const float *e = ends + i * end_stride;
+		sx = s[0] - cx;
+		sy = s[1] - cy;
+		sz = s[2] - cz;
+		vx = e[0] - s[0];
+		vy = e[1] - s[1];
+		vz = e[2] - s[2];
+		start_d2 = sx*sx + sy*sy + sz*sz;
+		end_d2 = (sx + vx)*(sx + vx) + (sy + vy)*(sy + vy) + (sz + vz)*(sz + vz);
+		mag2 = vx*vx + vy*vy + vz*vz;
+		dot = sx*vx + sy*vy + sz*vz;
+		/* The segment misses the sphere if both ends are outside it, and the
+		 * point of the line closest to the center is either outside it too,
+		 * or beyond the ends. Compared without dividing or branching */
+		misses = (start_d2 > outer_r2) & (end_d2 > outer_r2)
+			& (((start_d2 - outer_r2) * mag2 > dot*dot)
+				| (dot >= 0.0f) | (-dot >= mag2));
+		/* Segments in the hollow of the sphere never intersect it */
+		hollow = (start_d2 < inner_r2) & (end_d2 < inner_r2);
+		mask[i] = !(misses | hollow);
 	}
-	return pack_vectors(&point, &norm);
 }
 
+static void
+Sphere_bounds(SphereDomainObject *self, Vec3 *min, Vec3 *max)
+{
+	float r = self->outer_radius;
+
+	min->x = self->center.x - r;
+	min->y = self->center.y - r;
+	min->z = self->center.z - r;
+	max->x = self->center.x + r;
+	max->y = self->center.y + r;
+	max->z = self->center.z + r;
+}
+
+static float
+Sphere_volume(SphereDomainObject *self)
+{
+	return (float)(4.0 / 3.0 * M_PI) * (
+		self->outer_radius*self->outer_radius*self->outer_radius
+		- self->inner_radius*self->inner_radius*self->inner_radius);
+}
+
+static DomainNative SphereDomain_native = {
+	(void (*)(PyObject *, Vec3 *, RandState *))Sphere_generate,
+	(int (*)(PyObject *, Vec3 *))Sphere_contains,
+	(int (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *, Vec3 *))Sphere_intersect,
+	(void (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *))Sphere_closest_pt_to,
+	"Sphere",
+	(void (*)(PyObject *, const float *, Py_ssize_t, Py_ssize_t,
+		unsigned char *))Sphere_contains_many,
+	(void (*)(PyObject *, const float *, Py_ssize_t, const float *,
+		Py_ssize_t, Py_ssize_t, unsigned char *))Sphere_may_intersect_many,
+	(void (*)(PyObject *, Vec3 *, Vec3 *))Sphere_bounds,
+	(float (*)(PyObject *))Sphere_volume
+};
+
 static PyMethodDef SphereDomain_methods[] = {
-	{"generate", (PyCFunction)SphereDomain_generate, METH_NOARGS,
+	{"generate", (PyCFunction)Domain_generate, METH_NOARGS,
 		PyDoc_STR("generate() -> Vector\n"
 			"Return a random point inside the sphere or spherical shell")},
-	{"intersect", (PyCFunction)SphereDomain_intersect, METH_VARARGS,
+	{"intersect", (PyCFunction)Domain_intersect, METH_VARARGS,
 		PyDoc_STR("intersect(seg_start, seg_end) -> point, normal\n"
 			"Intersect the line segment with the sphere and return the first\n"
 			"intersection point and normal vector pointing into space from\n"
 			"the sphere intersection point. If the sphere has an inner radius,\n"
 			"the intersection can occur on the inner or outer shell surface.\n\n"
 			"If the line does not intersect, return (None, None)")},
-	{"closest_point_to", (PyCFunction)SphereDomain_closest_point_to, METH_VARARGS,
+	{"closest_point_to", (PyCFunction)Domain_closest_point_to, METH_VARARGS,
 		PyDoc_STR("closest_point_to(point) -> point, normal\n"
 			"Returns the closest point on the sphere's surface\n"
 			"to the supplied point.")},
+	DOMAIN_GENERATE_MANY_METHOD
+	DOMAIN_QUERY_MANY_METHODS
 	{NULL,		NULL}		/* sentinel */
 };
 
@@ -1084,7 +1684,7 @@ static PySequenceMethods SphereDomain_as_sequence = {
 	0,		/* sq_slice */
 	0,		/* sq_ass_item */
 	0,	    /* sq_ass_slice */
-	(objobjproc)SphereDomain_contains,	/* sq_contains */
+	(objobjproc)Domain_contains,	/* sq_contains */
 };
 
 PyDoc_STRVAR(SphereDomain__doc__,
@@ -1206,7 +1806,8 @@ DiscDomain_init(DiscDomainObject *self, PyObject *args)
 /* Generate a random point in the disk specified */
 static inline void
 generate_point_in_disc(Vec3 *point, Vec3 *center,
-	float inner_radius, float outer_radius, Vec3 *up, Vec3 *right)
+	float inner_radius, float outer_radius, Vec3 *up, Vec3 *right,
+	RandState *rng)
 {
 	float x, y, mag, outer_diam, range;
 
@@ -1214,19 +1815,19 @@ generate_point_in_disc(Vec3 *point, Vec3 *center,
 		/* solid circle */
 		outer_diam = outer_radius * 2.0f;
 		do {
-			x = rand_uni() * outer_diam - outer_radius;
-			y = rand_uni() * outer_diam - outer_radius;
+			x = rand_state_uni(rng) * outer_diam - outer_radius;
+			y = rand_state_uni(rng) * outer_diam - outer_radius;
 		} while ((x*x) + (y*y) > outer_radius*outer_radius);
 	} else {
 		/* hollow disc or circular shell */
 		do {
-			x = rand_norm(0.0f, 1.0f);
-			y = rand_norm(0.0f, 1.0f);
+			x = rand_state_norm(rng, 0.0f, 1.0f);
+			y = rand_state_norm(rng, 0.0f, 1.0f);
 			mag = (x*x) + (y*y);
 		} while (mag < EPSILON);
 		range = (outer_radius - inner_radius) / outer_radius;
 		/* Unfortunately InvSqrt() is not precise enough for shells */
-		mag = (1.0f / sqrtf(mag)) * (sqrtf(rand_uni()) * range + (1.0f - range)) * outer_radius;
+		mag = (1.0f / sqrtf(mag)) * (sqrtf(rand_state_uni(rng)) * range + (1.0f - range)) * outer_radius;
 		x *= mag;
 		y *= mag;
 	}
@@ -1236,30 +1837,11 @@ generate_point_in_disc(Vec3 *point, Vec3 *center,
 	point->z = x*right->z + y*up->z + center->z;
 }
 
-static PyObject *
-DiscDomain_generate(DiscDomainObject *self)
+static void
+Disc_generate(DiscDomainObject *self, Vec3 *point, RandState *rng)
 {
-	PyObject *x, *y, *z, *pt;
-	Vec3 point;
-
-	generate_point_in_disc(&point, &self->center, self->inner_radius, self->outer_radius,
-		&self->up, &self->right);
-
-	x = PyFloat_FromDouble(point.x);
-	y = PyFloat_FromDouble(point.y);
-	z = PyFloat_FromDouble(point.z);
-	if (x == NULL || y == NULL || z == NULL) {
-		Py_XDECREF(x);
-		Py_XDECREF(y);
-		Py_XDECREF(z);
-		return NULL;
-	}
-
-	pt = PyTuple_Pack(3, x, y, z);
-	Py_DECREF(x);
-	Py_DECREF(y);
-	Py_DECREF(z);
-	return pt;
+	generate_point_in_disc(point, &self->center, self->inner_radius, self->outer_radius,
+		&self->up, &self->right, rng);
 }
 
 static inline int
@@ -1296,25 +1878,16 @@ disc_intersect(Vec3 *sect_pt, Vec3 *sect_norm,
 	return 0;
 }
 
-static PyObject *
-DiscDomain_intersect(DiscDomainObject *self, PyObject *args)
+static int
+Disc_intersect(DiscDomainObject *self, Vec3 *start, Vec3 *end,
+	Vec3 *point, Vec3 *normal)
 {
-	Vec3 start, end, vec, point, normal;
-
-	if (!PyArg_ParseTuple(args, "(fff)(fff):intersect",
-		&start.x, &start.y, &start.z,
-		&end.x, &end.y, &end.z))
-		return NULL;
+	Vec3 vec;
 
-	Vec3_sub(&vec, &end, &start);
-	if (!disc_intersect(&point, &normal, &self->center, &self->normal, self->d,
+	Vec3_sub(&vec, end, start);
+	return disc_intersect(point, normal, &self->center, &self->normal, self->d,
 		self->inner_radius*self->inner_radius, self->outer_radius*self->outer_radius,
-		&start, &vec)) {
-		Py_INCREF(NO_INTERSECTION);
-		return NO_INTERSECTION;
-	} else {
-		return pack_vectors(&point, &normal);
-	}
+		start, &vec);
 }
 
 static inline void
@@ -1358,35 +1931,31 @@ disc_closest_pt_to(Vec3 *closest, Vec3 *norm,
 	}
 }
 
-static PyObject *
-DiscDomain_closest_point_to(DiscDomainObject *self, PyObject *args)
+static void
+Disc_closest_pt_to(DiscDomainObject *self, Vec3 *point,
+	Vec3 *closest, Vec3 *norm)
 {
-	Vec3 point, closest, norm;
-
-	if (!PyArg_ParseTuple(args, "(fff):closest_point_to",
-		&point.x, &point.y, &point.z))
-		return NULL;
-
-	disc_closest_pt_to(&closest, &norm, &self->center, &self->normal,
-		self->inner_radius, self->outer_radius, &point);
-	return pack_vectors(&closest, &norm);
+	disc_closest_pt_to(closest, norm, &self->center, &self->normal,
+		self->inner_radius, self->outer_radius, point);
 }
 
 static PyMethodDef DiscDomain_methods[] = {
-	{"generate", (PyCFunction)DiscDomain_generate, METH_NOARGS,
+	{"generate", (PyCFunction)Domain_generate, METH_NOARGS,
 		PyDoc_STR("generate() -> Vector\n"
 			"Return a random point in the disc")},
-	{"intersect", (PyCFunction)DiscDomain_intersect, METH_VARARGS,
+	{"intersect", (PyCFunction)Domain_intersect, METH_VARARGS,
 		PyDoc_STR("intersect(seg_start, seg_end) -> point, normal\n"
 			"Intersect the line segment with the disc return the intersection\n"
 			"point and normal vector pointing into space on the same side of the\n"
 			"disc as the start point.\n\n"
 			"If the line does not intersect, or lies completely in the disc\n"
 			"return (None, None)")},
-	{"closest_point_to", (PyCFunction)DiscDomain_closest_point_to, METH_VARARGS,
+	{"closest_point_to", (PyCFunction)Domain_closest_point_to, METH_VARARGS,
 		PyDoc_STR("closest_point_to(point) -> point, normal\n"
 			"Returns the closest point on the disc's surface\n"
 			"to the supplied point.")},
+	DOMAIN_GENERATE_MANY_METHOD
+	DOMAIN_QUERY_MANY_METHODS
 	{NULL,		NULL}		/* sentinel */
 };
 
@@ -1407,21 +1976,12 @@ static PyGetSetDef DiscDomain_descriptors[] = {
 };
 
 static int
-DiscDomain_contains(DiscDomainObject *self, PyObject *pt)
+Disc_contains(DiscDomainObject *self, Vec3 *point)
 {
-	Vec3 point, from_center;
+	Vec3 from_center;
 	float inner_r2, outer_r2, dist2;
 
-	pt = PySequence_Tuple(pt);
-	if (pt == NULL)
-		return -1;
-	if (!PyArg_ParseTuple(pt, "fff:__contains__", &point.x, &point.y, &point.z)) {
-		Py_DECREF(pt);
-		return -1;
-	}
-	Py_DECREF(pt);
-
-	Vec3_sub(&from_center, &point, &self->center);
+	Vec3_sub(&from_center, point, &self->center);
 	if (fabs(Vec3_dot(&from_center, &self->normal)) < EPSILON) {
 		/* point is coplanar to disc */
 		outer_r2 = self->outer_radius*self->outer_radius;
@@ -1432,6 +1992,31 @@ DiscDomain_contains(DiscDomainObject *self, PyObject *pt)
 	return 0;
 }
 
+static void
+Disc_bounds(DiscDomainObject *self, Vec3 *min, Vec3 *max)
+{
+	float r = self->outer_radius;
+
+	min->x = self->center.x - r;
+	min->y = self->center.y - r;
+	min->z = self->center.z - r;
+	max->x = self->center.x + r;
+	max->y = self->center.y + r;
+	max->z = self->center.z + r;
+}
+
+static DomainNative DiscDomain_native = {
+	(void (*)(PyObject *, Vec3 *, RandState *))Disc_generate,
+	(int (*)(PyObject *, Vec3 *))Disc_contains,
+	(int (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *, Vec3 *))Disc_intersect,
+	(void (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *))Disc_closest_pt_to,
+	"Disc",
+	NULL,
+	NULL,
+	(void (*)(PyObject *, Vec3 *, Vec3 *))Disc_bounds,
+	NULL
+};
+
 static PySequenceMethods DiscDomain_as_sequence = {
 	0,		/* sq_length */
 	0,		/* sq_concat */
@@ -1440,7 +2025,7 @@ static PySequenceMethods DiscDomain_as_sequence = {
 	0,		/* sq_slice */
 	0,		/* sq_ass_item */
 	0,	    /* sq_ass_slice */
-	(objobjproc)DiscDomain_contains,	/* sq_contains */
+	(objobjproc)Domain_contains,	/* sq_contains */
 };
 
 PyDoc_STRVAR(DiscDomain__doc__,
@@ -1551,48 +2136,30 @@ CylinderDomain_init(CylinderDomainObject *self, PyObject *args)
 	return CylinderDomain_setup_rot(self);
 }
 
-static PyObject *
-CylinderDomain_generate(CylinderDomainObject *self)
+static void
+Cylinder_generate(CylinderDomainObject *self, Vec3 *point, RandState *rng)
 {
-	PyObject *x, *y, *z, *pt;
-	Vec3 center, point;
+	Vec3 center;
 	float d;
 
 	Vec3_sub(&center, &self->end_point1, &self->end_point0);
-	d = rand_uni();
+	d = rand_state_uni(rng);
 	Vec3_scalar_muli(&center, d);
 	Vec3_addi(&center, &self->end_point0);
-	generate_point_in_disc(&point, &center, self->inner_radius, self->outer_radius,
-		&self->up, &self->right);
-
-	x = PyFloat_FromDouble(point.x);
-	y = PyFloat_FromDouble(point.y);
-	z = PyFloat_FromDouble(point.z);
-	if (x == NULL || y == NULL || z == NULL) {
-		Py_XDECREF(x);
-		Py_XDECREF(y);
-		Py_XDECREF(z);
-		return NULL;
-	}
-
-	pt = PyTuple_Pack(3, x, y, z);
-	Py_DECREF(x);
-	Py_DECREF(y);
-	Py_DECREF(z);
-	return pt;
+	generate_point_in_disc(point, &center, self->inner_radius, self->outer_radius,
+		&self->up, &self->right, rng);
 }
 
-static PyObject *
-CylinderDomain_intersect(CylinderDomainObject *self, PyObject *args)
+static int
+Cylinder_intersect(CylinderDomainObject *self, Vec3 *seg_start, Vec3 *seg_end,
+	Vec3 *point, Vec3 *normal)
 {
 	Vec3 start, end, to_start, seg, tmp, xa, xb, norm, tp, tn;
 	float inner_r2, outer_r2, r2, d2, dir, a, b, c, bb4ac, t, t1, t2;
 	int collided = 0;
 
-	if (!PyArg_ParseTuple(args, "(fff)(fff):intersect",
-		&start.x, &start.y, &start.z,
-		&end.x, &end.y, &end.z))
-		return NULL;
+	Vec3_copy(&start, seg_start);
+	Vec3_copy(&end, seg_end);
 
 	/* The assumed common-case here is no intersection, so we are
 	   optimizing for that case. The idea is to cheaply see if
@@ -1620,8 +2187,7 @@ CylinderDomain_intersect(CylinderDomainObject *self, PyObject *args)
 
 	if ((fabs(a - self->outer_radius) > b) & (fabs(a - self->inner_radius) > b)) {
 		/* No chance of intersection */
-		Py_INCREF(NO_INTERSECTION);
-		return NO_INTERSECTION;
+		return 0;
 	} else if (a >= self->outer_radius) {
 		r2 = outer_r2;
 		dir = 1.0f;
@@ -1697,15 +2263,13 @@ CylinderDomain_intersect(CylinderDomainObject *self, PyObject *args)
 		// printf("t1 = %f, t2 = %f\n", t1, t2);
 	} else if (collided) {
 		/* collided only against an end cap */
-		return pack_vectors(&end, &norm);
+		return sect_result(point, normal, &end, &norm);
 	} else {
-		Py_INCREF(NO_INTERSECTION);
-		return NO_INTERSECTION;
+		return 0;
 	}
 	if ((t < 0.0f) | (t > 1.0f)) {
 		/* intersection point not in segment */
-		Py_INCREF(NO_INTERSECTION);
-		return NO_INTERSECTION;
+		return 0;
 	}
 	// printf("t = %f\n", t);
 	Vec3_scalar_muli(&seg, t);
@@ -1722,7 +2286,7 @@ CylinderDomain_intersect(CylinderDomainObject *self, PyObject *args)
 			Vec3_sub(&tmp, &tp, &start);
 			if (d2 <= Vec3_len_sq(&tmp)) {
 				/* Other collisions were closer */
-				return pack_vectors(&end, &norm);
+				return sect_result(point, normal, &end, &norm);
 			}
 		}
 		Vec3_scalar_mul(&tmp, &self->axis_norm, t);
@@ -1730,38 +2294,36 @@ CylinderDomain_intersect(CylinderDomainObject *self, PyObject *args)
 		Vec3_sub(&norm, &tp, &tmp);
 		Vec3_scalar_muli(&norm, dir);
 		Vec3_normalize(&norm, &norm);
-		return pack_vectors(&tp, &norm);
+		return sect_result(point, normal, &tp, &norm);
 	}
 	if (collided) {
-		return pack_vectors(&end, &norm);
+		return sect_result(point, normal, &end, &norm);
 	}
-	Py_INCREF(NO_INTERSECTION);
-	return NO_INTERSECTION;
+	return 0;
 }
 
-static PyObject *
-CylinderDomain_closest_point_to(CylinderDomainObject *self, PyObject *args)
+static void
+Cylinder_closest_pt_to(CylinderDomainObject *self, Vec3 *pt,
+	Vec3 *result, Vec3 *norm)
 {
-	Vec3 point, closest, norm, tp, vec;
+	Vec3 point, closest, tp, vec;
 	float inner_r2, outer_r2, dist2;
 	float t;
 
-	if (!PyArg_ParseTuple(args, "(fff):closest_point_to",
-		&point.x, &point.y, &point.z))
-		return NULL;
+	Vec3_copy(&point, pt);
 
 	/* find the closest point along the axis */
 	Vec3_sub(&tp, &point, &self->end_point0);
 	t = Vec3_dot(&tp, &self->axis) / self->len_sq;
 	if (t < 0.0f) {
 		/* closest to cap at end point 0 */
-		disc_closest_pt_to(&point, &norm,
+		disc_closest_pt_to(&point, norm,
 			&self->end_point0,  &self->axis_norm,
 			self->inner_radius, self->outer_radius,
 			&point);
 	} else if (t > 1.0f) {
 		/* closest to cap at end point 1 */
-		disc_closest_pt_to(&point, &norm,
+		disc_closest_pt_to(&point, norm,
 			&self->end_point1,  &self->axis_norm,
 			self->inner_radius, self->outer_radius,
 			&point);
@@ -1775,23 +2337,23 @@ CylinderDomain_closest_point_to(CylinderDomainObject *self, PyObject *args)
 		dist2 = Vec3_len_sq(&vec);
 		if (dist2 > outer_r2) {
 			/* common case,  point outside cylinder */
-			Vec3_normalize(&norm, &vec);
-			Vec3_copy(&vec, &norm);
+			Vec3_normalize(norm, &vec);
+			Vec3_copy(&vec, norm);
 			Vec3_scalar_muli(&vec, self->outer_radius);
 			Vec3_add(&point, &vec, &closest);
 		} else if ((dist2 < inner_r2) & (dist2 > EPSILON)) {
 			/* point inside the inner radius */
-			Vec3_normalize(&norm, &vec);
-			Vec3_copy(&vec, &norm);
+			Vec3_normalize(norm, &vec);
+			Vec3_copy(&vec, norm);
 			Vec3_scalar_muli(&vec, self->inner_radius);
 			Vec3_add(&point, &vec, &closest);
-			Vec3_neg(&norm, &norm);
+			Vec3_neg(norm, norm);
 		} else {
 			/* point inside cylinder volume or along axis */
-			norm.x = norm.y = norm.z = 0.0f;
+			norm->x = norm->y = norm->z = 0.0f;
 		}
 	}
-	return pack_vectors(&point, &norm);
+	Vec3_copy(result, &point);
 }
 
 static int Cylinder_set_end_point0(CylinderDomainObject *self, PyObject *value, void *closure)
@@ -1819,20 +2381,22 @@ static int Cylinder_set_end_point1(CylinderDomainObject *self, PyObject *value,
 }
 
 static PyMethodDef CylinderDomain_methods[] = {
-	{"generate", (PyCFunction)CylinderDomain_generate, METH_NOARGS,
+	{"generate", (PyCFunction)Domain_generate, METH_NOARGS,
 		PyDoc_STR("generate() -> Vector\n"
 			"Return a random point in the cylinder volume")},
-	{"intersect", (PyCFunction)CylinderDomain_intersect, METH_VARARGS,
+	{"intersect", (PyCFunction)Domain_intersect, METH_VARARGS,
 		PyDoc_STR("intersect(seg_start, seg_end) -> point, normal\n"
 			"Intersect the line segment with the cylinder return the intersection\n"
 			"point and normal vector pointing into space on the same side of the\n"
 			"surface as the start point.\n\n"
 			"If the line does not intersect, or lies completely in the cylinder\n"
 			"return (None, None)")},
-	{"closest_point_to", (PyCFunction)CylinderDomain_closest_point_to, METH_VARARGS,
+	{"closest_point_to", (PyCFunction)Domain_closest_point_to, METH_VARARGS,
 		PyDoc_STR("closest_point_to(point) -> point, normal\n"
 			"Returns the closest point on the cylinder's surface\n"
 			"to the supplied point.")},
+	DOMAIN_GENERATE_MANY_METHOD
+	DOMAIN_QUERY_MANY_METHODS
 	{NULL,		NULL}		/* sentinel */
 };
 
@@ -1855,23 +2419,14 @@ static PyGetSetDef CylinderDomain_descriptors[] = {
 };
 
 static int
-CylinderDomain_contains(CylinderDomainObject *self, PyObject *pt)
+Cylinder_contains(CylinderDomainObject *self, Vec3 *point)
 {
-	Vec3 point, from_end, tmp;
+	Vec3 from_end, tmp;
 	float inner_r2, outer_r2, dist2, c;
 
-	pt = PySequence_Tuple(pt);
-	if (pt == NULL)
-		return -1;
-	if (!PyArg_ParseTuple(pt, "fff:__contains__", &point.x, &point.y, &point.z)) {
-		Py_DECREF(pt);
-		return -1;
-	}
-	Py_DECREF(pt);
-
 	inner_r2 = self->inner_radius*self->inner_radius;
 	outer_r2 = self->outer_radius*self->outer_radius;
-	Vec3_sub(&from_end, &point, &self->end_point0);
+	Vec3_sub(&from_end, point, &self->end_point0);
 	Vec3_cross(&tmp, &self->axis, &from_end);
 	dist2 = Vec3_len_sq(&tmp) / self->len_sq; /* sq distance from point to axis */
 	c = Vec3_dot(&self->axis_norm, &from_end);
@@ -1879,6 +2434,39 @@ CylinderDomain_contains(CylinderDomainObject *self, PyObject *pt)
 		& (c >= 0.0f) & (c <= self->len);
 }
 
+static void
+Cylinder_bounds(CylinderDomainObject *self, Vec3 *min, Vec3 *max)
+{
+	float r = self->outer_radius;
+
+	min->x = fminf(self->end_point0.x, self->end_point1.x) - r;
+	min->y = fminf(self->end_point0.y, self->end_point1.y) - r;
+	min->z = fminf(self->end_point0.z, self->end_point1.z) - r;
+	max->x = fmaxf(self->end_point0.x, self->end_point1.x) + r;
+	max->y = fmaxf(self->end_point0.y, self->end_point1.y) + r;
+	max->z = fmaxf(self->end_point0.z, self->end_point1.z) + r;
+}
+
+static float
+Cylinder_volume(CylinderDomainObject *self)
+{
+	return (float)M_PI * self->len * (
+		self->outer_radius*self->outer_radius
+		- self->inner_radius*self->inner_radius);
+}
+
+static DomainNative CylinderDomain_native = {
+	(void (*)(PyObject *, Vec3 *, RandState *))Cylinder_generate,
+	(int (*)(PyObject *, Vec3 *))Cylinder_contains,
+	(int (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *, Vec3 *))Cylinder_intersect,
+	(void (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *))Cylinder_closest_pt_to,
+	"Cylinder",
+	NULL,
+	NULL,
+	(void (*)(PyObject *, Vec3 *, Vec3 *))Cylinder_bounds,
+	(float (*)(PyObject *))Cylinder_volume
+};
+
 static PySequenceMethods CylinderDomain_as_sequence = {
 	0,		/* sq_length */
 	0,		/* sq_concat */
@@ -1887,7 +2475,7 @@ static PySequenceMethods CylinderDomain_as_sequence = {
 	0,		/* sq_slice */
 	0,		/* sq_ass_item */
 	0,	    /* sq_ass_slice */
-	(objobjproc)CylinderDomain_contains,	/* sq_contains */
+	(objobjproc)Domain_contains,	/* sq_contains */
 };
 
 PyDoc_STRVAR(CylinderDomain__doc__,
@@ -2020,35 +2608,18 @@ ConeDomain_init(ConeDomainObject *self, PyObject *args)
 	return ConeDomain_setup_rot(self);
 }
 
-static PyObject *
-ConeDomain_generate(ConeDomainObject *self)
+static void
+Cone_generate(ConeDomainObject *self, Vec3 *point, RandState *rng)
 {
-	PyObject *x, *y, *z, *pt;
-	Vec3 center, point;
+	Vec3 center;
 	float d;
 
 	Vec3_copy(&center, &self->axis);
-	d = sqrtf(rand_uni());
+	d = sqrtf(rand_state_uni(rng));
 	Vec3_scalar_muli(&center, d);
 	Vec3_addi(&center, &self->apex);
-	generate_point_in_disc(&point, &center, self->inner_radius*d, self->outer_radius*d,
-		&self->up, &self->right);
-
-	x = PyFloat_FromDouble(point.x);
-	y = PyFloat_FromDouble(point.y);
-	z = PyFloat_FromDouble(point.z);
-	if (x == NULL || y == NULL || z == NULL) {
-		Py_XDECREF(x);
-		Py_XDECREF(y);
-		Py_XDECREF(z);
-		return NULL;
-	}
-
-	pt = PyTuple_Pack(3, x, y, z);
-	Py_DECREF(x);
-	Py_DECREF(y);
-	Py_DECREF(z);
-	return pt;
+	generate_point_in_disc(point, &center, self->inner_radius*d, self->outer_radius*d,
+		&self->up, &self->right, rng);
 }
 
 /* Set point to the point on the segment at t
@@ -2147,18 +2718,17 @@ cone_intersect(Vec3 *sect_pt, Vec3 *sect_norm,
 	return 1;
 }
 
-static PyObject *
-ConeDomain_intersect(ConeDomainObject *self, PyObject *args)
+static int
+Cone_intersect(ConeDomainObject *self, Vec3 *seg_start, Vec3 *seg_end,
+	Vec3 *point, Vec3 *normal)
 {
 	Vec3 start, end, to_start, seg, seg_norm, tmp, norm, tp, tn;
 	float d2, a, b, t2, seg_len;
 	float dir = 1.0f;
 	int collided = 0;
 
-	if (!PyArg_ParseTuple(args, "(fff)(fff):intersect",
-		&start.x, &start.y, &start.z,
-		&end.x, &end.y, &end.z))
-		return NULL;
+	Vec3_copy(&start, seg_start);
+	Vec3_copy(&end, seg_end);
 
 	/* figure out where the start point is in relation to the
 	   cone volume. It's either outside the outer cone, inside the
@@ -2218,28 +2788,25 @@ ConeDomain_intersect(ConeDomainObject *self, PyObject *args)
 			}
 		}
 	} else {
-		Py_INCREF(NO_INTERSECTION);
-		return NO_INTERSECTION;
+		return 0;
 	}
 	if (collided) {
 		// printf("dir=%f\n", dir);
 		Vec3_scalar_muli(&norm, dir);
-		return pack_vectors(&end, &norm);
+		return sect_result(point, normal, &end, &norm);
 	} else {
-		Py_INCREF(NO_INTERSECTION);
-		return NO_INTERSECTION;
+		return 0;
 	}
 }
 
-static PyObject *
-ConeDomain_closest_point_to(ConeDomainObject *self, PyObject *args)
+static void
+Cone_closest_pt_to(ConeDomainObject *self, Vec3 *pt,
+	Vec3 *result, Vec3 *norm)
 {
-	Vec3 point, closest, norm, tp, vec, vec_norm;
+	Vec3 point, closest, tp, vec, vec_norm;
 	float d, t, r, c, dir, h;
 
-	if (!PyArg_ParseTuple(args, "(fff):closest_point_to",
-		&point.x, &point.y, &point.z))
-		return NULL;
+	Vec3_copy(&point, pt);
 
 	/* General algorithm:
 
@@ -2271,22 +2838,27 @@ ConeDomain_closest_point_to(ConeDomainObject *self, PyObject *args)
 		dir = -1.0f;
 	} else if ((d <= -self->outer_cosa) | (t < EPSILON)) {
 		/* point far "behind" apex or on axis behind apex */
-		Vec3_neg(&norm, &self->axis_norm);
-		return pack_vectors(&self->apex, &norm);
+		Vec3_neg(norm, &self->axis_norm);
+		Vec3_copy(result, &self->apex);
+		return;
 	} else if ((d > self->inner_cosa) & (d >= 1.0f - EPSILON)) {
 		/* point on axis beyond apex */
-		return pack_vectors(&self->apex, &self->axis_norm);
+		Vec3_copy(result, &self->apex);
+		Vec3_copy(norm, &self->axis_norm);
+		return;
 	} else if ((t > -EPSILON) & (t < 1.0f + EPSILON)) {
 		/* point within cone volume */
-		norm.x = norm.y = norm.z = 0.0f;
-		return pack_vectors(&point, &norm);
+		norm->x = norm->y = norm->z = 0.0f;
+		Vec3_copy(result, &point);
+		return;
 	} else {
 		/* point beyond base between inner and outer radii */
-		disc_closest_pt_to(&point, &norm,
+		disc_closest_pt_to(&point, norm,
 			&self->base,  &self->axis_norm,
 			self->inner_radius, self->outer_radius,
 			&point);
-		return pack_vectors(&point, &norm);
+		Vec3_copy(result, &point);
+		return;
 	}
 
 	if (fabs(t) > EPSILON) {
@@ -2319,17 +2891,18 @@ ConeDomain_closest_point_to(ConeDomainObject *self, PyObject *args)
 	if (Vec3_len_sq(&vec) < (h*h) + EPSILON) {
 		/* point is between apex and base */
 		Vec3_add(&closest, &self->apex, &vec);
-		Vec3_sub(&norm, &point, &closest);
-		Vec3_normalize(&norm, &norm);
-		Vec3_scalar_muli(&norm, dir);
-		return pack_vectors(&closest, &norm);
+		Vec3_sub(norm, &point, &closest);
+		Vec3_normalize(norm, norm);
+		Vec3_scalar_muli(norm, dir);
+		Vec3_copy(result, &closest);
+		return;
 	}
 	/* point beyond base */
-	disc_closest_pt_to(&point, &norm,
+	disc_closest_pt_to(&point, norm,
 		&self->base,  &self->axis_norm,
 		self->inner_radius, self->outer_radius,
 		&point);
-	return pack_vectors(&point, &norm);
+	Vec3_copy(result, &point);
 }
 
 
@@ -2418,20 +2991,22 @@ Cone_get_outer_radius(ConeDomainObject *self, void *closure)
 }
 
 static PyMethodDef ConeDomain_methods[] = {
-	{"generate", (PyCFunction)ConeDomain_generate, METH_NOARGS,
+	{"generate", (PyCFunction)Domain_generate, METH_NOARGS,
 		PyDoc_STR("generate() -> Vector\n"
 			"Return a random point in the cylinder volume")},
-	{"intersect", (PyCFunction)ConeDomain_intersect, METH_VARARGS,
+	{"intersect", (PyCFunction)Domain_intersect, METH_VARARGS,
 		PyDoc_STR("intersect(seg_start, seg_end) -> point, normal\n"
 			"Intersect the line segment with the cylinder return the intersection\n"
 			"point and normal vector pointing into space on the same side of the\n"
 			"surface as the start point.\n\n"
 			"If the line does not intersect, or lies completely in the cylinder\n"
 			"return (None, None)")},
-	{"closest_point_to", (PyCFunction)ConeDomain_closest_point_to, METH_VARARGS,
+	{"closest_point_to", (PyCFunction)Domain_closest_point_to, METH_VARARGS,
 		PyDoc_STR("closest_point_to(point) -> point, normal\n"
 			"Returns the closest point on the cone's surface\n"
 			"to the supplied point.")},
+	DOMAIN_GENERATE_MANY_METHOD
+	DOMAIN_QUERY_MANY_METHODS
 	{NULL,		NULL}		/* sentinel */
 };
 
@@ -2454,31 +3029,56 @@ static PyGetSetDef ConeDomain_descriptors[] = {
 };
 
 static int
-ConeDomain_contains(ConeDomainObject *self, PyObject *pt)
+Cone_contains(ConeDomainObject *self, Vec3 *point)
 {
-	Vec3 point, from_apex, from_base;
+	Vec3 from_apex, from_base;
 	float axis_cos, base_cos;
 	int at_apex;
 
-	pt = PySequence_Tuple(pt);
-	if (pt == NULL)
-		return -1;
-	if (!PyArg_ParseTuple(pt, "fff:__contains__", &point.x, &point.y, &point.z)) {
-		Py_DECREF(pt);
-		return -1;
-	}
-	Py_DECREF(pt);
-
-	Vec3_sub(&from_apex, &point, &self->apex);
+	Vec3_sub(&from_apex, point, &self->apex);
 	at_apex = !Vec3_normalize(&from_apex, &from_apex);
 	axis_cos = Vec3_dot(&from_apex, &self->axis_norm);
-	Vec3_sub(&from_base, &point, &self->base);
+	Vec3_sub(&from_base, point, &self->base);
 	base_cos = Vec3_dot(&from_base, &self->axis_norm);
 	return at_apex | ((axis_cos - self->inner_cosa < EPSILON)
 		& (self->outer_cosa - axis_cos < EPSILON)
 		& (base_cos <= 0.0f));
 }
 
+static void
+Cone_bounds(ConeDomainObject *self, Vec3 *min, Vec3 *max)
+{
+	float r = self->outer_radius;
+
+	min->x = fminf(self->apex.x, self->base.x - r);
+	min->y = fminf(self->apex.y, self->base.y - r);
+	min->z = fminf(self->apex.z, self->base.z - r);
+	max->x = fmaxf(self->apex.x, self->base.x + r);
+	max->y = fmaxf(self->apex.y, self->base.y + r);
+	max->z = fmaxf(self->apex.z, self->base.z + r);
+}
+
+static float
+Cone_volume(ConeDomainObject *self)
+{
+	/* The inner cone shares the apex and base plane */
+	return (float)(M_PI / 3.0) * self->len * (
+		self->outer_radius*self->outer_radius
+		- self->inner_radius*self->inner_radius);
+}
+
+static DomainNative ConeDomain_native = {
+	(void (*)(PyObject *, Vec3 *, RandState *))Cone_generate,
+	(int (*)(PyObject *, Vec3 *))Cone_contains,
+	(int (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *, Vec3 *))Cone_intersect,
+	(void (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *))Cone_closest_pt_to,
+	"Cone",
+	NULL,
+	NULL,
+	(void (*)(PyObject *, Vec3 *, Vec3 *))Cone_bounds,
+	(float (*)(PyObject *))Cone_volume
+};
+
 static PySequenceMethods ConeDomain_as_sequence = {
 	0,		/* sq_length */
 	0,		/* sq_concat */
@@ -2487,7 +3087,7 @@ static PySequenceMethods ConeDomain_as_sequence = {
 	0,		/* sq_slice */
 	0,		/* sq_ass_item */
 	0,	    /* sq_ass_slice */
-	(objobjproc)ConeDomain_contains,	/* sq_contains */
+	(objobjproc)Domain_contains,	/* sq_contains */
 };
 
 PyDoc_STRVAR(ConeDomain__doc__,
@@ -2546,48 +3146,2658 @@ static PyTypeObject ConeDomain_Type = {
 	0,                      /*tp_is_gc*/
 };
 
-MOD_INIT(_domain)
-{
-	PyObject *m;
-
-	/* Bind tp_new and tp_alloc here to appease certain compilers */
-	LineDomain_Type.tp_alloc = PyType_GenericAlloc;
-	LineDomain_Type.tp_new = PyType_GenericNew;
-	if (PyType_Ready(&LineDomain_Type) < 0)
-		return MOD_ERROR_VAL;
+/* --------------------------------------------------------------------- */
 
-	PlaneDomain_Type.tp_alloc = PyType_GenericAlloc;
-	PlaneDomain_Type.tp_new = PyType_GenericNew;
-	if (PyType_Ready(&PlaneDomain_Type) < 0)
-		return MOD_ERROR_VAL;
+/* Composite domains combine built-in child domains. Each child has a
+ * cached bounding box, tested before calling it. The boxes are computed
+ * when the composite is created and by refit()
+ */
 
-	AABoxDomain_Type.tp_alloc = PyType_GenericAlloc;
-	AABoxDomain_Type.tp_new = PyType_GenericNew;
-	if (PyType_Ready(&AABoxDomain_Type) < 0)
-		return MOD_ERROR_VAL;
+static PyTypeObject UnionDomain_Type;
+static PyTypeObject IntersectionDomain_Type;
+static PyTypeObject DifferenceDomain_Type;
 
-	SphereDomain_Type.tp_alloc = PyType_GenericAlloc;
-	SphereDomain_Type.tp_new = PyType_GenericNew;
-	if (PyType_Ready(&SphereDomain_Type) < 0)
-		return MOD_ERROR_VAL;
+/* Maximum number of points generated in a child domain before giving up
+ * on finding one in the composite */
+#define COMPOSITE_GENERATE_TRIES 64
 
-	DiscDomain_Type.tp_alloc = PyType_GenericAlloc;
-	DiscDomain_Type.tp_new = PyType_GenericNew;
-	if (PyType_Ready(&DiscDomain_Type) < 0)
-		return MOD_ERROR_VAL;
+typedef struct {
+	PyObject *domain;
+	DomainNative *native;
+	Vec3 min, max;	/* cached bounds */
+	float volume;
+} DomainChild;
 
-	CylinderDomain_Type.tp_alloc = PyType_GenericAlloc;
-	CylinderDomain_Type.tp_new = PyType_GenericNew;
-	if (PyType_Ready(&CylinderDomain_Type) < 0)
-		return MOD_ERROR_VAL;
+typedef struct {
+	PyObject_HEAD
+	PyObject *domains;	/* tuple of the child domains */
+	Py_ssize_t count;
+	DomainChild *children;
+	Vec3 min, max;	/* bounds of the composite */
+	float volume;	/* estimated volume of the composite */
+	Py_ssize_t generator;	/* index of the child generating points */
+} CompositeDomainObject;
+
+#define Composite_Check(op) \
+	(Py_TYPE(op) == &UnionDomain_Type \
+	 || Py_TYPE(op) == &IntersectionDomain_Type \
+	 || Py_TYPE(op) == &DifferenceDomain_Type)
+
+#define in_bounds(c, p) \
+	(((p)->x >= (c)->min.x) & ((p)->x <= (c)->max.x) \
+	 & ((p)->y >= (c)->min.y) & ((p)->y <= (c)->max.y) \
+	 & ((p)->z >= (c)->min.z) & ((p)->z <= (c)->max.z))
+
+/* Return true if the segment's bounding box overlaps those of c */
+#define seg_in_bounds(c, s, e) \
+	((fminf((s)->x, (e)->x) <= (c)->max.x) & (fmaxf((s)->x, (e)->x) >= (c)->min.x) \
+	 & (fminf((s)->y, (e)->y) <= (c)->max.y) & (fmaxf((s)->y, (e)->y) >= (c)->min.y) \
+	 & (fminf((s)->z, (e)->z) <= (c)->max.z) & (fmaxf((s)->z, (e)->z) >= (c)->min.z))
+
+static inline int
+child_contains(DomainChild *child, Vec3 *point)
+{
+	return in_bounds(child, point)
+		&& child->native->contains(child->domain, point);
+}
+
+/* Return the squared distance from point to the box from min to max */
+static inline float
+box_dist2(Vec3 *min, Vec3 *max, Vec3 *point)
+{
+	Vec3 vec;
+
+	vec.x = point->x - clamp(point->x, min->x, max->x);
+	vec.y = point->y - clamp(point->y, min->y, max->y);
+	vec.z = point->z - clamp(point->z, min->z, max->z);
+	return Vec3_len_sq(&vec);
+}
+
+static void Domain_refit(PyObject *domain);
+
+/* Recompute the cached bounds and volumes of the composite and its
+ * children, refitting children with cached bounds of their own first */
+static void
+Composite_refit(CompositeDomainObject *self)
+{
+	DomainChild *child;
+	Py_ssize_t i;
+
+	for (i = 0; i < self->count; i++) {
+		child = &self->children[i];
+		Domain_refit(child->domain);
+		if (child->native->bounds != NULL) {
+			child->native->bounds(child->domain, &child->min, &child->max);
+		} else {
+			child->min.x = child->min.y = child->min.z = -FLT_MAX;
+			child->max.x = child->max.y = child->max.z = FLT_MAX;
+		}
+		child->volume = child->native->volume != NULL ?
+			child->native->volume(child->domain) : 0.0f;
+	}
+
+	/* The union of the bounds for unions, their intersection for
+	 * intersections, and the bounds of the first child for differences */
+	child = &self->children[0];
+	Vec3_copy(&self->min, &child->min);
+	Vec3_copy(&self->max, &child->max);
+	self->volume = child->volume;
+	self->generator = 0;
+	for (i = 1; i < self->count; i++) {
+		child = &self->children[i];
+		if (Py_TYPE(self) == &UnionDomain_Type) {
+			self->min.x = fminf(self->min.x, child->min.x);
+			self->min.y = fminf(self->min.y, child->min.y);
+			self->min.z = fminf(self->min.z, child->min.z);
+			self->max.x = fmaxf(self->max.x, child->max.x);
+			self->max.y = fmaxf(self->max.y, child->max.y);
+			self->max.z = fmaxf(self->max.z, child->max.z);
+			self->volume += child->volume;
+		} else if (Py_TYPE(self) == &IntersectionDomain_Type) {
+			self->min.x = fmaxf(self->min.x, child->min.x);
+			self->min.y = fmaxf(self->min.y, child->min.y);
+			self->min.z = fmaxf(self->min.z, child->min.z);
+			self->max.x = fminf(self->max.x, child->max.x);
+			self->max.y = fminf(self->max.y, child->max.y);
+			self->max.z = fminf(self->max.z, child->max.z);
+			/* Generate in the smallest child, rejecting fewest points */
+			if (child->volume > 0.0f && (self->volume <= 0.0f
+				|| child->volume < self->volume)) {
+				self->volume = child->volume;
+				self->generator = i;
+			}
+		}
+	}
+}
+
+static int
+CompositeDomain_init(CompositeDomainObject *self, PyObject *args)
+{
+	DomainChild *child;
+	Py_ssize_t i;
+
+	if (self->children != NULL) {
+		/* Re-initializing could make the composite its own child */
+		PyErr_Format(PyExc_TypeError, "%s: already initialized",
+			Py_TYPE(self)->tp_name);
+		return -1;
+	}
+	if (PyTuple_GET_SIZE(args) < 1) {
+		PyErr_Format(PyExc_TypeError, "%s: expected at least one domain",
+			Py_TYPE(self)->tp_name);
+		return -1;
+	}
+	self->children = PyMem_Malloc(PyTuple_GET_SIZE(args) * sizeof(DomainChild));
+	if (self->children == NULL) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	self->count = PyTuple_GET_SIZE(args);
+	for (i = 0; i < self->count; i++) {
+		child = &self->children[i];
+		child->domain = PyTuple_GET_ITEM(args, i);
+		child->native = Domain_get_native(child->domain);
+		if (child->native == NULL) {
+			PyErr_Format(PyExc_TypeError,
+				"%s: expected built-in domains, got %s",
+				Py_TYPE(self)->tp_name, Py_TYPE(child->domain)->tp_name);
+			PyMem_Free(self->children);
+			self->children = NULL;
+			return -1;
+		}
+	}
+	Py_INCREF(args);
+	self->domains = args;
+	Composite_refit(self);
+	return 0;
+}
+
+static void
+CompositeDomain_dealloc(CompositeDomainObject *self)
+{
+	Py_CLEAR(self->domains);
+	PyMem_Free(self->children);
+	PyObject_Del(self);
+}
+
+static PyObject *
+CompositeDomain_refit(CompositeDomainObject *self)
+{
+	if (Domain_native((PyObject *)self) == NULL)
+		return NULL;
+	Composite_refit(self);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+CompositeDomain_get_domains(CompositeDomainObject *self, void *closure)
+{
+	if (self->domains == NULL)
+		return PyTuple_New(0);
+	Py_INCREF(self->domains);
+	return self->domains;
+}
+
+/* Composites created without calling __init__ have no children */
+static int
+Composite_initialized(CompositeDomainObject *self)
+{
+	return self->children != NULL;
+}
+
+static void
+Composite_bounds(CompositeDomainObject *self, Vec3 *min, Vec3 *max)
+{
+	Vec3_copy(min, &self->min);
+	Vec3_copy(max, &self->max);
+}
+
+static float
+Composite_volume(CompositeDomainObject *self)
+{
+	return self->volume;
+}
+
+/* Store in normal the unit vector from closest to point, or a zero vector
+ * if they are the same. The normals of composites point this way */
+static void
+Composite_normal(Vec3 *point, Vec3 *closest, Vec3 *normal)
+{
+	Vec3_sub(normal, point, closest);
+	if (Vec3_len_sq(normal) > EPSILON*EPSILON)
+		Vec3_normalize(normal, normal);
+	else
+		normal->x = normal->y = normal->z = 0.0f;
+}
+
+/* Return true if the point on the surface of child i is on the surface of
+ * the composite */
+typedef int (*CompositeSurfaceFunc)(CompositeDomainObject *self,
+	Py_ssize_t i, Vec3 *point);
+
+/* Intersect the segment with the surfaces of the children from its start,
+ * until a point on the surface of the composite is found. Points on the
+ * surface of a child but inside or outside the composite are passed over */
+static int
+Composite_intersect(CompositeDomainObject *self, Vec3 *start, Vec3 *end,
+	Vec3 *point, Vec3 *normal, CompositeSurfaceFunc on_surface)
+{
+	DomainChild *child;
+	Vec3 seg, seg_start, from_start, hit_pt, hit_norm, best_pt, best_norm;
+	float len2, nudge, t, t_min, best_t;
+	Py_ssize_t i, best, passes;
+
+	Vec3_sub(&seg, end, start);
+	len2 = Vec3_len_sq(&seg);
+	if (len2 <= 0.0f)
+		return 0;
+	/* Fraction of the segment to move past points not on the surface */
+	nudge = EPSILON * 10.0f / sqrtf(len2);
+	Vec3_copy(&seg_start, start);
+	best_norm.x = best_norm.y = best_norm.z = 0.0f;
+	t_min = -nudge;
+	for (passes = 0; passes <= self->count * 2; passes++) {
+		best = -1;
+		best_t = FLT_MAX;
+		for (i = 0; i < self->count; i++) {
+			child = &self->children[i];
+			if (!seg_in_bounds(child, &seg_start, end))
+				continue;
+			switch (child->native->intersect(child->domain, &seg_start, end,
+				&hit_pt, &hit_norm)) {
+			case 0:
+				continue;
+			case -1:
+				return -1;
+			}
+			/* Ignore hits outside of the rest of the segment */
+			Vec3_sub(&from_start, &hit_pt, start);
+			t = Vec3_dot(&from_start, &seg) / len2;
+			if ((t < t_min) | (t > 1.0f + nudge) | (t >= best_t))
+				continue;
+			best = i;
+			best_t = t;
+			Vec3_copy(&best_pt, &hit_pt);
+			Vec3_copy(&best_norm, &hit_norm);
+		}
+		if (best < 0)
+			return 0;
+		if (on_surface(self, best, &best_pt))
+			return sect_result(point, normal, &best_pt, &best_norm);
+		/* Continue from just past the hit */
+		t_min = best_t + nudge * 0.5f;
+		if (t_min >= 1.0f)
+			return 0;
+		Vec3_scalar_mul(&seg_start, &seg, best_t + nudge);
+		Vec3_addi(&seg_start, start);
+	}
+	return 0;
+}
+
+/* Store the closest point of child to point, skipping it if its bounds
+ * are further than best_dist2. Return the squared distance */
+static float
+Composite_child_closest(DomainChild *child, Vec3 *point, Vec3 *closest,
+	float best_dist2)
+{
+	Vec3 normal, vec;
+
+	if (box_dist2(&child->min, &child->max, point) >= best_dist2)
+		return FLT_MAX;
+	child->native->closest_point_to(child->domain, point, closest, &normal);
+	Vec3_sub(&vec, closest, point);
+	return Vec3_len_sq(&vec);
+}
+
+/* Union */
+
+static void
+Union_generate(CompositeDomainObject *self, Vec3 *point, RandState *rng)
+{
+	DomainChild *child = NULL;
+	float r;
+	int tries, inside;
+	Py_ssize_t i;
+
+	for (tries = 0; tries < COMPOSITE_GENERATE_TRIES; tries++) {
+		/* Pick a child weighted by volume, or any child without volumes */
+		if (self->volume > 0.0f) {
+			r = rand_state_uni(rng) * self->volume;
+			for (i = 0; i < self->count - 1; i++) {
+				r -= self->children[i].volume;
+				if (r <= 0.0f)
+					break;
+			}
+		} else {
+			i = (Py_ssize_t)(rand_state_uni(rng) * self->count);
+			i = min(i, self->count - 1);
+		}
+		child = &self->children[i];
+		child->native->generate(child->domain, point, rng);
+		/* Keep points in the overlap of n children with probability 1/n,
+		 * so that the points are spread evenly over the union */
+		inside = 0;
+		for (i = 0; i < self->count; i++)
+			inside += child_contains(&self->children[i], point);
+		if (inside <= 1 || rand_state_uni(rng) * inside <= 1.0f)
+			return;
+	}
+}
+
+static int
+Union_contains(CompositeDomainObject *self, Vec3 *point)
+{
+	Py_ssize_t i;
+
+	for (i = 0; i < self->count; i++) {
+		if (child_contains(&self->children[i], point))
+			return 1;
+	}
+	return 0;
+}
+
+static int
+Union_on_surface(CompositeDomainObject *self, Py_ssize_t i, Vec3 *point)
+{
+	Py_ssize_t j;
+
+	for (j = 0; j < self->count; j++) {
+		if (j != i && child_contains(&self->children[j], point))
+			return 0;
+	}
+	return 1;
+}
+
+static int
+Union_intersect(CompositeDomainObject *self, Vec3 *start, Vec3 *end,
+	Vec3 *point, Vec3 *normal)
+{
+	return Composite_intersect(self, start, end, point, normal,
+		Union_on_surface);
+}
+
+static void
+Union_closest_pt_to(CompositeDomainObject *self, Vec3 *point,
+	Vec3 *closest, Vec3 *normal)
+{
+	Vec3 child_closest;
+	float dist2, best_dist2 = FLT_MAX;
+	Py_ssize_t i;
+
+	Vec3_copy(closest, point);
+	if (!Union_contains(self, point)) {
+		for (i = 0; i < self->count; i++) {
+			dist2 = Composite_child_closest(&self->children[i], point,
+				&child_closest, best_dist2);
+			if (dist2 < best_dist2) {
+				best_dist2 = dist2;
+				Vec3_copy(closest, &child_closest);
+			}
+		}
+	}
+	Composite_normal(point, closest, normal);
+}
+
+/* Intersection */
+
+static int
+Intersection_contains(CompositeDomainObject *self, Vec3 *point)
+{
+	Py_ssize_t i;
+
+	for (i = 0; i < self->count; i++) {
+		if (!child_contains(&self->children[i], point))
+			return 0;
+	}
+	return 1;
+}
+
+static void
+Intersection_generate(CompositeDomainObject *self, Vec3 *point, RandState *rng)
+{
+	DomainChild *child = &self->children[self->generator];
+	int tries;
+
+	for (tries = 0; tries < COMPOSITE_GENERATE_TRIES; tries++) {
+		child->native->generate(child->domain, point, rng);
+		if (Intersection_contains(self, point))
+			return;
+	}
+}
+
+static int
+Intersection_on_surface(CompositeDomainObject *self, Py_ssize_t i, Vec3 *point)
+{
+	Py_ssize_t j;
+
+	for (j = 0; j < self->count; j++) {
+		if (j != i && !child_contains(&self->children[j], point))
+			return 0;
+	}
+	return 1;
+}
+
+static int
+Intersection_intersect(CompositeDomainObject *self, Vec3 *start, Vec3 *end,
+	Vec3 *point, Vec3 *normal)
+{
+	return Composite_intersect(self, start, end, point, normal,
+		Intersection_on_surface);
+}
+
+static void
+Intersection_closest_pt_to(CompositeDomainObject *self, Vec3 *point,
+	Vec3 *closest, Vec3 *normal)
+{
+	Vec3 child_closest, furthest;
+	float dist2, best_dist2 = FLT_MAX, furthest_dist2 = -1.0f;
+	Py_ssize_t i;
+
+	Vec3_copy(closest, point);
+	Vec3_copy(&furthest, point);
+	if (!Intersection_contains(self, point)) {
+		/* The closest of the children's closest points in the
+		 * intersection, otherwise approximated by the furthest of them */
+		for (i = 0; i < self->count; i++) {
+			dist2 = Composite_child_closest(&self->children[i], point,
+				&child_closest, FLT_MAX);
+			if (dist2 < best_dist2 && Intersection_on_surface(self, i, &child_closest)) {
+				best_dist2 = dist2;
+				Vec3_copy(closest, &child_closest);
+			}
+			if (dist2 > furthest_dist2) {
+				furthest_dist2 = dist2;
+				Vec3_copy(&furthest, &child_closest);
+			}
+		}
+		if (best_dist2 == FLT_MAX)
+			Vec3_copy(closest, &furthest);
+	}
+	Composite_normal(point, closest, normal);
+}
+
+/* Difference */
+
+static int
+Difference_contains(CompositeDomainObject *self, Vec3 *point)
+{
+	Py_ssize_t i;
+
+	if (!child_contains(&self->children[0], point))
+		return 0;
+	for (i = 1; i < self->count; i++) {
+		if (child_contains(&self->children[i], point))
+			return 0;
+	}
+	return 1;
+}
+
+static void
+Difference_generate(CompositeDomainObject *self, Vec3 *point, RandState *rng)
+{
+	DomainChild *child = &self->children[0];
+	int tries;
+
+	for (tries = 0; tries < COMPOSITE_GENERATE_TRIES; tries++) {
+		child->native->generate(child->domain, point, rng);
+		if (Difference_contains(self, point))
+			return;
+	}
+}
+
+static int
+Difference_on_surface(CompositeDomainObject *self, Py_ssize_t i, Vec3 *point)
+{
+	Py_ssize_t j;
+
+	/* On the first child outside the others, or on another child inside
+	 * the first and outside the rest */
+	if (i > 0 && !child_contains(&self->children[0], point))
+		return 0;
+	for (j = 1; j < self->count; j++) {
+		if (j != i && child_contains(&self->children[j], point))
+			return 0;
+	}
+	return 1;
+}
+
+static int
+Difference_intersect(CompositeDomainObject *self, Vec3 *start, Vec3 *end,
+	Vec3 *point, Vec3 *normal)
+{
+	return Composite_intersect(self, start, end, point, normal,
+		Difference_on_surface);
+}
+
+static void
+Difference_closest_pt_to(CompositeDomainObject *self, Vec3 *point,
+	Vec3 *closest, Vec3 *normal)
+{
+	DomainChild *child;
+	Vec3 center, far, hit_norm;
+	float reach;
+	Py_ssize_t i;
+
+	Vec3_copy(closest, point);
+	if (!child_contains(&self->children[0], point)) {
+		/* Outside the first child, approximated by its closest point */
+		Composite_child_closest(&self->children[0], point, closest, FLT_MAX);
+	} else {
+		for (i = 1; i < self->count; i++) {
+			child = &self->children[i];
+			if (!child_contains(child, point))
+				continue;
+			/* Inside a subtracted child, approximated by where the ray from
+			 * the center of its bounds through the point leaves it */
+			center.x = (child->min.x + child->max.x) * 0.5f;
+			center.y = (child->min.y + child->max.y) * 0.5f;
+			center.z = (child->min.z + child->max.z) * 0.5f;
+			Vec3_sub(&far, point, &center);
+			if (Vec3_len_sq(&far) <= EPSILON*EPSILON)
+				far.y = 1.0f;
+			Vec3_normalize(&far, &far);
+			Vec3_sub(&center, &child->max, &child->min);
+			reach = Vec3_len(&center) + 1.0f;
+			Vec3_scalar_muli(&far, reach);
+			Vec3_addi(&far, point);
+			if (child->native->intersect(child->domain, &far, point,
+				closest, &hit_norm) != 1)
+				Vec3_copy(closest, point);
+			break;
+		}
+	}
+	Composite_normal(point, closest, normal);
+}
+
+#define COMPOSITE_NATIVE(type, name) { \
+	(void (*)(PyObject *, Vec3 *, RandState *))type##_generate, \
+	(int (*)(PyObject *, Vec3 *))type##_contains, \
+	(int (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *, Vec3 *))type##_intersect, \
+	(void (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *))type##_closest_pt_to, \
+	name, \
+	NULL, \
+	NULL, \
+	(void (*)(PyObject *, Vec3 *, Vec3 *))Composite_bounds, \
+	(float (*)(PyObject *))Composite_volume, \
+	(int (*)(PyObject *))Composite_initialized \
+}
+
+static DomainNative UnionDomain_native = COMPOSITE_NATIVE(Union, "Union");
+static DomainNative IntersectionDomain_native =
+	COMPOSITE_NATIVE(Intersection, "Intersection");
+static DomainNative DifferenceDomain_native =
+	COMPOSITE_NATIVE(Difference, "Difference");
+
+static PyMethodDef CompositeDomain_methods[] = {
+	{"generate", (PyCFunction)Domain_generate, METH_NOARGS,
+		PyDoc_STR("generate() -> Vector\n"
+			"Return a random point in the composite domain. Points are\n"
+			"generated in the child domains, weighted by their volume,\n"
+			"until one is in the composite")},
+	{"intersect", (PyCFunction)Domain_intersect, METH_VARARGS,
+		PyDoc_STR("intersect(seg_start, seg_end) -> point, normal\n"
+			"Intersect the line segment with the surface of the composite\n"
+			"domain and return the first intersection point and the normal\n"
+			"vector facing the start point.\n\n"
+			"If the line does not intersect, return (None, None)")},
+	{"closest_point_to", (PyCFunction)Domain_closest_point_to, METH_VARARGS,
+		PyDoc_STR("closest_point_to(point) -> point, normal\n"
+			"Returns the closest point in the composite domain to the\n"
+			"supplied point, and the unit vector from it to the point.\n"
+			"This is approximate where the closest point of a child domain\n"
+			"is not on the surface of the composite.")},
+	{"refit", (PyCFunction)CompositeDomain_refit, METH_NOARGS,
+		PyDoc_STR("refit() -> None\n"
+			"Recompute the cached bounds and volumes of the child domains.\n"
+			"Call it after changing the children.")},
+	DOMAIN_GENERATE_MANY_METHOD
+	DOMAIN_QUERY_MANY_METHODS
+	{NULL,		NULL}		/* sentinel */
+};
+
+static PyGetSetDef CompositeDomain_descriptors[] = {
+	{"domains", (getter)CompositeDomain_get_domains, NULL,
+		"Tuple of the child domains", NULL},
+	{NULL}
+};
+
+static PySequenceMethods CompositeDomain_as_sequence = {
+	0,		/* sq_length */
+	0,		/* sq_concat */
+	0,		/* sq_repeat */
+	0,	    /* sq_item */
+	0,		/* sq_slice */
+	0,		/* sq_ass_item */
+	0,	    /* sq_ass_slice */
+	(objobjproc)Domain_contains,	/* sq_contains */
+};
+
+#define COMPOSITE_TYPE(tp_name, doc) { \
+	PyVarObject_HEAD_INIT(NULL, 0) \
+	tp_name,		/*tp_name*/ \
+	sizeof(CompositeDomainObject),	/*tp_basicsize*/ \
+	0,			/*tp_itemsize*/ \
+	(destructor)CompositeDomain_dealloc, /*tp_dealloc*/ \
+	0,			/*tp_print*/ \
+	0,          /*tp_getattr*/ \
+	0,          /*tp_setattr*/ \
+	0,			/*tp_compare*/ \
+	0,			/*tp_repr*/ \
+	0,			/*tp_as_number*/ \
+	&CompositeDomain_as_sequence, /*tp_as_sequence*/ \
+	0,			/*tp_as_mapping*/ \
+	0,			/*tp_hash*/ \
+	0,                      /*tp_call*/ \
+	0,                      /*tp_str*/ \
+	0,                      /*tp_getattro*/ \
+	0,                      /*tp_setattro*/ \
+	0,                      /*tp_as_buffer*/ \
+	Py_TPFLAGS_DEFAULT,     /*tp_flags*/ \
+	doc,                    /*tp_doc*/ \
+	0,                      /*tp_traverse*/ \
+	0,                      /*tp_clear*/ \
+	0,                      /*tp_richcompare*/ \
+	0,                      /*tp_weaklistoffset*/ \
+	0,                      /*tp_iter*/ \
+	0,                      /*tp_iternext*/ \
+	CompositeDomain_methods,  /*tp_methods*/ \
+	0,                      /*tp_members*/ \
+	CompositeDomain_descriptors, /*tp_getset*/ \
+	0,                      /*tp_base*/ \
+	0,                      /*tp_dict*/ \
+	0,                      /*tp_descr_get*/ \
+	0,                      /*tp_descr_set*/ \
+	0,                      /*tp_dictoffset*/ \
+	(initproc)CompositeDomain_init, /*tp_init*/ \
+	0,                      /*tp_alloc*/ \
+	0,                      /*tp_new*/ \
+	0,                      /*tp_free*/ \
+	0,                      /*tp_is_gc*/ \
+}
+
+PyDoc_STRVAR(UnionDomain__doc__,
+	"Union of domains\n\n"
+	"Union(domain, *domains)\n\n"
+	"Points are in the union if they are in any of the domains, which\n"
+	"must be built-in domains, including other composites.");
+
+PyDoc_STRVAR(IntersectionDomain__doc__,
+	"Intersection of domains\n\n"
+	"Intersection(domain, *domains)\n\n"
+	"Points are in the intersection if they are in all of the domains,\n"
+	"which must be built-in domains, including other composites.");
+
+PyDoc_STRVAR(DifferenceDomain__doc__,
+	"Difference of domains\n\n"
+	"Difference(domain, *subtracted)\n\n"
+	"Points are in the difference if they are in the first domain, but\n"
+	"not in any of the subtracted domains. All must be built-in domains,\n"
+	"including other composites.");
+
+static PyTypeObject UnionDomain_Type =
+	COMPOSITE_TYPE("domain.Union", UnionDomain__doc__);
+static PyTypeObject IntersectionDomain_Type =
+	COMPOSITE_TYPE("domain.Intersection", IntersectionDomain__doc__);
+static PyTypeObject DifferenceDomain_Type =
+	COMPOSITE_TYPE("domain.Difference", DifferenceDomain__doc__);
+
+/* --------------------------------------------------------------------- */
+
+/* Bounding volume hierarchies over the boxes of many items, such as
+ * domains or triangles, so that queries only visit the items near them
+ */
+
+/* Maximum number of items in a leaf node */
+#define BVH_LEAF_SIZE 4
+/* Maximum depth of the hierarchy, which median splits keep to about
+ * log2(count / BVH_LEAF_SIZE) */
+#define BVH_MAX_DEPTH 64
+
+typedef struct {
+	Vec3 min, max;
+	Py_ssize_t index;	/* index of the item in its owner's array */
+} BVHItem;
+
+typedef struct {
+	Vec3 min, max;
+	/* Leaves hold the items from first to first + count, inner nodes have
+	 * count 0, their left child at the next index and their right child at
+	 * first */
+	Py_ssize_t first;
+	Py_ssize_t count;
+} BVHNode;
+
+typedef struct {
+	BVHItem *items;	/* in hierarchy order */
+	BVHNode *nodes;	/* depth first, parents before children */
+	Py_ssize_t count;
+	Py_ssize_t node_count;
+} BVH;
+
+/* Allocate the arrays for count items. Return true on success, false with
+ * an exception set on failure */
+static int
+BVH_alloc(BVH *bvh, Py_ssize_t count)
+{
+	bvh->items = PyMem_Malloc(count * sizeof(BVHItem));
+	bvh->nodes = PyMem_Malloc((2 * count - 1) * sizeof(BVHNode));
+	bvh->count = count;
+	bvh->node_count = 0;
+	if (bvh->items == NULL || bvh->nodes == NULL) {
+		PyErr_NoMemory();
+		return 0;
+	}
+	return 1;
+}
+
+static void
+BVH_free(BVH *bvh)
+{
+	PyMem_Free(bvh->items);
+	PyMem_Free(bvh->nodes);
+	bvh->items = NULL;
+	bvh->nodes = NULL;
+}
+
+static inline float
+Vec3_axis(Vec3 *v, int axis)
+{
+	return axis == 0 ? v->x : (axis == 1 ? v->y : v->z);
+}
+
+static inline float
+item_center(BVHItem *item, int axis)
+{
+	return (Vec3_axis(&item->min, axis) + Vec3_axis(&item->max, axis)) * 0.5f;
+}
+
+/* Partially sort the items so that the kth has the median center along
+ * axis, with smaller ones before it and larger ones after it */
+static void
+BVH_select(BVHItem *items, Py_ssize_t count, Py_ssize_t k, int axis)
+{
+	BVHItem tmp;
+	Py_ssize_t lo = 0, hi = count - 1, i, j;
+	float pivot;
+
+	while (lo < hi) {
+		pivot = item_center(&items[(lo + hi) / 2], axis);
+		i = lo;
+		j = hi;
+		while (i <= j) {
+			while (item_center(&items[i], axis) < pivot)
+				i++;
+			while (item_center(&items[j], axis) > pivot)
+				j--;
+			if (i <= j) {
+				tmp = items[i];
+				items[i++] = items[j];
+				items[j--] = tmp;
+			}
+		}
+		if (k <= j)
+			hi = j;
+		else if (k >= i)
+			lo = i;
+		else
+			break;
+	}
+}
+
+/* Grow the box from min to max to include the box from lo to hi */
+static inline void
+box_include(Vec3 *min, Vec3 *max, Vec3 *lo, Vec3 *hi)
+{
+	min->x = fminf(min->x, lo->x);
+	min->y = fminf(min->y, lo->y);
+	min->z = fminf(min->z, lo->z);
+	max->x = fmaxf(max->x, hi->x);
+	max->y = fmaxf(max->y, hi->y);
+	max->z = fmaxf(max->z, hi->z);
+}
+
+/* Compute the bounds of the node from those of its items or children */
+static void
+BVH_fit_node(BVH *bvh, BVHNode *node)
+{
+	BVHItem *item;
+	BVHNode *right;
+	Py_ssize_t i;
+
+	if (node->count == 0) {
+		right = &bvh->nodes[node->first];
+		Vec3_copy(&node->min, &node[1].min);
+		Vec3_copy(&node->max, &node[1].max);
+		box_include(&node->min, &node->max, &right->min, &right->max);
+		return;
+	}
+	item = &bvh->items[node->first];
+	Vec3_copy(&node->min, &item->min);
+	Vec3_copy(&node->max, &item->max);
+	for (i = 1; i < node->count; i++) {
+		item++;
+		box_include(&node->min, &node->max, &item->min, &item->max);
+	}
+}
+
+/* Build the hierarchy over count items from first, splitting them at the
+ * median of their centers along the longest axis of the centers' bounds.
+ * Return the index of the root node */
+static Py_ssize_t
+BVH_build_node(BVH *bvh, Py_ssize_t first, Py_ssize_t count, int depth)
+{
+	BVHNode *node;
+	Py_ssize_t index = bvh->node_count++, i, half;
+	float lo, hi, extent, best_extent = 0.0f;
+	int axis, split_axis = 0;
+
+	node = &bvh->nodes[index];
+	node->first = first;
+	node->count = count;
+	if (count > BVH_LEAF_SIZE && depth < BVH_MAX_DEPTH) {
+		for (axis = 0; axis < 3; axis++) {
+			lo = hi = item_center(&bvh->items[first], axis);
+			for (i = first + 1; i < first + count; i++) {
+				lo = fminf(lo, item_center(&bvh->items[i], axis));
+				hi = fmaxf(hi, item_center(&bvh->items[i], axis));
+			}
+			extent = hi - lo;
+			if (extent > best_extent) {
+				best_extent = extent;
+				split_axis = axis;
+			}
+		}
+		/* Items with the same center stay in one leaf */
+		if (best_extent > 0.0f) {
+			half = count / 2;
+			BVH_select(&bvh->items[first], count, half, split_axis);
+			node->count = 0;
+			BVH_build_node(bvh, first, half, depth + 1);
+			node->first = BVH_build_node(
+				bvh, first + half, count - half, depth + 1);
+		}
+	}
+	BVH_fit_node(bvh, node);
+	return index;
+}
+
+/* Build the hierarchy over the items, whose bounds and indices are set */
+static void
+BVH_build(BVH *bvh)
+{
+	bvh->node_count = 0;
+	BVH_build_node(bvh, 0, bvh->count, 0);
+}
+
+/* Update the bounds of the nodes from the leaves up, after the bounds of
+ * the items change. The hierarchy keeps its structure */
+static void
+BVH_refit(BVH *bvh)
+{
+	Py_ssize_t i;
+
+	for (i = bvh->node_count - 1; i >= 0; i--)
+		BVH_fit_node(bvh, &bvh->nodes[i]);
+}
+
+/* Return true if the segment from start, along seg with inverse inv,
+ * passes through the node's box, grown by margin, before the fraction
+ * t_max of its length. Zero components of seg give infinite inverses and
+ * NaN products, which fminf and fmaxf ignore */
+static inline int
+seg_hits_node(BVHNode *node, Vec3 *start, Vec3 *inv, float t_max,
+	float margin)
+{
+	float t0, t1, t_near = 0.0f, t_far = t_max;
+
+	t0 = (node->min.x - margin - start->x) * inv->x;
+	t1 = (node->max.x + margin - start->x) * inv->x;
+	t_near = fmaxf(t_near, fminf(t0, t1));
+	t_far = fminf(t_far, fmaxf(t0, t1));
+	t0 = (node->min.y - margin - start->y) * inv->y;
+	t1 = (node->max.y + margin - start->y) * inv->y;
+	t_near = fmaxf(t_near, fminf(t0, t1));
+	t_far = fminf(t_far, fmaxf(t0, t1));
+	t0 = (node->min.z - margin - start->z) * inv->z;
+	t1 = (node->max.z + margin - start->z) * inv->z;
+	t_near = fmaxf(t_near, fminf(t0, t1));
+	t_far = fminf(t_far, fmaxf(t0, t1));
+	return t_near <= t_far;
+}
+
+/* Return the index of the first cumulative weight of count reaching r */
+static inline Py_ssize_t
+cumulative_search(float *cumulative, Py_ssize_t count, float r)
+{
+	Py_ssize_t lo = 0, hi = count - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (cumulative[mid] < r)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* --------------------------------------------------------------------- */
+
+/* Obstacle sets hold many bounded domains in a bounding volume hierarchy,
+ * so that a segment is only intersected with the obstacles near it
+ */
+
+static PyTypeObject ObstacleSetDomain_Type;
+
+typedef struct {
+	PyObject_HEAD
+	PyObject *obstacles;	/* tuple of the obstacle domains */
+	Py_ssize_t count;
+	DomainChild *children;
+	float *cumulative;	/* cumulative volume of the children */
+	BVH bvh;	/* items index the children */
+} ObstacleSetObject;
+
+/* Update the cached bounds and volumes of the obstacles, and the bounds of
+ * their items */
+static void
+ObstacleSet_fit_children(ObstacleSetObject *self)
+{
+	DomainChild *child;
+	BVHItem *item;
+	float total = 0.0f;
+	Py_ssize_t i;
+
+	for (i = 0; i < self->count; i++) {
+		child = &self->children[i];
+		Domain_refit(child->domain);
+		child->native->bounds(child->domain, &child->min, &child->max);
+		child->volume = child->native->volume != NULL ?
+			child->native->volume(child->domain) : 0.0f;
+		total += child->volume;
+		self->cumulative[i] = total;
+	}
+	for (i = 0; i < self->count; i++) {
+		item = &self->bvh.items[i];
+		child = &self->children[item->index];
+		Vec3_copy(&item->min, &child->min);
+		Vec3_copy(&item->max, &child->max);
+	}
+}
+
+static void
+ObstacleSet_refit(ObstacleSetObject *self)
+{
+	ObstacleSet_fit_children(self);
+	BVH_refit(&self->bvh);
+}
+
+static int
+ObstacleSetDomain_init(ObstacleSetObject *self, PyObject *args)
+{
+	PyObject *obstacles_arg, *obstacles;
+	DomainChild *child;
+	Py_ssize_t i, count;
+
+	if (self->children != NULL) {
+		/* Re-initializing could make the set its own obstacle */
+		PyErr_SetString(PyExc_TypeError, "ObstacleSet: already initialized");
+		return -1;
+	}
+	if (!PyArg_ParseTuple(args, "O:__init__", &obstacles_arg))
+		return -1;
+	obstacles = PySequence_Tuple(obstacles_arg);
+	if (obstacles == NULL)
+		return -1;
+	count = PyTuple_GET_SIZE(obstacles);
+	if (count < 1) {
+		PyErr_SetString(PyExc_ValueError,
+			"ObstacleSet: expected at least one obstacle");
+		goto error;
+	}
+	self->children = PyMem_Malloc(count * sizeof(DomainChild));
+	self->cumulative = PyMem_Malloc(count * sizeof(float));
+	if (self->children == NULL || self->cumulative == NULL) {
+		PyErr_NoMemory();
+		goto error;
+	}
+	if (!BVH_alloc(&self->bvh, count))
+		goto error;
+	for (i = 0; i < count; i++) {
+		child = &self->children[i];
+		child->domain = PyTuple_GET_ITEM(obstacles, i);
+		child->native = Domain_get_native(child->domain);
+		if (child->native == NULL || child->native->bounds == NULL) {
+			PyErr_Format(PyExc_TypeError,
+				"ObstacleSet: expected bounded built-in domains, got %s",
+				Py_TYPE(child->domain)->tp_name);
+			goto error;
+		}
+		self->bvh.items[i].index = i;
+	}
+	self->count = count;
+	self->obstacles = obstacles;
+	ObstacleSet_fit_children(self);
+	BVH_build(&self->bvh);
+	return 0;
+
+error:
+	Py_DECREF(obstacles);
+	PyMem_Free(self->children);
+	PyMem_Free(self->cumulative);
+	BVH_free(&self->bvh);
+	self->children = NULL;
+	self->cumulative = NULL;
+	return -1;
+}
+
+static void
+ObstacleSetDomain_dealloc(ObstacleSetObject *self)
+{
+	Py_CLEAR(self->obstacles);
+	PyMem_Free(self->children);
+	PyMem_Free(self->cumulative);
+	BVH_free(&self->bvh);
+	PyObject_Del(self);
+}
+
+static PyObject *
+ObstacleSetDomain_refit(ObstacleSetObject *self)
+{
+	if (Domain_native((PyObject *)self) == NULL)
+		return NULL;
+	ObstacleSet_refit(self);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+ObstacleSetDomain_get_obstacles(ObstacleSetObject *self, void *closure)
+{
+	if (self->obstacles == NULL)
+		return PyTuple_New(0);
+	Py_INCREF(self->obstacles);
+	return self->obstacles;
+}
+
+/* Sets created without calling __init__ have no obstacles */
+static int
+ObstacleSet_initialized(ObstacleSetObject *self)
+{
+	return self->count > 0;
+}
+
+static Py_ssize_t
+ObstacleSetDomain_length(ObstacleSetObject *self)
+{
+	return self->count;
+}
+
+static void
+ObstacleSet_bounds(ObstacleSetObject *self, Vec3 *min, Vec3 *max)
+{
+	Vec3_copy(min, &self->bvh.nodes[0].min);
+	Vec3_copy(max, &self->bvh.nodes[0].max);
+}
+
+static float
+ObstacleSet_volume(ObstacleSetObject *self)
+{
+	return self->cumulative[self->count - 1];
+}
+
+/* Generate a point in an obstacle picked by volume, or any obstacle if
+ * they have none. Points in overlapping obstacles are counted in each */
+static void
+ObstacleSet_generate(ObstacleSetObject *self, Vec3 *point, RandState *rng)
+{
+	DomainChild *child;
+	float total = self->cumulative[self->count - 1];
+	Py_ssize_t i;
+
+	if (total > 0.0f) {
+		i = cumulative_search(self->cumulative, self->count,
+			rand_state_uni(rng) * total);
+	} else {
+		i = min((Py_ssize_t)(rand_state_uni(rng) * self->count),
+			self->count - 1);
+	}
+	child = &self->children[i];
+	child->native->generate(child->domain, point, rng);
+}
+
+static int
+ObstacleSet_contains(ObstacleSetObject *self, Vec3 *point)
+{
+	DomainChild *child;
+	BVHNode *node;
+	Py_ssize_t stack[BVH_MAX_DEPTH + 1], top = 0, i;
+
+	stack[top++] = 0;
+	while (top > 0) {
+		node = &self->bvh.nodes[stack[--top]];
+		if (!in_bounds(node, point))
+			continue;
+		if (node->count == 0) {
+			stack[top++] = node->first;
+			stack[top++] = node - self->bvh.nodes + 1;
+			continue;
+		}
+		for (i = node->first; i < node->first + node->count; i++) {
+			child = &self->children[self->bvh.items[i].index];
+			if (child->native->contains(child->domain, point))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/* Intersect the segment with the obstacles whose boxes it passes through,
+ * returning the hit nearest its start */
+static int
+ObstacleSet_intersect(ObstacleSetObject *self, Vec3 *start, Vec3 *end,
+	Vec3 *point, Vec3 *normal)
+{
+	DomainChild *child;
+	BVHNode *node;
+	Vec3 seg, inv, from_start, hit_pt, hit_norm, best_pt, best_norm;
+	float len2, t, best_t = FLT_MAX, t_max = 1.0f + EPSILON;
+	Py_ssize_t stack[BVH_MAX_DEPTH + 1], top = 0, i;
+
+	Vec3_sub(&seg, end, start);
+	len2 = Vec3_len_sq(&seg);
+	if (len2 <= 0.0f)
+		return 0;
+	inv.x = 1.0f / seg.x;
+	inv.y = 1.0f / seg.y;
+	inv.z = 1.0f / seg.z;
+	Vec3_copy(&best_pt, start);
+	best_norm.x = best_norm.y = best_norm.z = 0.0f;
+	stack[top++] = 0;
+	while (top > 0) {
+		node = &self->bvh.nodes[stack[--top]];
+		if (!seg_hits_node(node, start, &inv, t_max, EPSILON))
+			continue;
+		if (node->count == 0) {
+			stack[top++] = node->first;
+			stack[top++] = node - self->bvh.nodes + 1;
+			continue;
+		}
+		for (i = node->first; i < node->first + node->count; i++) {
+			child = &self->children[self->bvh.items[i].index];
+			switch (child->native->intersect(child->domain, start, end,
+				&hit_pt, &hit_norm)) {
+			case 0:
+				continue;
+			case -1:
+				return -1;
+			}
+			/* Ignore hits behind the start */
+			Vec3_sub(&from_start, &hit_pt, start);
+			t = Vec3_dot(&from_start, &seg) / len2;
+			if ((t < -EPSILON) | (t >= best_t))
+				continue;
+			best_t = t;
+			t_max = fminf(t_max, t + EPSILON);
+			Vec3_copy(&best_pt, &hit_pt);
+			Vec3_copy(&best_norm, &hit_norm);
+		}
+	}
+	if (best_t == FLT_MAX)
+		return 0;
+	return sect_result(point, normal, &best_pt, &best_norm);
+}
+
+static void
+ObstacleSet_closest_pt_to(ObstacleSetObject *self, Vec3 *point,
+	Vec3 *closest, Vec3 *normal)
+{
+	DomainChild *child;
+	BVHNode *node;
+	Vec3 child_closest, child_normal, vec;
+	float dist2, best_dist2 = FLT_MAX;
+	Py_ssize_t stack[BVH_MAX_DEPTH + 1], top = 0, i;
+
+	Vec3_copy(closest, point);
+	normal->x = normal->y = normal->z = 0.0f;
+	if (ObstacleSet_contains(self, point))
+		return;
+	stack[top++] = 0;
+	while (top > 0) {
+		node = &self->bvh.nodes[stack[--top]];
+		if (box_dist2(&node->min, &node->max, point) >= best_dist2)
+			continue;
+		if (node->count == 0) {
+			stack[top++] = node->first;
+			stack[top++] = node - self->bvh.nodes + 1;
+			continue;
+		}
+		for (i = node->first; i < node->first + node->count; i++) {
+			child = &self->children[self->bvh.items[i].index];
+			if (box_dist2(&child->min, &child->max, point) >= best_dist2)
+				continue;
+			child->native->closest_point_to(child->domain, point,
+				&child_closest, &child_normal);
+			Vec3_sub(&vec, &child_closest, point);
+			dist2 = Vec3_len_sq(&vec);
+			if (dist2 < best_dist2) {
+				best_dist2 = dist2;
+				Vec3_copy(closest, &child_closest);
+				Vec3_copy(normal, &child_normal);
+			}
+		}
+	}
+}
+
+/* Update the cached bounds of composite domains and obstacle sets, and
+ * their children. Other domains have nothing to update */
+static void
+Domain_refit(PyObject *domain)
+{
+	if (Composite_Check(domain))
+		Composite_refit((CompositeDomainObject *)domain);
+	else if (Py_TYPE(domain) == &ObstacleSetDomain_Type)
+		ObstacleSet_refit((ObstacleSetObject *)domain);
+}
+
+static DomainNative ObstacleSetDomain_native = {
+	(void (*)(PyObject *, Vec3 *, RandState *))ObstacleSet_generate,
+	(int (*)(PyObject *, Vec3 *))ObstacleSet_contains,
+	(int (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *, Vec3 *))ObstacleSet_intersect,
+	(void (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *))ObstacleSet_closest_pt_to,
+	"ObstacleSet",
+	NULL,
+	NULL,
+	(void (*)(PyObject *, Vec3 *, Vec3 *))ObstacleSet_bounds,
+	(float (*)(PyObject *))ObstacleSet_volume,
+	(int (*)(PyObject *))ObstacleSet_initialized
+};
+
+static PyMethodDef ObstacleSetDomain_methods[] = {
+	{"generate", (PyCFunction)Domain_generate, METH_NOARGS,
+		PyDoc_STR("generate() -> Vector\n"
+			"Return a random point in one of the obstacles, picked in\n"
+			"proportion to their volume")},
+	{"intersect", (PyCFunction)Domain_intersect, METH_VARARGS,
+		PyDoc_STR("intersect(seg_start, seg_end) -> point, normal\n"
+			"Intersect the line segment with the obstacles and return the\n"
+			"intersection point nearest the start and the normal vector\n"
+			"facing the start point.\n\n"
+			"If the line does not intersect, return (None, None)")},
+	{"closest_point_to", (PyCFunction)Domain_closest_point_to, METH_VARARGS,
+		PyDoc_STR("closest_point_to(point) -> point, normal\n"
+			"Returns the closest point of the nearest obstacle to the\n"
+			"supplied point, and its surface normal there. Points inside\n"
+			"an obstacle return the point itself and a zero normal.")},
+	{"refit", (PyCFunction)ObstacleSetDomain_refit, METH_NOARGS,
+		PyDoc_STR("refit() -> None\n"
+			"Update the bounding volume hierarchy after obstacles move or\n"
+			"change size. The hierarchy keeps its structure, so create a\n"
+			"new set if the obstacles are rearranged substantially.")},
+	DOMAIN_GENERATE_MANY_METHOD
+	DOMAIN_QUERY_MANY_METHODS
+	{NULL,		NULL}		/* sentinel */
+};
+
+static PyGetSetDef ObstacleSetDomain_descriptors[] = {
+	{"obstacles", (getter)ObstacleSetDomain_get_obstacles, NULL,
+		"Tuple of the obstacle domains", NULL},
+	{NULL}
+};
+
+static PySequenceMethods ObstacleSetDomain_as_sequence = {
+	(lenfunc)ObstacleSetDomain_length,	/* sq_length */
+	0,		/* sq_concat */
+	0,		/* sq_repeat */
+	0,	    /* sq_item */
+	0,		/* sq_slice */
+	0,		/* sq_ass_item */
+	0,	    /* sq_ass_slice */
+	(objobjproc)Domain_contains,	/* sq_contains */
+};
+
+PyDoc_STRVAR(ObstacleSetDomain__doc__,
+	"Set of obstacle domains\n\n"
+	"ObstacleSet(obstacles)\n\n"
+	"obstacles -- A sequence of bounded built-in domains, such as\n"
+	"AABox, Sphere, Cylinder, Cone and Disc domains.\n\n"
+	"Points are in the set if they are in any of the obstacles. The\n"
+	"obstacles are kept in a bounding volume hierarchy, so that segments\n"
+	"and points are only tested against the obstacles near them.");
+
+static PyTypeObject ObstacleSetDomain_Type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"domain.ObstacleSet",		/*tp_name*/
+	sizeof(ObstacleSetObject),	/*tp_basicsize*/
+	0,			/*tp_itemsize*/
+	(destructor)ObstacleSetDomain_dealloc, /*tp_dealloc*/
+	0,			/*tp_print*/
+	0,          /*tp_getattr*/
+	0,          /*tp_setattr*/
+	0,			/*tp_compare*/
+	0,			/*tp_repr*/
+	0,			/*tp_as_number*/
+	&ObstacleSetDomain_as_sequence, /*tp_as_sequence*/
+	0,			/*tp_as_mapping*/
+	0,			/*tp_hash*/
+	0,                      /*tp_call*/
+	0,                      /*tp_str*/
+	0,                      /*tp_getattro*/
+	0,                      /*tp_setattro*/
+	0,                      /*tp_as_buffer*/
+	Py_TPFLAGS_DEFAULT,     /*tp_flags*/
+	ObstacleSetDomain__doc__, /*tp_doc*/
+	0,                      /*tp_traverse*/
+	0,                      /*tp_clear*/
+	0,                      /*tp_richcompare*/
+	0,                      /*tp_weaklistoffset*/
+	0,                      /*tp_iter*/
+	0,                      /*tp_iternext*/
+	ObstacleSetDomain_methods,  /*tp_methods*/
+	0,                      /*tp_members*/
+	ObstacleSetDomain_descriptors, /*tp_getset*/
+	0,                      /*tp_base*/
+	0,                      /*tp_dict*/
+	0,                      /*tp_descr_get*/
+	0,                      /*tp_descr_set*/
+	0,                      /*tp_dictoffset*/
+	(initproc)ObstacleSetDomain_init, /*tp_init*/
+	0,                      /*tp_alloc*/
+	0,                      /*tp_new*/
+	0,                      /*tp_free*/
+	0,                      /*tp_is_gc*/
+};
+
+/* --------------------------------------------------------------------- */
+
+/* Triangle meshes are surfaces built from vertex and index buffers. Points
+ * are generated on triangles picked by area, and queries visit only the
+ * triangles near them through a bounding volume hierarchy
+ */
+
+typedef struct {
+	Vec3 a;	/* first vertex */
+	Vec3 ab, ac;	/* edges from the first vertex to the others */
+	Vec3 normal;	/* unit normal, zero for degenerate triangles */
+} Triangle;
+
+typedef struct {
+	PyObject_HEAD
+	Vec3 *vertices;
+	Py_ssize_t vertex_count;
+	Py_ssize_t *indices;	/* three for each triangle */
+	Triangle *triangles;
+	Py_ssize_t triangle_count;
+	float *cumulative;	/* cumulative area of the triangles */
+	BVH bvh;	/* items index the triangles */
+} TriangleMeshObject;
+
+/* Read the vertices from an array of floats as Domain_get_points accepts,
+ * or a sequence of 3-sequences, into a new array. Return it, or NULL with
+ * an exception set on failure */
+static Vec3 *
+TriangleMesh_read_vertices(PyObject *obj, Py_ssize_t *count)
+{
+	PyObject *seq;
+	Py_buffer buf;
+	const float *points;
+	Vec3 *vertices;
+	Py_ssize_t stride, n, i;
+
+	if (PyObject_CheckBuffer(obj)) {
+		if (!Domain_get_points(obj, &buf, "TriangleMesh", &points, &stride, &n))
+			return NULL;
+		vertices = PyMem_Malloc((n > 0 ? n : 1) * sizeof(Vec3));
+		if (vertices == NULL) {
+			PyBuffer_Release(&buf);
+			PyErr_NoMemory();
+			return NULL;
+		}
+		for (i = 0; i < n; i++)
+			load_vec3(&vertices[i], points + i * stride);
+		PyBuffer_Release(&buf);
+		*count = n;
+		return vertices;
+	}
+	seq = PySequence_Fast(obj, "TriangleMesh: expected a sequence of vertices");
+	if (seq == NULL)
+		return NULL;
+	n = PySequence_Fast_GET_SIZE(seq);
+	vertices = PyMem_Malloc((n > 0 ? n : 1) * sizeof(Vec3));
+	if (vertices == NULL) {
+		Py_DECREF(seq);
+		PyErr_NoMemory();
+		return NULL;
+	}
+	for (i = 0; i < n; i++) {
+		if (!Vec3_FromSequence(&vertices[i], PySequence_Fast_GET_ITEM(seq, i))) {
+			Py_DECREF(seq);
+			PyMem_Free(vertices);
+			return NULL;
+		}
+	}
+	Py_DECREF(seq);
+	*count = n;
+	return vertices;
+}
+
+/* Read the vertex indices from a flat sequence of 3n integers or a
+ * sequence of n 3-sequences into a new array, checking that they are less
+ * than vertex_count. Return it, or NULL with an exception set on failure */
+static Py_ssize_t *
+TriangleMesh_read_indices(PyObject *obj, Py_ssize_t vertex_count,
+	Py_ssize_t *triangle_count)
+{
+	PyObject *seq, *item, *row;
+	Py_ssize_t *indices = NULL, n, count = 0, i, j;
+
+	seq = PySequence_Fast(obj, "TriangleMesh: expected a sequence of indices");
+	if (seq == NULL)
+		return NULL;
+	n = PySequence_Fast_GET_SIZE(seq);
+	/* Flat sequences have three indices per triangle, otherwise one row */
+	if (n > 0 && !PyIndex_Check(PySequence_Fast_GET_ITEM(seq, 0))) {
+		indices = PyMem_Malloc(n * 3 * sizeof(Py_ssize_t));
+		if (indices == NULL)
+			goto nomem;
+		for (i = 0; i < n; i++) {
+			row = PySequence_Fast(PySequence_Fast_GET_ITEM(seq, i),
+				"TriangleMesh: expected sequences of 3 indices");
+			if (row == NULL)
+				goto error;
+			if (PySequence_Fast_GET_SIZE(row) != 3) {
+				Py_DECREF(row);
+				PyErr_SetString(PyExc_ValueError,
+					"TriangleMesh: expected sequences of 3 indices");
+				goto error;
+			}
+			for (j = 0; j < 3; j++) {
+				indices[count++] = PyNumber_AsSsize_t(
+					PySequence_Fast_GET_ITEM(row, j), PyExc_IndexError);
+			}
+			Py_DECREF(row);
+			if (PyErr_Occurred())
+				goto error;
+		}
+	} else {
+		if (n % 3 != 0) {
+			PyErr_SetString(PyExc_ValueError,
+				"TriangleMesh: expected a multiple of 3 indices");
+			goto error;
+		}
+		indices = PyMem_Malloc((n > 0 ? n : 1) * sizeof(Py_ssize_t));
+		if (indices == NULL)
+			goto nomem;
+		for (i = 0; i < n; i++) {
+			item = PySequence_Fast_GET_ITEM(seq, i);
+			indices[count++] = PyNumber_AsSsize_t(item, PyExc_IndexError);
+			if (PyErr_Occurred())
+				goto error;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		if (indices[i] < 0 || indices[i] >= vertex_count) {
+			PyErr_Format(PyExc_IndexError,
+				"TriangleMesh: vertex index %zd out of range", indices[i]);
+			goto error;
+		}
+	}
+	Py_DECREF(seq);
+	*triangle_count = count / 3;
+	return indices;
+
+nomem:
+	PyErr_NoMemory();
+error:
+	Py_DECREF(seq);
+	PyMem_Free(indices);
+	return NULL;
+}
+
+/* Compute the triangles, their areas and the bounds of their items from
+ * the vertices */
+static void
+TriangleMesh_fit_triangles(TriangleMeshObject *self)
+{
+	Triangle *tri;
+	BVHItem *item;
+	Vec3 *b, *c;
+	Py_ssize_t *index, i;
+	float len, total = 0.0f;
+
+	for (i = 0; i < self->triangle_count; i++) {
+		tri = &self->triangles[i];
+		index = &self->indices[i * 3];
+		Vec3_copy(&tri->a, &self->vertices[index[0]]);
+		b = &self->vertices[index[1]];
+		c = &self->vertices[index[2]];
+		Vec3_sub(&tri->ab, b, &tri->a);
+		Vec3_sub(&tri->ac, c, &tri->a);
+		Vec3_cross(&tri->normal, &tri->ab, &tri->ac);
+		len = Vec3_len(&tri->normal);
+		if (len > EPSILON * EPSILON) {
+			Vec3_scalar_muli(&tri->normal, 1.0f / len);
+		} else {
+			len = 0.0f;
+			tri->normal.x = tri->normal.y = tri->normal.z = 0.0f;
+		}
+		total += len * 0.5f;
+		self->cumulative[i] = total;
+	}
+	for (i = 0; i < self->triangle_count; i++) {
+		item = &self->bvh.items[i];
+		tri = &self->triangles[item->index];
+		index = &self->indices[item->index * 3];
+		b = &self->vertices[index[1]];
+		c = &self->vertices[index[2]];
+		Vec3_copy(&item->min, &tri->a);
+		Vec3_copy(&item->max, &tri->a);
+		box_include(&item->min, &item->max, b, b);
+		box_include(&item->min, &item->max, c, c);
+	}
+}
+
+static int
+TriangleMeshDomain_init(TriangleMeshObject *self, PyObject *args)
+{
+	PyObject *vertices_arg, *indices_arg;
+	Py_ssize_t i;
+
+	if (self->triangles != NULL) {
+		PyErr_SetString(PyExc_TypeError, "TriangleMesh: already initialized");
+		return -1;
+	}
+	if (!PyArg_ParseTuple(args, "OO:__init__", &vertices_arg, &indices_arg))
+		return -1;
+	self->vertices = TriangleMesh_read_vertices(vertices_arg,
+		&self->vertex_count);
+	if (self->vertices == NULL)
+		goto error;
+	self->indices = TriangleMesh_read_indices(indices_arg,
+		self->vertex_count, &self->triangle_count);
+	if (self->indices == NULL)
+		goto error;
+	if (self->triangle_count < 1) {
+		PyErr_SetString(PyExc_ValueError,
+			"TriangleMesh: expected at least one triangle");
+		goto error;
+	}
+	self->triangles = PyMem_Malloc(self->triangle_count * sizeof(Triangle));
+	self->cumulative = PyMem_Malloc(self->triangle_count * sizeof(float));
+	if (self->triangles == NULL || self->cumulative == NULL) {
+		PyErr_NoMemory();
+		goto error;
+	}
+	if (!BVH_alloc(&self->bvh, self->triangle_count))
+		goto error;
+	for (i = 0; i < self->triangle_count; i++)
+		self->bvh.items[i].index = i;
+	TriangleMesh_fit_triangles(self);
+	BVH_build(&self->bvh);
+	return 0;
+
+error:
+	PyMem_Free(self->vertices);
+	PyMem_Free(self->indices);
+	PyMem_Free(self->triangles);
+	PyMem_Free(self->cumulative);
+	BVH_free(&self->bvh);
+	self->vertices = NULL;
+	self->indices = NULL;
+	self->triangles = NULL;
+	self->cumulative = NULL;
+	self->vertex_count = self->triangle_count = 0;
+	return -1;
+}
+
+static void
+TriangleMeshDomain_dealloc(TriangleMeshObject *self)
+{
+	PyMem_Free(self->vertices);
+	PyMem_Free(self->indices);
+	PyMem_Free(self->triangles);
+	PyMem_Free(self->cumulative);
+	BVH_free(&self->bvh);
+	PyObject_Del(self);
+}
+
+/* Meshes created without calling __init__ have no triangles */
+static int
+TriangleMesh_initialized(TriangleMeshObject *self)
+{
+	return self->triangle_count > 0;
+}
+
+static PyObject *
+TriangleMeshDomain_update_vertices(TriangleMeshObject *self, PyObject *args)
+{
+	PyObject *vertices_arg;
+	Vec3 *vertices;
+	Py_ssize_t count;
+
+	if (!PyArg_ParseTuple(args, "O:update_vertices", &vertices_arg))
+		return NULL;
+	if (Domain_native((PyObject *)self) == NULL)
+		return NULL;
+	vertices = TriangleMesh_read_vertices(vertices_arg, &count);
+	if (vertices == NULL)
+		return NULL;
+	if (count != self->vertex_count) {
+		PyMem_Free(vertices);
+		PyErr_Format(PyExc_ValueError,
+			"TriangleMesh.update_vertices: expected %zd vertices, got %zd",
+			self->vertex_count, count);
+		return NULL;
+	}
+	PyMem_Free(self->vertices);
+	self->vertices = vertices;
+	TriangleMesh_fit_triangles(self);
+	BVH_refit(&self->bvh);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static Py_ssize_t
+TriangleMeshDomain_length(TriangleMeshObject *self)
+{
+	return self->triangle_count;
+}
+
+static PyObject *
+TriangleMeshDomain_get_area(TriangleMeshObject *self, void *closure)
+{
+	if (self->triangle_count < 1)
+		return PyFloat_FromDouble(0.0);
+	return PyFloat_FromDouble(self->cumulative[self->triangle_count - 1]);
+}
+
+static PyObject *
+TriangleMeshDomain_get_vertex_count(TriangleMeshObject *self, void *closure)
+{
+	return PyInt_FromLong((long)self->vertex_count);
+}
+
+static void
+TriangleMesh_bounds(TriangleMeshObject *self, Vec3 *min, Vec3 *max)
+{
+	Vec3_copy(min, &self->bvh.nodes[0].min);
+	Vec3_copy(max, &self->bvh.nodes[0].max);
+}
+
+/* Generate a point uniformly over the surface, on a triangle picked by area
+ * from the cumulative table */
+static void
+TriangleMesh_generate(TriangleMeshObject *self, Vec3 *point, RandState *rng)
+{
+	Triangle *tri;
+	Vec3 edge;
+	float total = self->cumulative[self->triangle_count - 1], u, v;
+	Py_ssize_t i;
+
+	if (total > 0.0f) {
+		i = cumulative_search(self->cumulative, self->triangle_count,
+			rand_state_uni(rng) * total);
+	} else {
+		i = min((Py_ssize_t)(rand_state_uni(rng) * self->triangle_count),
+			self->triangle_count - 1);
+	}
+	tri = &self->triangles[i];
+	u = rand_state_uni(rng);
+	v = rand_state_uni(rng);
+	/* Fold points in the other half of the parallelogram into the triangle */
+	if (u + v > 1.0f) {
+		u = 1.0f - u;
+		v = 1.0f - v;
+	}
+	Vec3_scalar_mul(point, &tri->ab, u);
+	Vec3_scalar_mul(&edge, &tri->ac, v);
+	Vec3_addi(point, &edge);
+	Vec3_addi(point, &tri->a);
+}
+
+/* Store the closest point of the triangle to point */
+static void
+triangle_closest_pt_to(Triangle *tri, Vec3 *point, Vec3 *closest)
+{
+	Vec3 ap, bp, cp, bc;
+	float d1, d2, d3, d4, d5, d6, va, vb, vc, v, w, denom;
+
+	Vec3_sub(&ap, point, &tri->a);
+	d1 = Vec3_dot(&tri->ab, &ap);
+	d2 = Vec3_dot(&tri->ac, &ap);
+	if (d1 <= 0.0f && d2 <= 0.0f) {
+		/* Closest to vertex a */
+		Vec3_copy(closest, &tri->a);
+		return;
+	}
+	Vec3_sub(&bp, &ap, &tri->ab);
+	d3 = Vec3_dot(&tri->ab, &bp);
+	d4 = Vec3_dot(&tri->ac, &bp);
+	if (d3 >= 0.0f && d4 <= d3) {
+		/* Closest to vertex b */
+		Vec3_add(closest, &tri->a, &tri->ab);
+		return;
+	}
+	vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		/* Closest to edge ab */
+		Vec3_scalar_mul(closest, &tri->ab, d1 / (d1 - d3));
+		Vec3_addi(closest, &tri->a);
+		return;
+	}
+	Vec3_sub(&cp, &ap, &tri->ac);
+	d5 = Vec3_dot(&tri->ab, &cp);
+	d6 = Vec3_dot(&tri->ac, &cp);
+	if (d6 >= 0.0f && d5 <= d6) {
+		/* Closest to vertex c */
+		Vec3_add(closest, &tri->a, &tri->ac);
+		return;
+	}
+	vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		/* Closest to edge ac */
+		Vec3_scalar_mul(closest, &tri->ac, d2 / (d2 - d6));
+		Vec3_addi(closest, &tri->a);
+		return;
+	}
+	va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+		/* Closest to edge bc */
+		Vec3_sub(&bc, &tri->ac, &tri->ab);
+		Vec3_scalar_muli(&bc, (d4 - d3) / ((d4 - d3) + (d5 - d6)));
+		Vec3_add(closest, &tri->a, &tri->ab);
+		Vec3_addi(closest, &bc);
+		return;
+	}
+	/* Closest to the face */
+	denom = 1.0f / (va + vb + vc);
+	v = vb * denom;
+	w = vc * denom;
+	Vec3_scalar_mul(closest, &tri->ab, v);
+	Vec3_scalar_mul(&bc, &tri->ac, w);
+	Vec3_addi(closest, &bc);
+	Vec3_addi(closest, &tri->a);
+}
+
+/* Store the closest point of the mesh to point, visiting the triangles
+ * whose boxes are nearer than the closest point found so far. Return the
+ * closest triangle */
+static Triangle *
+TriangleMesh_closest(TriangleMeshObject *self, Vec3 *point, Vec3 *closest,
+	float max_dist2)
+{
+	Triangle *tri, *best = NULL;
+	BVHNode *node;
+	BVHItem *item;
+	Vec3 tri_closest, vec;
+	float dist2, best_dist2 = max_dist2;
+	Py_ssize_t stack[BVH_MAX_DEPTH + 1], top = 0, i;
+
+	stack[top++] = 0;
+	while (top > 0) {
+		node = &self->bvh.nodes[stack[--top]];
+		if (box_dist2(&node->min, &node->max, point) >= best_dist2)
+			continue;
+		if (node->count == 0) {
+			stack[top++] = node->first;
+			stack[top++] = node - self->bvh.nodes + 1;
+			continue;
+		}
+		for (i = node->first; i < node->first + node->count; i++) {
+			item = &self->bvh.items[i];
+			if (box_dist2(&item->min, &item->max, point) >= best_dist2)
+				continue;
+			tri = &self->triangles[item->index];
+			triangle_closest_pt_to(tri, point, &tri_closest);
+			Vec3_sub(&vec, &tri_closest, point);
+			dist2 = Vec3_len_sq(&vec);
+			if (dist2 < best_dist2) {
+				best_dist2 = dist2;
+				best = tri;
+				Vec3_copy(closest, &tri_closest);
+			}
+		}
+	}
+	return best;
+}
+
+/* Points within EPSILON of a triangle are on the surface */
+static int
+TriangleMesh_contains(TriangleMeshObject *self, Vec3 *point)
+{
+	Vec3 closest;
+
+	return TriangleMesh_closest(self, point, &closest,
+		EPSILON*EPSILON) != NULL;
+}
+
+static void
+TriangleMesh_closest_pt_to(TriangleMeshObject *self, Vec3 *point,
+	Vec3 *closest, Vec3 *normal)
+{
+	Triangle *tri;
+	Vec3 vec;
+	float side;
+
+	Vec3_copy(closest, point);
+	tri = TriangleMesh_closest(self, point, closest, FLT_MAX);
+	Vec3_sub(&vec, point, closest);
+	if (tri == NULL || Vec3_len_sq(&vec) < EPSILON*EPSILON) {
+		/* point on the surface */
+		normal->x = normal->y = normal->z = 0.0f;
+		return;
+	}
+	/* The triangle's normal on the point's side */
+	side = Vec3_dot(&vec, &tri->normal);
+	if (side < 0.0f) {
+		Vec3_neg(normal, &tri->normal);
+	} else {
+		Vec3_copy(normal, &tri->normal);
+	}
+}
+
+/* Intersect the segment with the triangles whose boxes it passes through,
+ * returning the hit nearest its start with the normal facing it */
+static int
+TriangleMesh_intersect(TriangleMeshObject *self, Vec3 *start, Vec3 *end,
+	Vec3 *point, Vec3 *normal)
+{
+	Triangle *tri, *best = NULL;
+	BVHNode *node;
+	Vec3 seg, inv, p, s, q;
+	float det, inv_det, u, v, t, best_t = 1.0f;
+	Py_ssize_t stack[BVH_MAX_DEPTH + 1], top = 0, i;
+
+	Vec3_sub(&seg, end, start);
+	if (Vec3_len_sq(&seg) <= 0.0f)
+		return 0;
+	inv.x = 1.0f / seg.x;
+	inv.y = 1.0f / seg.y;
+	inv.z = 1.0f / seg.z;
+	stack[top++] = 0;
+	while (top > 0) {
+		node = &self->bvh.nodes[stack[--top]];
+		if (!seg_hits_node(node, start, &inv, best_t, EPSILON))
+			continue;
+		if (node->count == 0) {
+			stack[top++] = node->first;
+			stack[top++] = node - self->bvh.nodes + 1;
+			continue;
+		}
+		for (i = node->first; i < node->first + node->count; i++) {
+			/* Moller-Trumbore ray-triangle intersection */
+			tri = &self->triangles[self->bvh.items[i].index];
+			Vec3_cross(&p, &seg, &tri->ac);
+			det = Vec3_dot(&tri->ab, &p);
+			if (fabsf(det) < EPSILON * EPSILON * EPSILON)
+				continue; /* parallel or degenerate */
+			inv_det = 1.0f / det;
+			Vec3_sub(&s, start, &tri->a);
+			u = Vec3_dot(&s, &p) * inv_det;
+			if ((u < 0.0f) | (u > 1.0f))
+				continue;
+			Vec3_cross(&q, &s, &tri->ab);
+			v = Vec3_dot(&seg, &q) * inv_det;
+			if ((v < 0.0f) | (u + v > 1.0f))
+				continue;
+			t = Vec3_dot(&tri->ac, &q) * inv_det;
+			if ((t < 0.0f) | (t > best_t))
+				continue;
+			best_t = t;
+			best = tri;
+		}
+	}
+	if (best == NULL)
+		return 0;
+	Vec3_scalar_mul(point, &seg, best_t);
+	Vec3_addi(point, start);
+	if (Vec3_dot(&best->normal, &seg) > 0.0f) {
+		Vec3_neg(normal, &best->normal);
+	} else {
+		Vec3_copy(normal, &best->normal);
+	}
+	return 1;
+}
+
+static DomainNative TriangleMeshDomain_native = {
+	(void (*)(PyObject *, Vec3 *, RandState *))TriangleMesh_generate,
+	(int (*)(PyObject *, Vec3 *))TriangleMesh_contains,
+	(int (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *, Vec3 *))TriangleMesh_intersect,
+	(void (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *))TriangleMesh_closest_pt_to,
+	"TriangleMesh",
+	NULL,
+	NULL,
+	(void (*)(PyObject *, Vec3 *, Vec3 *))TriangleMesh_bounds,
+	NULL,
+	(int (*)(PyObject *))TriangleMesh_initialized
+};
+
+static PyMethodDef TriangleMeshDomain_methods[] = {
+	{"generate", (PyCFunction)Domain_generate, METH_NOARGS,
+		PyDoc_STR("generate() -> Vector\n"
+			"Return a random point on the surface of the mesh, distributed\n"
+			"evenly by area")},
+	{"intersect", (PyCFunction)Domain_intersect, METH_VARARGS,
+		PyDoc_STR("intersect(seg_start, seg_end) -> point, normal\n"
+			"Intersect the line segment with the mesh and return the\n"
+			"intersection point nearest the start and the normal vector of\n"
+			"the triangle facing the start point.\n\n"
+			"If the line does not intersect, return (None, None)")},
+	{"closest_point_to", (PyCFunction)Domain_closest_point_to, METH_VARARGS,
+		PyDoc_STR("closest_point_to(point) -> point, normal\n"
+			"Returns the closest point on the mesh's surface to the supplied\n"
+			"point, and the normal of its triangle facing the point.")},
+	{"update_vertices", (PyCFunction)TriangleMeshDomain_update_vertices,
+		METH_VARARGS,
+		PyDoc_STR("update_vertices(vertices) -> None\n"
+			"Replace the positions of the vertices, keeping the triangles.\n"
+			"The bounding volume hierarchy is refit rather than rebuilt, so\n"
+			"this suits animated meshes.")},
+	DOMAIN_GENERATE_MANY_METHOD
+	DOMAIN_QUERY_MANY_METHODS
+	{NULL,		NULL}		/* sentinel */
+};
+
+static PyGetSetDef TriangleMeshDomain_descriptors[] = {
+	{"area", (getter)TriangleMeshDomain_get_area, NULL,
+		"Total surface area of the mesh", NULL},
+	{"vertex_count", (getter)TriangleMeshDomain_get_vertex_count, NULL,
+		"Number of vertices in the mesh", NULL},
+	{NULL}
+};
+
+static PySequenceMethods TriangleMeshDomain_as_sequence = {
+	(lenfunc)TriangleMeshDomain_length,	/* sq_length */
+	0,		/* sq_concat */
+	0,		/* sq_repeat */
+	0,	    /* sq_item */
+	0,		/* sq_slice */
+	0,		/* sq_ass_item */
+	0,	    /* sq_ass_slice */
+	(objobjproc)Domain_contains,	/* sq_contains */
+};
+
+PyDoc_STRVAR(TriangleMeshDomain__doc__,
+	"Triangle mesh domain\n\n"
+	"TriangleMesh(vertices, indices)\n\n"
+	"vertices -- The vertex positions, as an (n, 3) array of floats, a\n"
+	"flat array of 3n floats or a sequence of 3-sequences.\n\n"
+	"indices -- The vertex indices of the triangles, as a flat sequence\n"
+	"of 3m integers or a sequence of m 3-sequences.\n\n"
+	"The domain is the surface of the mesh. Points are in it if they are\n"
+	"on one of its triangles.");
+
+static PyTypeObject TriangleMeshDomain_Type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"domain.TriangleMesh",		/*tp_name*/
+	sizeof(TriangleMeshObject),	/*tp_basicsize*/
+	0,			/*tp_itemsize*/
+	(destructor)TriangleMeshDomain_dealloc, /*tp_dealloc*/
+	0,			/*tp_print*/
+	0,          /*tp_getattr*/
+	0,          /*tp_setattr*/
+	0,			/*tp_compare*/
+	0,			/*tp_repr*/
+	0,			/*tp_as_number*/
+	&TriangleMeshDomain_as_sequence, /*tp_as_sequence*/
+	0,			/*tp_as_mapping*/
+	0,			/*tp_hash*/
+	0,                      /*tp_call*/
+	0,                      /*tp_str*/
+	0,                      /*tp_getattro*/
+	0,                      /*tp_setattro*/
+	0,                      /*tp_as_buffer*/
+	Py_TPFLAGS_DEFAULT,     /*tp_flags*/
+	TriangleMeshDomain__doc__, /*tp_doc*/
+	0,                      /*tp_traverse*/
+	0,                      /*tp_clear*/
+	0,                      /*tp_richcompare*/
+	0,                      /*tp_weaklistoffset*/
+	0,                      /*tp_iter*/
+	0,                      /*tp_iternext*/
+	TriangleMeshDomain_methods,  /*tp_methods*/
+	0,                      /*tp_members*/
+	TriangleMeshDomain_descriptors, /*tp_getset*/
+	0,                      /*tp_base*/
+	0,                      /*tp_dict*/
+	0,                      /*tp_descr_get*/
+	0,                      /*tp_descr_set*/
+	0,                      /*tp_dictoffset*/
+	(initproc)TriangleMeshDomain_init, /*tp_init*/
+	0,                      /*tp_alloc*/
+	0,                      /*tp_new*/
+	0,                      /*tp_free*/
+	0,                      /*tp_is_gc*/
+};
+
+/* --------------------------------------------------------------------- */
+
+/* Signed distance field volumes sample a regular grid of signed distances
+ * to a surface, negative inside it, with trilinear interpolation. The grid
+ * is read in place from any buffer of floats, such as a memory mapped file
+ */
+
+/* Maximum number of points generated in the bounds of the inside samples
+ * before giving up on finding one inside the volume */
+#define SDF_GENERATE_TRIES 64
+/* Minimum sphere tracing step, in cells */
+#define SDF_MIN_STEP 0.25f
+/* Number of bisections refining an intersection once it is bracketed */
+#define SDF_REFINE_STEPS 12
+
+typedef struct {
+	PyObject_HEAD
+	Py_buffer buf;	/* the distances, held until deallocated */
+	const float *distances;	/* x-major, with z varying fastest */
+	Py_ssize_t nx, ny, nz;
+	Vec3 origin;	/* position of the first sample */
+	float cell_size;	/* distance between samples */
+	/* Bounds of the samples inside the volume, grown by a cell, in
+	 * samples. Empty if there are none */
+	Py_ssize_t min_index[3], max_index[3];
+	Py_ssize_t inside_count;	/* number of samples inside the volume */
+} SDFVolumeObject;
+
+/* Return the signed distance at point, interpolated from the samples of
+ * the cell around it. Points outside the grid are clamped into it */
+static float
+SDF_sample(SDFVolumeObject *self, Vec3 *point)
+{
+	const float *d = self->distances, *c;
+	float inv_cell = 1.0f / self->cell_size, gx, gy, gz, fx, fy, fz;
+	float c00, c01, c10, c11;
+	Py_ssize_t ix, iy, iz, sy = self->nz, sx = self->ny * self->nz;
+
+	gx = clamp((point->x - self->origin.x) * inv_cell, 0.0f, (float)(self->nx - 1));
+	gy = clamp((point->y - self->origin.y) * inv_cell, 0.0f, (float)(self->ny - 1));
+	gz = clamp((point->z - self->origin.z) * inv_cell, 0.0f, (float)(self->nz - 1));
+	ix = min((Py_ssize_t)gx, self->nx - 2);
+	iy = min((Py_ssize_t)gy, self->ny - 2);
+	iz = min((Py_ssize_t)gz, self->nz - 2);
+	fx = gx - ix;
+	fy = gy - iy;
+	fz = gz - iz;
+	c = d + ix * sx + iy * sy + iz;
+	c00 = c[0] + (c[1] - c[0]) * fz;
+	c01 = c[sy] + (c[sy + 1] - c[sy]) * fz;
+	c10 = c[sx] + (c[sx + 1] - c[sx]) * fz;
+	c11 = c[sx + sy] + (c[sx + sy + 1] - c[sx + sy]) * fz;
+	c00 += (c01 - c00) * fy;
+	c10 += (c11 - c10) * fy;
+	return c00 + (c10 - c00) * fx;
+}
+
+/* Store the corners of the grid */
+static inline void
+SDF_grid_bounds(SDFVolumeObject *self, Vec3 *min, Vec3 *max)
+{
+	Vec3_copy(min, &self->origin);
+	max->x = self->origin.x + (self->nx - 1) * self->cell_size;
+	max->y = self->origin.y + (self->ny - 1) * self->cell_size;
+	max->z = self->origin.z + (self->nz - 1) * self->cell_size;
+}
+
+/* Store the unit gradient of the distance at point, by differences of
+ * samples half a cell to either side, clamped into the grid, or a zero
+ * vector where it is flat */
+static void
+SDF_gradient(SDFVolumeObject *self, Vec3 *point, Vec3 *gradient)
+{
+	Vec3 min, max, p;
+	float h = self->cell_size * 0.5f, lo, hi;
+
+	SDF_grid_bounds(self, &min, &max);
+	Vec3_copy(&p, point);
+#define SDF_DIFF(axis) \
+	lo = fmaxf(point->axis - h, min.axis); \
+	hi = fminf(point->axis + h, max.axis); \
+	p.axis = hi; \
+	gradient->axis = SDF_sample(self, &p); \
+	p.axis = lo; \
+	gradient->axis = (gradient->axis - SDF_sample(self, &p)) / (hi - lo); \
+	p.axis = point->axis;
+	SDF_DIFF(x)
+	SDF_DIFF(y)
+	SDF_DIFF(z)
+#undef SDF_DIFF
+	if (Vec3_len_sq(gradient) > EPSILON*EPSILON)
+		Vec3_normalize(gradient, gradient);
+	else
+		gradient->x = gradient->y = gradient->z = 0.0f;
+}
+
+/* Find the samples inside the volume, after the distances change */
+static void
+SDF_refit(SDFVolumeObject *self)
+{
+	Py_ssize_t i, j, k, n[3] = {self->nx, self->ny, self->nz}, axis;
+	const float *d = self->distances;
+
+	self->inside_count = 0;
+	for (axis = 0; axis < 3; axis++) {
+		self->min_index[axis] = n[axis];
+		self->max_index[axis] = -1;
+	}
+	for (i = 0; i < self->nx; i++) {
+		for (j = 0; j < self->ny; j++) {
+			for (k = 0; k < self->nz; k++) {
+				if (*d++ > 0.0f)
+					continue;
+				self->inside_count++;
+				self->min_index[0] = min(self->min_index[0], i);
+				self->min_index[1] = min(self->min_index[1], j);
+				self->min_index[2] = min(self->min_index[2], k);
+				self->max_index[0] = max(self->max_index[0], i);
+				self->max_index[1] = max(self->max_index[1], j);
+				self->max_index[2] = max(self->max_index[2], k);
+			}
+		}
+	}
+	/* The surface lies within a cell of the inside samples */
+	for (axis = 0; axis < 3 && self->inside_count > 0; axis++) {
+		self->min_index[axis] = max(self->min_index[axis] - 1, 0);
+		self->max_index[axis] = min(self->max_index[axis] + 1, n[axis] - 1);
+	}
+}
+
+static int
+SDFVolumeDomain_init(SDFVolumeObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *kwlist[] = {"distances", "origin", "cell_size", "shape", NULL};
+	PyObject *distances, *shape = Py_None;
+	const char *format;
+	Py_ssize_t n;
+
+	if (self->distances != NULL) {
+		PyErr_SetString(PyExc_TypeError, "SDFVolume: already initialized");
+		return -1;
+	}
+	self->cell_size = 1.0f;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|(fff)fO:__init__", kwlist,
+		&distances, &self->origin.x, &self->origin.y, &self->origin.z,
+		&self->cell_size, &shape))
+		return -1;
+	if (self->cell_size <= 0.0f) {
+		PyErr_SetString(PyExc_ValueError, "SDFVolume: expected cell_size > 0");
+		return -1;
+	}
+	if (PyObject_GetBuffer(distances, &self->buf,
+		PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+		return -1;
+	format = self->buf.format;
+	if (format != NULL && (*format == '@' || *format == '='))
+		format++;
+	if (format == NULL || strcmp(format, "f")) {
+		PyErr_Format(PyExc_TypeError,
+			"SDFVolume: unsupported buffer format '%s'", self->buf.format);
+		goto error;
+	}
+	if (shape != Py_None) {
+		if (!PyArg_ParseTuple(shape, "nnn;expected shape of 3 integers",
+			&self->nx, &self->ny, &self->nz))
+			goto error;
+	} else if (self->buf.ndim == 3) {
+		self->nx = self->buf.shape[0];
+		self->ny = self->buf.shape[1];
+		self->nz = self->buf.shape[2];
+	} else {
+		PyErr_SetString(PyExc_ValueError,
+			"SDFVolume: expected a 3 dimensional array, or a shape");
+		goto error;
+	}
+	if (self->nx < 2 || self->ny < 2 || self->nz < 2) {
+		PyErr_SetString(PyExc_ValueError,
+			"SDFVolume: expected at least 2 samples along each axis");
+		goto error;
+	}
+	n = self->nx * self->ny * self->nz;
+	if (self->buf.len != n * (Py_ssize_t)sizeof(float)) {
+		PyErr_Format(PyExc_ValueError,
+			"SDFVolume: expected %zd distances, got %zd",
+			n, self->buf.len / (Py_ssize_t)sizeof(float));
+		goto error;
+	}
+	self->distances = (const float *)self->buf.buf;
+	SDF_refit(self);
+	return 0;
+
+error:
+	PyBuffer_Release(&self->buf);
+	return -1;
+}
+
+static void
+SDFVolumeDomain_dealloc(SDFVolumeObject *self)
+{
+	if (self->distances != NULL)
+		PyBuffer_Release(&self->buf);
+	PyObject_Del(self);
+}
+
+static PyObject *
+SDFVolumeDomain_refit(SDFVolumeObject *self)
+{
+	if (Domain_native((PyObject *)self) == NULL)
+		return NULL;
+	SDF_refit(self);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+/* Volumes created without calling __init__ have no distances */
+static int
+SDF_initialized(SDFVolumeObject *self)
+{
+	return self->distances != NULL;
+}
+
+static PyObject *
+SDFVolumeDomain_get_shape(SDFVolumeObject *self, void *closure)
+{
+	return Py_BuildValue("(nnn)", self->nx, self->ny, self->nz);
+}
+
+static void
+SDF_bounds(SDFVolumeObject *self, Vec3 *min, Vec3 *max)
+{
+	if (self->inside_count == 0) {
+		SDF_grid_bounds(self, min, max);
+		return;
+	}
+	min->x = self->origin.x + self->min_index[0] * self->cell_size;
+	min->y = self->origin.y + self->min_index[1] * self->cell_size;
+	min->z = self->origin.z + self->min_index[2] * self->cell_size;
+	max->x = self->origin.x + self->max_index[0] * self->cell_size;
+	max->y = self->origin.y + self->max_index[1] * self->cell_size;
+	max->z = self->origin.z + self->max_index[2] * self->cell_size;
+}
+
+/* Estimated by the cells of the inside samples */
+static float
+SDF_volume(SDFVolumeObject *self)
+{
+	return self->inside_count * self->cell_size * self->cell_size
+		* self->cell_size;
+}
+
+/* Points outside the grid are outside the volume */
+static int
+SDF_contains(SDFVolumeObject *self, Vec3 *point)
+{
+	Vec3 min, max;
+
+	SDF_grid_bounds(self, &min, &max);
+	return (point->x >= min.x) & (point->x <= max.x)
+		& (point->y >= min.y) & (point->y <= max.y)
+		& (point->z >= min.z) & (point->z <= max.z)
+		&& SDF_sample(self, point) <= 0.0f;
+}
+
+static void
+SDF_generate(SDFVolumeObject *self, Vec3 *point, RandState *rng)
+{
+	Vec3 min, max;
+	int tries;
+
+	SDF_bounds(self, &min, &max);
+	for (tries = 0; tries < SDF_GENERATE_TRIES; tries++) {
+		point->x = min.x + (max.x - min.x) * rand_state_uni(rng);
+		point->y = min.y + (max.y - min.y) * rand_state_uni(rng);
+		point->z = min.z + (max.z - min.z) * rand_state_uni(rng);
+		if (SDF_sample(self, point) <= 0.0f)
+			return;
+	}
+}
+
+/* Step from the point, clamped into the grid, along the gradient by its
+ * distance. This is exact for true distance fields between samples, and
+ * approximate near corners of the surface */
+static void
+SDF_closest_pt_to(SDFVolumeObject *self, Vec3 *point, Vec3 *closest,
+	Vec3 *normal)
+{
+	Vec3 min, max, step;
+	float d;
+
+	if (SDF_contains(self, point)) {
+		Vec3_copy(closest, point);
+		normal->x = normal->y = normal->z = 0.0f;
+		return;
+	}
+	SDF_grid_bounds(self, &min, &max);
+	closest->x = clamp(point->x, min.x, max.x);
+	closest->y = clamp(point->y, min.y, max.y);
+	closest->z = clamp(point->z, min.z, max.z);
+	d = SDF_sample(self, closest);
+	SDF_gradient(self, closest, normal);
+	if (d > 0.0f) {
+		Vec3_scalar_mul(&step, normal, d);
+		Vec3_subi(closest, &step);
+	} else {
+		/* The grid's face cuts through the volume */
+		Vec3_sub(normal, point, closest);
+		Vec3_normalize(normal, normal);
+	}
+}
+
+/* Sphere trace the segment through the grid, stepping by the distance to
+ * the surface, at least SDF_MIN_STEP cells, until the sign of the distance
+ * changes. Then refine the crossing by bisection */
+static int
+SDF_intersect(SDFVolumeObject *self, Vec3 *start, Vec3 *end,
+	Vec3 *point, Vec3 *normal)
+{
+	Vec3 seg, min, max, p;
+	float len, t0, t1, ta, tb, t, d, min_step;
+	int inside, i;
+
+	Vec3_sub(&seg, end, start);
+	len = Vec3_len(&seg);
+	if (len <= 0.0f)
+		return 0;
+	/* Clip the segment to the grid */
+	SDF_grid_bounds(self, &min, &max);
+	t0 = 0.0f;
+	t1 = 1.0f;
+#define SDF_CLIP(axis) \
+	if (seg.axis != 0.0f) { \
+		ta = (min.axis - start->axis) / seg.axis; \
+		tb = (max.axis - start->axis) / seg.axis; \
+		t0 = fmaxf(t0, fminf(ta, tb)); \
+		t1 = fminf(t1, fmaxf(ta, tb)); \
+	} else if ((start->axis < min.axis) | (start->axis > max.axis)) { \
+		return 0; \
+	}
+	SDF_CLIP(x)
+	SDF_CLIP(y)
+	SDF_CLIP(z)
+#undef SDF_CLIP
+	if (t0 > t1)
+		return 0;
+
+	Vec3_scalar_mul(&p, &seg, t0);
+	Vec3_addi(&p, start);
+	d = SDF_sample(self, &p);
+	inside = d <= 0.0f;
+	if (inside && t0 > 0.0f) {
+		/* Entering the grid inside the volume, through the grid's face */
+		Vec3_copy(point, &p);
+		Vec3_scalar_mul(normal, &seg, -1.0f / len);
+		return 1;
+	}
+	min_step = self->cell_size * SDF_MIN_STEP / len;
+	ta = t0;
+	t = t0;
+	while (t < t1) {
+		t = fminf(t + fmaxf(fabsf(d) / len, min_step), t1);
+		Vec3_scalar_mul(&p, &seg, t);
+		Vec3_addi(&p, start);
+		d = SDF_sample(self, &p);
+		if ((d <= 0.0f) != inside)
+			break;
+		ta = t;
+	}
+	if ((d <= 0.0f) == inside) {
+		if (!inside || t1 >= 1.0f)
+			return 0;
+		/* Leaving the grid inside the volume, through the grid's face */
+		Vec3_copy(point, &p);
+		Vec3_scalar_mul(normal, &seg, -1.0f / len);
+		return 1;
+	}
+	/* The surface is crossed between ta and t */
+	tb = t;
+	for (i = 0; i < SDF_REFINE_STEPS; i++) {
+		t = (ta + tb) * 0.5f;
+		Vec3_scalar_mul(&p, &seg, t);
+		Vec3_addi(&p, start);
+		if ((SDF_sample(self, &p) <= 0.0f) == inside)
+			ta = t;
+		else
+			tb = t;
+	}
+	Vec3_scalar_mul(point, &seg, tb);
+	Vec3_addi(point, start);
+	/* The gradient points out of the volume, face it toward the start */
+	SDF_gradient(self, point, normal);
+	if (Vec3_dot(normal, &seg) > 0.0f) {
+		Vec3_neg(normal, normal);
+	}
+	return 1;
+}
+
+static DomainNative SDFVolumeDomain_native = {
+	(void (*)(PyObject *, Vec3 *, RandState *))SDF_generate,
+	(int (*)(PyObject *, Vec3 *))SDF_contains,
+	(int (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *, Vec3 *))SDF_intersect,
+	(void (*)(PyObject *, Vec3 *, Vec3 *, Vec3 *))SDF_closest_pt_to,
+	"SDFVolume",
+	NULL,
+	NULL,
+	(void (*)(PyObject *, Vec3 *, Vec3 *))SDF_bounds,
+	(float (*)(PyObject *))SDF_volume,
+	(int (*)(PyObject *))SDF_initialized
+};
+
+static PyMethodDef SDFVolumeDomain_methods[] = {
+	{"generate", (PyCFunction)Domain_generate, METH_NOARGS,
+		PyDoc_STR("generate() -> Vector\n"
+			"Return a random point inside the volume")},
+	{"intersect", (PyCFunction)Domain_intersect, METH_VARARGS,
+		PyDoc_STR("intersect(seg_start, seg_end) -> point, normal\n"
+			"Intersect the line segment with the surface of the volume by\n"
+			"sphere tracing, and return the first intersection point and\n"
+			"the normal vector facing the start point.\n\n"
+			"If the line does not intersect, return (None, None)")},
+	{"closest_point_to", (PyCFunction)Domain_closest_point_to, METH_VARARGS,
+		PyDoc_STR("closest_point_to(point) -> point, normal\n"
+			"Returns the closest point of the volume to the supplied point,\n"
+			"found by a step along the distance gradient, and the normal\n"
+			"facing the point.")},
+	{"refit", (PyCFunction)SDFVolumeDomain_refit, METH_NOARGS,
+		PyDoc_STR("refit() -> None\n"
+			"Recompute the bounds and volume of the inside samples after\n"
+			"changing the distances.")},
+	DOMAIN_GENERATE_MANY_METHOD
+	DOMAIN_QUERY_MANY_METHODS
+	{NULL,		NULL}		/* sentinel */
+};
+
+static PyMemberDef SDFVolumeDomain_members[] = {
+	{"cell_size", T_FLOAT, offsetof(SDFVolumeObject, cell_size), READONLY,
+		"Distance between samples"},
+	{NULL}
+};
+
+static PyGetSetDef SDFVolumeDomain_descriptors[] = {
+	{"origin", (getter)Vector_get, (setter)Vector_set,
+		"Position of the first sample", (void *)offsetof(SDFVolumeObject, origin)},
+	{"shape", (getter)SDFVolumeDomain_get_shape, NULL,
+		"Number of samples along each axis", NULL},
+	{NULL}
+};
+
+static PySequenceMethods SDFVolumeDomain_as_sequence = {
+	0,		/* sq_length */
+	0,		/* sq_concat */
+	0,		/* sq_repeat */
+	0,	    /* sq_item */
+	0,		/* sq_slice */
+	0,		/* sq_ass_item */
+	0,	    /* sq_ass_slice */
+	(objobjproc)Domain_contains,	/* sq_contains */
+};
+
+PyDoc_STRVAR(SDFVolumeDomain__doc__,
+	"Signed distance field volume domain\n\n"
+	"SDFVolume(distances, origin=(0, 0, 0), cell_size=1.0, shape=None)\n\n"
+	"distances -- A buffer of floats sampling the signed distance to the\n"
+	"surface on a regular grid, negative inside. It is indexed by x, y and\n"
+	"z samples, with z varying fastest, and is read in place.\n\n"
+	"origin -- The position of the first sample.\n\n"
+	"cell_size -- The distance between samples.\n\n"
+	"shape -- The number of samples along each axis, if distances is not\n"
+	"a 3 dimensional array.\n\n"
+	"Points are in the volume if they are in the grid, and the distance\n"
+	"interpolated from the samples around them is not positive.");
+
+static PyTypeObject SDFVolumeDomain_Type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"domain.SDFVolume",		/*tp_name*/
+	sizeof(SDFVolumeObject),	/*tp_basicsize*/
+	0,			/*tp_itemsize*/
+	(destructor)SDFVolumeDomain_dealloc, /*tp_dealloc*/
+	0,			/*tp_print*/
+	0,          /*tp_getattr*/
+	0,          /*tp_setattr*/
+	0,			/*tp_compare*/
+	0,			/*tp_repr*/
+	0,			/*tp_as_number*/
+	&SDFVolumeDomain_as_sequence, /*tp_as_sequence*/
+	0,			/*tp_as_mapping*/
+	0,			/*tp_hash*/
+	0,                      /*tp_call*/
+	0,                      /*tp_str*/
+	0,                      /*tp_getattro*/
+	0,                      /*tp_setattro*/
+	0,                      /*tp_as_buffer*/
+	Py_TPFLAGS_DEFAULT,     /*tp_flags*/
+	SDFVolumeDomain__doc__, /*tp_doc*/
+	0,                      /*tp_traverse*/
+	0,                      /*tp_clear*/
+	0,                      /*tp_richcompare*/
+	0,                      /*tp_weaklistoffset*/
+	0,                      /*tp_iter*/
+	0,                      /*tp_iternext*/
+	SDFVolumeDomain_methods,  /*tp_methods*/
+	SDFVolumeDomain_members,  /*tp_members*/
+	SDFVolumeDomain_descriptors, /*tp_getset*/
+	0,                      /*tp_base*/
+	0,                      /*tp_dict*/
+	0,                      /*tp_descr_get*/
+	0,                      /*tp_descr_set*/
+	0,                      /*tp_dictoffset*/
+	(initproc)SDFVolumeDomain_init, /*tp_init*/
+	0,                      /*tp_alloc*/
+	0,                      /*tp_new*/
+	0,                      /*tp_free*/
+	0,                      /*tp_is_gc*/
+};
+
+/* --------------------------------------------------------------------- */
+
+static PyObject *
+domain_seed(PyObject *module, PyObject *seed)
+{
+	PyObject *value;
+	unsigned long s;
+
+	value = PyNumber_Long(seed);
+	if (value == NULL)
+		return NULL;
+	s = PyLong_AsUnsignedLongMask(value);
+	Py_DECREF(value);
+	if (s == (unsigned long)-1 && PyErr_Occurred())
+		return NULL;
+	rand_seed((uint32_t)s);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyMethodDef domain_methods[] = {
+	{"seed", (PyCFunction)domain_seed, METH_O,
+		PyDoc_STR("seed(seed) -> None\n"
+			"Restart the random stream the domains generate points from\n"
+			"with the integer seed")},
+	{NULL}
+};
+
+MOD_INIT(_domain)
+{
+	PyObject *m;
+
+	/* Bind tp_new and tp_alloc here to appease certain compilers */
+	LineDomain_Type.tp_alloc = PyType_GenericAlloc;
+	LineDomain_Type.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&LineDomain_Type) < 0
+		|| !Domain_set_native(&LineDomain_Type, &LineDomain_native))
+		return MOD_ERROR_VAL;
+
+	PlaneDomain_Type.tp_alloc = PyType_GenericAlloc;
+	PlaneDomain_Type.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&PlaneDomain_Type) < 0
+		|| !Domain_set_native(&PlaneDomain_Type, &PlaneDomain_native))
+		return MOD_ERROR_VAL;
+
+	AABoxDomain_Type.tp_alloc = PyType_GenericAlloc;
+	AABoxDomain_Type.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&AABoxDomain_Type) < 0
+		|| !Domain_set_native(&AABoxDomain_Type, &AABoxDomain_native))
+		return MOD_ERROR_VAL;
+
+	SphereDomain_Type.tp_alloc = PyType_GenericAlloc;
+	SphereDomain_Type.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&SphereDomain_Type) < 0
+		|| !Domain_set_native(&SphereDomain_Type, &SphereDomain_native))
+		return MOD_ERROR_VAL;
+
+	DiscDomain_Type.tp_alloc = PyType_GenericAlloc;
+	DiscDomain_Type.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&DiscDomain_Type) < 0
+		|| !Domain_set_native(&DiscDomain_Type, &DiscDomain_native))
+		return MOD_ERROR_VAL;
+
+	CylinderDomain_Type.tp_alloc = PyType_GenericAlloc;
+	CylinderDomain_Type.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&CylinderDomain_Type) < 0
+		|| !Domain_set_native(&CylinderDomain_Type, &CylinderDomain_native))
+		return MOD_ERROR_VAL;
 
 	ConeDomain_Type.tp_alloc = PyType_GenericAlloc;
 	ConeDomain_Type.tp_new = PyType_GenericNew;
-	if (PyType_Ready(&ConeDomain_Type) < 0)
+	if (PyType_Ready(&ConeDomain_Type) < 0
+		|| !Domain_set_native(&ConeDomain_Type, &ConeDomain_native))
+		return MOD_ERROR_VAL;
+
+	UnionDomain_Type.tp_alloc = PyType_GenericAlloc;
+	UnionDomain_Type.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&UnionDomain_Type) < 0
+		|| !Domain_set_native(&UnionDomain_Type, &UnionDomain_native))
+		return MOD_ERROR_VAL;
+
+	IntersectionDomain_Type.tp_alloc = PyType_GenericAlloc;
+	IntersectionDomain_Type.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&IntersectionDomain_Type) < 0
+		|| !Domain_set_native(&IntersectionDomain_Type, &IntersectionDomain_native))
+		return MOD_ERROR_VAL;
+
+	DifferenceDomain_Type.tp_alloc = PyType_GenericAlloc;
+	DifferenceDomain_Type.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&DifferenceDomain_Type) < 0
+		|| !Domain_set_native(&DifferenceDomain_Type, &DifferenceDomain_native))
+		return MOD_ERROR_VAL;
+
+	ObstacleSetDomain_Type.tp_alloc = PyType_GenericAlloc;
+	ObstacleSetDomain_Type.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&ObstacleSetDomain_Type) < 0
+		|| !Domain_set_native(&ObstacleSetDomain_Type, &ObstacleSetDomain_native))
+		return MOD_ERROR_VAL;
+
+	TriangleMeshDomain_Type.tp_alloc = PyType_GenericAlloc;
+	TriangleMeshDomain_Type.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&TriangleMeshDomain_Type) < 0
+		|| !Domain_set_native(&TriangleMeshDomain_Type, &TriangleMeshDomain_native))
+		return MOD_ERROR_VAL;
+
+	SDFVolumeDomain_Type.tp_alloc = PyType_GenericAlloc;
+	SDFVolumeDomain_Type.tp_new = PyType_GenericNew;
+	if (PyType_Ready(&SDFVolumeDomain_Type) < 0
+		|| !Domain_set_native(&SDFVolumeDomain_Type, &SDFVolumeDomain_native))
 		return MOD_ERROR_VAL;
 
 	/* Create the module and add the types */
-	MOD_DEF(m, "_domain", "Spacial domains", NULL);
+	MOD_DEF(m, "_domain", "Spacial domains", domain_methods);
 	if (m == NULL)
 		return MOD_ERROR_VAL;
 
@@ -2642,6 +5852,18 @@ MOD_INIT(_domain)
 	PyModule_AddObject(m, "Cylinder", (PyObject *)&CylinderDomain_Type);
 	Py_INCREF(&ConeDomain_Type);
 	PyModule_AddObject(m, "Cone", (PyObject *)&ConeDomain_Type);
+	Py_INCREF(&UnionDomain_Type);
+	PyModule_AddObject(m, "Union", (PyObject *)&UnionDomain_Type);
+	Py_INCREF(&IntersectionDomain_Type);
+	PyModule_AddObject(m, "Intersection", (PyObject *)&IntersectionDomain_Type);
+	Py_INCREF(&DifferenceDomain_Type);
+	PyModule_AddObject(m, "Difference", (PyObject *)&DifferenceDomain_Type);
+	Py_INCREF(&ObstacleSetDomain_Type);
+	PyModule_AddObject(m, "ObstacleSet", (PyObject *)&ObstacleSetDomain_Type);
+	Py_INCREF(&TriangleMeshDomain_Type);
+	PyModule_AddObject(m, "TriangleMesh", (PyObject *)&TriangleMeshDomain_Type);
+	Py_INCREF(&SDFVolumeDomain_Type);
+	PyModule_AddObject(m, "SDFVolume", (PyObject *)&SDFVolumeDomain_Type);
 
 	rand_seed((unsigned long)time(NULL));
 
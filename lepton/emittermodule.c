@@ -24,6 +24,7 @@
 #include "fastrng.h"
 #include "group.h"
 #include "vector.h"
+#include "domain.h"
 
 static PyTypeObject StaticEmitter_Type;
 
@@ -54,6 +55,8 @@ typedef struct {
 	float time_to_live;
 	PyObject *domain[DISCRETE_COUNT];
 	PyObject *discrete[DISCRETE_COUNT];
+	DomainNative *native[DISCRETE_COUNT]; /* native protocol of each domain */
+	RandState rng; /* random stream of the emitter */
 } StaticEmitterObject;
 
 static void
@@ -68,6 +71,26 @@ Emitter_dealloc(StaticEmitterObject *self) {
 
 #define NO_TTL -1.0f
 
+/* Seed the emitter's random stream from a Python integer. Return true on
+ * success, false with an exception set on failure
+ */
+static int
+Emitter_seed_from(StaticEmitterObject *self, PyObject *seed)
+{
+	PyObject *value;
+	unsigned long s;
+
+	value = PyNumber_Long(seed);
+	if (value == NULL)
+		return 0;
+	s = PyLong_AsUnsignedLongMask(value);
+	Py_DECREF(value);
+	if (s == (unsigned long)-1 && PyErr_Occurred())
+		return 0;
+	rand_state_seed(&self->rng, (uint32_t)s);
+	return 1;
+}
+
 static int
 Emitter_parse_kwargs(StaticEmitterObject *self,
 	PyObject **ptemplate, PyObject **pdeviation, PyObject *kwargs)
@@ -105,6 +128,12 @@ Emitter_parse_kwargs(StaticEmitterObject *self,
 			PyDict_DelItemString(kwargs, "time_to_live");
 		}
 	}
+	value = PyDict_GetItemString(kwargs, "seed");
+	if (value != NULL) {
+		if (value != Py_None && !Emitter_seed_from(self, value))
+			return 0;
+		PyDict_DelItemString(kwargs, "seed");
+	}
 	if (*ptemplate == NULL) {
 		*ptemplate = PyDict_GetItemString(kwargs, "template");
 		if (*ptemplate != NULL) {
@@ -134,6 +163,7 @@ Emitter_parse_kwargs(StaticEmitterObject *self,
 				if (PyObject_HasAttrString(value, "generate")) {
 					Py_INCREF(value);
 					self->domain[i] = value;
+					self->native[i] = Domain_get_native(value);
 				} else if (PySequence_Check(value)) {
 					value = PySequence_Fast(value,
 						"StaticEmitter: Invalid discrete value sequence");
@@ -195,9 +225,12 @@ StaticEmitter_init(StaticEmitterObject *self, PyObject *args, PyObject *kwargs)
 	for (i = 0; i < DISCRETE_COUNT; i++) {
 		self->domain[i] = NULL;
 		self->discrete[i] = NULL;
+		self->native[i] = NULL;
 	}
 	self->rate = -FLT_MAX;
 	self->time_to_live = NO_TTL;
+	/* Unless seeded, each emitter gets its own stream from the default */
+	rand_state_seed(&self->rng, rand_int32());
 	if (!PyArg_ParseTuple(args, "|fOOf:__init__",
 		&self->rate, &ptemplate, &pdeviation, &self->time_to_live))
 		return -1;
@@ -240,15 +273,17 @@ error:
 }
 
 /* Fill in a vector value either from a domain, discrete sequence or template
- * vector value. Return true on success
+ * vector value. Native domains are called directly. Return true on success
  */
 static inline int
-Vec3_fill(Vec3 * __restrict__ vec, PyObject *domain, PyObject *discrete_seq,
-	Vec3 * __restrict__ tmpl)
+Vec3_fill(Vec3 * __restrict__ vec, PyObject *domain, DomainNative *native,
+	PyObject *discrete_seq, Vec3 * __restrict__ tmpl, RandState *rng)
 {
 	PyObject *v = NULL;
 
-	if (domain != NULL) {
+	if (native != NULL) {
+		native->generate(domain, vec, rng);
+	} else if (domain != NULL) {
 		v = PyObject_CallMethod(domain, "generate", NULL);
 		if (v == NULL)
 			return 0;
@@ -259,7 +294,7 @@ Vec3_fill(Vec3 * __restrict__ vec, PyObject *domain, PyObject *discrete_seq,
 		Py_DECREF(v);
 	} else if (discrete_seq != NULL) {
 		v = PySequence_Fast_GET_ITEM(discrete_seq,
-				(Py_ssize_t)(PySequence_Fast_GET_SIZE(discrete_seq) * rand_uni()));
+				(Py_ssize_t)(PySequence_Fast_GET_SIZE(discrete_seq) * rand_state_uni(rng)));
 		if (!Vec3_FromSequence(vec, v))
 			return 0;
 	} else {
@@ -269,15 +304,22 @@ Vec3_fill(Vec3 * __restrict__ vec, PyObject *domain, PyObject *discrete_seq,
 }
 
 /* Fill in a color value either from a domain, discrete sequence or template
- * vector value. Return true on success
+ * vector value. Native domains are called directly. Return true on success
  */
 static inline int
-Color_fill(Color * __restrict__ color, PyObject *domain, PyObject *discrete_seq,
-	Color * __restrict__ tmpl)
+Color_fill(Color * __restrict__ color, PyObject *domain, DomainNative *native,
+	PyObject *discrete_seq, Color * __restrict__ tmpl, RandState *rng)
 {
 	PyObject *v = NULL;
-
-	if (domain != NULL) {
+	Vec3 rgb;
+
+	if (native != NULL) {
+		native->generate(domain, &rgb, rng);
+		color->r = rgb.x;
+		color->g = rgb.y;
+		color->b = rgb.z;
+		color->a = 1.0f;
+	} else if (domain != NULL) {
 		v = PyObject_CallMethod(domain, "generate", NULL);
 		if (v == NULL)
 			return 0;
@@ -288,7 +330,7 @@ Color_fill(Color * __restrict__ color, PyObject *domain, PyObject *discrete_seq,
 		Py_DECREF(v);
 	} else if (discrete_seq != NULL) {
 		v = PySequence_Fast_GET_ITEM(discrete_seq,
-				(Py_ssize_t)(PySequence_Fast_GET_SIZE(discrete_seq) * rand_uni()));
+				(Py_ssize_t)(PySequence_Fast_GET_SIZE(discrete_seq) * rand_state_uni(rng)));
 		if (!Color_FromSequence(color, v))
 			return 0;
 	} else {
@@ -301,7 +343,8 @@ Color_fill(Color * __restrict__ color, PyObject *domain, PyObject *discrete_seq,
  * vector value. Return true on success
  */
 static inline int
-Float_fill(float * f, PyObject *domain, PyObject *discrete_seq, float tmpl)
+Float_fill(float * f, PyObject *domain, PyObject *discrete_seq, float tmpl,
+	RandState *rng)
 {
 	int result = 0;
 	PyObject *v = NULL, *pyfloat = NULL;
@@ -312,7 +355,7 @@ Float_fill(float * f, PyObject *domain, PyObject *discrete_seq, float tmpl)
 			return 0;
 	} else if (discrete_seq != NULL) {
 		v = PySequence_Fast_GET_ITEM(discrete_seq,
-				(Py_ssize_t)(PySequence_Fast_GET_SIZE(discrete_seq) * rand_uni()));
+				(Py_ssize_t)(PySequence_Fast_GET_SIZE(discrete_seq) * rand_state_uni(rng)));
 		Py_INCREF(v);
 	}
 
@@ -331,70 +374,145 @@ Float_fill(float * f, PyObject *domain, PyObject *discrete_seq, float tmpl)
 	return result;
 }
 
-EXTERN_INLINE void
-Vec3_deviate(Vec3 *dest, Vec3 *deviation)
-{
-	dest->x = deviation->x ? rand_norm(dest->x, deviation->x) : dest->x;
-	dest->y = deviation->y ? rand_norm(dest->y, deviation->y) : dest->y;
-	dest->z = deviation->z ? rand_norm(dest->z, deviation->z) : dest->z;
-}
+/* Particle components that may deviate from the template */
+#define DEVIATE_COUNT 21
+
+static const size_t deviate_offsets[DEVIATE_COUNT] = {
+	offsetof(Particle, position.x), offsetof(Particle, position.y),
+	offsetof(Particle, position.z),
+	offsetof(Particle, velocity.x), offsetof(Particle, velocity.y),
+	offsetof(Particle, velocity.z),
+	offsetof(Particle, size.x), offsetof(Particle, size.y),
+	offsetof(Particle, size.z),
+	offsetof(Particle, up.x), offsetof(Particle, up.y),
+	offsetof(Particle, up.z),
+	offsetof(Particle, rotation.x), offsetof(Particle, rotation.y),
+	offsetof(Particle, rotation.z),
+	offsetof(Particle, color.r), offsetof(Particle, color.g),
+	offsetof(Particle, color.b), offsetof(Particle, color.a),
+	offsetof(Particle, age), offsetof(Particle, mass)
+};
 
-EXTERN_INLINE void
-Color_deviate(Color *dest, Color *deviation)
+#define Particle_component(p, offset) (*(float *)((char *)(p) + (offset)))
+
+/* Store the offsets and deviations of the components the emitter's
+ * deviation template varies, returning their number
+ */
+static int
+Emitter_deviates(StaticEmitterObject *self, size_t *offsets, float *sigmas)
 {
-	dest->r = deviation->r ? rand_norm(dest->r, deviation->r) : dest->r;
-	dest->g = deviation->g ? rand_norm(dest->g, deviation->g) : dest->g;
-	dest->b = deviation->b ? rand_norm(dest->b, deviation->b) : dest->b;
-	dest->a = deviation->a ? rand_norm(dest->a, deviation->a) : dest->a;
+	float sigma;
+	int i, count = 0;
+
+	if (!self->has_deviation)
+		return 0;
+	for (i = 0; i < DEVIATE_COUNT; i++) {
+		sigma = Particle_component(&self->pdeviation, deviate_offsets[i]);
+		if (sigma) {
+			offsets[count] = deviate_offsets[i];
+			sigmas[count++] = sigma;
+		}
+	}
+	return count;
 }
 
 /* Populate the values for a particle based on the emitter's domain,
- * discrete and template particle values
+ * discrete and template particle values, before deviation
  */
 static int
 Emitter_make_particle(StaticEmitterObject *self, Particle *p)
 {
+	RandState *rng = &self->rng;
 	int success = (
-		Vec3_fill(&p->position, self->domain[POSITION_I],
-			self->discrete[POSITION_I], &self->ptemplate.position) &&
-		Vec3_fill(&p->velocity, self->domain[VELOCITY_I],
-			self->discrete[VELOCITY_I], &self->ptemplate.velocity) &&
-		Vec3_fill(&p->size, self->domain[SIZE_I],
-			self->discrete[SIZE_I], &self->ptemplate.size) &&
-		Vec3_fill(&p->up, self->domain[UP_I],
-			self->discrete[UP_I], &self->ptemplate.up) &&
-		Vec3_fill(&p->rotation, self->domain[ROTATION_I],
-			self->discrete[ROTATION_I], &self->ptemplate.rotation) &&
-		Color_fill(&p->color, self->domain[COLOR_I],
-			self->discrete[COLOR_I], &self->ptemplate.color) &&
+		Vec3_fill(&p->position, self->domain[POSITION_I], self->native[POSITION_I],
+			self->discrete[POSITION_I], &self->ptemplate.position, rng) &&
+		Vec3_fill(&p->velocity, self->domain[VELOCITY_I], self->native[VELOCITY_I],
+			self->discrete[VELOCITY_I], &self->ptemplate.velocity, rng) &&
+		Vec3_fill(&p->size, self->domain[SIZE_I], self->native[SIZE_I],
+			self->discrete[SIZE_I], &self->ptemplate.size, rng) &&
+		Vec3_fill(&p->up, self->domain[UP_I], self->native[UP_I],
+			self->discrete[UP_I], &self->ptemplate.up, rng) &&
+		Vec3_fill(&p->rotation, self->domain[ROTATION_I], self->native[ROTATION_I],
+			self->discrete[ROTATION_I], &self->ptemplate.rotation, rng) &&
+		Color_fill(&p->color, self->domain[COLOR_I], self->native[COLOR_I],
+			self->discrete[COLOR_I], &self->ptemplate.color, rng) &&
 		Float_fill(&p->age, self->domain[AGE_I],
-			self->discrete[AGE_I], self->ptemplate.age) &&
+			self->discrete[AGE_I], self->ptemplate.age, rng) &&
 		Float_fill(&p->mass, self->domain[MASS_I],
-			self->discrete[MASS_I], self->ptemplate.mass));
-	if (!success)
-		return 0;
-	if (self->has_deviation) {
-		Vec3_deviate(&p->position, &self->pdeviation.position);
-		Vec3_deviate(&p->velocity, &self->pdeviation.velocity);
-		Vec3_deviate(&p->size, &self->pdeviation.size);
-		Vec3_deviate(&p->up, &self->pdeviation.up);
-		Vec3_deviate(&p->rotation, &self->pdeviation.rotation);
-		Color_deviate(&p->color, &self->pdeviation.color);
-		p->age = self->pdeviation.age ? rand_norm(p->age, self->pdeviation.age) : p->age;
-		p->mass = self->pdeviation.mass ? rand_norm(p->mass, self->pdeviation.mass) : p->mass;
-	}
-	if (p->age < 0)
-		p->age = 0;
+			self->discrete[MASS_I], self->ptemplate.mass, rng));
+	return success;
+}
+
+/* Number of particles whose deviations are sampled at once */
+#define DEVIATE_BLOCK 64
+
+/* Make new particles to fill the count slots starting at pindex, which were
+ * previously allocated with Group_new_n(). Return true on success, false on
+ * failure with an exception set. On failure the slots not filled are killed
+ * so that they are reclaimed at the next update.
+ */
+static int
+Emitter_fill_particles(StaticEmitterObject *self, GroupObject *pgroup,
+	unsigned long pindex, unsigned long count)
+{
+	Particle p;
+	size_t offsets[DEVIATE_COUNT];
+	float sigmas[DEVIATE_COUNT];
+	float normals[DEVIATE_BLOCK * DEVIATE_COUNT], *z = normals;
+	unsigned long i, block;
+	int j, deviates;
+
+	/* The deviations of a block of particles are drawn in one bulk call */
+	deviates = Emitter_deviates(self, offsets, sigmas);
+	for (i = 0; i < count; i++) {
+		if (deviates && i % DEVIATE_BLOCK == 0) {
+			block = count - i < DEVIATE_BLOCK ? count - i : DEVIATE_BLOCK;
+			rand_state_norm_n(&self->rng, normals, block * deviates, 0.0f, 1.0f);
+			z = normals;
+		}
+		memset(&p, 0, sizeof(Particle));
+		if (!Emitter_make_particle(self, &p)) {
+			Group_lock(pgroup);
+			for (; i < count; i++)
+				Group_kill_p(pgroup, pindex + i);
+			Group_unlock(pgroup);
+			return 0;
+		}
+		for (j = 0; j < deviates; j++)
+			Particle_component(&p, offsets[j]) += sigmas[j] * *z++;
+		if (p.age < 0)
+			p.age = 0;
+		Group_store_p(pgroup, pindex + i, &p);
+	}
 	return 1;
 }
 
+/* Make count new particles and add them to the group, allocating all of
+ * their slots at once. Return true on success, false on failure with an
+ * exception set
+ */
+static int
+Emitter_add_particles(StaticEmitterObject *self, GroupObject *pgroup,
+	unsigned long count)
+{
+	long pindex;
+
+	if (count == 0)
+		return 1;
+	Group_lock(pgroup);
+	pindex = Group_new_n(pgroup, count);
+	Group_unlock(pgroup);
+	if (pindex < 0)
+		return 0;
+	return Emitter_fill_particles(self, pgroup, pindex, count);
+}
+
 static PyObject *
 StaticEmitter_call(StaticEmitterObject *self, PyObject *args)
 {
 	float td;
 	GroupObject *pgroup;
 	float count;
-	long pindex;
 	PyObject *result;
 
 	if (!PyArg_ParseTuple(args, "fO:__init__", &td, &pgroup))
@@ -420,20 +538,11 @@ StaticEmitter_call(StaticEmitterObject *self, PyObject *args)
 	count = td * self->rate + self->partial;
 	result = PyInt_FromLong((long)count);
 
-	while (count >= 1.0f) {
-		pindex = Group_new_p(pgroup);
-		if (pindex < 0) {
-			PyErr_NoMemory();
-			Py_DECREF(result);
-			return NULL;
-		}
-		if (!Emitter_make_particle(self, &pgroup->plist->p[pindex])) {
-			Py_DECREF(result);
-			return NULL;
-		}
-		count--;
+	if (!Emitter_add_particles(self, pgroup, (unsigned long)count)) {
+		Py_DECREF(result);
+		return NULL;
 	}
-	self->partial = count;
+	self->partial = count - (float)(unsigned long)count;
 
 	return result;
 }
@@ -443,7 +552,6 @@ Emitter_emit(StaticEmitterObject *self, PyObject *args)
 {
 	long count;
 	GroupObject *pgroup;
-	long pindex;
 
 	if (!PyArg_ParseTuple(args, "lO:emit", &count, &pgroup))
 		return NULL;
@@ -456,17 +564,18 @@ Emitter_emit(StaticEmitterObject *self, PyObject *args)
 	if (count < 0)
         count = 0;
 
-	for (; count > 0; count--) {
-		pindex = Group_new_p(pgroup);
-		if (pindex < 0) {
-			PyErr_NoMemory();
-			return NULL;
-		}
-		if (!Emitter_make_particle(self, &pgroup->plist->p[pindex])) {
-			return NULL;
-		}
-	}
+	if (!Emitter_add_particles(self, pgroup, count))
+		return NULL;
+
+	Py_INCREF(Py_None);
+	return Py_None;
+}
 
+static PyObject *
+Emitter_seed(StaticEmitterObject *self, PyObject *seed)
+{
+	if (!Emitter_seed_from(self, seed))
+		return NULL;
 	Py_INCREF(Py_None);
 	return Py_None;
 }
@@ -485,6 +594,11 @@ static PyMethodDef StaticEmitter_methods[] = {
 			"Emit count new particles into the group specified.\n"
 			"This call is not affected by the emitter rate or\n"
 			"time to live values.")},
+	{"seed", (PyCFunction)Emitter_seed, METH_O,
+		PyDoc_STR("seed(seed) -> None\n"
+			"Restart the emitter's random stream from the integer seed.\n"
+			"Emitters with the same seed and settings emit the same\n"
+			"particles, as long as their domains do too.")},
 	{NULL,		NULL}		/* sentinel */
 };
 
@@ -493,9 +607,9 @@ StaticEmitter_getattr(StaticEmitterObject *self, PyObject *o)
 {
 	char *name = PyString_AS_STRING(o);
 	if (!strcmp(name, "template")) {
-		return (PyObject *)ParticleRefObject_New(NULL, &self->ptemplate);
+		return (PyObject *)ParticleRefObject_FromStruct(NULL, &self->ptemplate);
 	} else if (!strcmp(name, "deviation")) {
-		return (PyObject *)ParticleRefObject_New(NULL, &self->ptemplate);
+		return (PyObject *)ParticleRefObject_FromStruct(NULL, &self->ptemplate);
 	} else if (!strcmp(name, "rate")) {
 		return PyMember_GetOne((char *)self, &StaticEmitter_members[0]);
 	} else if (!strcmp(name, "time_to_live")) {
@@ -509,7 +623,8 @@ PyDoc_STRVAR(StaticEmitter__doc__,
 	"Creates particles in a group at a fixed rate deriving particle\n"
 	"attributes from a configurable mix of domain, discrete value lists\n"
 	"and fixed template particles plus random deviation\n\n"
-	"StaticEmitter(rate, template=None, deviation=None, time_to_live=None, **discrete)\n\n"
+	"StaticEmitter(rate, template=None, deviation=None, time_to_live=None,\n"
+	"    seed=None, **discrete)\n\n"
 	"rate -- Emission rate in particles per unit time.\n\n"
 	"template -- A Particle instance used as the basis (mathematical\n"
 	"average) for the emitted particles' attributes for attributes\n"
@@ -528,7 +643,10 @@ PyDoc_STRVAR(StaticEmitter__doc__,
 	"any object with a generate() method returning values).  This allows you\n"
 	"to specify a discrete range of values that will be used uniformly for\n"
 	"a particular attribute. Note the discrete values are still randomized\n"
-	"by the deviation template the same way as the template values.");
+	"by the deviation template the same way as the template values.\n\n"
+	"seed -- If specified, the integer seed of the emitter's random\n"
+	"stream, which makes the particles emitted reproducible. Otherwise\n"
+	"the stream is seeded from the module's random stream.");
 
 static PyTypeObject StaticEmitter_Type = {
 	/* The ob_type field must be initialized in the module init function
@@ -590,6 +708,8 @@ typedef struct {
 	float time_to_live;
 	PyObject *domain[DISCRETE_COUNT];
 	PyObject *discrete[DISCRETE_COUNT];
+	DomainNative *native[DISCRETE_COUNT]; /* native protocol of each domain */
+	RandState rng; /* random stream of the emitter */
 	GroupObject *source_group;
 } PerParticleEmitterObject;
 
@@ -602,9 +722,11 @@ PerParticleEmitter_init(PerParticleEmitterObject *self, PyObject *args, PyObject
 	for (i = 0; i < DISCRETE_COUNT; i++) {
 		self->domain[i] = NULL;
 		self->discrete[i] = NULL;
+		self->native[i] = NULL;
 	}
 	self->rate = -FLT_MAX;
 	self->time_to_live = NO_TTL;
+	rand_state_seed(&self->rng, rand_int32());
 	if (!PyArg_ParseTuple(args, "O|fOOf:__init__",
 		&self->source_group, &self->rate, &ptemplate, &pdeviation, &self->time_to_live))
 		return -1;
@@ -649,15 +771,63 @@ error:
 	return 1;
 }
 
+/* Emit count particles at the position of each live particle in the
+ * source group into pgroup, allocating all of the slots at once. Return the
+ * number of source particles, or -1 on failure with an exception set.
+ * Source particles are addressed by index since adding particles may
+ * reallocate the source group if it is also the target.
+ */
+static long
+PerParticleEmitter_add_particles(PerParticleEmitterObject *self,
+	GroupObject *pgroup, unsigned long count)
+{
+	GroupObject *source = self->source_group;
+	unsigned long i, pcount, sources;
+	long pindex, next;
+
+	if (!Group_require(source, PATTR_BIT(PATTR_POSITION),
+		"PerParticleEmitter source group"))
+		return -1;
+	pcount = GroupObject_ActiveCount(source);
+	sources = 0;
+	for (i = 0; i < pcount; i++) {
+		if (Group_IsAlive(source, i))
+			sources++;
+	}
+	if (sources == 0 || count == 0)
+		return sources;
+
+	Group_lock(pgroup);
+	pindex = Group_new_n(pgroup, sources * count);
+	Group_unlock(pgroup);
+	if (pindex < 0)
+		return -1;
+	next = pindex;
+	for (i = 0; i < pcount; i++) {
+		if (Group_IsAlive(source, i)) {
+			Vec3_copy(&self->ptemplate.position,
+				Group_Vec3(source, PATTR_POSITION, i));
+			if (!Emitter_fill_particles((StaticEmitterObject *)self, pgroup,
+				next, count)) {
+				Group_lock(pgroup);
+				for (next += count; next < pindex + (long)(sources * count); next++)
+					Group_kill_p(pgroup, next);
+				Group_unlock(pgroup);
+				return -1;
+			}
+			next += count;
+		}
+	}
+	return sources;
+}
+
 static PyObject *
 PerParticleEmitter_call(PerParticleEmitterObject *self, PyObject *args)
 {
 	float td;
 	GroupObject *pgroup;
-	float count, remaining;
-	long pindex, total = 0;
-	Particle *p;
-	unsigned long pcount;
+	float count;
+	long sources, total = 0;
 	PyObject *result;
 
 	if (!PyArg_ParseTuple(args, "fO:__init__", &td, &pgroup))
@@ -681,36 +851,17 @@ PerParticleEmitter_call(PerParticleEmitterObject *self, PyObject *args)
 		}
 	}
 	count = td * self->rate + self->partial;
-	remaining = count;
 
 	if (count >= 1.0f) {
-		p = self->source_group->plist->p;
-		pcount = GroupObject_ActiveCount(self->source_group);
-
-		while (pcount--) {
-			if (Particle_IsAlive(*p)) {
-				remaining = count;
-				Vec3_copy(&self->ptemplate.position, &p->position);
-
-				while (remaining >= 1.0f) {
-					pindex = Group_new_p(pgroup);
-					if (pindex < 0) {
-						PyErr_NoMemory();
-						return NULL;
-					}
-					if (!Emitter_make_particle(
-						(StaticEmitterObject *)self, &pgroup->plist->p[pindex]))
-						return NULL;
-					remaining--;
-				}
-				total += (long)count;
-			}
-			p++;
-		}
-		self->partial = remaining;
-	} else {
-		self->partial = count;
+		sources = PerParticleEmitter_add_particles(self, pgroup,
+			(unsigned long)count);
+		if (sources < 0)
+			return NULL;
+		total = sources * (long)count;
+		if (sources > 0)
+			count -= (float)(unsigned long)count;
 	}
+	self->partial = count;
 
 	return PyInt_FromLong(total);
 }
@@ -718,11 +869,8 @@ PerParticleEmitter_call(PerParticleEmitterObject *self, PyObject *args)
 static PyObject *
 PerParticleEmitter_emit(PerParticleEmitterObject *self, PyObject *args)
 {
-	long count, remaining;
-	unsigned long pcount;
+	long count;
 	GroupObject *pgroup;
-	Particle *p;
-	long pindex;
 
 	if (!PyArg_ParseTuple(args, "lO:emit", &count, &pgroup))
 		return NULL;
@@ -735,25 +883,8 @@ PerParticleEmitter_emit(PerParticleEmitterObject *self, PyObject *args)
 	if (count <= 0)
         count = 0;
 
-	p = self->source_group->plist->p;
-	pcount = GroupObject_ActiveCount(self->source_group);
-
-	for (; pcount > 0; pcount--, p++) {
-		if (Particle_IsAlive(*p)) {
-			Vec3_copy(&self->ptemplate.position, &p->position);
-			for (remaining = count; remaining > 0; remaining--) {
-				pindex = Group_new_p(pgroup);
-				if (pindex < 0) {
-					PyErr_NoMemory();
-					return NULL;
-				}
-				if (!Emitter_make_particle(
-					(StaticEmitterObject *)self, &pgroup->plist->p[pindex])) {
-					return NULL;
-				}
-			}
-		}
-	}
+	if (PerParticleEmitter_add_particles(self, pgroup, count) < 0)
+		return NULL;
 
 	Py_INCREF(Py_None);
 	return Py_None;
@@ -775,6 +906,9 @@ static PyMethodDef PerParticleEmitter_methods[] = {
 			"Emit count new particles per source particle into the\n"
 			"group specified. This call is not affected by the emitter\n"
 			"rate or time to live values.")},
+	{"seed", (PyCFunction)Emitter_seed, METH_O,
+		PyDoc_STR("seed(seed) -> None\n"
+			"Restart the emitter's random stream from the integer seed.")},
 	{NULL,		NULL}		/* sentinel */
 };
 
@@ -783,9 +917,9 @@ PerParticleEmitter_getattr(PerParticleEmitterObject *self, PyObject *o)
 {
 	char *name = PyString_AS_STRING(o);
 	if (!strcmp(name, "template")) {
-		return (PyObject *)ParticleRefObject_New(NULL, &self->ptemplate);
+		return (PyObject *)ParticleRefObject_FromStruct(NULL, &self->ptemplate);
 	} else if (!strcmp(name, "deviation")) {
-		return (PyObject *)ParticleRefObject_New(NULL, &self->ptemplate);
+		return (PyObject *)ParticleRefObject_FromStruct(NULL, &self->ptemplate);
 	} else if (!strcmp(name, "rate")) {
 		return PyMember_GetOne((char *)self, &PerParticleEmitter_members[0]);
 	} else if (!strcmp(name, "time_to_live")) {
@@ -803,7 +937,7 @@ PyDoc_STRVAR(PerParticleEmitter__doc__,
 	"of source particle, domain, discrete value lists and fixed template \n"
 	"particles plus random deviation\n\n"
 	"PerParticleEmitter(source_group, rate, template=None, deviation=None,\n"
-	"    time_to_live=None, **discrete)\n\n"
+	"    time_to_live=None, seed=None, **discrete)\n\n"
 	"source_group -- Source particles used as templates for new particles\n"
 	"rate -- Emission rate in particles per unit time.\n\n"
 	"template -- A Particle instance used as the basis (mathematical\n"
@@ -823,7 +957,10 @@ PyDoc_STRVAR(PerParticleEmitter__doc__,
 	"any object with a generate() method returning values).  This allows you\n"
 	"to specify a discrete range of values that will be used uniformly for\n"
 	"a particular attribute. Note the discrete values are still randomized\n"
-	"by the deviation template the same way as the template values.");
+	"by the deviation template the same way as the template values.\n\n"
+	"seed -- If specified, the integer seed of the emitter's random\n"
+	"stream, which makes the particles emitted reproducible. Otherwise\n"
+	"the stream is seeded from the module's random stream.");
 
 static PyTypeObject PerParticleEmitter_Type = {
 	/* The ob_type field must be initialized in the module init function
@@ -873,6 +1010,123 @@ static PyTypeObject PerParticleEmitter_Type = {
 
 /* --------------------------------------------------------------------- */
 
+static PyObject *
+emitter_seed(PyObject *module, PyObject *seed)
+{
+	PyObject *value;
+	unsigned long s;
+
+	value = PyNumber_Long(seed);
+	if (value == NULL)
+		return NULL;
+	s = PyLong_AsUnsignedLongMask(value);
+	Py_DECREF(value);
+	if (s == (unsigned long)-1 && PyErr_Occurred())
+		return NULL;
+	rand_seed((uint32_t)s);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+/* Get a writable C-contiguous buffer of floats from obj. Return true on
+ * success, false with an exception set on failure */
+static int
+emitter_get_float_buffer(PyObject *obj, Py_buffer *buf, const char *name)
+{
+	const char *format;
+
+	if (PyObject_GetBuffer(obj, buf,
+		PyBUF_WRITABLE | PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) < 0)
+		return 0;
+	format = buf->format;
+	if (format != NULL && (*format == '@' || *format == '='))
+		format++;
+	if (format == NULL || strcmp(format, "f") || buf->itemsize != sizeof(float)) {
+		PyErr_Format(PyExc_TypeError, "%s: expected a buffer of floats", name);
+		PyBuffer_Release(buf);
+		return 0;
+	}
+	return 1;
+}
+
+static PyObject *
+emitter_fill_uniform(PyObject *module, PyObject *args)
+{
+	PyObject *out;
+	Py_buffer buf;
+
+	if (!PyArg_ParseTuple(args, "O:fill_uniform", &out))
+		return NULL;
+	if (!emitter_get_float_buffer(out, &buf, "fill_uniform"))
+		return NULL;
+	rand_uni_n((float *)buf.buf, buf.len / sizeof(float));
+	PyBuffer_Release(&buf);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+emitter_fill_normal(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	static char *kwlist[] = {"out", "mu", "sigma", NULL};
+	PyObject *out;
+	Py_buffer buf;
+	float mu = 0.0f, sigma = 1.0f;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ff:fill_normal", kwlist,
+		&out, &mu, &sigma))
+		return NULL;
+	if (!emitter_get_float_buffer(out, &buf, "fill_normal"))
+		return NULL;
+	rand_norm_n((float *)buf.buf, buf.len / sizeof(float), mu, sigma);
+	PyBuffer_Release(&buf);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+emitter_fill_exponential(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	static char *kwlist[] = {"out", "mu", NULL};
+	PyObject *out;
+	Py_buffer buf;
+	float mu = 1.0f;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|f:fill_exponential",
+		kwlist, &out, &mu))
+		return NULL;
+	if (!emitter_get_float_buffer(out, &buf, "fill_exponential"))
+		return NULL;
+	rand_expo_n((float *)buf.buf, buf.len / sizeof(float), mu);
+	PyBuffer_Release(&buf);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyMethodDef emitter_methods[] = {
+	{"seed", (PyCFunction)emitter_seed, METH_O,
+		PyDoc_STR("seed(seed) -> None\n"
+			"Restart the random stream that seeds the streams of emitters\n"
+			"created without a seed with the integer seed")},
+	{"fill_uniform", (PyCFunction)emitter_fill_uniform, METH_VARARGS,
+		PyDoc_STR("fill_uniform(out) -> None\n"
+			"Fill the writable buffer of floats out, such as an\n"
+			"array.array('f'), with random numbers uniformly distributed\n"
+			"in the interval (0, 1]")},
+	{"fill_normal", (PyCFunction)emitter_fill_normal,
+		METH_VARARGS | METH_KEYWORDS,
+		PyDoc_STR("fill_normal(out, mu=0.0, sigma=1.0) -> None\n"
+			"Fill the writable buffer of floats out with normally\n"
+			"distributed random numbers of mean mu and standard\n"
+			"deviation sigma")},
+	{"fill_exponential", (PyCFunction)emitter_fill_exponential,
+		METH_VARARGS | METH_KEYWORDS,
+		PyDoc_STR("fill_exponential(out, mu=1.0) -> None\n"
+			"Fill the writable buffer of floats out with exponentially\n"
+			"distributed random numbers of mean mu")},
+	{NULL}
+};
+
 MOD_INIT(emitter)
 {
 	PyObject *m;
@@ -889,7 +1143,7 @@ MOD_INIT(emitter)
 		return MOD_ERROR_VAL;
 
 	/* Create the module and add the types */
-	MOD_DEF(m, "emitter", "Particle Emitters", NULL);
+	MOD_DEF(m, "emitter", "Particle Emitters", emitter_methods);
 	if (m == NULL)
 		return MOD_ERROR_VAL;
 
@@ -33,9 +33,11 @@
    independent, while 32 successive truly random 32-bit
    integers, viewed as binary vectors, will be linearly
    independent only about 29% of the time.
+
+   Callers declare jz for its temporary value.
 */
-static uint32_t jz, jsr=123456789;
-#define SHR3 (jz=jsr, jsr^=(jsr<<13), jsr^=(jsr>>17), jsr^=(jsr<<5),jz+jsr)
+#define SHR3(s) (jz=(s)->jsr, (s)->jsr^=((s)->jsr<<13), (s)->jsr^=((s)->jsr>>17), \
+	(s)->jsr^=((s)->jsr<<5), jz+(s)->jsr)
 
 /*
    The MWC generator concatenates two 16-bit multiply-
@@ -43,10 +45,9 @@ static uint32_t jz, jsr=123456789;
    y(n)=18000y(n-1)+carry mod 2^16, has period about
    2^60 and seems to pass all tests of randomness
 */
-static uint32_t z=362436069, w=521288629;
-#define znew (z=36969*(z&65535)+(z>>16))
-#define wnew (w=18000*(w&65535)+(w>>16))
-#define MWC ((znew<<16)+wnew )
+#define znew(s) ((s)->z=36969*((s)->z&65535)+((s)->z>>16))
+#define wnew(s) ((s)->w=18000*((s)->w&65535)+((s)->w>>16))
+#define MWC(s) ((znew(s)<<16)+wnew(s))
 
 /*
    CONG is a congruential generator with the widely used 69069
@@ -54,17 +55,20 @@ static uint32_t z=362436069, w=521288629;
    2^32. The leading half of its 32 bits seem to pass
    tests, but bits in the last half are too regular.
 */
-static uint32_t jcong=380116160;
-#define CONG (jcong=69069*jcong+1234567)
+#define CONG(s) ((s)->jcong=69069*(s)->jcong+1234567)
+
+/* The stream used by the functions without explicit state */
+static RandState rand_default = {123456789, 362436069, 521288629, 380116160};
 
 static uint32_t kn[128], ke[256];
 static float wn[128], fn[128], we[256], fe[256];
+static int tables_ready = 0;
 
 /*
-	Set the random number seed and initialize the ziggurat tables
+	Initialize the ziggurat tables, once
 */
-void
-rand_seed(uint32_t s) 
+static void
+rand_init_tables(void)
 {
 	const double m1 = 2147483648.0, m2 = 4294967296.;
 	double dn = 3.442619855899, tn=dn, vn = 9.91256303526217e-3;
@@ -72,11 +76,8 @@ rand_seed(uint32_t s)
 	double q;
 	int i;
 
-	/* Seed RNGs */
-	jsr = s;
-	z = SHR3;
-	w = SHR3;
-	jcong = SHR3;
+	if (tables_ready)
+		return;
 
 	/* Setup ziggurat tables for rand_norm() */
 	q = vn / exp(-.5 * dn*dn);
@@ -115,6 +116,64 @@ rand_seed(uint32_t s)
 		fe[i] = (float)exp(-de);
 		we[i] = (float)(de / m2);
 	}
+	tables_ready = 1;
+}
+
+/*
+	Scramble the bits of x, so that similar seeds give unrelated streams
+*/
+static uint32_t
+rand_mix(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352dU;
+	x ^= x >> 15;
+	x *= 0x846ca68bU;
+	x ^= x >> 16;
+	return x;
+}
+
+/*
+	Set the random number seed and initialize the ziggurat tables
+*/
+void
+rand_seed(uint32_t s) 
+{
+	rand_state_seed(&rand_default, s);
+}
+
+void
+rand_state_seed(RandState *state, uint32_t s)
+{
+	uint32_t jz;
+	int i, j;
+
+	rand_init_tables();
+	/* None of the generators may start from zero, or they stay there */
+	state->jsr = rand_mix(s);
+	if (state->jsr == 0)
+		state->jsr = 123456789;
+	state->z = SHR3(state);
+	state->w = SHR3(state);
+	state->jcong = SHR3(state);
+	if (state->z == 0)
+		state->z = 362436069;
+	if (state->w == 0)
+		state->w = 521288629;
+	/* xoshiro128+ may not start from all zero words */
+	for (i = 0; i < RAND_LANES; i++) {
+		for (j = 0; j < 4; j++)
+			state->lane[j][i] = rand_state_int32(state);
+		if ((state->lane[0][i] | state->lane[1][i]
+			| state->lane[2][i] | state->lane[3][i]) == 0)
+			state->lane[0][i] = i + 1;
+	}
+}
+
+RandState *
+rand_default_state(void)
+{
+	return &rand_default;
 }
 
 /*
@@ -125,19 +184,33 @@ rand_seed(uint32_t s)
    the congruential generator CONG, using addition and
    exclusive-or. Period about 2^123.
 */
+uint32_t
+rand_state_int32(RandState *state)
+{
+	uint32_t jz;
+
+	return (MWC(state) ^ CONG(state)) + SHR3(state);
+}
+
 inline uint32_t 
 rand_int32(void) 
 {
-	return (MWC ^ CONG) + SHR3;
+	return rand_state_int32(&rand_default);
 }
 
 /*
 	Generate a random number with uniform distribution in the interval (0, 1.0]
 */
+float
+rand_state_uni(RandState *state)
+{
+	return 0.5f + (signed)rand_state_int32(state) * .2328306e-9f;
+}
+
 inline float
 rand_uni(void) 
 {
-	return 0.5f + (signed)((MWC ^ CONG) + SHR3) * .2328306e-9f;
+	return rand_state_uni(&rand_default);
 }
 
 #define RIGHT_TAIL 3.442620f
@@ -151,7 +224,7 @@ rand_uni(void)
 	expected from the theory, but performance is still excellent.
 */
 static float
-norm_outlier(int32_t hz, int32_t iz)
+norm_outlier(RandState *state, int32_t hz, int32_t iz)
 {
 	float x, y;
 
@@ -162,18 +235,18 @@ norm_outlier(int32_t hz, int32_t iz)
 		/* handle the base strip */
 		if (iz == 0) {
 			do { 
-				x = -logf(rand_uni()) * ONE_OVER_RIGHT_TAIL; 
-				y = -logf(rand_uni());
+				x = -logf(rand_state_uni(state)) * ONE_OVER_RIGHT_TAIL; 
+				y = -logf(rand_state_uni(state));
 			} while (y + y < x * x);
 			return (hz > 0) ? RIGHT_TAIL + x : -RIGHT_TAIL - x;
 		}
 
 		/* handle the wedges of other strips */
-		if (fn[iz] + rand_uni()*(fn[iz-1] - fn[iz]) < expf(-0.5f * x*x)) 
+		if (fn[iz] + rand_state_uni(state)*(fn[iz-1] - fn[iz]) < expf(-0.5f * x*x)) 
 			return x;
 
 		/* Try again from the top and see if we can exit */
-		hz = rand_int32();
+		hz = rand_state_int32(state);
 		iz = hz & 127;
 		if ((uint32_t)labs(hz) < kn[iz]) 
 			return hz * wn[iz];
@@ -186,12 +259,18 @@ norm_outlier(int32_t hz, int32_t iz)
 
 	mu is the mean and sigma is the std deviation
 */
+float
+rand_state_norm(RandState *state, const float mu, const float sigma)
+{
+	int32_t hz = rand_state_int32(state);
+	int32_t iz = hz & 127;
+	return mu + (((uint32_t)labs(hz) < kn[iz]) ? hz * wn[iz] : norm_outlier(state, hz, iz)) * sigma;
+}
+
 inline float
 rand_norm(const float mu, const float sigma)
 {
-	int32_t hz = rand_int32();
-	int32_t iz = hz & 127;
-	return mu + (((uint32_t)labs(hz) < kn[iz]) ? hz * wn[iz] : norm_outlier(hz, iz)) * sigma;
+	return rand_state_norm(&rand_default, mu, sigma);
 }
 
 /*
@@ -202,21 +281,21 @@ rand_norm(const float mu, const float sigma)
 	expected from the theory
 */
 static float
-expo_outlier(uint32_t hz, uint32_t iz)
+expo_outlier(RandState *state, uint32_t hz, uint32_t iz)
 {
 	float x;
 
 	for(;;)
 	{
 		if (iz == 0) 
-			return 7.69711f - logf(rand_uni());
+			return 7.69711f - logf(rand_state_uni(state));
 
-		 x = jz * we[iz]; 
-		 if (fe[iz] + rand_uni()*(fe[iz-1] - fe[iz]) < expf(-x)) 
+		 x = hz * we[iz]; 
+		 if (fe[iz] + rand_state_uni(state)*(fe[iz-1] - fe[iz]) < expf(-x)) 
 		 	return x;
 
 		/* Try again from the top and see if we can exit */
-		hz = rand_int32();
+		hz = rand_state_int32(state);
 		iz = hz & 255;
 		if (hz < ke[iz]) 
 			return hz * we[iz];
@@ -229,11 +308,116 @@ expo_outlier(uint32_t hz, uint32_t iz)
 
 	mu is the desired mean.
 */
+float
+rand_state_expo(RandState *state, const float mu)
+{
+	uint32_t hz = rand_state_int32(state);
+	uint32_t iz = hz & 255;
+	return ((hz < ke[iz]) ? hz * we[iz] : expo_outlier(state, hz, iz)) * mu;
+}
+
 inline float
 rand_expo(const float mu)
 {
-	uint32_t hz = rand_int32();
-	uint32_t iz = hz & 255;
-	return ((hz < ke[iz]) ? hz * we[iz] : expo_outlier(hz, iz)) * mu;
+	return rand_state_expo(&rand_default, mu);
+}
+
+/*
+	Advance the xoshiro128+ generator of each lane, storing their outputs
+	in r. The top 24 bits of xoshiro128+ outputs are the strongest, which
+	are all the float conversions below use.
+*/
+static inline void
+rand_lanes_next(RandState *state, uint32_t r[RAND_LANES])
+{
+	uint32_t *s0 = state->lane[0], *s1 = state->lane[1];
+	uint32_t *s2 = state->lane[2], *s3 = state->lane[3];
+	uint32_t t;
+	int i;
+
+	for (i = 0; i < RAND_LANES; i++) {
+		r[i] = s0[i] + s3[i];
+		t = s1[i] << 9;
+		s2[i] ^= s0[i];
+		s3[i] ^= s1[i];
+		s1[i] ^= s2[i];
+		s0[i] ^= s3[i];
+		s2[i] ^= t;
+		s3[i] = (s3[i] << 11) | (s3[i] >> 21);
+	}
+}
+
+/* Convert the top 24 bits of r to a float in the interval (0, 1.0] */
+#define RAND_UNIT(r) ((float)(((r) >> 8) + 1) * (1.0f / 16777216.0f))
+
+void
+rand_state_uni_n(RandState *state, float *out, unsigned long n)
+{
+	uint32_t r[RAND_LANES];
+	unsigned long i;
+	int j;
+
+	for (i = 0; i + RAND_LANES <= n; i += RAND_LANES) {
+		rand_lanes_next(state, r);
+		for (j = 0; j < RAND_LANES; j++)
+			out[i + j] = RAND_UNIT(r[j]);
+	}
+	if (i < n) {
+		rand_lanes_next(state, r);
+		for (j = 0; i + j < n; j++)
+			out[i + j] = RAND_UNIT(r[j]);
+	}
+}
+
+#define TWO_PI 6.2831853f
+
+void
+rand_state_norm_n(RandState *state, float *out, unsigned long n,
+	const float mu, const float sigma)
+{
+	float pair[2], r, a;
+	unsigned long i, even = n & ~1UL;
+
+	/* Each pair of uniform samples transforms to a pair of normal ones */
+	rand_state_uni_n(state, out, even);
+	for (i = 0; i < even; i += 2) {
+		r = sqrtf(-2.0f * logf(out[i])) * sigma;
+		a = TWO_PI * out[i + 1];
+		out[i] = mu + r * cosf(a);
+		out[i + 1] = mu + r * sinf(a);
+	}
+	if (even < n) {
+		rand_state_uni_n(state, pair, 2);
+		out[even] = mu + sqrtf(-2.0f * logf(pair[0])) * cosf(TWO_PI * pair[1])
+			* sigma;
+	}
+}
+
+void
+rand_state_expo_n(RandState *state, float *out, unsigned long n,
+	const float mu)
+{
+	unsigned long i;
+
+	rand_state_uni_n(state, out, n);
+	for (i = 0; i < n; i++)
+		out[i] = -logf(out[i]) * mu;
+}
+
+void
+rand_uni_n(float *out, unsigned long n)
+{
+	rand_state_uni_n(&rand_default, out, n);
+}
+
+void
+rand_norm_n(float *out, unsigned long n, const float mu, const float sigma)
+{
+	rand_state_norm_n(&rand_default, out, n, mu, sigma);
 }
 
+void
+rand_expo_n(float *out, unsigned long n, const float mu)
+{
+	rand_state_expo_n(&rand_default, out, n, mu);
+}
@@ -17,10 +17,85 @@
 #ifndef _FASTRNG_H_
 #define _FASTRNG_H_
 
+/* Number of independent generators the bulk functions run side by side */
+#define RAND_LANES 8
+
+/* State of a random number stream. The rand_state_* functions draw from the
+ * stream given, so objects and threads that need their own reproducible
+ * sequence keep a state of their own. The other functions draw from a
+ * default stream shared by the module, which must only be used with the GIL
+ * held.
+ */
+typedef struct {
+	uint32_t jsr;   /* SHR3 state, never zero */
+	uint32_t z, w;  /* MWC states */
+	uint32_t jcong; /* CONG state */
+	/* xoshiro128+ states of the bulk generators, word major so that the
+	 * lanes advance together in vector registers */
+	uint32_t lane[4][RAND_LANES];
+} RandState;
+
 /* Seed the random number generators and initialize tables for rand_norm */
 void
 rand_seed(uint32_t s);
 
+/* Seed a stream. Equal seeds produce equal sequences */
+void
+rand_state_seed(RandState *state, uint32_t s);
+
+/* Return the default stream, which must only be used with the GIL held */
+RandState *
+rand_default_state(void);
+
+/* Explicit state variants of the functions below */
+uint32_t
+rand_state_int32(RandState *state);
+
+float
+rand_state_uni(RandState *state);
+
+float
+rand_state_norm(RandState *state, const float mu, const float sigma);
+
+float
+rand_state_expo(RandState *state, const float mu);
+
+/*
+	Fill out with n random numbers with uniform distribution in the
+	interval (0, 1.0]
+
+	The bulk functions draw from generators of their own, which have no
+	branches per sample, so the loops vectorize. They produce different
+	sequences than the single sample functions.
+*/
+void
+rand_state_uni_n(RandState *state, float *out, unsigned long n);
+
+/*
+	Fill out with n random numbers with normal distribution, using the
+	Box-Muller transform
+*/
+void
+rand_state_norm_n(RandState *state, float *out, unsigned long n,
+	const float mu, const float sigma);
+
+/*
+	Fill out with n random numbers with exponential distribution
+*/
+void
+rand_state_expo_n(RandState *state, float *out, unsigned long n,
+	const float mu);
+
+/* Default stream variants of the bulk functions */
+void
+rand_uni_n(float *out, unsigned long n);
+
+void
+rand_norm_n(float *out, unsigned long n, const float mu, const float sigma);
+
+void
+rand_expo_n(float *out, unsigned long n, const float mu);
+
 /*
    Generate a 32-bit random number in with the interval [0,0xffffffff]
 */
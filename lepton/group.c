@@ -17,48 +17,694 @@
 
 #include <Python.h>
 #include <float.h>
+#include <stddef.h>
+#include <string.h>
 #include "group.h"
 #include "compat.h"
 
+#ifdef MS_WINDOWS
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+const ParticleAttrInfo Particle_attr_info[PATTR_COUNT] = {
+	{"position", offsetof(Particle, position), sizeof(Vec3), 3},
+	{"color", offsetof(Particle, color), sizeof(Color), 4},
+	{"velocity", offsetof(Particle, velocity), sizeof(Vec3), 3},
+	{"size", offsetof(Particle, size), sizeof(Vec3), 3},
+	{"up", offsetof(Particle, up), sizeof(Vec3), 3},
+	{"rotation", offsetof(Particle, rotation), sizeof(Vec3), 3},
+	{"last_position", offsetof(Particle, last_position), sizeof(Vec3), 3},
+	{"last_velocity", offsetof(Particle, last_velocity), sizeof(Vec3), 3},
+	{"age", offsetof(Particle, age), sizeof(float), 1},
+	{"mass", offsetof(Particle, mass), sizeof(float), 1},
+};
+
+/* Allocate a block of memory aligned to GROUP_ALIGN bytes. The address of
+ * the underlying allocation is stashed just before the aligned block
+ */
+static void *
+Group_alloc_block(size_t size)
+{
+	char *raw, *block;
+
+	raw = (char *)PyMem_Malloc(size + GROUP_ALIGN + sizeof(void *));
+	if (raw == NULL)
+		return NULL;
+	block = (char *)(((uintptr_t)(raw + sizeof(void *)) + GROUP_ALIGN - 1)
+		& ~(uintptr_t)(GROUP_ALIGN - 1));
+	((void **)block)[-1] = raw;
+	return block;
+}
+
+static void
+Group_free_block(void *block)
+{
+	if (block != NULL)
+		PyMem_Free(((void **)block)[-1]);
+}
+
+/* Round size up to a whole number of pages */
+#define Group_page_round(size) \
+	(((size) + GROUP_PAGE_SIZE - 1) & ~(size_t)(GROUP_PAGE_SIZE - 1))
+
+/* Reserve address space for a paged block of size bytes without committing
+ * memory to it. Return NULL on failure
+ */
+static char *
+Group_reserve_pages(size_t size)
+{
+	void *block;
+
+#ifdef MS_WINDOWS
+	block = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+	block = mmap(NULL, size, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (block == MAP_FAILED)
+		return NULL;
+#ifdef MADV_HUGEPAGE
+	/* Large groups benefit from fewer TLB misses, this is only a hint */
+	madvise(block, size, MADV_HUGEPAGE);
+#endif
+#endif
+	return (char *)block;
+}
+
+/* Change the committed portion of a paged block from the first committed
+ * bytes to the first size bytes. Both must be multiples of GROUP_PAGE_SIZE.
+ * Return true on success, false if out of memory
+ */
+static int
+Group_commit_pages(char *block, size_t committed, size_t size)
+{
+	if (size > committed) {
+#ifdef MS_WINDOWS
+		return VirtualAlloc(block + committed, size - committed,
+			MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+		return mprotect(block + committed, size - committed,
+			PROT_READ | PROT_WRITE) == 0;
+#endif
+	} else if (size < committed) {
+#ifdef MS_WINDOWS
+		VirtualFree(block + size, committed - size, MEM_DECOMMIT);
+#else
+		madvise(block + size, committed - size, MADV_DONTNEED);
+		mprotect(block + size, committed - size, PROT_NONE);
+#endif
+	}
+	return 1;
+}
+
+/* Release a paged block of size bytes reserved by Group_reserve_pages() */
+static void
+Group_release_pages(char *block, size_t size)
+{
+	if (block == NULL)
+		return;
+#ifdef MS_WINDOWS
+	VirtualFree(block, 0, MEM_RELEASE);
+#else
+	munmap(block, size);
+#endif
+}
+
+/* Return the bytes of storage per particle of the block holding attr */
+static size_t
+ParticleList_block_psize(ParticleList *plist, int attr)
+{
+	if (plist->layout == GROUP_LAYOUT_AOS)
+		return plist->psize;
+	return Particle_attr_info[attr].size;
+}
+
+/* Reserve the paged storage blocks of a new list and set up its columns.
+ * Return true on success, false if the address space could not be reserved
+ */
+static int
+ParticleList_reserve_pages(ParticleList *plist)
+{
+	size_t reserved;
+	int attr;
+
+	if (plist->layout == GROUP_LAYOUT_AOS) {
+		reserved = Group_page_round(plist->psize * plist->pmax);
+		plist->block = Group_reserve_pages(reserved);
+		if (plist->block == NULL)
+			return 0;
+	}
+	for (attr = 0; attr < PATTR_COUNT; attr++) {
+		if (!(plist->attrs & PATTR_BIT(attr)))
+			continue;
+		if (plist->layout == GROUP_LAYOUT_AOS) {
+			plist->col[attr].base = plist->block + plist->col[attr].stride;
+			plist->col[attr].stride = plist->psize;
+		} else {
+			reserved = Group_page_round(Particle_attr_info[attr].size * plist->pmax);
+			plist->col[attr].base = Group_reserve_pages(reserved);
+			plist->col[attr].stride = Particle_attr_info[attr].size;
+			if (plist->col[attr].base == NULL)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/* Allocate a new, empty particle list with the given layout storing the
+ * attributes in the PATTR_BIT mask attrs. If pmax is nonzero, the list uses
+ * paged storage holding at most pmax particles. Return NULL with an
+ * exception set on failure
+ */
+ParticleList *
+ParticleList_new(int layout, unsigned int attrs, unsigned long pmax)
+{
+	ParticleList *plist;
+	size_t psize;
+	int attr, has_vector;
+
+	if (layout != GROUP_LAYOUT_AOS && layout != GROUP_LAYOUT_SOA) {
+		PyErr_SetString(PyExc_ValueError, "invalid particle layout");
+		return NULL;
+	}
+	plist = (ParticleList *)PyMem_Malloc(sizeof(ParticleList));
+	if (plist == NULL) {
+		PyErr_NoMemory();
+		return NULL;
+	}
+	memset(plist, 0, sizeof(ParticleList));
+	plist->layout = layout;
+	plist->attrs = (attrs | PATTR_BIT(PATTR_AGE)) & PATTR_ALL;
+
+	/* Assign record offsets for the attributes stored. Vectors precede the
+	 * scalars in attribute order, so they stay 16-byte aligned. With all
+	 * attributes present this matches the Particle struct exactly */
+	psize = 0;
+	has_vector = 0;
+	for (attr = 0; attr < PATTR_COUNT; attr++) {
+		if (plist->attrs & PATTR_BIT(attr)) {
+			plist->col[attr].stride = psize; /* offset until allocated */
+			psize += Particle_attr_info[attr].size;
+			has_vector |= Particle_attr_info[attr].length > 1;
+		}
+	}
+	if (has_vector)
+		psize = (psize + sizeof(Vec3) - 1) & ~(sizeof(Vec3) - 1);
+	plist->psize = psize;
+	plist->pmax = pmax;
+	if (pmax > 0) {
+		if (pmax > (size_t)-1 / sizeof(Particle)) {
+			PyErr_SetString(PyExc_ValueError, "particle limit too large");
+			ParticleList_free(plist);
+			return NULL;
+		}
+		if (!ParticleList_reserve_pages(plist)) {
+			ParticleList_free(plist);
+			PyErr_NoMemory();
+			return NULL;
+		}
+	}
+	if (!ParticleList_resize(plist,
+		pmax > 0 && pmax < GROUP_MIN_ALLOC ? pmax : GROUP_MIN_ALLOC)) {
+		ParticleList_free(plist);
+		return NULL;
+	}
+	return plist;
+}
+
+/* Free a particle list and its storage */
+void
+ParticleList_free(ParticleList *plist)
+{
+	int attr;
+
+	if (plist == NULL)
+		return;
+	if (plist->handles != NULL) {
+		PyMem_Free(plist->handles->slot_handle);
+		PyMem_Free(plist->handles->entries);
+		PyMem_Free(plist->handles);
+	}
+	if (plist->pmax > 0) {
+		for (attr = 0; attr < PATTR_COUNT; attr++) {
+			if (plist->layout == GROUP_LAYOUT_SOA && (plist->attrs & PATTR_BIT(attr)))
+				Group_release_pages(plist->col[attr].base, Group_page_round(
+					Particle_attr_info[attr].size * plist->pmax));
+		}
+		Group_release_pages(plist->block,
+			Group_page_round(plist->psize * plist->pmax));
+	} else if (plist->layout == GROUP_LAYOUT_AOS) {
+		Group_free_block(plist->block);
+	} else {
+		for (attr = 0; attr < PATTR_COUNT; attr++) {
+			if (plist->attrs & PATTR_BIT(attr))
+				Group_free_block(plist->col[attr].base);
+		}
+	}
+	PyMem_Free(plist);
+}
+
+/* Make room in the slot handle array of the list for at least palloc
+ * slots. Return true on success, false with an exception set on failure
+ */
+static int
+ParticleList_resize_handle_slots(ParticleList *plist, unsigned long palloc)
+{
+	ParticleHandles *handles = plist->handles;
+	uint32_t *slot_handle;
+	unsigned long i;
+
+	if (palloc <= handles->slots)
+		return 1;
+	slot_handle = (uint32_t *)PyMem_Realloc(handles->slot_handle,
+		palloc * sizeof(uint32_t));
+	if (slot_handle == NULL) {
+		PyErr_NoMemory();
+		return 0;
+	}
+	for (i = handles->slots; i < palloc; i++)
+		slot_handle[i] = GROUP_HANDLE_NONE;
+	handles->slot_handle = slot_handle;
+	handles->slots = palloc;
+	return 1;
+}
+
+/* Enable stable handles for the particles in an empty list. Return true on
+ * success, false with an exception set on failure
+ */
+int
+ParticleList_enable_handles(ParticleList *plist)
+{
+	if (plist->handles != NULL)
+		return 1;
+	plist->handles = (ParticleHandles *)PyMem_Malloc(sizeof(ParticleHandles));
+	if (plist->handles == NULL) {
+		PyErr_NoMemory();
+		return 0;
+	}
+	memset(plist->handles, 0, sizeof(ParticleHandles));
+	plist->handles->free = GROUP_HANDLE_NONE;
+	return ParticleList_resize_handle_slots(plist, plist->palloc);
+}
+
+/* Release the handle of the particle in slot, if any, so that it no longer
+ * refers to a particle */
+static void
+ParticleList_release_handle(ParticleList *plist, unsigned long slot)
+{
+	ParticleHandles *handles = plist->handles;
+	ParticleHandleEntry *entry;
+	uint32_t handle;
+
+	handle = handles->slot_handle[slot];
+	if (handle == GROUP_HANDLE_NONE)
+		return;
+	entry = &handles->entries[Handle_index(handle)];
+	entry->used = 0;
+	entry->generation = (entry->generation + 1)
+		& (0xFFFFFFFFu >> GROUP_HANDLE_INDEX_BITS);
+	entry->slot = handles->free;
+	handles->free = Handle_index(handle);
+	handles->slot_handle[slot] = GROUP_HANDLE_NONE;
+}
+
+/* Assign new handles to the count slots starting at slot. Return true on
+ * success, false with an exception set on failure
+ */
+static int
+ParticleList_assign_handles(ParticleList *plist, unsigned long slot,
+	unsigned long count)
+{
+	ParticleHandles *handles = plist->handles;
+	ParticleHandleEntry *entries;
+	unsigned long i, index, alloc;
+
+	for (i = slot; i < slot + count; i++) {
+		if (handles->free != GROUP_HANDLE_NONE) {
+			index = handles->free;
+			handles->free = handles->entries[index].slot;
+		} else {
+			if (handles->count >= GROUP_HANDLE_INDEX_MASK) {
+				PyErr_SetString(PyExc_MemoryError,
+					"too many particle handles in group");
+				goto error;
+			}
+			if (handles->count == handles->alloc) {
+				alloc = handles->alloc * 2;
+				if (alloc < GROUP_MIN_ALLOC)
+					alloc = GROUP_MIN_ALLOC;
+				if (alloc > GROUP_HANDLE_INDEX_MASK)
+					alloc = GROUP_HANDLE_INDEX_MASK;
+				entries = (ParticleHandleEntry *)PyMem_Realloc(handles->entries,
+					alloc * sizeof(ParticleHandleEntry));
+				if (entries == NULL) {
+					PyErr_NoMemory();
+					goto error;
+				}
+				handles->entries = entries;
+				handles->alloc = alloc;
+			}
+			index = handles->count++;
+			handles->entries[index].generation = 0;
+		}
+		handles->entries[index].slot = i;
+		handles->entries[index].used = 1;
+		handles->slot_handle[i] = Handle_make(index,
+			handles->entries[index].generation);
+	}
+	return 1;
+
+error:
+	while (i-- > slot)
+		ParticleList_release_handle(plist, i);
+	return 0;
+}
+
+/* Return the slot of the particle with the given handle, or -1 if the
+ * handle does not refer to a particle in the list
+ */
+long
+ParticleList_handle_slot(ParticleList *plist, uint32_t handle)
+{
+	ParticleHandleEntry *entry;
+
+	if (plist->handles == NULL || Handle_index(handle) >= plist->handles->count)
+		return -1;
+	entry = &plist->handles->entries[Handle_index(handle)];
+	if (!entry->used || entry->generation != Handle_generation(handle))
+		return -1;
+	return entry->slot;
+}
+
+/* Change the number of particle slots allocated, preserving the contents
+ * of the slots in use. Return true on success, false with an exception set
+ * on failure, in which case the particles are left unchanged.
+ */
+int
+ParticleList_resize(ParticleList *plist, unsigned long palloc)
+{
+	unsigned long used;
+	const ParticleAttrInfo *info;
+	char *block, *blocks[PATTR_COUNT];
+	size_t psize;
+	int attr;
+
+	if (plist->exports > 0 && (plist->pmax == 0 || palloc < plist->palloc)) {
+		/* Reallocating or decommitting pages would leave exported buffers
+		 * dangling. Paged storage may still grow in place */
+		PyErr_SetString(PyExc_BufferError,
+			"particle group storage cannot be resized while views of it exist");
+		return 0;
+	}
+	if (plist->handles != NULL && !ParticleList_resize_handle_slots(plist, palloc))
+		return 0;
+	if (plist->pmax > 0) {
+		/* Paged storage is committed in place, so particles never move */
+		if (palloc > plist->pmax) {
+			PyErr_Format(PyExc_MemoryError,
+				"particle group is limited to %lu particles", plist->pmax);
+			return 0;
+		}
+		for (attr = 0; attr < PATTR_COUNT; attr++) {
+			if (!(plist->attrs & PATTR_BIT(attr)))
+				continue;
+			psize = ParticleList_block_psize(plist, attr);
+			block = plist->layout == GROUP_LAYOUT_AOS ?
+				plist->block : plist->col[attr].base;
+			if (!Group_commit_pages(block, Group_page_round(psize * plist->palloc),
+				Group_page_round(psize * palloc))) {
+				PyErr_NoMemory();
+				return 0;
+			}
+			if (plist->layout == GROUP_LAYOUT_AOS)
+				break;
+		}
+		plist->palloc = palloc;
+		return 1;
+	}
+	used = plist->pactive + plist->pkilled + plist->pnew;
+	if (used > palloc)
+		used = palloc;
+	if (plist->layout == GROUP_LAYOUT_AOS) {
+		block = (char *)Group_alloc_block(plist->psize * palloc);
+		if (block == NULL) {
+			PyErr_NoMemory();
+			return 0;
+		}
+		for (attr = 0; attr < PATTR_COUNT; attr++) {
+			if (!(plist->attrs & PATTR_BIT(attr)))
+				continue;
+			if (plist->block != NULL) {
+				/* rebase the column, its offset in the record is unchanged */
+				plist->col[attr].base = block +
+					(plist->col[attr].base - plist->block);
+			} else {
+				plist->col[attr].base = block + plist->col[attr].stride;
+			}
+			plist->col[attr].stride = plist->psize;
+		}
+		if (plist->block != NULL) {
+			memcpy(block, plist->block, plist->psize * used);
+			Group_free_block(plist->block);
+		}
+		plist->block = block;
+	} else {
+		for (attr = 0; attr < PATTR_COUNT; attr++) {
+			blocks[attr] = NULL;
+			if (!(plist->attrs & PATTR_BIT(attr)))
+				continue;
+			blocks[attr] = (char *)Group_alloc_block(
+				Particle_attr_info[attr].size * palloc);
+			if (blocks[attr] == NULL) {
+				while (attr--)
+					Group_free_block(blocks[attr]);
+				PyErr_NoMemory();
+				return 0;
+			}
+		}
+		for (attr = 0; attr < PATTR_COUNT; attr++) {
+			if (!(plist->attrs & PATTR_BIT(attr)))
+				continue;
+			info = &Particle_attr_info[attr];
+			if (plist->col[attr].base != NULL) {
+				memcpy(blocks[attr], plist->col[attr].base, info->size * used);
+				Group_free_block(plist->col[attr].base);
+			}
+			plist->col[attr].base = blocks[attr];
+			plist->col[attr].stride = info->size;
+		}
+	}
+	plist->palloc = palloc;
+	return 1;
+}
+
 /* Return an index for a new particle in the group, allocating space for it if
- * necessary.
+ * necessary. Return -1 with an exception set on failure.
  */
 long
 Group_new_p(GroupObject *group) {
+	return Group_new_n(group, 1);
+}
+
+/* Return the index of the first of count contiguous new particle slots in
+ * the group, allocating space for them if necessary. The list grows at least
+ * geometrically, but by no more than a single allocation per call. Return
+ * -1 with an exception set on failure.
+ */
+long
+Group_new_n(GroupObject *group, unsigned long count) {
 	unsigned long pindex;
-	unsigned long expansion;
-	ParticleList *realloc_plist;
+	unsigned long palloc;
 
 	pindex = group->plist->pactive + group->plist->pkilled + group->plist->pnew;
-	if (pindex >= group->plist->palloc) {
-		expansion = group->plist->palloc / 5;
-		if (expansion < GROUP_MIN_ALLOC)
-			expansion = GROUP_MIN_ALLOC;
-		realloc_plist = (ParticleList *)PyMem_Realloc(group->plist,
-			sizeof(ParticleList) +
-			sizeof(Particle) * (group->plist->palloc + expansion));
-		if (realloc_plist == NULL) {
+	if (pindex + count > group->plist->palloc) {
+		palloc = group->plist->palloc / 5;
+		if (palloc < GROUP_MIN_ALLOC)
+			palloc = GROUP_MIN_ALLOC;
+		palloc += group->plist->palloc;
+		if (group->plist->pmax > 0 && palloc > group->plist->pmax)
+			palloc = group->plist->pmax;
+		if (palloc < pindex + count)
+			palloc = pindex + count;
+		if (!ParticleList_resize(group->plist, palloc))
 			return -1;
-		}
-		group->plist = realloc_plist;
-		group->plist->palloc += expansion;
 	}
-	group->plist->pnew++;
+	if (group->plist->handles != NULL
+		&& !ParticleList_assign_handles(group->plist, pindex, count))
+		return -1;
+	group->plist->pnew += count;
 	return pindex;
 }
 
-/* Kill the particle specified.
+/* Ensure the group has slots allocated for at least palloc particles.
+ * Return true on success, false with an exception set on failure.
+ */
+int
+Group_reserve(GroupObject *group, unsigned long palloc)
+{
+	if (palloc <= group->plist->palloc)
+		return 1;
+	return ParticleList_resize(group->plist, palloc);
+}
+
+/* Kill the particle at the index specified.
  */
 EXTERN_INLINE void
-Group_kill_p(GroupObject *group, Particle *p) {
-	Particle *lastactive;
-	lastactive = &group->plist->p[GroupObject_ActiveCount(group)];
-	if (Particle_IsAlive(*p) && p < lastactive) {
+Group_kill_p(GroupObject *group, unsigned long index) {
+	float *age;
+
+	age = Group_float(group, PATTR_AGE, index);
+	if (*age >= 0 && index < GroupObject_ActiveCount(group)) {
 		group->plist->pactive--;
 		group->plist->pkilled++;
 	}
-	p->age = -FLT_MAX;
-	p->position.z = FLT_MAX;
+	*age = -FLT_MAX;
+	if (group->plist->attrs & PATTR_BIT(PATTR_POSITION))
+		Group_Vec3(group, PATTR_POSITION, index)->z = FLT_MAX;
+	if (group->plist->handles != NULL)
+		ParticleList_release_handle(group->plist, index);
+}
+
+/* Copy the particle struct p into the slot at index */
+void
+Group_store_p(GroupObject *group, unsigned long index, const Particle *p)
+{
+	ParticleList *plist = group->plist;
+	const ParticleAttrInfo *info;
+	int attr;
+
+	if (plist->layout == GROUP_LAYOUT_AOS && plist->attrs == PATTR_ALL) {
+		memcpy(plist->block + sizeof(Particle) * index, p, sizeof(Particle));
+	} else {
+		for (attr = 0; attr < PATTR_COUNT; attr++) {
+			if (!(plist->attrs & PATTR_BIT(attr)))
+				continue;
+			info = &Particle_attr_info[attr];
+			memcpy(Column_ptr(plist->col[attr], char, index),
+				(const char *)p + info->offset, info->size);
+		}
+	}
+}
+
+/* Copy the particle in the slot at index into the particle struct p */
+void
+Group_load_p(GroupObject *group, unsigned long index, Particle *p)
+{
+	ParticleList *plist = group->plist;
+	const ParticleAttrInfo *info;
+	int attr;
+
+	if (plist->layout == GROUP_LAYOUT_AOS && plist->attrs == PATTR_ALL) {
+		memcpy(p, plist->block + sizeof(Particle) * index, sizeof(Particle));
+	} else {
+		memset(p, 0, sizeof(Particle));
+		for (attr = 0; attr < PATTR_COUNT; attr++) {
+			if (!(plist->attrs & PATTR_BIT(attr)))
+				continue;
+			info = &Particle_attr_info[attr];
+			memcpy((char *)p + info->offset,
+				Column_ptr(plist->col[attr], char, index), info->size);
+		}
+	}
+}
+
+/* Copy the particle in slot src over the particle in slot dst */
+void
+Group_move_p(GroupObject *group, unsigned long dst, unsigned long src)
+{
+	ParticleList *plist = group->plist;
+	uint32_t handle;
+	int attr;
+
+	if (plist->layout == GROUP_LAYOUT_AOS) {
+		memcpy(plist->block + plist->psize * dst,
+			plist->block + plist->psize * src, plist->psize);
+	} else {
+		for (attr = 0; attr < PATTR_COUNT; attr++) {
+			if (!(plist->attrs & PATTR_BIT(attr)))
+				continue;
+			memcpy(Column_ptr(plist->col[attr], char, dst),
+				Column_ptr(plist->col[attr], char, src),
+				Particle_attr_info[attr].size);
+		}
+	}
+	if (plist->handles != NULL) {
+		/* The particle in dst is replaced, the one in src moves with its
+		 * handle */
+		ParticleList_release_handle(plist, dst);
+		handle = plist->handles->slot_handle[src];
+		plist->handles->slot_handle[dst] = handle;
+		plist->handles->slot_handle[src] = GROUP_HANDLE_NONE;
+		if (handle != GROUP_HANDLE_NONE)
+			plist->handles->entries[Handle_index(handle)].slot = dst;
+	}
+}
+
+/* Remove all killed particles from the group's active section. If
+ * preserve_order is true the live particles are slid down in order,
+ * otherwise killed slots are filled with the last live particles, which
+ * moves fewer particles. Must only be called when there are no new
+ * particles pending. Return the number of particles moved
+ */
+unsigned long
+Group_compact(GroupObject *group, int preserve_order)
+{
+	ParticleList *plist = group->plist;
+	unsigned long head, tail, dst, moved = 0;
+
+	if (plist->pkilled == 0)
+		return 0;
+	tail = plist->pactive + plist->pkilled;
+	if (preserve_order) {
+		for (head = 0; head < tail && Group_IsAlive(group, head); head++);
+		for (dst = head; head < tail; head++) {
+			if (Group_IsAlive(group, head)) {
+				Group_move_p(group, dst++, head);
+				moved++;
+			}
+		}
+	} else {
+		head = 0;
+		for (;;) {
+			while (head < tail && Group_IsAlive(group, head))
+				head++;
+			while (tail > head && !Group_IsAlive(group, tail - 1))
+				tail--;
+			if (head >= tail)
+				break;
+			Group_move_p(group, head++, --tail);
+			moved++;
+		}
+	}
+	if (plist->handles != NULL) {
+		/* Release the handles of killed particles left past the end */
+		for (head = plist->pactive; head < plist->pactive + plist->pkilled; head++)
+			ParticleList_release_handle(plist, head);
+	}
+	plist->pkilled = 0;
+	return moved;
+}
+
+/* Check that the group stores all of the attributes in the PATTR_BIT mask
+ * attrs, which are needed by user. Return true if it does, otherwise set a
+ * ValueError naming the first missing attribute and return false
+ */
+int
+Group_require(GroupObject *group, unsigned int attrs, const char *user)
+{
+	int attr;
+
+	if (Group_HasAttrs(group, attrs))
+		return 1;
+	for (attr = 0; attr < PATTR_COUNT; attr++) {
+		if ((attrs & PATTR_BIT(attr)) && !(group->plist->attrs & PATTR_BIT(attr)))
+			break;
+	}
+	PyErr_Format(PyExc_ValueError,
+		"%s requires the particle attribute '%s', which the group does not store",
+		user, Particle_attr_info[attr].name);
+	return 0;
 }
 
 /* Return true if o is a bon-a-fide GroupObject */
@@ -81,6 +727,231 @@ GroupObject_Check(GroupObject *o)
 	return 1;
 }
 
+/* Acquire the group's lock, releasing the GIL while waiting for it */
+void
+Group_lock(GroupObject *group)
+{
+	if (group->lock == NULL)
+		return;
+	if (!PyThread_acquire_lock(group->lock, NOWAIT_LOCK)) {
+		Py_BEGIN_ALLOW_THREADS
+		PyThread_acquire_lock(group->lock, WAIT_LOCK);
+		Py_END_ALLOW_THREADS
+	}
+}
+
+void
+Group_unlock(GroupObject *group)
+{
+	if (group->lock != NULL)
+		PyThread_release_lock(group->lock);
+}
+
+/* Lock the group and release the GIL to update count particles */
+PyThreadState *
+Group_begin_nogil(GroupObject *group, unsigned long count)
+{
+	Group_lock(group);
+	if (count < GROUP_NOGIL_MIN)
+		return NULL;
+	return PyEval_SaveThread();
+}
+
+void
+Group_end_nogil(GroupObject *group, PyThreadState *state)
+{
+	if (state != NULL)
+		PyEval_RestoreThread(state);
+	Group_unlock(group);
+}
+
+/* Return true if a kernel over count particles would run in parallel */
+int
+Group_parallel(GroupObject *group, unsigned long count)
+{
+	GroupKernelPool *kernels = group->kernels;
+
+	return kernels != NULL && kernels->threads > 1
+		&& count >= 2 * kernels->min_chunk;
+}
+
+typedef struct {
+	GroupObject		*group;
+	GroupKernelFunc	func;
+	void			*arg;
+	unsigned long	start, end;
+} GroupKernelChunk;
+
+static void
+Group_run_chunk(void *task, int thread)
+{
+	GroupKernelChunk *chunk = (GroupKernelChunk *)task;
+
+	chunk->func(chunk->group, chunk->arg, chunk->start, chunk->end);
+}
+
+/* Run a kernel over the group's particles, in parallel if worthwhile */
+void
+Group_parallel_for(GroupObject *group, unsigned long count,
+	GroupKernelFunc func, void *arg)
+{
+	GroupKernelPool *kernels = group->kernels;
+	GroupKernelChunk chunks[GROUP_KERNEL_MAX_CHUNKS];
+	void *tasks[GROUP_KERNEL_MAX_CHUNKS];
+	unsigned long nchunks, size, start;
+
+	/* Another thread using the pool, for another group, has it to itself */
+	if (!Group_parallel(group, count)
+		|| !PyThread_acquire_lock(kernels->lock, NOWAIT_LOCK)) {
+		func(group, arg, 0, count);
+		return;
+	}
+	if (kernels->pool == NULL) {
+		PyThread_release_lock(kernels->lock);
+		func(group, arg, 0, count);
+		return;
+	}
+	/* A few chunks per thread lets the pool balance uneven chunks */
+	nchunks = count / kernels->min_chunk;
+	if (nchunks > (unsigned long)kernels->threads * 4)
+		nchunks = kernels->threads * 4;
+	if (nchunks > GROUP_KERNEL_MAX_CHUNKS)
+		nchunks = GROUP_KERNEL_MAX_CHUNKS;
+	/* Whole cache lines of particles, so threads never share a line */
+	size = (count + nchunks - 1) / nchunks;
+	size = (size + GROUP_ALIGN - 1) / GROUP_ALIGN * GROUP_ALIGN;
+	for (nchunks = 0, start = 0; start < count; nchunks++, start += size) {
+		chunks[nchunks].group = group;
+		chunks[nchunks].func = func;
+		chunks[nchunks].arg = arg;
+		chunks[nchunks].start = start;
+		chunks[nchunks].end = start + size < count ? start + size : count;
+		tasks[nchunks] = &chunks[nchunks];
+	}
+	WorkerPool_run(kernels->pool, Group_run_chunk, tasks, nchunks);
+	PyThread_release_lock(kernels->lock);
+}
+
+/* Publish the native protocol of a ready controller type */
+int
+Controller_set_native(PyTypeObject *type, ControllerNative *native)
+{
+	PyObject *capsule;
+	int result;
+
+	capsule = PyCapsule_New(native, CONTROLLER_NATIVE_CAPSULE, NULL);
+	if (capsule == NULL)
+		return 0;
+	result = PyDict_SetItemString(type->tp_dict, CONTROLLER_NATIVE_ATTR, capsule);
+	Py_DECREF(capsule);
+	PyType_Modified(type);
+	return result == 0;
+}
+
+typedef struct {
+	float				td;
+	PyObject			**ctrlrs;
+	ControllerNative	**natives;
+	int					count;
+} ControllerFusedRun;
+
+/* Run fused controllers over the particles in [first, last) */
+static void
+Controller_fused_range(GroupObject *group, void *arg,
+	unsigned long first, unsigned long last)
+{
+	ControllerFusedRun *run = (ControllerFusedRun *)arg;
+	unsigned long start, end;
+	int i;
+
+	for (start = first; start < last; start = end) {
+		end = start + CONTROLLER_FUSE_CHUNK;
+		if (end > last)
+			end = last;
+		for (i = 0; i < run->count; i++)
+			run->natives[i]->update_range(run->ctrlrs[i], group, run->td,
+				start, end);
+	}
+}
+
+/* Run fusable controllers over the group's particles in a single pass */
+void
+Controller_fused_pass(GroupObject *group, float td, PyObject **ctrlrs,
+	ControllerNative **natives, int count)
+{
+	ControllerFusedRun run;
+	unsigned long pcount;
+	int i, first;
+
+	pcount = GroupObject_ActiveCount(group);
+	run.td = td;
+	if (!Group_parallel(group, pcount)) {
+		run.ctrlrs = ctrlrs;
+		run.natives = natives;
+		run.count = count;
+		Controller_fused_range(group, &run, 0, pcount);
+	} else {
+		/* Each run of controllers that change shared state, or not, gets a
+		 * pass of its own, so that only the latter run in parallel */
+		for (first = 0; first < count; first = i) {
+			for (i = first + 1; i < count
+				&& !natives[i]->shared == !natives[first]->shared; i++);
+			run.ctrlrs = ctrlrs + first;
+			run.natives = natives + first;
+			run.count = i - first;
+			if (natives[first]->shared)
+				Controller_fused_range(group, &run, 0, pcount);
+			else
+				Group_parallel_for(group, pcount, Controller_fused_range, &run);
+		}
+	}
+	for (i = 0; i < count; i++) {
+		if (natives[i]->finish != NULL)
+			natives[i]->finish(ctrlrs[i], group, td);
+	}
+}
+
+/* Run native controllers that provide update_range in a single pass */
+int
+Controller_run_fused(GroupObject *group, float td, PyObject **ctrlrs,
+	ControllerNative **natives, int count)
+{
+	PyThreadState *state;
+	int ready;
+
+	/* As when run sequentially, the controllers preceding one that cannot
+	 * update the group still run */
+	for (ready = 0; ready < count; ready++) {
+		if (!Group_HasAttrs(group, natives[ready]->attrs))
+			break;
+	}
+	state = Group_begin_nogil(group, GroupObject_ActiveCount(group) * ready);
+	Controller_fused_pass(group, td, ctrlrs, natives, ready);
+	Group_end_nogil(group, state);
+	if (ready < count) {
+		Group_require(group, natives[ready]->attrs, natives[ready]->name);
+		return -1;
+	}
+	return 0;
+}
+
+/* Return the native protocol capsule of controller's type, or None */
+PyObject *
+Controller_get_native(PyObject *controller)
+{
+	PyObject *capsule;
+
+	capsule = PyObject_GetAttrString((PyObject *)Py_TYPE(controller),
+		CONTROLLER_NATIVE_ATTR);
+	if (capsule == NULL || !PyCapsule_IsValid(capsule, CONTROLLER_NATIVE_CAPSULE)) {
+		PyErr_Clear();
+		Py_XDECREF(capsule);
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+	return capsule;
+}
+
 /* Get a vector from an attrbute of the template and store it in vec */
 int
 get_Vec3(Vec3 *vec, PyObject *dict, PyObject *template, const char *attrname)
@@ -6,6 +6,7 @@
 #include "vector.h"
 #include "compat.h"
 #include "cccompat.h"
+#include "workerpool.h"
 
 #ifndef _GROUP_H_
 #define _GROUP_H_
@@ -29,6 +30,95 @@ typedef struct {
 
 #define Particle_IsAlive(p) ((p).age >= 0)
 
+/* Particle attributes, in the same order as the Particle struct fields */
+typedef enum {
+	PATTR_POSITION = 0,
+	PATTR_COLOR,
+	PATTR_VELOCITY,
+	PATTR_SIZE,
+	PATTR_UP,
+	PATTR_ROTATION,
+	PATTR_LAST_POSITION,
+	PATTR_LAST_VELOCITY,
+	PATTR_AGE,
+	PATTR_MASS,
+	PATTR_COUNT
+} ParticleAttr;
+
+/* Static description of a particle attribute */
+typedef struct {
+	const char	*name;
+	size_t		offset; /* offset of the field in the Particle struct */
+	size_t		size;   /* storage size of the field in bytes */
+	int			length; /* number of floats exposed (1, 3 or 4) */
+} ParticleAttrInfo;
+
+extern const ParticleAttrInfo Particle_attr_info[PATTR_COUNT];
+
+/* Attribute bit masks, used to describe the set of attributes a particle
+ * list stores. The age attribute is always stored since it determines
+ * whether a particle is alive.
+ */
+#define PATTR_BIT(attr) (1u << (attr))
+#define PATTR_ALL (PATTR_BIT(PATTR_COUNT) - 1)
+
+/* Storage layouts for particle lists */
+#define GROUP_LAYOUT_AOS 0 /* One array of Particle structs (default) */
+#define GROUP_LAYOUT_SOA 1 /* One aligned array per particle attribute */
+
+/* Alignment of particle storage blocks, one cache line */
+#define GROUP_ALIGN 64
+
+/* Granularity that paged particle storage is committed and released in */
+#define GROUP_PAGE_SIZE (64 * 1024)
+
+/* A column addresses one attribute of every particle in a list. The
+ * attribute of particle i is found at base + i * stride, regardless of the
+ * storage layout, so kernels written against columns work for all layouts.
+ * The base is NULL for attributes that the list does not store.
+ */
+typedef struct {
+	char			*base;   /* address of the attribute for particle 0 */
+	size_t			stride;  /* bytes between consecutive particles */
+} ParticleColumn;
+
+#define Column_ptr(col, type, i) \
+	((type *)((col).base + (size_t)(i) * (col).stride))
+
+/* Stable particle handles
+ *
+ * Particle indices change as the group is consolidated, so lists may
+ * optionally assign each particle a 32-bit handle that stays valid for the
+ * life of the particle. The low GROUP_HANDLE_INDEX_BITS of a handle index a
+ * table entry holding the particle's current slot, the high bits hold the
+ * entry's generation, which is incremented when the particle dies so that
+ * stale handles are detected. The table is kept up to date whenever
+ * particles are added, moved or killed.
+ */
+#define GROUP_HANDLE_INDEX_BITS 24
+#define GROUP_HANDLE_INDEX_MASK ((1u << GROUP_HANDLE_INDEX_BITS) - 1)
+#define GROUP_HANDLE_NONE 0xFFFFFFFFu /* No handle, also ends the free list */
+
+#define Handle_make(index, generation) \
+	((uint32_t)(index) | ((uint32_t)(generation) << GROUP_HANDLE_INDEX_BITS))
+#define Handle_index(handle) ((handle) & GROUP_HANDLE_INDEX_MASK)
+#define Handle_generation(handle) ((handle) >> GROUP_HANDLE_INDEX_BITS)
+
+typedef struct {
+	uint32_t		slot;       /* slot of the particle, or the next free entry */
+	uint32_t		generation; /* generation of the current handle */
+	int				used;       /* true if the entry refers to a particle */
+} ParticleHandleEntry;
+
+typedef struct {
+	uint32_t			*slot_handle; /* handle of the particle in each slot */
+	ParticleHandleEntry	*entries;     /* handle table */
+	unsigned long		slots;        /* length of the slot_handle array */
+	unsigned long		count;        /* entries initialized */
+	unsigned long		alloc;        /* entries allocated */
+	uint32_t			free;         /* first free entry */
+} ParticleHandles;
+
 /* A ParticleList is a dynamic array arranged as follows:
  * |<----- active and killed ----->|<- new ->|            |
  * |<--------- allocated slots -------------------------->|
@@ -58,15 +148,71 @@ typedef struct {
  * right-most active particle, reclaiming any killed particles at the end of
  * the list. The number of killed particle slots left will depend on the
  * birth/death rate and order.
+ *
+ * The particle slots themselves are stored according to the list layout.
+ * GROUP_LAYOUT_AOS stores particle records back to back in a single block,
+ * GROUP_LAYOUT_SOA stores each attribute in its own block so that code
+ * touching only a few attributes streams only those through the cache.
+ * A list may also store only a subset of the particle attributes, in which
+ * case AOS records are packed to hold only those. When all attributes are
+ * stored, AOS records have the same layout as the Particle struct. Particle
+ * data must always be accessed through the list's columns.
+ *
+ * By default each storage block is allocated from the heap and reallocated
+ * as the list grows, which moves the particles. Paged lists (pmax > 0)
+ * instead reserve address space for pmax particles up front and commit it
+ * GROUP_PAGE_SIZE bytes at a time as the list grows, so particles never
+ * move and each column stays contiguous. A paged list cannot grow beyond
+ * pmax particles.
  */
 typedef struct {
 	unsigned long	palloc;    /* Total particle slots allocated */
 	unsigned long	pactive;   /* Active particle count */
 	unsigned long	pkilled;   /* Total particles killed and not collected */
 	unsigned long	pnew;      /* New unincorporated particles */
-	Particle		p[];
+	int				layout;    /* GROUP_LAYOUT_* storage layout */
+	unsigned int	attrs;     /* PATTR_BIT mask of attributes stored */
+	size_t			psize;     /* bytes of storage per particle */
+	unsigned long	pmax;      /* Slot limit of paged lists, 0 if not paged */
+	unsigned long	exports;   /* Buffers exported from the storage in use */
+	ParticleHandles	*handles;  /* Stable handles, NULL if not enabled */
+	char			*block;    /* particle storage for the AOS layout */
+	ParticleColumn	col[PATTR_COUNT];
 } ParticleList;
 
+#define Group_column(group, attr) ((group)->plist->col[(attr)])
+
+#define Group_HasAttrs(group, mask) (((group)->plist->attrs & (mask)) == (mask))
+
+#define Group_Vec3(group, attr, i) Column_ptr(Group_column(group, attr), Vec3, i)
+#define Group_Color(group, i) Column_ptr(Group_column(group, PATTR_COLOR), Color, i)
+#define Group_float(group, attr, i) Column_ptr(Group_column(group, attr), float, i)
+
+#define Group_IsAlive(group, i) (*Group_float(group, PATTR_AGE, i) >= 0)
+
+/* Compaction policies applied by the group update */
+#define GROUP_COMPACT_LAZY 0      /* Only reclaim slots using new particles */
+#define GROUP_COMPACT_THRESHOLD 1 /* Compact when the killed ratio is exceeded */
+#define GROUP_COMPACT_ALWAYS 2    /* Compact at every update */
+
+typedef struct ControllerNative ControllerNative;
+
+/* Pool of threads shared by all groups to run the kernels of a single large
+ * group in parallel, each thread over its own range of particles
+ */
+typedef struct {
+	PyThread_type_lock	lock; /* held while the pool runs or is replaced */
+	WorkerPool		*pool; /* NULL to run kernels serially */
+	int				threads; /* threads of the pool, 1 if there is none */
+	unsigned long	min_chunk; /* fewest particles run by one thread */
+} GroupKernelPool;
+
+/* Default minimum number of particles per parallel kernel chunk */
+#define GROUP_KERNEL_MIN_CHUNK 16384
+
+/* Maximum number of chunks a kernel is split into */
+#define GROUP_KERNEL_MAX_CHUNKS 64
+
 /* The particle group object */
 typedef struct {
 	PyObject_HEAD
@@ -75,8 +221,60 @@ typedef struct {
 	PyObject		*system;
 	unsigned long	iteration; /* update iteration count */
 	ParticleList	*plist;
+	int				compaction; /* GROUP_COMPACT_* policy */
+	float			compaction_threshold; /* killed/total ratio to compact at */
+	char			preserve_order; /* compact without reordering particles */
+	/* Controller dispatch cache, rebuilt when either source tuple changes */
+	PyObject		*ctrlr_sources[2]; /* system and group controller tuples */
+	PyObject		*ctrlr_cache; /* tuple of all controllers in call order */
+	PyObject		*ctrlr_native; /* native capsule per controller, or None */
+	/* Held while the particles are changed with the GIL released, and by
+	 * other threads to change the particles meanwhile */
+	PyThread_type_lock	lock;
+	GroupKernelPool	*kernels; /* Pool running the group's kernels */
 } GroupObject;
 
+/* Particle loops over at least this many particles release the GIL */
+#define GROUP_NOGIL_MIN 2048
+
+/* Native controller protocol
+ *
+ * Built-in controller types store a capsule named CONTROLLER_NATIVE_CAPSULE
+ * holding a ControllerNative as the CONTROLLER_NATIVE_ATTR attribute of the
+ * type. The group update calls it directly rather than calling the
+ * controller object.
+ *
+ * Controllers that only ever change each particle based on its own state
+ * provide update_range, which updates the particles in [start, end) and
+ * cannot fail, instead of update. The group runs consecutive controllers of
+ * this kind together over cache-sized chunks of particles, which has the
+ * same result as running them one after the other over all particles.
+ */
+#define CONTROLLER_NATIVE_ATTR "_native_controller"
+#define CONTROLLER_NATIVE_CAPSULE "lepton.controller.native"
+
+struct ControllerNative {
+	/* Update the group, return 0 on success, or set an exception and
+	 * return -1 */
+	int (*update)(PyObject *controller, GroupObject *group, float td);
+	/* Fusable update of the particles in [start, end) */
+	void (*update_range)(PyObject *controller, GroupObject *group, float td,
+		unsigned long start, unsigned long end);
+	/* Optionally called once after update_range visited all particles */
+	void (*finish)(PyObject *controller, GroupObject *group, float td);
+	unsigned int attrs; /* PATTR_BIT mask of attributes update_range uses */
+	const char *name; /* Used in error messages */
+	/* True if update_range changes state shared by the particles, such as
+	 * the group's particle counts, thus must not run in parallel */
+	int shared;
+};
+
+/* Number of particles fused controllers process at a time */
+#define CONTROLLER_FUSE_CHUNK 256
+
+/* Maximum number of controllers fused into a single pass */
+#define CONTROLLER_FUSE_MAX 16
+
 #define GroupObject_ActiveCount(group) \
 	((group)->plist->pactive + (group)->plist->pkilled)
 
@@ -101,7 +299,8 @@ typedef struct {
 	PyObject_HEAD
 	PyObject		*parent; /* parent object (such as a group or domain) */
 	unsigned long	iteration; /* update iteration reference is valid for */
-	Particle		*p; /* pointer to particle in group */
+	unsigned long	index; /* index of particle in group */
+	Particle		*p; /* particle struct referenced if not in a group */
 } ParticleRefObject;
 
 /* Vector objects are used to manipulate Vec3/Color structs from Python
@@ -122,22 +321,171 @@ typedef struct {
 
 #define GROUP_MIN_ALLOC 100
 
+/* Allocate a new, empty particle list with the given layout storing the
+ * attributes in the PATTR_BIT mask attrs. If pmax is nonzero, the list uses
+ * paged storage holding at most pmax particles. Return NULL with an
+ * exception set on failure
+ */
+ParticleList *
+ParticleList_new(int layout, unsigned int attrs, unsigned long pmax);
+
+/* Free a particle list and its storage */
+void
+ParticleList_free(ParticleList *plist);
+
+/* Change the number of particle slots allocated, preserving the contents
+ * of the slots in use. Return true on success, false with an exception set
+ * if out of memory, palloc exceeds the limit of a paged list, or the
+ * storage would move while buffers exported from it are in use.
+ */
+int
+ParticleList_resize(ParticleList *plist, unsigned long palloc);
+
+/* Enable stable handles for the particles in an empty list. Return true on
+ * success, false with an exception set on failure
+ */
+int
+ParticleList_enable_handles(ParticleList *plist);
+
+/* Return the slot of the particle with the given handle, or -1 if the
+ * handle does not refer to a particle in the list
+ */
+long
+ParticleList_handle_slot(ParticleList *plist, uint32_t handle);
+
 /* Return an index for a new particle in the group, allocating space for it if
- * necessary.
+ * necessary. Return -1 with an exception set on failure.
  */
 long
 Group_new_p(GroupObject *group);
 
+/* Return the index of the first of count contiguous new particle slots in
+ * the group, allocating space for them if necessary. Return -1 with an
+ * exception set on failure. The caller must store a particle into each slot
+ * returned.
+ */
+long
+Group_new_n(GroupObject *group, unsigned long count);
+
+/* Ensure the group has slots allocated for at least palloc particles.
+ * Return true on success, false with an exception set on failure.
+ */
+int
+Group_reserve(GroupObject *group, unsigned long palloc);
+
 /* Kill the particle at the index specified. Does nothing if the index does
  * not point to a valid particle
  */
 EXTERN_INLINE void
-Group_kill_p(GroupObject *group, Particle *p);
+Group_kill_p(GroupObject *group, unsigned long index);
+
+/* Copy the particle struct p into the slot at index */
+void
+Group_store_p(GroupObject *group, unsigned long index, const Particle *p);
+
+/* Copy the particle in the slot at index into the particle struct p */
+void
+Group_load_p(GroupObject *group, unsigned long index, Particle *p);
+
+/* Copy the particle in slot src over the particle in slot dst */
+void
+Group_move_p(GroupObject *group, unsigned long dst, unsigned long src);
+
+/* Remove all killed particles from the group's active section. If
+ * preserve_order is true the live particles are slid down in order,
+ * otherwise killed slots are filled with the last live particles, which
+ * moves fewer particles. Must only be called when there are no new
+ * particles pending. Return the number of particles moved
+ */
+unsigned long
+Group_compact(GroupObject *group, int preserve_order);
+
+/* Check that the group stores all of the attributes in the PATTR_BIT mask
+ * attrs, which are needed by user. Return true if it does, otherwise set a
+ * ValueError naming the first missing attribute and return false
+ */
+int
+Group_require(GroupObject *group, unsigned int attrs, const char *user);
 
 /* Return true if o is a bon-a-fide GroupObject */
 int
 GroupObject_Check(GroupObject *o);
 
+/* Acquire the group's lock, releasing the GIL while waiting for it. Take the
+ * lock around changes to the particle storage or counts, such as allocating
+ * new particles, resizing or killing particles, outside of the group update,
+ * so that they do not race with an update in another thread. The lock is not
+ * reentrant, so do not call back into Python while holding it
+ */
+void
+Group_lock(GroupObject *group);
+
+void
+Group_unlock(GroupObject *group);
+
+/* Lock the group to update count particles natively, releasing the GIL if
+ * there are enough of them to make that worthwhile. Pass the result to
+ * Group_end_nogil() when done. No Python API may be used in between
+ */
+PyThreadState *
+Group_begin_nogil(GroupObject *group, unsigned long count);
+
+void
+Group_end_nogil(GroupObject *group, PyThreadState *state);
+
+/* Kernel function updating the particles in [start, end) of the group. It
+ * must not use the Python API, nor change state shared with other particles
+ */
+typedef void (*GroupKernelFunc)(GroupObject *group, void *arg,
+	unsigned long start, unsigned long end);
+
+/* Return true if a kernel over count particles of the group would be split
+ * across the group's kernel pool
+ */
+int
+Group_parallel(GroupObject *group, unsigned long count);
+
+/* Run func over the particles in [0, count) of the locked group, split into
+ * chunks on its kernel pool if count is large enough, otherwise, or if the
+ * pool is in use by another thread, in a single call. May be called with or
+ * without the GIL
+ */
+void
+Group_parallel_for(GroupObject *group, unsigned long count,
+	GroupKernelFunc func, void *arg);
+
+/* Publish the native protocol of a ready controller type. Return true on
+ * success, otherwise set an exception and return false
+ */
+int
+Controller_set_native(PyTypeObject *type, ControllerNative *native);
+
+/* Return a new reference to the native protocol capsule of controller's
+ * type, or None if it does not implement the protocol
+ */
+PyObject *
+Controller_get_native(PyObject *controller);
+
+/* Run count native controllers that all provide update_range over the group
+ * in a single pass, without the GIL for large groups. Return 0 on success,
+ * or set an exception and return -1
+ * if the group lacks an attribute one of them needs, after running the
+ * controllers preceding it
+ */
+int
+Controller_run_fused(GroupObject *group, float td, PyObject **ctrlrs,
+	ControllerNative **natives, int count);
+
+/* The pass of Controller_run_fused() over the particles. The group must
+ * store the attributes all of the controllers use, and be locked. It does
+ * not use the Python API, thus can run without the GIL. Large groups are
+ * split across the group's kernel pool, except for controllers that change
+ * shared state, which run in a pass of their own
+ */
+void
+Controller_fused_pass(GroupObject *group, float td, PyObject **ctrlrs,
+	ControllerNative **natives, int count);
+
 /* Get a vector from an attrbute of the template and store it in vec */
 int
 get_Vec3(Vec3 *vec, PyObject *dict, PyObject *template, const char *attrname);
@@ -152,7 +500,13 @@ get_Float(float *f, PyObject *dict, PyObject *template, const char *attrname);
 
 /* Create a new particle reference object for the given group and particle */
 EXTERN_INLINE ParticleRefObject *
-ParticleRefObject_New(PyObject *parent, Particle *p);
+ParticleRefObject_New(PyObject *parent, unsigned long index);
+
+/* Create a new particle reference object for a particle struct owned by
+ * the parent object, such as an emitter template
+ */
+ParticleRefObject *
+ParticleRefObject_FromStruct(PyObject *parent, Particle *p);
 
 /* Create a new vector object for the parent object and vector struct specified
  * The parent object may be NULL if there is none
@@ -16,10 +16,14 @@
 
 #include <Python.h>
 #include <structmember.h>
+#include <float.h>
 
 #include "cccompat.h"
 #include "compat.h"
 #include "group.h"
+#include "domain.h"
+#include "workerpool.h"
+#include "simd.h"
 
 static PyTypeObject ParticleGroup_Type;
 static PyTypeObject ParticleIter_Type;
@@ -27,6 +31,11 @@ static PyTypeObject ParticleProxy_Type;
 
 static PyObject *InvalidParticleRefError;
 
+/* Kernel pool shared by all groups, serial until set_kernel_threads() */
+static GroupKernelPool Group_kernels = {
+	NULL, NULL, 1, GROUP_KERNEL_MIN_CHUNK
+};
+
 #define GroupObject_CHECK(v) (Py_TYPE(v) == &ParticleGroup_Type)
 #define ParticleProxy_CHECK(v) (Py_TYPE(v) == &ParticleProxy_Type)
 
@@ -36,35 +45,172 @@ ParticleGroup_dealloc(GroupObject *self)
 	Py_CLEAR(self->controllers);
 	Py_CLEAR(self->renderer);
 	Py_CLEAR(self->system);
-	PyMem_Free(self->plist);
+	Py_CLEAR(self->ctrlr_sources[0]);
+	Py_CLEAR(self->ctrlr_sources[1]);
+	Py_CLEAR(self->ctrlr_cache);
+	Py_CLEAR(self->ctrlr_native);
+	if (self->lock != NULL) {
+		PyThread_free_lock(self->lock);
+		self->lock = NULL;
+	}
+	ParticleList_free(self->plist);
 	self->plist = NULL;
 	PyObject_Del(self);
 }
 
+/* Return the attribute number for name, or -1 if there is none */
+static int
+Particle_attrnum(const char *name)
+{
+	int attr;
+
+	for (attr = 0; attr < PATTR_COUNT; attr++) {
+		if (!strcmp(name, Particle_attr_info[attr].name))
+			return attr;
+	}
+	return -1;
+}
+
+/* Convert a sequence of attribute names to a PATTR_BIT mask.
+ * Return true on success, false on failure with an exception set
+ */
+static int
+ParticleGroup_parse_attrs(PyObject *names, unsigned int *attrs)
+{
+	PyObject *seq, *name;
+	const char *attrname;
+	Py_ssize_t i;
+	int attr;
+
+	seq = PySequence_Fast(names, "attributes must be a sequence of names");
+	if (seq == NULL)
+		return 0;
+	*attrs = 0;
+	for (i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+		name = PySequence_Fast_GET_ITEM(seq, i);
+		attrname = PyString_AsString(name);
+		if (attrname == NULL)
+			goto error;
+		attr = Particle_attrnum(attrname);
+		if (attr < 0) {
+			PyErr_Format(PyExc_ValueError,
+				"unknown particle attribute '%s'", attrname);
+			goto error;
+		}
+		*attrs |= PATTR_BIT(attr);
+	}
+	Py_DECREF(seq);
+	return 1;
+
+error:
+	Py_DECREF(seq);
+	return 0;
+}
+
+/* Names of the GROUP_COMPACT_* policies */
+static const char *compaction_names[] = {"lazy", "threshold", "always", NULL};
+
+/* Return the compaction policy for name, or -1 with an exception set */
+static int
+ParticleGroup_parse_compaction(const char *name)
+{
+	int i;
+
+	for (i = 0; compaction_names[i] != NULL; i++) {
+		if (!strcmp(name, compaction_names[i]))
+			return i;
+	}
+	PyErr_Format(PyExc_ValueError,
+		"compaction must be 'lazy', 'threshold' or 'always', not '%s'", name);
+	return -1;
+}
+
 static int
 ParticleGroup_init(GroupObject *self, PyObject *args, PyObject *kwargs)
 {
 	PyObject *particle_module, *r;
-	PyObject *controllers = NULL, *system = NULL;
-
-	static char *kwlist[] = {"controllers", "renderer", "system", NULL};
+	PyObject *controllers = NULL, *system = NULL, *attributes = NULL;
+	PyObject *max_particles = NULL, *preserve_order = NULL;
+	PyObject *stable_handles = NULL;
+	const char *layout_name = "aos", *compaction_name = "lazy";
+	int layout, truth;
+	unsigned int attrs;
+	long pmax;
+
+	static char *kwlist[] = {"controllers", "renderer", "system", "layout",
+		"attributes", "max_particles", "compaction", "compaction_threshold",
+		"preserve_order", "stable_handles", NULL};
 
 	self->renderer = NULL;
-	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OOO:__init__", kwlist,
-		&controllers, &self->renderer, &system))
+	self->compaction_threshold = 0.25f;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OOOsOOsfOO:__init__", kwlist,
+		&controllers, &self->renderer, &system, &layout_name, &attributes,
+		&max_particles, &compaction_name, &self->compaction_threshold,
+		&preserve_order, &stable_handles))
+		return -1;
+
+	self->compaction = ParticleGroup_parse_compaction(compaction_name);
+	if (self->compaction < 0)
+		return -1;
+	if (self->compaction_threshold < 0) {
+		PyErr_SetString(PyExc_ValueError, "compaction_threshold must be >= 0");
+		return -1;
+	}
+	self->preserve_order = 1;
+	if (preserve_order != NULL) {
+		truth = PyObject_IsTrue(preserve_order);
+		if (truth < 0)
+			return -1;
+		self->preserve_order = (char)truth;
+	}
+
+	if (!strcmp(layout_name, "aos")) {
+		layout = GROUP_LAYOUT_AOS;
+	} else if (!strcmp(layout_name, "soa")) {
+		layout = GROUP_LAYOUT_SOA;
+	} else {
+		PyErr_Format(PyExc_ValueError,
+			"layout must be 'aos' or 'soa', not '%s'", layout_name);
 		return -1;
+	}
 
+	attrs = PATTR_ALL;
+	if (attributes != NULL && attributes != Py_None) {
+		if (!ParticleGroup_parse_attrs(attributes, &attrs))
+			return -1;
+	}
+
+	pmax = 0;
+	if (max_particles != NULL && max_particles != Py_None) {
+		pmax = PyInt_AsLong(max_particles);
+		if (pmax == -1 && PyErr_Occurred())
+			return -1;
+		if (pmax <= 0) {
+			PyErr_SetString(PyExc_ValueError, "max_particles must be > 0");
+			return -1;
+		}
+	}
+
+	if (self->lock == NULL) {
+		self->lock = PyThread_allocate_lock();
+		if (self->lock == NULL) {
+			PyErr_NoMemory();
+			return -1;
+		}
+	}
 	self->iteration = 0;
-	self->plist = (ParticleList *)PyMem_Malloc(
-		sizeof(ParticleList) + sizeof(Particle) * GROUP_MIN_ALLOC);
-	if (self->plist == NULL) {
-		PyErr_NoMemory();
+	self->kernels = &Group_kernels;
+	self->plist = ParticleList_new(layout, attrs, pmax);
+	if (self->plist == NULL)
 		return -1;
+	if (stable_handles != NULL) {
+		truth = PyObject_IsTrue(stable_handles);
+		if (truth < 0 || (truth && !ParticleList_enable_handles(self->plist))) {
+			ParticleList_free(self->plist);
+			self->plist = NULL;
+			return -1;
+		}
 	}
-	self->plist->palloc = GROUP_MIN_ALLOC;
-	self->plist->pactive = 0;
-	self->plist->pnew = 0;
-	self->plist->pkilled = 0;
 	self->controllers = NULL;
 	self->system = NULL;
 
@@ -104,29 +250,25 @@ error:
 	Py_XDECREF(self->controllers);
 	Py_XDECREF(self->renderer);
 	Py_XDECREF(self->system);
-	PyMem_Free(self->plist);
+	ParticleList_free(self->plist);
+	self->plist = NULL;
 	return -1;
 }
 
 /* Group methods */
 
 EXTERN_INLINE ParticleRefObject *
-ParticleRefObject_New(PyObject *parent, Particle *p);
+ParticleRefObject_New(PyObject *parent, unsigned long index);
 
 /* Create a new particle in the group from a template */
 static ParticleRefObject *
 ParticleGroup_new(GroupObject *self, PyObject *args, PyObject *kwargs)
 {
 	long pindex;
-	Particle *pnew;
+	Particle pnew;
 	int success, arg_count;
 	PyObject *ptemplate = NULL;
 
-	pindex = Group_new_p(self);
-	if (pindex < 0) {
-		PyErr_NoMemory();
-		return NULL;
-	}
 	arg_count = PyTuple_Size(args);
 	if (arg_count == 1) {
 		ptemplate = PyTuple_GetItem(args, 0);
@@ -137,20 +279,27 @@ ParticleGroup_new(GroupObject *self, PyObject *args, PyObject *kwargs)
 		return NULL;
 	}
 
-	pnew = self->plist->p + pindex;
+	memset(&pnew, 0, sizeof(Particle));
 	success = (
-		get_Vec3(&pnew->position, kwargs, ptemplate, "position") &&
-		get_Vec3(&pnew->velocity, kwargs, ptemplate, "velocity") &&
-		get_Vec3(&pnew->size, kwargs, ptemplate, "size") &&
-		get_Vec3(&pnew->up, kwargs, ptemplate, "up") &&
-		get_Vec3(&pnew->rotation, kwargs, ptemplate, "rotation") &&
-		get_Color(&pnew->color, kwargs, ptemplate, "color") &&
-		get_Float(&pnew->age, kwargs, ptemplate, "age") &&
-		get_Float(&pnew->mass, kwargs, ptemplate, "mass"));
+		get_Vec3(&pnew.position, kwargs, ptemplate, "position") &&
+		get_Vec3(&pnew.velocity, kwargs, ptemplate, "velocity") &&
+		get_Vec3(&pnew.size, kwargs, ptemplate, "size") &&
+		get_Vec3(&pnew.up, kwargs, ptemplate, "up") &&
+		get_Vec3(&pnew.rotation, kwargs, ptemplate, "rotation") &&
+		get_Color(&pnew.color, kwargs, ptemplate, "color") &&
+		get_Float(&pnew.age, kwargs, ptemplate, "age") &&
+		get_Float(&pnew.mass, kwargs, ptemplate, "mass"));
 	if (!success)
 		return NULL;
 
-	return ParticleRefObject_New((PyObject *)self, pnew);
+	Group_lock(self);
+	pindex = Group_new_p(self);
+	if (pindex >= 0)
+		Group_store_p(self, pindex, &pnew);
+	Group_unlock(self);
+	if (pindex < 0)
+		return NULL;
+	return ParticleRefObject_New((PyObject *)self, pindex);
 }
 
 static inline int
@@ -168,11 +317,226 @@ ParticleGroup_kill(GroupObject *self, ParticleRefObject *pref)
 	if (!ParticleRefObject_IsValid(pref))
 		return NULL;
 
-	Group_kill_p(self, pref->p);
+	Group_lock(self);
+	Group_kill_p(self, pref->index);
+	Group_unlock(self);
 	Py_INCREF(Py_None);
 	return Py_None;
 }
 
+/* Return true if the group has stable handles, otherwise set a ValueError
+ * and return false */
+static int
+ParticleGroup_check_handles(GroupObject *self)
+{
+	if (self->plist->handles == NULL) {
+		PyErr_SetString(PyExc_ValueError,
+			"particle group was not created with stable_handles=True");
+		return 0;
+	}
+	return 1;
+}
+
+/* Return a reference to the particle with a stable handle */
+static PyObject *
+ParticleGroup_get(GroupObject *self, PyObject *args)
+{
+	unsigned long handle;
+	long slot;
+
+	if (!PyArg_ParseTuple(args, "k:get", &handle))
+		return NULL;
+	if (!ParticleGroup_check_handles(self))
+		return NULL;
+	slot = -1;
+	if (handle <= 0xFFFFFFFFul)
+		slot = ParticleList_handle_slot(self->plist, (uint32_t)handle);
+	if (slot < 0 || !Group_IsAlive(self, slot)) {
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+	return (PyObject *)ParticleRefObject_New((PyObject *)self, slot);
+}
+
+/* Return the stable handles of the particles in the group */
+static PyObject *
+ParticleGroup_handles(GroupObject *self, PyObject *args, PyObject *kwargs)
+{
+	PyObject *bytes, *view, *result;
+	uint32_t *handles;
+	unsigned long i, pcount, count;
+	int alive_only = 1;
+
+	static char *kwlist[] = {"alive_only", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i:handles", kwlist,
+		&alive_only))
+		return NULL;
+	if (!ParticleGroup_check_handles(self))
+		return NULL;
+	pcount = GroupObject_ActiveCount(self);
+	count = pcount;
+	if (alive_only) {
+		count = 0;
+		for (i = 0; i < pcount; i++)
+			count += Group_IsAlive(self, i);
+	}
+	bytes = PyByteArray_FromStringAndSize(NULL, count * sizeof(uint32_t));
+	if (bytes == NULL)
+		return NULL;
+	handles = (uint32_t *)PyByteArray_AS_STRING(bytes);
+	for (i = 0; i < pcount; i++) {
+		if (!alive_only)
+			*handles++ = self->plist->handles->slot_handle[i];
+		else if (Group_IsAlive(self, i))
+			*handles++ = self->plist->handles->slot_handle[i];
+	}
+	view = PyMemoryView_FromObject(bytes);
+	Py_DECREF(bytes);
+	if (view == NULL)
+		return NULL;
+	result = PyObject_CallMethod(view, "cast", "s", "I");
+	Py_DECREF(view);
+	return result;
+}
+
+/* Actions performed on the particles matching a query */
+#define WHERE_COUNT 0
+#define WHERE_KILL 1
+#define WHERE_INDICES 2
+
+/* Evaluate a query over the live particles of the group, matching those
+ * whose age is between min_age and max_age, and whose position is inside
+ * (or outside) the domain if one is specified. Depending on the action,
+ * return the number of matching particles, kill them and return their
+ * number, or return a list of their indices.
+ */
+static PyObject *
+ParticleGroup_where(GroupObject *self, PyObject *args, PyObject *kwargs,
+	int action)
+{
+	PyObject *domain = Py_None, *indices = NULL, *index;
+	VectorObject *vector = NULL;
+	DomainNative *native = NULL;
+	objobjproc contains = NULL;
+	ParticleColumn position, age;
+	float min_age = 0.0f, max_age = FLT_MAX, page;
+	int inside = 1, in_domain;
+	unsigned char *matched = NULL;
+	unsigned long i, pcount, count = 0;
+
+	static char *kwlist[] = {"domain", "inside", "min_age", "max_age", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Oiff:where", kwlist,
+		&domain, &inside, &min_age, &max_age))
+		return NULL;
+	inside = inside ? 1 : 0;
+	position = Group_column(self, PATTR_POSITION);
+	if (domain != Py_None) {
+		if (!Group_require(self, PATTR_BIT(PATTR_POSITION), "domain query"))
+			return NULL;
+		native = Domain_get_native(domain);
+		if (native == NULL) {
+			vector = Vector_new(NULL, Column_ptr(position, Vec3, 0), 3);
+			if (vector == NULL)
+				return NULL;
+			/* Call the domain's contains slot directly to avoid the generic
+			 * dispatch for every particle */
+			if (Py_TYPE(domain)->tp_as_sequence != NULL)
+				contains = Py_TYPE(domain)->tp_as_sequence->sq_contains;
+		}
+	}
+	age = Group_column(self, PATTR_AGE);
+	pcount = GroupObject_ActiveCount(self);
+	if (action == WHERE_INDICES) {
+		indices = PyList_New(0);
+		if (indices == NULL)
+			goto error;
+	} else if (action == WHERE_KILL && pcount > 0) {
+		/* Matches are killed together once the domain, which may call back
+		 * into Python, has been tested */
+		matched = (unsigned char *)PyMem_Malloc(pcount);
+		if (matched == NULL) {
+			PyErr_NoMemory();
+			goto error;
+		}
+		memset(matched, 0, pcount);
+	}
+
+	for (i = 0; i < pcount; i++) {
+		page = *Column_ptr(age, float, i);
+		if (page < 0 || page < min_age || page > max_age)
+			continue;
+		if (native != NULL) {
+			in_domain = native->contains(domain,
+				Column_ptr(position, Vec3, i)) != 0;
+			if (in_domain != inside)
+				continue;
+		} else if (vector != NULL) {
+			vector->vec = Column_ptr(position, Vec3, i);
+			if (contains != NULL)
+				in_domain = contains(domain, (PyObject *)vector);
+			else
+				in_domain = PySequence_Contains(domain, (PyObject *)vector);
+			if (in_domain < 0)
+				goto error;
+			if (in_domain != inside)
+				continue;
+		}
+		count++;
+		if (action == WHERE_KILL) {
+			matched[i] = 1;
+		} else if (action == WHERE_INDICES) {
+			index = PyLong_FromUnsignedLong(i);
+			if (index == NULL || PyList_Append(indices, index) < 0) {
+				Py_XDECREF(index);
+				goto error;
+			}
+			Py_DECREF(index);
+		}
+	}
+	if (matched != NULL) {
+		Group_lock(self);
+		for (i = 0; i < pcount; i++) {
+			if (matched[i])
+				Group_kill_p(self, i);
+		}
+		Group_unlock(self);
+		PyMem_Free(matched);
+	}
+	Py_XDECREF(vector);
+	if (action == WHERE_INDICES)
+		return indices;
+	return PyInt_FromLong(count);
+
+error:
+	PyMem_Free(matched);
+	Py_XDECREF(vector);
+	Py_XDECREF(indices);
+	return NULL;
+}
+
+/* Kill the particles matching a query */
+static PyObject *
+ParticleGroup_kill_where(GroupObject *self, PyObject *args, PyObject *kwargs)
+{
+	return ParticleGroup_where(self, args, kwargs, WHERE_KILL);
+}
+
+/* Count the particles matching a query */
+static PyObject *
+ParticleGroup_count_where(GroupObject *self, PyObject *args, PyObject *kwargs)
+{
+	return ParticleGroup_where(self, args, kwargs, WHERE_COUNT);
+}
+
+/* Return the indices of the particles matching a query */
+static PyObject *
+ParticleGroup_indices_where(GroupObject *self, PyObject *args, PyObject *kwargs)
+{
+	return ParticleGroup_where(self, args, kwargs, WHERE_INDICES);
+}
+
 /* Return the number of active particles */
 static Py_ssize_t
 ParticleGroup_length(GroupObject *self)
@@ -194,6 +558,60 @@ ParticleGroup_killed_count(GroupObject *self)
 	return PyInt_FromLong(self->plist->pkilled);
 }
 
+/* Return the fraction of the group's particle slots occupied by
+ * unreclaimed, killed particles */
+static PyObject *
+ParticleGroup_fragmentation(GroupObject *self)
+{
+	unsigned long total = GroupObject_ActiveCount(self);
+
+	if (total == 0)
+		return PyFloat_FromDouble(0.0);
+	return PyFloat_FromDouble((double)self->plist->pkilled / total);
+}
+
+/* Allocate slots for at least count particles */
+static PyObject *
+ParticleGroup_reserve(GroupObject *self, PyObject *args)
+{
+	long count;
+	int success;
+
+	if (!PyArg_ParseTuple(args, "l:reserve", &count))
+		return NULL;
+	if (count < 0) {
+		PyErr_SetString(PyExc_ValueError, "reserve: Expected count >= 0");
+		return NULL;
+	}
+	Group_lock(self);
+	success = Group_reserve(self, count);
+	Group_unlock(self);
+	if (!success)
+		return NULL;
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+/* Release the slots not used by active, killed or new particles */
+static PyObject *
+ParticleGroup_shrink_to_fit(GroupObject *self)
+{
+	unsigned long palloc;
+	int success = 1;
+
+	Group_lock(self);
+	palloc = GroupObject_ActiveCount(self) + self->plist->pnew;
+	if (palloc < GROUP_MIN_ALLOC)
+		palloc = GROUP_MIN_ALLOC;
+	if (palloc < self->plist->palloc)
+		success = ParticleList_resize(self->plist, palloc);
+	Group_unlock(self);
+	if (!success)
+		return NULL;
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
 /* Return a new particle group iterator */
 static PyObject *
 ParticleGroup_iter(PyObject *self)
@@ -208,48 +626,140 @@ ParticleGroup_iter(PyObject *self)
 	}
 	piter->parent = (PyObject *)group;
 	Py_INCREF(group);
-	piter->p = group->plist->p;
+	piter->index = 0;
+	piter->p = NULL;
 	piter->iteration = group->iteration;
 	return (PyObject *)piter;
 }
 
-/* Perform an update iteration */
-static PyObject *
-ParticleGroup_update(GroupObject *self, PyObject *args)
+/* Resolve the controllers to invoke from the system's and the group's
+ * controller tuples. The result is cached until either tuple is replaced,
+ * which is how controllers are added to or removed from both. Return true on
+ * success, otherwise set an exception and return false
+ */
+static int
+ParticleGroup_resolve_controllers(GroupObject *self, PyObject *system_ctrlrs)
 {
-	float td;
-	unsigned long head, tail, pnew;
-	Particle *p;
-	PyObject *ctrlr, *ctrlr_seq, *ctrlr_iter[2], *ctrlr_args;
-	PyObject *r;
-	int i;
+	PyObject *sources[2], *seq, *cache = NULL, *native = NULL, *ctrlr, *capsule;
+	Py_ssize_t i, j, k, count;
 
-	if (!PyArg_ParseTuple(args, "f:update",  &td))
-		return NULL;
+	sources[0] = system_ctrlrs;
+	sources[1] = self->controllers;
+	if (self->ctrlr_cache != NULL && sources[0] == self->ctrlr_sources[0]
+		&& sources[1] == self->ctrlr_sources[1])
+		return 1;
 
-	self->iteration++; /* invalidate proxies and group iterators */
+	count = 0;
+	for (i = 0; i <= 1; i++) {
+		if (sources[i] != NULL)
+			count += PyTuple_GET_SIZE(sources[i]);
+	}
+	cache = PyTuple_New(count);
+	native = PyTuple_New(count);
+	if (cache == NULL || native == NULL)
+		goto error;
+	k = 0;
+	for (i = 0; i <= 1; i++) {
+		seq = sources[i];
+		for (j = 0; seq != NULL && j < PyTuple_GET_SIZE(seq); j++, k++) {
+			ctrlr = PyTuple_GET_ITEM(seq, j);
+			capsule = Controller_get_native(ctrlr);
+			Py_INCREF(ctrlr);
+			PyTuple_SET_ITEM(cache, k, ctrlr);
+			PyTuple_SET_ITEM(native, k, capsule);
+		}
+	}
 
-	/* consolidate active and new particles, reclaim some killed in the
-	 * process. The goal here is to strike a balance between consolidation
-	 * cost and keeping killed particles at bay. New particles are moved into
-	 * killed particle slots, and any killed particles at the end of the plist
-	 * are reclaimed. Care is taken not to reorder active particles to avoid
-	 * popping artifacts for renderers that draw in group-order. The order for
-	 * newly incorporated particles is arbitrary. This implementation never
-	 * moves active particles, but that is not a guarantee of the API, thus we
-	 * still invalidate proxies and particles iters beforehand.
-	 */
-	p = self->plist->p;
+	for (i = 0; i <= 1; i++) {
+		Py_XINCREF(sources[i]);
+		Py_XDECREF(self->ctrlr_sources[i]);
+		self->ctrlr_sources[i] = sources[i];
+	}
+	Py_XDECREF(self->ctrlr_cache);
+	self->ctrlr_cache = cache;
+	Py_XDECREF(self->ctrlr_native);
+	self->ctrlr_native = native;
+	return 1;
+
+error:
+	Py_XDECREF(cache);
+	Py_XDECREF(native);
+	return 0;
+}
+
+/* Universal particle state advanced by each update */
+typedef struct {
+	float td;
+	ParticleColumn age, position, velocity, last_position, last_velocity;
+} ParticleStateUpdate;
+
+/* Age the live particles in [start, end), and remember their last position
+ * and velocity */
+static void
+ParticleGroup_update_state(GroupObject *self, void *arg,
+	unsigned long start, unsigned long end)
+{
+	ParticleStateUpdate *update = (ParticleStateUpdate *)arg;
+	unsigned long i;
+
+	for (i = start; i < end; i++) {
+		if (*Column_ptr(update->age, float, i) < 0)
+			continue;
+		*Column_ptr(update->age, float, i) += update->td;
+		if (update->last_position.base != NULL)
+			*Column_ptr(update->last_position, Vec3, i) =
+				*Column_ptr(update->position, Vec3, i);
+		if (update->last_velocity.base != NULL)
+			*Column_ptr(update->last_velocity, Vec3, i) =
+				*Column_ptr(update->velocity, Vec3, i);
+	}
+}
+
+/* Consolidate active and new particles, reclaim some killed in the process.
+ * The goal here is to strike a balance between consolidation cost and
+ * keeping killed particles at bay. New particles are moved into killed
+ * particle slots, and any killed particles at the end of the plist are
+ * reclaimed. Care is taken not to reorder active particles to avoid popping
+ * artifacts for renderers that draw in group-order. The order for newly
+ * incorporated particles is arbitrary. This sweep never moves active
+ * particles, but the compaction policy applied afterward may, thus the
+ * caller must invalidate proxies and particles iters beforehand. The group
+ * must be locked; the Python API is not used, so the GIL need not be held.
+ */
+static void
+ParticleGroup_consolidate(GroupObject *self, float td)
+{
+	unsigned long head, tail, pnew, run;
+	ParticleStateUpdate update;
+	ParticleColumn age;
+	int parallel;
+
+	update.td = td;
+	update.age = age = Group_column(self, PATTR_AGE);
+	update.position = Group_column(self, PATTR_POSITION);
+	update.velocity = Group_column(self, PATTR_VELOCITY);
+	update.last_position = Group_column(self, PATTR_LAST_POSITION);
+	update.last_velocity = Group_column(self, PATTR_LAST_VELOCITY);
+	/* Only track the last state of attributes the group stores */
+	if (update.position.base == NULL)
+		update.last_position.base = NULL;
+	if (update.velocity.base == NULL)
+		update.last_velocity.base = NULL;
 	pnew = self->plist->pnew;
 	head = 0;
 	tail = GroupObject_ActiveCount(self) + pnew;
+	/* Large groups update the particle state in a parallel pass after the
+	 * sweep, smaller ones as the sweep visits the particles */
+	parallel = Group_parallel(self, tail);
 	/* Incorporate new particles and update last* and age particle attributes */
 	while (head < tail) {
-		if (!Particle_IsAlive(p[head])) {
+		if (*Column_ptr(age, float, head) < 0) {
 			if (pnew > 0) {
-				if (Particle_IsAlive(p[--tail])) {
-					memcpy(&p[head], &p[tail], sizeof(Particle));
+				if (*Column_ptr(age, float, --tail) >= 0) {
+					Group_move_p(self, head, tail);
 					self->plist->pactive++;
+				} else if (self->plist->handles != NULL) {
+					Group_kill_p(self, tail); /* release its handle */
 				}
 				pnew--;
 			} else {
@@ -257,58 +767,174 @@ ParticleGroup_update(GroupObject *self, PyObject *args)
 			}
 		}
 		/* This loop visits all active particles */
-		while (head < tail && Particle_IsAlive(p[head])) {
-			/* Update some universal particle state */
-			p[head].age += td;
-			p[head].last_position = p[head].position;
-			p[head].last_velocity = p[head].velocity;
+		run = head;
+		while (head < tail && *Column_ptr(age, float, head) >= 0)
 			head++;
-		}
+		if (!parallel)
+			ParticleGroup_update_state(self, &update, run, head);
 	}
 	/* reclaim killed particles at the end */
-	while (tail > 0 && !Particle_IsAlive(p[tail - 1]))
+	while (tail > 0 && *Column_ptr(age, float, tail - 1) < 0) {
 		tail--;
+		if (self->plist->handles != NULL)
+			Group_kill_p(self, tail); /* release its handle */
+	}
     self->plist->pactive += pnew;
 	self->plist->pkilled = tail - self->plist->pactive;
 	self->plist->pnew = 0;
+	if (parallel)
+		Group_parallel_for(self, tail, ParticleGroup_update_state, &update);
+
+	/* Remove the killed particles left over if the policy calls for it */
+	if (self->compaction == GROUP_COMPACT_ALWAYS
+		|| (self->compaction == GROUP_COMPACT_THRESHOLD && self->plist->pkilled
+			> self->compaction_threshold * GroupObject_ActiveCount(self)))
+		Group_compact(self, self->preserve_order);
+}
+
+/* Resolve the controllers of the group's system and of the group itself into
+ * the dispatch cache. Return true on success, otherwise set an exception and
+ * return false
+ */
+static int
+ParticleGroup_prepare_controllers(GroupObject *self)
+{
+	PyObject *ctrlr_seq, *seq;
+	int result;
 
-	/* invoke the controllers */
 	ctrlr_seq = PyObject_GetAttrString(self->system, "controllers");
 	if (ctrlr_seq == NULL)
+		return 0;
+	if (!PyTuple_CheckExact(ctrlr_seq)) {
+		/* Not immutable, so it cannot be cached */
+		seq = PySequence_Tuple(ctrlr_seq);
+		Py_DECREF(ctrlr_seq);
+		if (seq == NULL)
+			return 0;
+		ctrlr_seq = seq;
+	}
+	result = ParticleGroup_resolve_controllers(self, ctrlr_seq);
+	Py_DECREF(ctrlr_seq);
+	return result;
+}
+
+/* Return the native protocol of cached controller i, or NULL if it is a
+ * Python controller */
+static ControllerNative *
+ParticleGroup_controller_native(PyObject *natives, Py_ssize_t i)
+{
+	PyObject *capsule = PyTuple_GET_ITEM(natives, i);
+
+	if (capsule == Py_None)
 		return NULL;
-	ctrlr_iter[0] = PyObject_GetIter(ctrlr_seq);
-	Py_CLEAR(ctrlr_seq);
-	if (ctrlr_iter[0] == NULL)
-		return NULL;
-	if (self->controllers != NULL)
-		ctrlr_iter[1] = PyObject_GetIter(self->controllers);
-	else
-		ctrlr_iter[1] = NULL;
-	ctrlr_args = Py_BuildValue("fO", td, self);
-	if (ctrlr_args == NULL)
-		goto error;
+	return (ControllerNative *)PyCapsule_GetPointer(
+		capsule, CONTROLLER_NATIVE_CAPSULE);
+}
 
-	for (i = 0; i <= 1; i++) {
-		if (ctrlr_iter[i] != NULL) {
-			while ((ctrlr = PyIter_Next(ctrlr_iter[i]))) {
-				r = PyObject_CallObject(ctrlr, ctrlr_args);
-				Py_DECREF(ctrlr);
-				Py_XDECREF(r);
-				if (r == NULL || PyErr_Occurred())
+/* Invoke the controllers in the tuple ctrlrs, with native capsules natives
+ * as in the dispatch cache, in order starting with controller first. Native
+ * controllers are called directly. Return 0 on success, otherwise set an
+ * exception and return -1
+ */
+static int
+ParticleGroup_invoke_controllers(GroupObject *self, float td,
+	PyObject *ctrlrs, PyObject *natives, Py_ssize_t first)
+{
+	PyObject *ctrlr, *ctrlr_args = NULL, *r;
+	PyObject *fused[CONTROLLER_FUSE_MAX];
+	ControllerNative *native, *fused_native[CONTROLLER_FUSE_MAX];
+	Py_ssize_t i, count;
+	int nfused, j;
+
+	/* Python controllers may change the cache, so hold on to these */
+	Py_INCREF(ctrlrs);
+	Py_INCREF(natives);
+
+	count = PyTuple_GET_SIZE(ctrlrs);
+	nfused = 0;
+	for (i = first; i < count; i++) {
+		ctrlr = PyTuple_GET_ITEM(ctrlrs, i);
+		native = ParticleGroup_controller_native(natives, i);
+		if (native == NULL && PyErr_Occurred())
+			goto error;
+		if (native != NULL && native->update_range != NULL) {
+			/* A controller with a finish step changes its state after its
+			 * pass, which a second run of it must see, so the pending
+			 * pass is run first */
+			for (j = 0; native->finish != NULL && j < nfused; j++) {
+				if (fused[j] == ctrlr) {
+					if (Controller_run_fused(self, td, fused, fused_native,
+						nfused) < 0)
+						goto error;
+					nfused = 0;
+				}
+			}
+			/* Collect consecutive fusable controllers, then run them in a
+			 * single pass at the next one that is not */
+			fused[nfused] = ctrlr;
+			fused_native[nfused++] = native;
+			if (nfused < CONTROLLER_FUSE_MAX && i + 1 < count)
+				continue;
+		}
+		if (nfused > 0) {
+			if (Controller_run_fused(self, td, fused, fused_native, nfused) < 0)
+				goto error;
+			nfused = 0;
+			if (native != NULL && native->update_range != NULL)
+				continue;
+		}
+		if (native != NULL) {
+			if (native->update(ctrlr, self, td) < 0)
+				goto error;
+		} else {
+			if (ctrlr_args == NULL) {
+				ctrlr_args = Py_BuildValue("fO", td, self);
+				if (ctrlr_args == NULL)
 					goto error;
 			}
-			Py_CLEAR(ctrlr_iter[i]);
+			r = PyObject_CallObject(ctrlr, ctrlr_args);
+			Py_XDECREF(r);
+			if (r == NULL || PyErr_Occurred())
+				goto error;
 		}
 	}
 
-	Py_DECREF(ctrlr_args);
-	Py_INCREF(Py_None);
-	return Py_None;
+	Py_DECREF(ctrlrs);
+	Py_DECREF(natives);
+	Py_XDECREF(ctrlr_args);
+	return 0;
 error:
-	Py_XDECREF(ctrlr_iter[0]);
-	Py_XDECREF(ctrlr_iter[1]);
+	Py_DECREF(ctrlrs);
+	Py_DECREF(natives);
 	Py_XDECREF(ctrlr_args);
-	return NULL;
+	return -1;
+}
+
+/* Perform an update iteration */
+static PyObject *
+ParticleGroup_update(GroupObject *self, PyObject *args)
+{
+	float td;
+	PyThreadState *state;
+
+	if (!PyArg_ParseTuple(args, "f:update",  &td))
+		return NULL;
+
+	self->iteration++; /* invalidate proxies and group iterators */
+
+	/* Other threads may run while large groups are consolidated, but cannot
+	 * change the particles while the group is locked */
+	state = Group_begin_nogil(self,
+		GroupObject_ActiveCount(self) + self->plist->pnew);
+	ParticleGroup_consolidate(self, td);
+	Group_end_nogil(self, state);
+
+	if (!ParticleGroup_prepare_controllers(self)
+		|| ParticleGroup_invoke_controllers(self, td,
+			self->ctrlr_cache, self->ctrlr_native, 0) < 0)
+		return NULL;
+	Py_INCREF(Py_None);
+	return Py_None;
 }
 
 /* Bind one or more controllers to the group */
@@ -352,35 +978,572 @@ ParticleGroup_unbind_controller(GroupObject *self, PyObject *ctrlr)
 			PyTuple_SET_ITEM(new_ctrlrs, n++, item);
 		}
 	}
-	Py_DECREF(self->controllers);
-	self->controllers = new_ctrlrs;
-	Py_INCREF(Py_None);
-	return Py_None;
+	Py_DECREF(self->controllers);
+	self->controllers = new_ctrlrs;
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+/* Draw the group using its renderer (if any) */
+static PyObject *
+ParticleGroup_draw(GroupObject *self)
+{
+	PyObject *r;
+	static PyObject *draw_str = NULL;
+
+	if (draw_str == NULL) {
+		draw_str = PyString_InternFromString("draw");
+		if (draw_str == NULL) {
+			return NULL;
+		}
+	}
+	if (self->renderer != NULL && self->renderer != Py_None) {
+		r = PyObject_CallMethodObjArgs(self->renderer, draw_str, self, NULL);
+		if (r == NULL)
+			return NULL;
+		Py_DECREF(r);
+	}
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+/* Buffer export
+ *
+ * Particle attributes can be exported through the buffer protocol as arrays
+ * of floats with one row per particle slot, including killed particles. The
+ * group itself exports its particle records when using the AOS layout, and
+ * per-attribute views are exported by a helper object returned wrapped in
+ * a memoryview by ParticleGroup.view(). While any buffer is exported the
+ * group's storage may not move, so growing a group that does not use paged
+ * storage raises BufferError until the buffers are released.
+ */
+
+#if PY_MAJOR_VERSION >= 3
+
+static PyTypeObject ParticleView_Type;
+
+/* Exporter of a single particle attribute of a group */
+typedef struct {
+	PyObject_HEAD
+	GroupObject		*group;
+	int				attr;
+} ParticleViewObject;
+
+/* Fill in a buffer of rows of cols floats, one row per particle slot in the
+ * group, starting at buf with consecutive rows stride bytes apart. Return 0
+ * on success, -1 with an exception set on failure
+ */
+static int
+Group_fill_buffer(GroupObject *group, PyObject *exporter, Py_buffer *view,
+	int flags, char *buf, int ndim, Py_ssize_t cols, Py_ssize_t stride,
+	int readonly)
+{
+	Py_ssize_t *dims;
+
+	if (readonly && (flags & PyBUF_WRITABLE)) {
+		PyErr_SetString(PyExc_BufferError,
+			"buffers of particle ages are read-only, use kill() to kill particles");
+		return -1;
+	}
+	if (!(flags & PyBUF_STRIDES) && stride != cols * (Py_ssize_t)sizeof(float)) {
+		PyErr_SetString(PyExc_BufferError,
+			"particle attribute buffers are not contiguous");
+		return -1;
+	}
+	/* shape and strides, freed on release */
+	dims = (Py_ssize_t *)PyMem_Malloc(4 * sizeof(Py_ssize_t));
+	if (dims == NULL) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	dims[0] = GroupObject_ActiveCount(group);
+	dims[1] = cols;
+	dims[2] = stride;
+	dims[3] = sizeof(float);
+	view->buf = buf;
+	view->obj = exporter;
+	Py_INCREF(exporter);
+	view->len = dims[0] * cols * sizeof(float);
+	view->readonly = readonly;
+	view->itemsize = sizeof(float);
+	view->format = (flags & PyBUF_FORMAT) ? "f" : NULL;
+	view->ndim = ndim;
+	view->shape = (flags & PyBUF_ND) ? dims : NULL;
+	view->strides = (flags & PyBUF_STRIDES) ? dims + 2 : NULL;
+	view->suboffsets = NULL;
+	view->internal = dims;
+	group->plist->exports++;
+	return 0;
+}
+
+static void
+Group_release_buffer(GroupObject *group, Py_buffer *view)
+{
+	PyMem_Free(view->internal);
+	group->plist->exports--;
+}
+
+/* Export the group's particle records as a 2D array of floats */
+static int
+ParticleGroup_getbuffer(GroupObject *self, Py_buffer *view, int flags)
+{
+	ParticleList *plist = self->plist;
+
+	if (plist->layout != GROUP_LAYOUT_AOS) {
+		PyErr_SetString(PyExc_BufferError,
+			"only groups with the 'aos' layout export particle records, "
+			"use view() to access individual attributes");
+		return -1;
+	}
+	/* Records include the age, which tells live particles from killed ones */
+	return Group_fill_buffer(self, (PyObject *)self, view, flags,
+		plist->block, 2, plist->psize / sizeof(float), plist->psize, 1);
+}
+
+static void
+ParticleGroup_releasebuffer(GroupObject *self, Py_buffer *view)
+{
+	Group_release_buffer(self, view);
+}
+
+static PyBufferProcs ParticleGroup_as_buffer = {
+	(getbufferproc)ParticleGroup_getbuffer,
+	(releasebufferproc)ParticleGroup_releasebuffer,
+};
+
+/* Export a particle attribute as an array of floats with one row per
+ * particle for vector attributes, or a flat array for scalar attributes */
+static int
+ParticleView_getbuffer(ParticleViewObject *self, Py_buffer *view, int flags)
+{
+	const ParticleAttrInfo *info = &Particle_attr_info[self->attr];
+	ParticleColumn col = Group_column(self->group, self->attr);
+
+	return Group_fill_buffer(self->group, (PyObject *)self, view, flags,
+		col.base, info->length > 1 ? 2 : 1, info->length, col.stride,
+		self->attr == PATTR_AGE);
+}
+
+static void
+ParticleView_releasebuffer(ParticleViewObject *self, Py_buffer *view)
+{
+	Group_release_buffer(self->group, view);
+}
+
+static void
+ParticleView_dealloc(ParticleViewObject *self)
+{
+	Py_CLEAR(self->group);
+	PyObject_Del(self);
+}
+
+static PyBufferProcs ParticleView_as_buffer = {
+	(getbufferproc)ParticleView_getbuffer,
+	(releasebufferproc)ParticleView_releasebuffer,
+};
+
+static PyTypeObject ParticleView_Type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"group.ParticleView",		/*tp_name*/
+	sizeof(ParticleViewObject),	/*tp_basicsize*/
+	0,			/*tp_itemsize*/
+	/* methods */
+	(destructor)ParticleView_dealloc, /*tp_dealloc*/
+	0,			/*tp_print*/
+	0,          /*tp_getattr*/
+	0,          /*tp_setattr*/
+	0,			/*tp_compare*/
+	0,			/*tp_repr*/
+	0,			/*tp_as_number*/
+	0,			/*tp_as_sequence*/
+	0,			/*tp_as_mapping*/
+	0,			/*tp_hash*/
+	0,                      /*tp_call*/
+	0,                      /*tp_str*/
+	0,                      /*tp_getattro*/
+	0,                      /*tp_setattro*/
+	&ParticleView_as_buffer, /*tp_as_buffer*/
+	Py_TPFLAGS_DEFAULT,     /*tp_flags*/
+	0,                      /*tp_doc*/
+};
+
+/* Return a memoryview of a single particle attribute */
+static PyObject *
+ParticleGroup_view(GroupObject *self, PyObject *args)
+{
+	const char *name;
+	ParticleViewObject *exporter;
+	PyObject *view;
+	int attr;
+
+	if (!PyArg_ParseTuple(args, "s:view", &name))
+		return NULL;
+	attr = Particle_attrnum(name);
+	if (attr < 0) {
+		PyErr_Format(PyExc_ValueError, "unknown particle attribute '%s'", name);
+		return NULL;
+	}
+	if (!Group_require(self, PATTR_BIT(attr), "view"))
+		return NULL;
+
+	exporter = PyObject_New(ParticleViewObject, &ParticleView_Type);
+	if (exporter == NULL)
+		return NULL;
+	Py_INCREF(self);
+	exporter->group = self;
+	exporter->attr = attr;
+	view = PyMemoryView_FromObject((PyObject *)exporter);
+	Py_DECREF(exporter);
+	return view;
+}
+
+/* Bulk attribute access
+ *
+ * get_attribute() and set_attribute() copy a particle attribute between the
+ * group and a contiguous buffer of floats (or doubles) in a single loop,
+ * with one row per live particle in group order.
+ */
+
+/* Element types of bulk attribute buffers */
+#define BULK_FLOAT 0
+#define BULK_DOUBLE 1
+#define BULK_BYTE 2
+
+/* Return the element type of a buffer from its struct format, or -1 if it
+ * is not supported */
+static int
+bulk_format(const char *format)
+{
+	if (format == NULL)
+		return BULK_BYTE;
+	if (*format == '@' || *format == '='
+#if PY_LITTLE_ENDIAN
+		|| *format == '<'
+#else
+		|| *format == '>'
+#endif
+		)
+		format++;
+	if (!strcmp(format, "f"))
+		return BULK_FLOAT;
+	if (!strcmp(format, "d"))
+		return BULK_DOUBLE;
+	if (!strcmp(format, "?") || !strcmp(format, "b") || !strcmp(format, "B"))
+		return BULK_BYTE;
+	return -1;
+}
+
+/* Get a C-contiguous buffer from obj with an element type in the types bit
+ * mask, returned in *type. Return true on success, false with an exception
+ * set on failure */
+static int
+bulk_get_buffer(PyObject *obj, Py_buffer *buf, int flags, int types,
+	int *type, const char *argname)
+{
+	if (PyObject_GetBuffer(obj, buf, flags | PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) < 0)
+		return 0;
+	*type = bulk_format(buf->format);
+	if (*type < 0 || !(types & (1 << *type))) {
+		PyErr_Format(PyExc_TypeError, "%s: unsupported buffer format '%s'",
+			argname, buf->format);
+		PyBuffer_Release(buf);
+		return 0;
+	}
+	return 1;
+}
+
+/* Copy a particle attribute into a buffer of floats */
+static PyObject *
+ParticleGroup_get_attribute(GroupObject *self, PyObject *args, PyObject *kwargs)
+{
+	const char *name;
+	PyObject *out = NULL, *bytes = NULL, *result = NULL;
+	int alive_only = 1, attr, type, length, j;
+	unsigned long i, count, pcount, row;
+	ParticleColumn col;
+	Py_buffer buf;
+	float *src;
+
+	static char *kwlist[] = {"name", "out", "alive_only", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|Oi:get_attribute", kwlist,
+		&name, &out, &alive_only))
+		return NULL;
+	attr = Particle_attrnum(name);
+	if (attr < 0) {
+		PyErr_Format(PyExc_ValueError, "unknown particle attribute '%s'", name);
+		return NULL;
+	}
+	if (!Group_require(self, PATTR_BIT(attr), "get_attribute"))
+		return NULL;
+	col = Group_column(self, attr);
+	length = Particle_attr_info[attr].length;
+	pcount = GroupObject_ActiveCount(self);
+	count = pcount;
+	if (alive_only) {
+		count = 0;
+		for (i = 0; i < pcount; i++)
+			count += Group_IsAlive(self, i);
+	}
+
+	if (out == NULL || out == Py_None) {
+		bytes = PyByteArray_FromStringAndSize(NULL, count * length * sizeof(float));
+		if (bytes == NULL)
+			return NULL;
+		out = bytes;
+	}
+	if (!bulk_get_buffer(out, &buf, PyBUF_WRITABLE,
+		(1 << BULK_FLOAT) | (1 << BULK_DOUBLE) | (bytes != NULL) << BULK_BYTE,
+		&type, "get_attribute"))
+		goto error;
+	if (type == BULK_BYTE)
+		type = BULK_FLOAT; /* our own bytearray */
+	if ((unsigned long)(buf.len / buf.itemsize) < count * length) {
+		PyErr_Format(PyExc_ValueError,
+			"get_attribute: out must have room for %lu values", count * length);
+		PyBuffer_Release(&buf);
+		goto error;
+	}
+
+	/* Particles may be incorporated by an update in another thread since they
+	 * were counted, so stop when out is full */
+	Group_lock(self);
+	row = 0;
+	for (i = 0; i < pcount && row < count; i++) {
+		if (alive_only && !Group_IsAlive(self, i))
+			continue;
+		src = Column_ptr(col, float, i);
+		if (type == BULK_FLOAT) {
+			memcpy((float *)buf.buf + row * length, src, length * sizeof(float));
+		} else {
+			for (j = 0; j < length; j++)
+				((double *)buf.buf)[row * length + j] = src[j];
+		}
+		row++;
+	}
+	Group_unlock(self);
+	PyBuffer_Release(&buf);
+
+	if (bytes != NULL) {
+		/* Return the new array as a view shaped like those of view() */
+		out = PyMemoryView_FromObject(bytes);
+		Py_DECREF(bytes);
+		if (out == NULL)
+			return NULL;
+		if (length > 1 && count > 0) /* memoryviews cannot be cast to (0, n) */
+			result = PyObject_CallMethod(out, "cast", "s(ki)", "f", count, length);
+		else
+			result = PyObject_CallMethod(out, "cast", "s", "f");
+		Py_DECREF(out);
+		return result;
+	}
+	Py_INCREF(out);
+	return out;
+
+error:
+	Py_XDECREF(bytes);
+	return NULL;
+}
+
+/* Copy values from a buffer of floats into a particle attribute */
+static PyObject *
+ParticleGroup_set_attribute(GroupObject *self, PyObject *args, PyObject *kwargs)
+{
+	const char *name;
+	PyObject *values, *mask = NULL;
+	int attr, type, mask_type, length, j;
+	unsigned long i, count, pcount, row, step;
+	ParticleColumn col;
+	Py_buffer buf, mask_buf;
+	float *dst;
+
+	static char *kwlist[] = {"name", "values", "mask", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sO|O:set_attribute", kwlist,
+		&name, &values, &mask))
+		return NULL;
+	attr = Particle_attrnum(name);
+	if (attr < 0) {
+		PyErr_Format(PyExc_ValueError, "unknown particle attribute '%s'", name);
+		return NULL;
+	}
+	if (!Group_require(self, PATTR_BIT(attr), "set_attribute"))
+		return NULL;
+	col = Group_column(self, attr);
+	length = Particle_attr_info[attr].length;
+	pcount = GroupObject_ActiveCount(self);
+	count = 0;
+	for (i = 0; i < pcount; i++)
+		count += Group_IsAlive(self, i);
+
+	if (!bulk_get_buffer(values, &buf, PyBUF_SIMPLE,
+		(1 << BULK_FLOAT) | (1 << BULK_DOUBLE), &type, "set_attribute"))
+		return NULL;
+	/* A single value is assigned to all particles */
+	if (buf.len / buf.itemsize == length) {
+		step = 0;
+	} else if ((unsigned long)(buf.len / buf.itemsize) == count * length) {
+		step = length;
+	} else {
+		PyErr_Format(PyExc_ValueError,
+			"set_attribute: expected %d or %lu values", length, count * length);
+		PyBuffer_Release(&buf);
+		return NULL;
+	}
+	if (mask != NULL && mask != Py_None) {
+		if (!bulk_get_buffer(mask, &mask_buf, PyBUF_SIMPLE, 1 << BULK_BYTE,
+			&mask_type, "set_attribute mask")) {
+			PyBuffer_Release(&buf);
+			return NULL;
+		}
+		if ((unsigned long)mask_buf.len != count) {
+			PyErr_Format(PyExc_ValueError,
+				"set_attribute: expected a mask of %lu values", count);
+			PyBuffer_Release(&mask_buf);
+			PyBuffer_Release(&buf);
+			return NULL;
+		}
+	} else {
+		mask = NULL;
+	}
+
+	Group_lock(self);
+	row = 0;
+	for (i = 0; i < pcount && row < count; i++) {
+		if (!Group_IsAlive(self, i))
+			continue;
+		if (mask == NULL || ((char *)mask_buf.buf)[row]) {
+			dst = Column_ptr(col, float, i);
+			if (type == BULK_FLOAT) {
+				memcpy(dst, (float *)buf.buf + row * step, length * sizeof(float));
+			} else {
+				for (j = 0; j < length; j++)
+					dst[j] = (float)((double *)buf.buf)[row * step + j];
+			}
+			/* A negative age kills the particle, which must be counted */
+			if (attr == PATTR_AGE && *dst < 0) {
+				*dst = 0;
+				Group_kill_p(self, i);
+			}
+		}
+		row++;
+	}
+	Group_unlock(self);
+	if (mask != NULL)
+		PyBuffer_Release(&mask_buf);
+	PyBuffer_Release(&buf);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+#define ParticleGroup_AS_BUFFER (&ParticleGroup_as_buffer)
+
+#else
+
+#define ParticleGroup_AS_BUFFER 0
+
+#endif
+
+/* Return the name of the group's storage layout */
+static PyObject *
+ParticleGroup_get_layout(GroupObject *self, void *closure)
+{
+	if (self->plist->layout == GROUP_LAYOUT_SOA)
+		return PyString_FromString("soa");
+	return PyString_FromString("aos");
+}
+
+/* Return a tuple of the names of the particle attributes the group stores */
+static PyObject *
+ParticleGroup_get_attributes(GroupObject *self, void *closure)
+{
+	PyObject *names, *name;
+	int attr;
+
+	names = PyList_New(0);
+	if (names == NULL)
+		return NULL;
+	for (attr = 0; attr < PATTR_COUNT; attr++) {
+		if (self->plist->attrs & PATTR_BIT(attr)) {
+			name = PyString_FromString(Particle_attr_info[attr].name);
+			if (name == NULL || PyList_Append(names, name) < 0) {
+				Py_XDECREF(name);
+				Py_DECREF(names);
+				return NULL;
+			}
+			Py_DECREF(name);
+		}
+	}
+	name = PyList_AsTuple(names);
+	Py_DECREF(names);
+	return name;
 }
 
-/* Draw the group using its renderer (if any) */
 static PyObject *
-ParticleGroup_draw(GroupObject *self)
+ParticleGroup_get_capacity(GroupObject *self, void *closure)
 {
-	PyObject *r;
-	static PyObject *draw_str = NULL;
+	return PyInt_FromLong(self->plist->palloc);
+}
 
-	if (draw_str == NULL) {
-		draw_str = PyString_InternFromString("draw");
-		if (draw_str == NULL) {
-			return NULL;
-		}
+static PyObject *
+ParticleGroup_get_max_particles(GroupObject *self, void *closure)
+{
+	if (self->plist->pmax == 0) {
+		Py_INCREF(Py_None);
+		return Py_None;
 	}
-	if (self->renderer != NULL && self->renderer != Py_None) {
-		r = PyObject_CallMethodObjArgs(self->renderer, draw_str, self, NULL);
-		if (r == NULL)
-			return NULL;
-		Py_DECREF(r);
+	return PyInt_FromLong(self->plist->pmax);
+}
+
+static PyObject *
+ParticleGroup_get_compaction(GroupObject *self, void *closure)
+{
+	return PyString_FromString(compaction_names[self->compaction]);
+}
+
+static int
+ParticleGroup_set_compaction(GroupObject *self, PyObject *value, void *closure)
+{
+	const char *name;
+	int compaction;
+
+	if (value == NULL) {
+		PyErr_SetString(PyExc_TypeError, "Cannot delete compaction");
+		return -1;
 	}
-	Py_INCREF(Py_None);
-	return Py_None;
+	name = PyString_AsString(value);
+	if (name == NULL)
+		return -1;
+	compaction = ParticleGroup_parse_compaction(name);
+	if (compaction < 0)
+		return -1;
+	self->compaction = compaction;
+	return 0;
+}
+
+static PyObject *
+ParticleGroup_get_stable_handles(GroupObject *self, void *closure)
+{
+	return PyBool_FromLong(self->plist->handles != NULL);
 }
 
+static PyGetSetDef ParticleGroup_getset[] = {
+	{"stable_handles", (getter)ParticleGroup_get_stable_handles, NULL,
+		"Whether the group assigns stable handles to its particles", NULL},
+	{"capacity", (getter)ParticleGroup_get_capacity, NULL,
+		"Number of particle slots allocated", NULL},
+	{"compaction", (getter)ParticleGroup_get_compaction,
+		(setter)ParticleGroup_set_compaction,
+		"Compaction policy, one of 'lazy', 'threshold' or 'always'", NULL},
+	{"max_particles", (getter)ParticleGroup_get_max_particles, NULL,
+		"Particle limit of groups with paged storage, otherwise None", NULL},
+	{"layout", (getter)ParticleGroup_get_layout, NULL,
+		"Particle storage layout, either 'aos' or 'soa'", NULL},
+	{"attributes", (getter)ParticleGroup_get_attributes, NULL,
+		"Names of the particle attributes stored by the group", NULL},
+	{NULL}
+};
+
 static struct PyMemberDef ParticleGroup_members[] = {
     {"controllers", T_OBJECT, offsetof(GroupObject, controllers), READONLY,
         "Controllers bound to this group"},
@@ -388,6 +1551,10 @@ static struct PyMemberDef ParticleGroup_members[] = {
         "Renderer bound to this group"},
     {"system", T_OBJECT, offsetof(GroupObject, system), READONLY,
         "Particle system this group belongs to"},
+    {"compaction_threshold", T_FLOAT, offsetof(GroupObject, compaction_threshold), 0,
+        "Fraction of killed particles that triggers threshold compaction"},
+    {"preserve_order", T_BOOL, offsetof(GroupObject, preserve_order), 0,
+        "Whether compaction keeps particles in their original order"},
 	{NULL}
 };
 
@@ -403,10 +1570,82 @@ static PyMethodDef ParticleGroup_methods[] = {
 	{"kill", (PyCFunction)ParticleGroup_kill, METH_O,
 		PyDoc_STR("kill(particle) -> None\n"
 			"Destroy a particle in the group.")},
+	{"get", (PyCFunction)ParticleGroup_get, METH_VARARGS,
+		PyDoc_STR("get(handle) -> particle reference or None\n"
+			"Return a reference to the particle with the stable handle\n"
+			"specified, or None if the particle has died. The group must\n"
+			"have been created with stable_handles=True.")},
+	{"handles", (PyCFunction)ParticleGroup_handles, METH_VARARGS | METH_KEYWORDS,
+		PyDoc_STR("handles(alive_only=True) -> memoryview\n"
+			"Return the stable handles of the particles in the group, in\n"
+			"the same order as get_attribute(). If alive_only is false,\n"
+			"killed particles are included, with the handle 0xFFFFFFFF.")},
+	{"kill_where", (PyCFunction)ParticleGroup_kill_where,
+		METH_VARARGS | METH_KEYWORDS,
+		PyDoc_STR("kill_where(domain=None, inside=True, min_age=0,\n"
+			"           max_age=infinity) -> number of particles killed\n"
+			"Kill the live particles whose age is between min_age and\n"
+			"max_age inclusive and, if a domain is specified, whose\n"
+			"position is inside the domain, or outside if inside is false.")},
+	{"count_where", (PyCFunction)ParticleGroup_count_where,
+		METH_VARARGS | METH_KEYWORDS,
+		PyDoc_STR("count_where(domain=None, inside=True, min_age=0,\n"
+			"            max_age=infinity) -> number of particles\n"
+			"Return the number of live particles matching the criteria,\n"
+			"which are the same as for kill_where()")},
+	{"indices_where", (PyCFunction)ParticleGroup_indices_where,
+		METH_VARARGS | METH_KEYWORDS,
+		PyDoc_STR("indices_where(domain=None, inside=True, min_age=0,\n"
+			"              max_age=infinity) -> list of indices\n"
+			"Return the indices of the live particles matching the criteria\n"
+			"of kill_where(). The indices address the rows of the arrays\n"
+			"returned by view() and get_attribute(alive_only=False), and\n"
+			"are valid until the next update.")},
 	{"new_count", (PyCFunction)ParticleGroup_new_count, METH_NOARGS,
 		PyDoc_STR("new_count() -> Number of new particles not yet incorporated")},
 	{"killed_count", (PyCFunction)ParticleGroup_killed_count, METH_NOARGS,
 		PyDoc_STR("killed_count() -> Number of killed particles not yet reclaimed")},
+	{"fragmentation", (PyCFunction)ParticleGroup_fragmentation, METH_NOARGS,
+		PyDoc_STR("fragmentation() -> Fraction of the group's particle slots\n"
+			"occupied by killed particles not yet reclaimed")},
+#if PY_MAJOR_VERSION >= 3
+	{"get_attribute", (PyCFunction)ParticleGroup_get_attribute,
+		METH_VARARGS | METH_KEYWORDS,
+		PyDoc_STR("get_attribute(name, out=None, alive_only=True) -> array\n"
+			"Copy a particle attribute of the particles in the group into\n"
+			"a contiguous array of floats, one row per particle in group\n"
+			"order. If alive_only is false, killed particles are included.\n"
+			"If out is specified it must be a writable buffer of floats or\n"
+			"doubles large enough for the values, and is returned.\n"
+			"Otherwise a new memoryview shaped like view() is returned.")},
+	{"set_attribute", (PyCFunction)ParticleGroup_set_attribute,
+		METH_VARARGS | METH_KEYWORDS,
+		PyDoc_STR("set_attribute(name, values, mask=None) -> None\n"
+			"Copy a contiguous buffer of floats or doubles into a particle\n"
+			"attribute of the live particles in the group, one row per\n"
+			"particle in the same order as get_attribute(). values may\n"
+			"also contain a single value assigned to every particle.\n"
+			"If mask is specified, it is a buffer of bools (or bytes)\n"
+			"with one item per live particle, and only the particles\n"
+			"whose mask is true are assigned.")},
+	{"view", (PyCFunction)ParticleGroup_view, METH_VARARGS,
+		PyDoc_STR("view(attribute) -> memoryview\n"
+			"Return a writable view of a particle attribute of every\n"
+			"particle slot in the group, including killed particles, whose\n"
+			"age is negative. Vector and color attributes have the shape\n"
+			"(n, 3) or (n, 4), scalars the shape (n,). Like particle\n"
+			"references, the view is only meaningful until the next update.\n"
+			"Release it before adding particles to the group.")},
+#endif
+	{"reserve", (PyCFunction)ParticleGroup_reserve, METH_VARARGS,
+		PyDoc_STR("reserve(count) -> None\n"
+			"Allocate slots for at least count particles in a single step,\n"
+			"so that the group does not need to grow while they are added.")},
+	{"shrink_to_fit", (PyCFunction)ParticleGroup_shrink_to_fit, METH_NOARGS,
+		PyDoc_STR("shrink_to_fit() -> None\n"
+			"Release the allocated slots that are not in use by particles.\n"
+			"Killed particles are only reclaimed by update(), so call this\n"
+			"afterward to free the most memory.")},
 	{"update", (PyCFunction)ParticleGroup_update, METH_VARARGS,
 		PyDoc_STR("update(time_delta) -> None\n"
 			"Incorporate new particles added since the last update,\n"
@@ -430,13 +1669,40 @@ static PySequenceMethods ParticleGroup_as_sequence = {
 PyDoc_STRVAR(ParticleGroup__doc__,
 	"Group of particles that share behavior via controllers\n"
 	"and are rendered as a unit\n\n"
-	"ParticleGroup(controllers=(), renderer=None, system=particle.default_system)\n\n"
+	"ParticleGroup(controllers=(), renderer=None, system=particle.default_system,\n"
+	"              layout='aos', attributes=None, max_particles=None,\n"
+	"              compaction='lazy', compaction_threshold=0.25,\n"
+	"              preserve_order=True, stable_handles=False)\n\n"
 	"Initialize the particle group, binding the supplied\n"
 	"controllers to it and setting the renderer.\n\n"
 	"If a system is specified, the group is added to that particle system\n"
 	"automatically. By default, the group is added to the default particle\n"
 	"system (particle.default_system). If you do not wish to bind the group to a\n"
-	"system immediately, pass None for the system.");
+	"system immediately, pass None for the system.\n\n"
+	"layout selects how particles are stored. 'aos' (the default) stores\n"
+	"each particle as a single record. 'soa' stores each particle attribute\n"
+	"in its own array, which reduces memory traffic for controllers that\n"
+	"only touch a few attributes of large groups.\n\n"
+	"attributes is an optional sequence of the particle attribute names the\n"
+	"group needs, e.g. ('position', 'velocity', 'color', 'age'). Only these\n"
+	"are stored (age is always stored). Controllers and renderers that need\n"
+	"an attribute the group does not store raise ValueError.\n\n"
+	"max_particles, if specified, selects paged storage for the group.\n"
+	"Address space for max_particles particles is reserved up front and\n"
+	"memory is committed to it as the group grows, so large groups grow\n"
+	"without copying their particles. Adding particles beyond the limit\n"
+	"raises MemoryError.\n\n"
+	"compaction selects how killed particles are reclaimed by update().\n"
+	"'lazy' (the default) only reuses their slots for new particles and\n"
+	"trims them from the end of the group. 'threshold' also removes all\n"
+	"killed particles once they exceed compaction_threshold of the group's\n"
+	"slots, and 'always' removes them at every update. If preserve_order\n"
+	"is true, compaction keeps the particles in order, otherwise it fills\n"
+	"killed slots with particles from the end of the group, which is\n"
+	"cheaper.\n\n"
+	"If stable_handles is true, each particle is assigned a handle that\n"
+	"remains valid across updates for the life of the particle, see get()\n"
+	"and handles().");
 
 static PyTypeObject ParticleGroup_Type = {
 	/* The ob_type field must be initialized in the module init function
@@ -460,7 +1726,7 @@ static PyTypeObject ParticleGroup_Type = {
 	0,                      /*tp_str*/
 	0,                      /*tp_getattro*/
 	0,                      /*tp_setattro*/
-	0,                      /*tp_as_buffer*/
+	ParticleGroup_AS_BUFFER, /*tp_as_buffer*/
 	Py_TPFLAGS_DEFAULT,     /*tp_flags*/
 	ParticleGroup__doc__,   /*tp_doc*/
 	0,                      /*tp_traverse*/
@@ -471,7 +1737,7 @@ static PyTypeObject ParticleGroup_Type = {
 	0,                      /*tp_iternext*/
 	ParticleGroup_methods,  /*tp_methods*/
 	ParticleGroup_members,  /*tp_members*/
-	0,                      /*tp_getset*/
+	ParticleGroup_getset,   /*tp_getset*/
 	0,                      /*tp_base*/
 	0,                      /*tp_dict*/
 	0,                      /*tp_descr_get*/
@@ -801,7 +2067,7 @@ ParticleProxy_dealloc(ParticleRefObject *self)
  * no range checking is done
  */
 EXTERN_INLINE ParticleRefObject *
-ParticleRefObject_New(PyObject *parent, Particle *p)
+ParticleRefObject_New(PyObject *parent, unsigned long index)
 {
 	ParticleRefObject *pproxy;
 	if (pproxy_pool_count) {
@@ -827,7 +2093,22 @@ ParticleRefObject_New(PyObject *parent, Particle *p)
 	} else {
 		pproxy->iteration = 0;
 	}
-	pproxy->p = p;
+	pproxy->index = index;
+	pproxy->p = NULL;
+	return pproxy;
+}
+
+/* Create a new particle reference object for a particle struct owned by
+ * the parent object, such as an emitter template
+ */
+ParticleRefObject *
+ParticleRefObject_FromStruct(PyObject *parent, Particle *p)
+{
+	ParticleRefObject *pproxy;
+
+	pproxy = ParticleRefObject_New(parent, 0);
+	if (pproxy != NULL)
+		pproxy->p = p;
 	return pproxy;
 }
 
@@ -841,61 +2122,84 @@ ParticleRefObject_IsValid(ParticleRefObject *pref) {
 	}
 }
 
-static const char *ParticleProxy_attrname[] = {
-	"position", "velocity", "size", "up", "rotation",
-	"last_position", "last_velocity", "color", "mass", "age",
-	NULL
-};
+/* Return the attribute number for name if the referenced particle has it,
+ * otherwise set an AttributeError and return -1
+ */
+static int
+ParticleProxy_attrnum(ParticleRefObject *self, const char *name)
+{
+	int attr;
+
+	attr = Particle_attrnum(name);
+	if (attr < 0) {
+		PyErr_SetString(PyExc_AttributeError, name);
+	} else if (self->p == NULL &&
+		!(((GroupObject *)self->parent)->plist->attrs & PATTR_BIT(attr))) {
+		PyErr_Format(PyExc_AttributeError,
+			"particle group does not store attribute '%s'", name);
+		attr = -1;
+	}
+	return attr;
+}
+
+/* Return the address of the referenced particle's attribute */
+static char *
+ParticleProxy_attrptr(ParticleRefObject *self, int attr)
+{
+	if (self->p != NULL)
+		return (char *)self->p + Particle_attr_info[attr].offset;
+	return Column_ptr(((GroupObject *)self->parent)->plist->col[attr],
+		char, self->index);
+}
 
 static PyObject *
 ParticleProxy_getattr(ParticleRefObject *self, char *name)
 {
-	int attr_no;
+	ParticleList *plist;
+	int attr;
+	char *value;
 
 	if (!ParticleRefObject_IsValid(self))
 		return NULL;
 
-	for (attr_no = 0; ParticleProxy_attrname[attr_no]; attr_no++) {
-		if (!strcmp(name, ParticleProxy_attrname[attr_no]) )
-			break;
+	if (self->p == NULL && !strcmp(name, "handle")) {
+		plist = ((GroupObject *)self->parent)->plist;
+		if (plist->handles == NULL
+			|| plist->handles->slot_handle[self->index] == GROUP_HANDLE_NONE) {
+			Py_INCREF(Py_None);
+			return Py_None;
+		}
+		return PyLong_FromUnsignedLong(plist->handles->slot_handle[self->index]);
 	}
-	if (!ParticleProxy_attrname[attr_no]) {
-		PyErr_SetString(PyExc_AttributeError, name);
+
+	attr = ParticleProxy_attrnum(self, name);
+	if (attr < 0)
 		return NULL;
-	}
 
-	switch (attr_no) {
-		case 0: return (PyObject *)Vector_new(self->parent, &self->p->position, 3);
-		case 1: return (PyObject *)Vector_new(self->parent, &self->p->velocity, 3);
-		case 2: return (PyObject *)Vector_new(self->parent, &self->p->size, 3);
-		case 3: return (PyObject *)Vector_new(self->parent, &self->p->up, 3);
-		case 4: return (PyObject *)Vector_new(self->parent, &self->p->rotation, 3);
-		case 5: return (PyObject *)Vector_new(self->parent, &self->p->last_position, 3);
-		case 6: return (PyObject *)Vector_new(self->parent, &self->p->last_velocity, 3);
-		case 7: return (PyObject *)Vector_new(self->parent, (Vec3 *)&self->p->color, 4);
-		case 8: return Py_BuildValue("f", self->p->mass);
-		case 9: return Py_BuildValue("f", self->p->age);
-	};
-	return NULL; /* shouldn't get here */
+	value = ParticleProxy_attrptr(self, attr);
+	if (Particle_attr_info[attr].length == 1)
+		return PyFloat_FromDouble(*(float *)value);
+	return (PyObject *)Vector_new(self->parent, (Vec3 *)value,
+		Particle_attr_info[attr].length);
 }
 
 static int
 ParticleProxy_setattr(ParticleRefObject *self, char *name, PyObject *v)
 {
-	int attr_no, result = 0;
+	int attr, result = 0;
+	Vec3 *vec;
 
 	if (!ParticleRefObject_IsValid(self))
 		return -1;
 
-	for (attr_no = 0; ParticleProxy_attrname[attr_no]; attr_no++) {
-		if (!strcmp(name, ParticleProxy_attrname[attr_no]) )
-			break;
-	}
-	if (!ParticleProxy_attrname[attr_no] || v == NULL) {
+	if (v == NULL) {
 		PyErr_SetString(PyExc_AttributeError, name);
 		return -1;
 	}
-	if (attr_no <= 7) {
+	attr = ParticleProxy_attrnum(self, name);
+	if (attr < 0)
+		return -1;
+	if (Particle_attr_info[attr].length > 1) {
 		v = PySequence_Tuple(v);
 	} else {
 		v = PyNumber_Float(v);
@@ -903,59 +2207,19 @@ ParticleProxy_setattr(ParticleRefObject *self, char *name, PyObject *v)
 	if (v == NULL)
 		return -1;
 
-	switch (attr_no) {
-		case 0:
-			result = PyArg_ParseTuple(v, "fff;3 floats expected",
-				&self->p->position.x,
-				&self->p->position.y,
-				&self->p->position.z) - 1;
-			break;
-		case 1:
-			result = PyArg_ParseTuple(v, "fff;3 floats expected",
-				&self->p->velocity.x,
-				&self->p->velocity.y,
-				&self->p->velocity.z) - 1;
-			break;
-		case 2:
-			result = PyArg_ParseTuple(v, "fff;3 floats expected",
-				&self->p->size.x,
-				&self->p->size.y,
-				&self->p->size.z) - 1;
-			break;
+	vec = (Vec3 *)ParticleProxy_attrptr(self, attr);
+	switch (Particle_attr_info[attr].length) {
 		case 3:
 			result = PyArg_ParseTuple(v, "fff;3 floats expected",
-				&self->p->up.x,
-				&self->p->up.y,
-				&self->p->up.z) - 1;
+				&vec->x, &vec->y, &vec->z) - 1;
 			break;
 		case 4:
-			result = PyArg_ParseTuple(v, "fff;3 floats expected",
-				&self->p->rotation.x,
-				&self->p->rotation.y,
-				&self->p->rotation.z) - 1;
-			break;
-		case 5:
-			result = PyArg_ParseTuple(v, "fff;3 floats expected",
-				&self->p->last_position.x,
-				&self->p->last_position.y,
-				&self->p->last_position.z) - 1;
-			break;
-		case 6:
-			result = PyArg_ParseTuple(v, "fff;3 floats expected",
-				&self->p->last_velocity.x, &self->p->last_velocity.y,
-				&self->p->last_velocity.z) - 1;
-			break;
-		case 7:
-			self->p->color.a = 1.0f;
+			vec->_pad = 1.0f;
 			result = PyArg_ParseTuple(v, "fff|f;3 or 4 floats expected",
-				&self->p->color.r,
-				&self->p->color.g,
-				&self->p->color.b,
-				&self->p->color.a) - 1;
+				&vec->x, &vec->y, &vec->z, &vec->_pad) - 1;
 			break;
-		case 8: self->p->mass = (float)PyFloat_AS_DOUBLE(v);
-			break;
-		case 9: self->p->age = (float)PyFloat_AS_DOUBLE(v);
+		default:
+			*(float *)vec = (float)PyFloat_AS_DOUBLE(v);
 	};
 
 	Py_XDECREF(v);
@@ -966,8 +2230,13 @@ static PyObject *
 ParticleProxy_repr(ParticleRefObject *self)
 {
 	char buf[1024];
+	Particle p;
 
 	if (ParticleRefObject_IsValid(self)) {
+		if (self->p != NULL)
+			p = *self->p;
+		else
+			Group_load_p((GroupObject *)self->parent, self->index, &p);
 		buf[0] = 0; /* paranoid */
 		PyOS_snprintf(buf, 1024, "<Particle %lu of group 0x%lx: "
 			"position=(%.1f, %.1f, %.1f) velocity=(%.1f, %.1f, %.1f) "
@@ -975,20 +2244,20 @@ ParticleProxy_repr(ParticleRefObject *self)
 			"up=(%.1f, %.1f, %.1f) rotation=(%.1f, %.1f, %.1f) "
 			"last_position=(%.1f, %.1f, %.1f) last_velocity=(%.1f, %.1f, %.1f) "
 			"mass=%.1f age=%.1f>",
-			(unsigned long)(self->p), (unsigned long)self->parent,
-			self->p->position.x, self->p->position.y, self->p->position.z,
-			self->p->velocity.x, self->p->velocity.y, self->p->velocity.z,
-			self->p->color.r, self->p->color.g, self->p->color.b, self->p->color.a,
-			self->p->size.x, self->p->size.y, self->p->size.z,
-			self->p->up.x, self->p->up.y, self->p->up.z,
-			self->p->rotation.x, self->p->rotation.y, self->p->rotation.z,
-			self->p->last_position.x, self->p->last_position.y, self->p->last_position.z,
-			self->p->last_velocity.x, self->p->last_velocity.y, self->p->last_velocity.z,
-			self->p->mass, self->p->age);
+			self->index, (unsigned long)self->parent,
+			p.position.x, p.position.y, p.position.z,
+			p.velocity.x, p.velocity.y, p.velocity.z,
+			p.color.r, p.color.g, p.color.b, p.color.a,
+			p.size.x, p.size.y, p.size.z,
+			p.up.x, p.up.y, p.up.z,
+			p.rotation.x, p.rotation.y, p.rotation.z,
+			p.last_position.x, p.last_position.y, p.last_position.z,
+			p.last_velocity.x, p.last_velocity.y, p.last_velocity.z,
+			p.mass, p.age);
 		return PyString_FromString(buf);
 	} else {
 		return PyString_FromFormat("<INVALID Particle %lu of group %p>",
-			(unsigned long)(self->p), self->parent);
+			self->index, self->parent);
 	}
 }
 
@@ -1054,22 +2323,22 @@ ParticleIter_dealloc(ParticleRefObject *self)
 static PyObject *
 ParticleIter_next(ParticleRefObject *self)
 {
-	Particle *lastp;
+	unsigned long lastp;
 	GroupObject *pgroup;
 
 	if (!ParticleRefObject_IsValid(self))
 		return NULL;
 
 	pgroup = (GroupObject *)self->parent;
-	lastp = &pgroup->plist->p[GroupObject_ActiveCount(pgroup)];
+	lastp = GroupObject_ActiveCount(pgroup);
 
 	/* Scan to the next active particle */
-	while (self->p < lastp && !Particle_IsAlive(*self->p)) {
-		self->p++;
+	while (self->index < lastp && !Group_IsAlive(pgroup, self->index)) {
+		self->index++;
 	}
 
-	if (self->p < lastp) {
-		return (PyObject *)ParticleRefObject_New(self->parent, self->p++);
+	if (self->index < lastp) {
+		return (PyObject *)ParticleRefObject_New(self->parent, self->index++);
 	} else {
 		/* End of iteration */
 		return NULL;
@@ -1126,6 +2395,383 @@ static PyTypeObject ParticleIter_Type = {
 
 /* --------------------------------------------------------------------- */
 /* Prepare a type object */
+/* --------------------------------------------------------------------- */
+
+/* Update pools update many groups at once on a native worker pool. Each
+ * group is updated by a single thread, which consolidates it and runs the
+ * leading fusable native controllers. The remaining controllers of each
+ * group then run in the calling thread, in the order the groups are given.
+ */
+
+static PyTypeObject UpdatePool_Type;
+
+typedef struct {
+	PyObject_HEAD
+	WorkerPool *pool;
+} UpdatePoolObject;
+
+/* The part of a group update done by the pool */
+typedef struct {
+	GroupObject *group;
+	float td;
+	unsigned long cost; /* estimated time to run the task */
+	PyObject *ctrlrs; /* the group's dispatch cache when prepared */
+	PyObject *natives;
+	int nfused; /* number of leading controllers run by the task */
+	PyObject *fused[CONTROLLER_FUSE_MAX];
+	ControllerNative *fused_native[CONTROLLER_FUSE_MAX];
+} GroupUpdateTask;
+
+static void
+UpdatePool_dealloc(UpdatePoolObject *self)
+{
+	WorkerPool_free(self->pool);
+	self->pool = NULL;
+	PyObject_Del(self);
+}
+
+static int
+UpdatePool_init(UpdatePoolObject *self, PyObject *args)
+{
+	int threads;
+
+	if (!PyArg_ParseTuple(args, "i:__init__", &threads))
+		return -1;
+	WorkerPool_free(self->pool);
+	self->pool = WorkerPool_new(threads);
+	if (self->pool == NULL)
+		return -1;
+	return 0;
+}
+
+/* Prepare the update of a group, finding the leading controllers that can
+ * run on the pool. Return true on success, otherwise set an exception and
+ * return false
+ */
+static int
+GroupUpdateTask_prepare(GroupUpdateTask *task, GroupObject *group, float td)
+{
+	ControllerNative *native;
+	Py_ssize_t i;
+
+	task->group = group;
+	task->td = td;
+	task->nfused = 0;
+	task->ctrlrs = task->natives = NULL;
+	group->iteration++; /* invalidate proxies and group iterators */
+	if (!ParticleGroup_prepare_controllers(group))
+		return 0;
+	task->ctrlrs = group->ctrlr_cache;
+	task->natives = group->ctrlr_native;
+	Py_INCREF(task->ctrlrs);
+	Py_INCREF(task->natives);
+	for (i = 0; i < PyTuple_GET_SIZE(task->ctrlrs)
+		&& task->nfused < CONTROLLER_FUSE_MAX; i++) {
+		native = ParticleGroup_controller_native(task->natives, i);
+		if (native == NULL) {
+			if (PyErr_Occurred())
+				return 0;
+			break;
+		}
+		/* Controllers that would fail run in the calling thread to raise.
+		 * Those with a finish step change their own state, which may be
+		 * shared with other groups, so they run there too, in group order */
+		if (native->update_range == NULL || native->finish != NULL
+			|| !Group_HasAttrs(group, native->attrs))
+			break;
+		task->fused[task->nfused] = PyTuple_GET_ITEM(task->ctrlrs, i);
+		task->fused_native[task->nfused++] = native;
+	}
+	task->cost = (GroupObject_ActiveCount(group) + group->plist->pnew)
+		* (task->nfused + 1);
+	return 1;
+}
+
+/* Run a group update task on the pool, without the GIL */
+static void
+GroupUpdateTask_run(void *arg, int thread)
+{
+	GroupUpdateTask *task = (GroupUpdateTask *)arg;
+	GroupObject *group = task->group;
+
+	if (group->lock != NULL)
+		PyThread_acquire_lock(group->lock, WAIT_LOCK);
+	ParticleGroup_consolidate(group, task->td);
+	if (task->nfused > 0)
+		Controller_fused_pass(group, task->td, task->fused, task->fused_native,
+			task->nfused);
+	if (group->lock != NULL)
+		PyThread_release_lock(group->lock);
+}
+
+/* Return true if the pool has its threads, otherwise set an exception and
+ * return false. Pools made without calling __init__ have none */
+static int
+UpdatePool_check(UpdatePoolObject *self)
+{
+	if (self->pool == NULL) {
+		PyErr_SetString(PyExc_ValueError, "UpdatePool: not initialized");
+		return 0;
+	}
+	return 1;
+}
+
+/* Order tasks from the most to the least costly */
+static int
+GroupUpdateTask_compare(const void *a, const void *b)
+{
+	unsigned long cost_a = (*(GroupUpdateTask **)a)->cost;
+	unsigned long cost_b = (*(GroupUpdateTask **)b)->cost;
+
+	return (cost_a < cost_b) - (cost_a > cost_b);
+}
+
+static PyObject *
+UpdatePool_update(UpdatePoolObject *self, PyObject *args)
+{
+	PyObject *groups, *seq = NULL, *seen = NULL, *item, *r;
+	GroupUpdateTask *tasks = NULL, **order = NULL;
+	Py_ssize_t i, j, count, ntasks = 0;
+	float td;
+	int pooled;
+
+	if (!PyArg_ParseTuple(args, "Of:update", &groups, &td))
+		return NULL;
+	if (!UpdatePool_check(self))
+		return NULL;
+	seq = PySequence_Fast(groups, "update: expected a sequence of groups");
+	if (seq == NULL)
+		return NULL;
+	count = PySequence_Fast_GET_SIZE(seq);
+	tasks = (GroupUpdateTask *)PyMem_Malloc(sizeof(GroupUpdateTask) * (count + 1));
+	order = (GroupUpdateTask **)PyMem_Malloc(sizeof(GroupUpdateTask *) * (count + 1));
+	seen = PySet_New(NULL);
+	if (tasks == NULL || order == NULL || seen == NULL) {
+		if (!PyErr_Occurred())
+			PyErr_NoMemory();
+		goto error;
+	}
+
+	/* Groups of other types are updated by calling their update method */
+	for (i = 0; i < count; i++) {
+		item = PySequence_Fast_GET_ITEM(seq, i);
+		if (!GroupObject_CHECK(item))
+			continue;
+		pooled = PySet_Contains(seen, item);
+		if (pooled < 0)
+			goto error;
+		if (pooled) {
+			PyErr_SetString(PyExc_ValueError,
+				"update: a group may only be updated once at a time");
+			goto error;
+		}
+		if (PySet_Add(seen, item) < 0)
+			goto error;
+		if (!GroupUpdateTask_prepare(&tasks[ntasks++], (GroupObject *)item, td))
+			goto error;
+	}
+	for (i = 0; i < ntasks; i++)
+		order[i] = &tasks[i];
+	qsort(order, ntasks, sizeof(GroupUpdateTask *), GroupUpdateTask_compare);
+	Py_BEGIN_ALLOW_THREADS
+	WorkerPool_run(self->pool, GroupUpdateTask_run, (void **)order, ntasks);
+	Py_END_ALLOW_THREADS
+
+	j = 0;
+	for (i = 0; i < count; i++) {
+		item = PySequence_Fast_GET_ITEM(seq, i);
+		if (GroupObject_CHECK(item)) {
+			if (ParticleGroup_invoke_controllers((GroupObject *)item, td,
+				tasks[j].ctrlrs, tasks[j].natives, tasks[j].nfused) < 0)
+				goto error;
+			j++;
+		} else {
+			r = PyObject_CallMethod(item, "update", "f", td);
+			if (r == NULL)
+				goto error;
+			Py_DECREF(r);
+		}
+	}
+
+	for (i = 0; i < ntasks; i++) {
+		Py_XDECREF(tasks[i].ctrlrs);
+		Py_XDECREF(tasks[i].natives);
+	}
+	PyMem_Free(tasks);
+	PyMem_Free(order);
+	Py_DECREF(seen);
+	Py_DECREF(seq);
+	Py_INCREF(Py_None);
+	return Py_None;
+
+error:
+	if (tasks != NULL) {
+		for (i = 0; i < ntasks; i++) {
+			Py_XDECREF(tasks[i].ctrlrs);
+			Py_XDECREF(tasks[i].natives);
+		}
+	}
+	PyMem_Free(tasks);
+	PyMem_Free(order);
+	Py_XDECREF(seen);
+	Py_XDECREF(seq);
+	return NULL;
+}
+
+static PyMethodDef UpdatePool_methods[] = {
+	{"update", (PyCFunction)UpdatePool_update, METH_VARARGS,
+		PyDoc_STR("update(groups, td) -> None\n"
+			"Update the groups in the sequence, as if update(td) was called\n"
+			"on each of them in turn.")},
+	{NULL,		NULL}		/* sentinel */
+};
+
+static PyObject *
+UpdatePool_get_threads(UpdatePoolObject *self, void *closure)
+{
+	if (!UpdatePool_check(self))
+		return NULL;
+	return PyInt_FromLong(WorkerPool_threads(self->pool));
+}
+
+static PyGetSetDef UpdatePool_getset[] = {
+	{"threads", (getter)UpdatePool_get_threads, NULL,
+		"Number of threads that update groups, including the caller", NULL},
+	{NULL}
+};
+
+PyDoc_STRVAR(UpdatePool__doc__,
+	"Updates many particle groups in parallel\n\n"
+	"UpdatePool(threads)\n\n"
+	"threads -- The number of threads to update groups with, including\n"
+	"the thread calling update(). Each group is consolidated and its\n"
+	"leading built-in controllers that can be fused are run by a single\n"
+	"pool thread. Its other controllers are then run by the calling\n"
+	"thread, one group at a time in order. Unlike calling update() on\n"
+	"each group in turn, every group is consolidated before any Python\n"
+	"controller runs, so particles added to a group by the controllers\n"
+	"of another are incorporated at the next update. Each group may\n"
+	"only be given once, otherwise ValueError is raised");
+
+static PyTypeObject UpdatePool_Type = {
+	/* The ob_type field must be initialized in the module init function
+	 * to be portable to Windows without using C++. */
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"group.UpdatePool",		/*tp_name*/
+	sizeof(UpdatePoolObject),	/*tp_basicsize*/
+	0,			/*tp_itemsize*/
+	/* methods */
+	(destructor)UpdatePool_dealloc, /*tp_dealloc*/
+	0,			/*tp_print*/
+	0,          /*tp_getattr*/
+	0,          /*tp_setattr*/
+	0,			/*tp_compare*/
+	0,			/*tp_repr*/
+	0,			/*tp_as_number*/
+	0,	        /*tp_as_sequence*/
+	0,			/*tp_as_mapping*/
+	0,			/*tp_hash*/
+	0,                      /*tp_call*/
+	0,                      /*tp_str*/
+	0,                      /*tp_getattro*/
+	0,                      /*tp_setattro*/
+	0,                      /*tp_as_buffer*/
+	Py_TPFLAGS_DEFAULT,     /*tp_flags*/
+	UpdatePool__doc__,      /*tp_doc*/
+	0,                      /*tp_traverse*/
+	0,                      /*tp_clear*/
+	0,                      /*tp_richcompare*/
+	0,                      /*tp_weaklistoffset*/
+	0,                      /*tp_iter*/
+	0,                      /*tp_iternext*/
+	UpdatePool_methods,     /*tp_methods*/
+	0,                      /*tp_members*/
+	UpdatePool_getset,      /*tp_getset*/
+	0,                      /*tp_base*/
+	0,                      /*tp_dict*/
+	0,                      /*tp_descr_get*/
+	0,                      /*tp_descr_set*/
+	0,                      /*tp_dictoffset*/
+	(initproc)UpdatePool_init, /*tp_init*/
+	0,                      /*tp_alloc*/
+	0,                      /*tp_new*/
+	0,                      /*tp_free*/
+	0,                      /*tp_is_gc*/
+};
+
+/* --------------------------------------------------------------------- */
+
+static PyObject *
+group_set_kernel_threads(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	static char *kwlist[] = {"threads", "min_chunk", NULL};
+	int threads;
+	long min_chunk = GROUP_KERNEL_MIN_CHUNK;
+	WorkerPool *pool = NULL, *old;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|l:set_kernel_threads",
+		kwlist, &threads, &min_chunk))
+		return NULL;
+	if (threads < 1) {
+		PyErr_SetString(PyExc_ValueError, "threads must be >= 1");
+		return NULL;
+	}
+	if (min_chunk < 1) {
+		PyErr_SetString(PyExc_ValueError, "min_chunk must be >= 1");
+		return NULL;
+	}
+	if (threads > 1) {
+		pool = WorkerPool_new(threads);
+		if (pool == NULL)
+			return NULL;
+	}
+	/* Wait for kernels running on the old pool to finish with it */
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(Group_kernels.lock, WAIT_LOCK);
+	Py_END_ALLOW_THREADS
+	old = Group_kernels.pool;
+	Group_kernels.pool = pool;
+	Group_kernels.threads = threads;
+	Group_kernels.min_chunk = min_chunk;
+	PyThread_release_lock(Group_kernels.lock);
+	WorkerPool_free(old);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject *
+group_get_kernel_threads(PyObject *module)
+{
+	return Py_BuildValue("(ik)", Group_kernels.threads, Group_kernels.min_chunk);
+}
+
+static PyObject *
+group_simd_level(PyObject *module)
+{
+	return PyString_FromString(Simd_kernels()->name);
+}
+
+static PyMethodDef group_methods[] = {
+	{"set_kernel_threads", (PyCFunction)group_set_kernel_threads,
+		METH_VARARGS | METH_KEYWORDS,
+		PyDoc_STR("set_kernel_threads(threads, min_chunk=16384) -> None\n"
+			"Run the kernels of large particle groups, such as the built-in\n"
+			"controllers and the update of particle ages, on threads threads\n"
+			"in total, each over at least min_chunk particles. Groups with\n"
+			"fewer than twice min_chunk particles are updated in the calling\n"
+			"thread. A single thread, the default, runs all kernels serially")},
+	{"get_kernel_threads", (PyCFunction)group_get_kernel_threads, METH_NOARGS,
+		PyDoc_STR("get_kernel_threads() -> (threads, min_chunk)\n"
+			"Return the settings of set_kernel_threads()")},
+	{"simd_level", (PyCFunction)group_simd_level, METH_NOARGS,
+		PyDoc_STR("simd_level() -> str\n"
+			"Return the vector instruction set the particle kernels use,\n"
+			"one of 'scalar', 'sse2', 'avx2' or 'neon'")},
+	{NULL}
+};
+
+/* --------------------------------------------------------------------- */
+
 int prepare_type(PyTypeObject *type) {
     type->tp_alloc = PyType_GenericAlloc;
 	type->tp_new = PyType_GenericNew;
@@ -1142,6 +2788,9 @@ MOD_INIT(group)
 	if (!prepare_type(&ParticleGroup_Type))
 		return MOD_ERROR_VAL;
 
+	if (!prepare_type(&UpdatePool_Type))
+		return MOD_ERROR_VAL;
+
 	ParticleProxy_Type.tp_alloc = PyType_GenericAlloc;
 	if (PyType_Ready(&ParticleProxy_Type) < 0)
 		return MOD_ERROR_VAL;
@@ -1156,12 +2805,25 @@ MOD_INIT(group)
 	if (PyType_Ready(&Vector_Type) < 0)
 		return MOD_ERROR_VAL;
 
+#if PY_MAJOR_VERSION >= 3
+	if (PyType_Ready(&ParticleView_Type) < 0)
+		return MOD_ERROR_VAL;
+#endif
+
 	/* Create the module and add the types */
-	MOD_DEF(m, "group", "Particle Groups", NULL);
+	MOD_DEF(m, "group", "Particle Groups", group_methods);
 	if (m == NULL) {
 		return MOD_ERROR_VAL;
     }
 
+	if (Group_kernels.lock == NULL) {
+		Group_kernels.lock = PyThread_allocate_lock();
+		if (Group_kernels.lock == NULL) {
+			PyErr_NoMemory();
+			return MOD_ERROR_VAL;
+		}
+	}
+
 	if (InvalidParticleRefError == NULL) {
 		InvalidParticleRefError = PyErr_NewException(
 			"group.InvalidParticleRefError", NULL, NULL);
@@ -1177,6 +2839,8 @@ MOD_INIT(group)
 	PyModule_AddObject(m, "ParticleProxy", (PyObject *)&ParticleProxy_Type);
 	Py_INCREF(&Vector_Type);
 	PyModule_AddObject(m, "Vector", (PyObject *)&Vector_Type);
+	Py_INCREF(&UpdatePool_Type);
+	PyModule_AddObject(m, "UpdatePool", (PyObject *)&UpdatePool_Type);
 
     return MOD_SUCCESS_VAL(m);
 }
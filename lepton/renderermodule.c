@@ -282,7 +282,7 @@ PointRenderer_init(PointRendererObject *self, PyObject *args, PyObject *kwargs)
 static PyObject *
 PointRenderer_draw(PointRendererObject *self, GroupObject *pgroup)
 {
-	Particle *p;
+	ParticleColumn position, color;
 	PyObject *r = NULL;
 	int GL_error;
 	unsigned long count_particles;
@@ -292,12 +292,17 @@ PointRenderer_draw(PointRendererObject *self, GroupObject *pgroup)
 		return NULL;
 	}
 
+	if (!Group_require(pgroup, PATTR_BIT(PATTR_POSITION) | PATTR_BIT(PATTR_COLOR),
+		"PointRenderer"))
+		return NULL;
+
 	if (!glew_initialize())
 		return NULL;
 
 	count_particles = GroupObject_ActiveCount(pgroup);
 	if (count_particles > 0){
-		p = pgroup->plist->p;
+		position = Group_column(pgroup, PATTR_POSITION);
+		color = Group_column(pgroup, PATTR_COLOR);
 		if (self->texturizer != NULL) {
 			r = PyObject_CallMethod(self->texturizer, "set_state", NULL);
 			if (r == NULL)
@@ -311,8 +316,8 @@ PointRenderer_draw(PointRendererObject *self, GroupObject *pgroup)
 		glEnableClientState(GL_VERTEX_ARRAY);
 		glEnableClientState(GL_COLOR_ARRAY);
 		glPointSize(self->point_size);
-		glVertexPointer(3, GL_FLOAT, sizeof(Particle), &p[0].position);
-		glColorPointer(4, GL_FLOAT, sizeof(Particle), &p[0].color);
+		glVertexPointer(3, GL_FLOAT, position.stride, position.base);
+		glColorPointer(4, GL_FLOAT, color.stride, color.base);
 		glDrawArrays(GL_POINTS, 0, GroupObject_ActiveCount(pgroup));
 		glPopClientAttrib();
 
@@ -520,7 +525,10 @@ draw_billboards(unsigned long count) {
 static PyObject *
 BillboardRenderer_draw(RendererObject *self, GroupObject *pgroup)
 {
-	Particle *p;
+	ParticleColumn position, color, size, up;
+	Vec3 *pos, *psize;
+	Color *pcolor;
+	float up_z;
 	int GL_error;
 	unsigned int pcount;
 	register unsigned int i;
@@ -536,10 +544,17 @@ BillboardRenderer_draw(RendererObject *self, GroupObject *pgroup)
 		return NULL;
 	}
 
+	if (!Group_require(pgroup, PATTR_BIT(PATTR_POSITION) | PATTR_BIT(PATTR_COLOR)
+		| PATTR_BIT(PATTR_SIZE), "BillboardRenderer"))
+		return NULL;
+
 	if (!glew_initialize())
 		return NULL;
 
-	p = pgroup->plist->p;
+	position = Group_column(pgroup, PATTR_POSITION);
+	color = Group_column(pgroup, PATTR_COLOR);
+	size = Group_column(pgroup, PATTR_SIZE);
+	up = Group_column(pgroup, PATTR_UP);
 	pcount = GroupObject_ActiveCount(pgroup);
 	if (pcount == 0) {
 		Py_INCREF(Py_None);
@@ -609,45 +624,48 @@ BillboardRenderer_draw(RendererObject *self, GroupObject *pgroup)
 
 		/* vertex coords */
 
-		if (p->up.z) {
+		pos = Column_ptr(position, Vec3, i / 4);
+		psize = Column_ptr(size, Vec3, i / 4);
+		pcolor = Column_ptr(color, Color, i / 4);
+		/* groups that do not store up are drawn unrotated */
+		up_z = up.base != NULL ? Column_ptr(up, Vec3, i / 4)->z : 0.0f;
+		if (up_z) {
 			/* billboard supports only z-axis rotation
 			   where the z-axiz is always that of the
 			   model-view matrix
 			*/
-			rotsin = (float)sin(p->up.z);
-			rotcos = (float)cos(p->up.z);
+			rotsin = (float)sin(up_z);
+			rotcos = (float)cos(up_z);
 			Vec3_scalar_mul(&vright, &vright_unit, rotcos);
 			Vec3_scalar_mul(&vrot, &vup_unit, rotsin);
 			Vec3_addi(&vright, &vrot);
 			Vec3_scalar_mul(&vup, &vup_unit, rotcos);
 			Vec3_scalar_mul(&vrot, &vright_unit, rotsin);
 			Vec3_subi(&vup, &vrot);
-			Vec3_scalar_muli(&vright, p->size.x * 0.5f);
-			Vec3_scalar_muli(&vup, p->size.y * 0.5f);
+			Vec3_scalar_muli(&vright, psize->x * 0.5f);
+			Vec3_scalar_muli(&vup, psize->y * 0.5f);
 		} else {
-			Vec3_scalar_mul(&vright, &vright_unit, p->size.x * 0.5f);
-			Vec3_scalar_mul(&vup, &vup_unit, p->size.y * 0.5f);
+			Vec3_scalar_mul(&vright, &vright_unit, psize->x * 0.5f);
+			Vec3_scalar_mul(&vup, &vup_unit, psize->y * 0.5f);
 		}
 
-		Vec3_sub(&data.verts[POINT0], &p->position, &vright);
+		Vec3_sub(&data.verts[POINT0], pos, &vright);
 		Vec3_subi(&data.verts[POINT0], &vup);
-		Vec3_add(&data.verts[POINT1], &p->position, &vright);
+		Vec3_add(&data.verts[POINT1], pos, &vright);
 		Vec3_subi(&data.verts[POINT1], &vup);
-		Vec3_add(&data.verts[POINT2], &p->position, &vright);
+		Vec3_add(&data.verts[POINT2], pos, &vright);
 		Vec3_addi(&data.verts[POINT2], &vup);
-		Vec3_sub(&data.verts[POINT3], &p->position, &vright);
+		Vec3_sub(&data.verts[POINT3], pos, &vright);
 		Vec3_addi(&data.verts[POINT3], &vup);
 
 		/* colors */
-		data.colors[POINT0].rgba.r = (unsigned char)(p->color.r * 255);
-		data.colors[POINT0].rgba.g = (unsigned char)(p->color.g * 255);
-		data.colors[POINT0].rgba.b = (unsigned char)(p->color.b * 255);
-		data.colors[POINT0].rgba.a = (unsigned char)(p->color.a * 255);
+		data.colors[POINT0].rgba.r = (unsigned char)(pcolor->r * 255);
+		data.colors[POINT0].rgba.g = (unsigned char)(pcolor->g * 255);
+		data.colors[POINT0].rgba.b = (unsigned char)(pcolor->b * 255);
+		data.colors[POINT0].rgba.a = (unsigned char)(pcolor->a * 255);
 		data.colors[POINT1].colorl = data.colors[POINT0].colorl;
 		data.colors[POINT2].colorl = data.colors[POINT0].colorl;
 		data.colors[POINT3].colorl = data.colors[POINT0].colorl;
-
-		p++;
 	}
 
 	if (self->texturizer != NULL) {
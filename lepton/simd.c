@@ -0,0 +1,406 @@
+/****************************************************************************
+*
+* Copyright (c) 2008 by Casey Duncan and contributors
+* All Rights Reserved.
+*
+* This software is subject to the provisions of the MIT License
+* A copy of the license should accompany this distribution.
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+*
+****************************************************************************/
+/* SIMD particle kernels with runtime dispatch
+ *
+ * x86 variants are compiled with per-function target attributes, so the
+ * rest of the extension keeps the baseline instruction set, and selected by
+ * CPUID. NEON is part of the baseline of the ARM targets that have it.
+ *
+ * $Id$
+ */
+
+#include <Python.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simd.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMD_TARGET_SSE2 __attribute__((target("sse2")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#include <intrin.h>
+#define SIMD_TARGET_SSE2
+#define SIMD_TARGET_AVX2
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__aarch64__)
+#define SIMD_ARM_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* --------------------------------------------------------------------- */
+/* Scalar reference kernels */
+
+static void
+Simd_scalar_vec3_add(ParticleColumn col, const Vec3 *v,
+	unsigned long start, unsigned long end)
+{
+	register unsigned long i;
+
+	for (i = start; i < end; i++) {
+		Vec3_addi(Column_ptr(col, Vec3, i), v);
+	}
+}
+
+static void
+Simd_scalar_vec3_add_scaled(ParticleColumn dst, ParticleColumn src, float s,
+	unsigned long start, unsigned long end)
+{
+	Vec3 v;
+	register unsigned long i;
+
+	for (i = start; i < end; i++) {
+		Vec3_scalar_mul(&v, Column_ptr(src, Vec3, i), s);
+		Vec3_addi(Column_ptr(dst, Vec3, i), &v);
+	}
+}
+
+static void
+Simd_scalar_vec3_damp_add(ParticleColumn dst, ParticleColumn src,
+	const Vec3 *damping, float s, unsigned long start, unsigned long end)
+{
+	Vec3 v, *sv;
+	register unsigned long i;
+
+	for (i = start; i < end; i++) {
+		sv = Column_ptr(src, Vec3, i);
+		Vec3_muli(sv, damping);
+		Vec3_scalar_mul(&v, sv, s);
+		Vec3_addi(Column_ptr(dst, Vec3, i), &v);
+	}
+}
+
+static const SimdKernels Simd_scalar = {
+	SIMD_SCALAR,
+	"scalar",
+	Simd_scalar_vec3_add,
+	Simd_scalar_vec3_add_scaled,
+	Simd_scalar_vec3_damp_add
+};
+
+#ifdef SIMD_X86
+/* --------------------------------------------------------------------- */
+/* SSE2 kernels, one vector per instruction */
+
+SIMD_TARGET_SSE2 static void
+Simd_sse2_vec3_add(ParticleColumn col, const Vec3 *v,
+	unsigned long start, unsigned long end)
+{
+	__m128 a = _mm_set_ps(0.0f, v->z, v->y, v->x);
+	float *p;
+	register unsigned long i;
+
+	for (i = start; i < end; i++) {
+		p = Column_ptr(col, float, i);
+		_mm_storeu_ps(p, _mm_add_ps(_mm_loadu_ps(p), a));
+	}
+}
+
+SIMD_TARGET_SSE2 static void
+Simd_sse2_vec3_add_scaled(ParticleColumn dst, ParticleColumn src, float s,
+	unsigned long start, unsigned long end)
+{
+	__m128 scale = _mm_set_ps(0.0f, s, s, s);
+	float *p;
+	register unsigned long i;
+
+	for (i = start; i < end; i++) {
+		p = Column_ptr(dst, float, i);
+		_mm_storeu_ps(p, _mm_add_ps(_mm_loadu_ps(p),
+			_mm_mul_ps(_mm_loadu_ps(Column_ptr(src, float, i)), scale)));
+	}
+}
+
+SIMD_TARGET_SSE2 static void
+Simd_sse2_vec3_damp_add(ParticleColumn dst, ParticleColumn src,
+	const Vec3 *damping, float s, unsigned long start, unsigned long end)
+{
+	__m128 damp = _mm_set_ps(1.0f, damping->z, damping->y, damping->x);
+	__m128 scale = _mm_set_ps(0.0f, s, s, s);
+	__m128 v;
+	float *p;
+	register unsigned long i;
+
+	for (i = start; i < end; i++) {
+		p = Column_ptr(src, float, i);
+		v = _mm_mul_ps(_mm_loadu_ps(p), damp);
+		_mm_storeu_ps(p, v);
+		p = Column_ptr(dst, float, i);
+		_mm_storeu_ps(p, _mm_add_ps(_mm_loadu_ps(p), _mm_mul_ps(v, scale)));
+	}
+}
+
+static const SimdKernels Simd_sse2 = {
+	SIMD_SSE2,
+	"sse2",
+	Simd_sse2_vec3_add,
+	Simd_sse2_vec3_add_scaled,
+	Simd_sse2_vec3_damp_add
+};
+
+/* --------------------------------------------------------------------- */
+/* AVX2 kernels, two vectors per instruction where the column is contiguous,
+ * as with the SOA layout. AOS records are too far apart to pair up cheaply,
+ * so they are processed one at a time with VEX encoded SSE instructions */
+
+#define Simd_contiguous(col) ((col).stride == sizeof(Vec3))
+
+SIMD_TARGET_AVX2 static void
+Simd_avx2_vec3_add(ParticleColumn col, const Vec3 *v,
+	unsigned long start, unsigned long end)
+{
+	__m256 a = _mm256_set_ps(0.0f, v->z, v->y, v->x, 0.0f, v->z, v->y, v->x);
+	float *p;
+	register unsigned long i = start;
+
+	if (Simd_contiguous(col)) {
+		for (; i + 2 <= end; i += 2) {
+			p = Column_ptr(col, float, i);
+			_mm256_storeu_ps(p, _mm256_add_ps(_mm256_loadu_ps(p), a));
+		}
+	}
+	for (; i < end; i++) {
+		p = Column_ptr(col, float, i);
+		_mm_storeu_ps(p, _mm_add_ps(_mm_loadu_ps(p), _mm256_castps256_ps128(a)));
+	}
+}
+
+SIMD_TARGET_AVX2 static void
+Simd_avx2_vec3_add_scaled(ParticleColumn dst, ParticleColumn src, float s,
+	unsigned long start, unsigned long end)
+{
+	__m256 scale = _mm256_set_ps(0.0f, s, s, s, 0.0f, s, s, s);
+	float *p;
+	register unsigned long i = start;
+
+	if (Simd_contiguous(dst) && Simd_contiguous(src)) {
+		for (; i + 2 <= end; i += 2) {
+			p = Column_ptr(dst, float, i);
+			_mm256_storeu_ps(p, _mm256_add_ps(_mm256_loadu_ps(p),
+				_mm256_mul_ps(_mm256_loadu_ps(Column_ptr(src, float, i)), scale)));
+		}
+	}
+	for (; i < end; i++) {
+		p = Column_ptr(dst, float, i);
+		_mm_storeu_ps(p, _mm_add_ps(_mm_loadu_ps(p),
+			_mm_mul_ps(_mm_loadu_ps(Column_ptr(src, float, i)),
+				_mm256_castps256_ps128(scale))));
+	}
+}
+
+SIMD_TARGET_AVX2 static void
+Simd_avx2_vec3_damp_add(ParticleColumn dst, ParticleColumn src,
+	const Vec3 *damping, float s, unsigned long start, unsigned long end)
+{
+	__m256 damp = _mm256_set_ps(1.0f, damping->z, damping->y, damping->x,
+		1.0f, damping->z, damping->y, damping->x);
+	__m256 scale = _mm256_set_ps(0.0f, s, s, s, 0.0f, s, s, s);
+	__m256 v;
+	__m128 v1;
+	float *p;
+	register unsigned long i = start;
+
+	if (Simd_contiguous(dst) && Simd_contiguous(src)) {
+		for (; i + 2 <= end; i += 2) {
+			p = Column_ptr(src, float, i);
+			v = _mm256_mul_ps(_mm256_loadu_ps(p), damp);
+			_mm256_storeu_ps(p, v);
+			p = Column_ptr(dst, float, i);
+			_mm256_storeu_ps(p, _mm256_add_ps(_mm256_loadu_ps(p),
+				_mm256_mul_ps(v, scale)));
+		}
+	}
+	for (; i < end; i++) {
+		p = Column_ptr(src, float, i);
+		v1 = _mm_mul_ps(_mm_loadu_ps(p), _mm256_castps256_ps128(damp));
+		_mm_storeu_ps(p, v1);
+		p = Column_ptr(dst, float, i);
+		_mm_storeu_ps(p, _mm_add_ps(_mm_loadu_ps(p),
+			_mm_mul_ps(v1, _mm256_castps256_ps128(scale))));
+	}
+}
+
+static const SimdKernels Simd_avx2 = {
+	SIMD_AVX2,
+	"avx2",
+	Simd_avx2_vec3_add,
+	Simd_avx2_vec3_add_scaled,
+	Simd_avx2_vec3_damp_add
+};
+
+/* Return the best level the CPU and operating system support */
+static SimdLevel
+Simd_detect(void)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	__builtin_cpu_init();
+	/* Also checks that the OS saves the AVX registers */
+	if (__builtin_cpu_supports("avx2"))
+		return SIMD_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return SIMD_SSE2;
+	return SIMD_SCALAR;
+#else
+	int info[4];
+	int avx2 = 0;
+
+	__cpuid(info, 0);
+	if (info[0] >= 7) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+	__cpuid(info, 1);
+	/* AVX2 is usable if the OS saves the YMM registers, per XGETBV */
+	if (avx2 && (info[2] & (1 << 27)) && (info[2] & (1 << 28))
+		&& (_xgetbv(0) & 6) == 6)
+		return SIMD_AVX2;
+	if (info[3] & (1 << 26))
+		return SIMD_SSE2;
+	return SIMD_SCALAR;
+#endif
+}
+
+#elif defined(SIMD_ARM_NEON)
+/* --------------------------------------------------------------------- */
+/* NEON kernels */
+
+static void
+Simd_neon_vec3_add(ParticleColumn col, const Vec3 *v,
+	unsigned long start, unsigned long end)
+{
+	float a_init[4];
+	float32x4_t a;
+	float *p;
+	register unsigned long i;
+
+	a_init[0] = v->x; a_init[1] = v->y; a_init[2] = v->z; a_init[3] = 0.0f;
+	a = vld1q_f32(a_init);
+	for (i = start; i < end; i++) {
+		p = Column_ptr(col, float, i);
+		vst1q_f32(p, vaddq_f32(vld1q_f32(p), a));
+	}
+}
+
+static void
+Simd_neon_vec3_add_scaled(ParticleColumn dst, ParticleColumn src, float s,
+	unsigned long start, unsigned long end)
+{
+	float scale_init[4];
+	float32x4_t scale;
+	float *p;
+	register unsigned long i;
+
+	scale_init[0] = scale_init[1] = scale_init[2] = s;
+	scale_init[3] = 0.0f;
+	scale = vld1q_f32(scale_init);
+	for (i = start; i < end; i++) {
+		p = Column_ptr(dst, float, i);
+		vst1q_f32(p, vmlaq_f32(vld1q_f32(p),
+			vld1q_f32(Column_ptr(src, float, i)), scale));
+	}
+}
+
+static void
+Simd_neon_vec3_damp_add(ParticleColumn dst, ParticleColumn src,
+	const Vec3 *damping, float s, unsigned long start, unsigned long end)
+{
+	float init[4];
+	float32x4_t damp, scale, v;
+	float *p;
+	register unsigned long i;
+
+	init[0] = damping->x; init[1] = damping->y; init[2] = damping->z;
+	init[3] = 1.0f;
+	damp = vld1q_f32(init);
+	init[0] = init[1] = init[2] = s;
+	init[3] = 0.0f;
+	scale = vld1q_f32(init);
+	for (i = start; i < end; i++) {
+		p = Column_ptr(src, float, i);
+		v = vmulq_f32(vld1q_f32(p), damp);
+		vst1q_f32(p, v);
+		p = Column_ptr(dst, float, i);
+		vst1q_f32(p, vmlaq_f32(vld1q_f32(p), v, scale));
+	}
+}
+
+static const SimdKernels Simd_neon = {
+	SIMD_NEON,
+	"neon",
+	Simd_neon_vec3_add,
+	Simd_neon_vec3_add_scaled,
+	Simd_neon_vec3_damp_add
+};
+
+static SimdLevel
+Simd_detect(void)
+{
+	return SIMD_NEON;
+}
+
+#else
+
+static SimdLevel
+Simd_detect(void)
+{
+	return SIMD_SCALAR;
+}
+
+#endif
+
+/* Return the kernels of a supported level */
+static const SimdKernels *
+Simd_level_kernels(SimdLevel level)
+{
+	switch (level) {
+#ifdef SIMD_X86
+	case SIMD_AVX2:
+		return &Simd_avx2;
+	case SIMD_SSE2:
+		return &Simd_sse2;
+#elif defined(SIMD_ARM_NEON)
+	case SIMD_NEON:
+		return &Simd_neon;
+#endif
+	default:
+		return &Simd_scalar;
+	}
+}
+
+const SimdKernels *
+Simd_kernels(void)
+{
+	/* Each extension module selects its own kernels, all alike */
+	static const SimdKernels *kernels = NULL;
+	const SimdKernels *best, *lower;
+	const char *name;
+	int level;
+
+	if (kernels == NULL) {
+		best = Simd_level_kernels(Simd_detect());
+		/* A supported level may be requested by name, others are ignored */
+		name = getenv("LEPTON_SIMD");
+		for (level = best->level; name != NULL && level >= SIMD_SCALAR; level--) {
+			lower = Simd_level_kernels((SimdLevel)level);
+			if ((int)lower->level == level && strcmp(lower->name, name) == 0) {
+				best = lower;
+				break;
+			}
+		}
+		kernels = best;
+	}
+	return kernels;
+}
@@ -0,0 +1,47 @@
+/* SIMD particle kernels
+ *
+ * Vector kernels over particle columns, in scalar, SSE2, AVX2 and NEON
+ * variants. The best variant the CPU supports is selected at runtime, so a
+ * single build runs on any CPU of its architecture. The LEPTON_SIMD
+ * environment variable may name a lower level to use instead, such as
+ * "scalar" to compare against the reference implementation.
+ *
+ * Vec3 values are 16 bytes including their padding, so each is processed as
+ * one 4-float vector. The kernels leave the padding of the vectors they
+ * change as it is.
+ *
+ * $Id$
+ */
+
+#include <Python.h>
+#include "group.h"
+
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+typedef enum {
+	SIMD_SCALAR = 0,
+	SIMD_SSE2,
+	SIMD_AVX2,
+	SIMD_NEON
+} SimdLevel;
+
+typedef struct {
+	SimdLevel level;
+	const char *name;
+	/* col[i] += v for i in [start, end) */
+	void (*vec3_add)(ParticleColumn col, const Vec3 *v,
+		unsigned long start, unsigned long end);
+	/* dst[i] += src[i] * s for i in [start, end) */
+	void (*vec3_add_scaled)(ParticleColumn dst, ParticleColumn src, float s,
+		unsigned long start, unsigned long end);
+	/* src[i] *= damping, then dst[i] += src[i] * s for i in [start, end) */
+	void (*vec3_damp_add)(ParticleColumn dst, ParticleColumn src,
+		const Vec3 *damping, float s, unsigned long start, unsigned long end);
+} SimdKernels;
+
+/* Return the kernels selected for this CPU */
+const SimdKernels *
+Simd_kernels(void);
+
+#endif
@@ -19,14 +19,25 @@ if sys.version_info < (3, 0):
 
 class ParticleSystem(object):
 
-    def __init__(self, global_controllers=()):
+    def __init__(self, global_controllers=(), threads=1):
         """Initialize the particle system, adding the specified global
         controllers, if any
+
+        threads -- The number of threads used to update the system's groups.
+        With more than one, independent groups are updated in parallel
+        by a native worker pool.
         """
         # Tuples are used for global controllers to prevent
         # unpleasant side-affects if they are added during update or draw
         self.controllers = tuple(global_controllers)
         self.groups = []
+        if threads < 1:
+            raise ValueError("threads must be >= 1")
+        self.threads = threads
+        self._pool = None
+        if threads > 1:
+            from lepton.group import UpdatePool
+            self._pool = UpdatePool(threads)
 
     def add_global_controller(self, *controllers):
         """Add a global controller applied to all groups on update"""
@@ -63,11 +74,25 @@ class ParticleSystem(object):
         When updating, first the global controllers are applied to
         all groups. Then update(time_delta) is called for all groups.
 
+        If the system has more than one thread, all groups are first
+        consolidated and have their leading built-in controllers run in
+        parallel. Their remaining controllers then run in the calling
+        thread, one group at a time in the system's order. This differs
+        from a serial update across groups: controllers and emitters of
+        one group see every other group already consolidated, so particles
+        they add to a group later in the order are only incorporated at
+        its next update. A group may also only be in a threaded system
+        once, otherwise ValueError is raised, where a serial system
+        updates it once for each time it was added.
+
         This method can be conveniently scheduled using the Pyglet
         scheduler method: pyglet.clock.schedule_interval
         """
-        for group in self:
-            group.update(time_delta)
+        if self._pool is not None:
+            self._pool.update(list(self.groups), time_delta)
+        else:
+            for group in self:
+                group.update(time_delta)
 
     def run_ahead(self, time, framerate):
         """Run the particle system for the specified time frame at the
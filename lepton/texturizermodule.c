@@ -37,11 +37,14 @@
 static void
 adjust_particle_widths(GroupObject *pgroup, FloatArrayObject *tex_array)
 {
-	Particle *p;
+	ParticleColumn size;
+	Vec3 *psize;
 	float *tex, min_s, min_t, max_s, max_t, t_width, t_height;
 	int i, j, t;
 
-	p = pgroup->plist->p;
+	size = Group_column(pgroup, PATTR_SIZE);
+	if (size.base == NULL)
+		return; /* nothing to adjust */
 	tex = tex_array->data;
 	for (i = 0, t = 0; i < GroupObject_ActiveCount(pgroup); i++, t += 8) {
 		min_s = max_s = tex[t];
@@ -54,18 +57,22 @@ adjust_particle_widths(GroupObject *pgroup, FloatArrayObject *tex_array)
 		}
 		t_width = max_s - min_s;
 		t_height = max_t - min_t + EPSILON;
-		p[i].size.x = p[i].size.y * t_width / t_height;
+		psize = Column_ptr(size, Vec3, i);
+		psize->x = psize->y * t_width / t_height;
 	}
 }
 
 static void
 adjust_particle_heights(GroupObject *pgroup, FloatArrayObject *tex_array)
 {
-	Particle *p;
+	ParticleColumn size;
+	Vec3 *psize;
 	float *tex, min_s, min_t, max_s, max_t, t_width, t_height;
 	int i, j, t;
 
-	p = pgroup->plist->p;
+	size = Group_column(pgroup, PATTR_SIZE);
+	if (size.base == NULL)
+		return; /* nothing to adjust */
 	tex = tex_array->data;
 	for (i = 0, t = 0; i < GroupObject_ActiveCount(pgroup); i++, t += 8) {
 		min_s = max_s = tex[t];
@@ -78,7 +85,8 @@ adjust_particle_heights(GroupObject *pgroup, FloatArrayObject *tex_array)
 		}
 		t_width = max_s - min_s + EPSILON;
 		t_height = max_t - min_t;
-		p[i].size.y = p[i].size.x * t_height / t_width;
+		psize = Column_ptr(size, Vec3, i);
+		psize->y = psize->x * t_height / t_width;
 	}
 }
 
@@ -946,8 +954,9 @@ FlipBookTex_restore_state(FlipBookTexObject *self)
 static FloatArrayObject *
 FlipBookTex_generate_tex_coords(FlipBookTexObject *self, GroupObject *pgroup)
 {
-	register unsigned long pcount;
-	register Particle *p;
+	register unsigned long i, pcount;
+	register float *page;
+	ParticleColumn age_col;
 	int coord_count, loop, last_coord, frame = 0;
 	register float *ptex, *ttex;
 	float *tex_coords, total_time, duration, age, *times;
@@ -958,7 +967,7 @@ FlipBookTex_generate_tex_coords(FlipBookTexObject *self, GroupObject *pgroup)
 	}
 
 	pcount = GroupObject_ActiveCount(pgroup);
-	p = pgroup->plist->p;
+	age_col = Group_column(pgroup, PATTR_AGE);
 
 	if (self->tex_array == NULL || self->tex_array->size < pcount * self->dimension * 4) {
 		Py_XDECREF(self->tex_array);
@@ -978,12 +987,13 @@ FlipBookTex_generate_tex_coords(FlipBookTexObject *self, GroupObject *pgroup)
 		if (times == NULL) {
 			total_time = self->duration * last_coord;
 			duration = self->duration;
-			while (pcount--) {
-				if (p->age >= 0.0f) {
+			for (i = 0; i < pcount; i++) {
+				page = Column_ptr(age_col, float, i);
+				if (*page >= 0.0f) {
 					if (loop) {
-						frame = (int)(p->age / duration) % coord_count;
+						frame = (int)(*page / duration) % coord_count;
 					} else {
-						frame = (int)(fminf(p->age, total_time) / duration);
+						frame = (int)(fminf(*page, total_time) / duration);
 					}
 				} /* we don't care what the frame is for dead particles */
 				ttex = tex_coords + frame * 8;
@@ -995,16 +1005,16 @@ FlipBookTex_generate_tex_coords(FlipBookTexObject *self, GroupObject *pgroup)
 				*ptex++ = *ttex++;
 				*ptex++ = *ttex++;
 				*ptex++ = *ttex++;
-				p++;
 			}
 		} else {
 			total_time = times[last_coord];
-			while (pcount--) {
-				if (p->age >= 0.0f) {
+			for (i = 0; i < pcount; i++) {
+				page = Column_ptr(age_col, float, i);
+				if (*page >= 0.0f) {
 					if (loop) {
-						age = fmodf(p->age, total_time);
+						age = fmodf(*page, total_time);
 					} else {
-						age = p->age;
+						age = *page;
 					}
 					for (; frame < last_coord && age > times[frame]; frame++);
 					for (; frame > 0 && age <= times[frame - 1]; frame--);
@@ -1018,7 +1028,6 @@ FlipBookTex_generate_tex_coords(FlipBookTexObject *self, GroupObject *pgroup)
 				*ptex++ = *ttex++;
 				*ptex++ = *ttex++;
 				*ptex++ = *ttex++;
-				p++;
 			}
 		}
 		if (self->adjust_width) {
@@ -1030,12 +1039,13 @@ FlipBookTex_generate_tex_coords(FlipBookTexObject *self, GroupObject *pgroup)
 		if (times == NULL) {
 			total_time = self->duration * last_coord;
 			duration = self->duration;
-			while (pcount--) {
-				if (p->age >= 0.0f) {
+			for (i = 0; i < pcount; i++) {
+				page = Column_ptr(age_col, float, i);
+				if (*page >= 0.0f) {
 					if (loop) {
-						frame = (int)(p->age / duration) % coord_count;
+						frame = (int)(*page / duration) % coord_count;
 					} else {
-						frame = (int)(fminf(p->age, total_time) / duration);
+						frame = (int)(fminf(*page, total_time) / duration);
 					}
 				} /* we don't care what the frame is for dead particles */
 				ttex = tex_coords + frame * 12;
@@ -1051,16 +1061,16 @@ FlipBookTex_generate_tex_coords(FlipBookTexObject *self, GroupObject *pgroup)
 				*ptex++ = *ttex++;
 				*ptex++ = *ttex++;
 				*ptex++ = *ttex++;
-				p++;
 			}
 		} else {
 			total_time = times[last_coord];
-			while (pcount--) {
-				if (p->age >= 0.0f) {
+			for (i = 0; i < pcount; i++) {
+				page = Column_ptr(age_col, float, i);
+				if (*page >= 0.0f) {
 					if (loop) {
-						age = fmodf(p->age, total_time);
+						age = fmodf(*page, total_time);
 					} else {
-						age = p->age;
+						age = *page;
 					}
 					for (; frame < last_coord && age > times[frame]; frame++);
 					for (; frame > 0 && age <= times[frame - 1]; frame--);
@@ -1078,7 +1088,6 @@ FlipBookTex_generate_tex_coords(FlipBookTexObject *self, GroupObject *pgroup)
 				*ptex++ = *ttex++;
 				*ptex++ = *ttex++;
 				*ptex++ = *ttex++;
-				p++;
 			}
 		}
 	}
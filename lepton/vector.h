@@ -37,6 +37,20 @@ typedef struct {
 
 #define EPSILON 0.00001f
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <float.h>
+#include <xmmintrin.h>
+
+/* Fast inverse sqrt using the SSE reciprocal square root estimate, refined
+ * by one iteration of newton's method. Like the portable version, it is
+ * finite for zero, so that x * InvSqrt(x) is zero
+ */
+static inline float InvSqrt (float x) {
+	float y = _mm_cvtss_f32(_mm_rsqrt_ss(
+		_mm_max_ss(_mm_set_ss(x), _mm_set_ss(FLT_MIN))));
+	return y*(1.5f - 0.5f*x*y*y);
+}
+#else
 /* The illustrious fast inverse sqrt of Quake 3 fame
  * This algorithm is very fast, but at the cost of accuracy
  */
@@ -51,6 +65,7 @@ static inline float InvSqrt (float x) {
     x = x*(1.5f - xhalf*x*x);
     return x;
 }
+#endif
 
 #define clamp(n, min, max) \
 	((n) < (min) ? (min) : ((n) > (max) ? (max) : (n)))
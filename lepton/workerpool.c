@@ -0,0 +1,236 @@
+/****************************************************************************
+*
+* Copyright (c) 2008 by Casey Duncan and contributors
+* All Rights Reserved.
+*
+* This software is subject to the provisions of the MIT License
+* A copy of the license should accompany this distribution.
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+*
+****************************************************************************/
+/* Native worker thread pool
+ *
+ * Each thread, including the caller of WorkerPool_run(), owns a queue of
+ * tasks. Task k of a batch goes to queue k % threads, so the queues are
+ * strided views of the task array. Owners take tasks from the front of their
+ * queue, thieves from the back of another's, each under the queue's lock.
+ *
+ * The worker threads wait on their start lock, which the pool holds while
+ * they are idle, and release their done lock when their batch is finished.
+ * Python thread locks may be released by any thread, thus serve as
+ * semaphores here.
+ *
+ * $Id$
+ */
+
+#include <Python.h>
+#include "workerpool.h"
+
+typedef struct {
+	PyThread_type_lock lock; /* protects head and tail */
+	unsigned long head, tail; /* strided indices of the tasks left */
+} WorkerQueue;
+
+typedef struct {
+	WorkerPool *pool;
+	int thread;
+	PyThread_type_lock start;
+	PyThread_type_lock done;
+} WorkerThread;
+
+struct WorkerPool {
+	int threads;
+	int quit;
+	PyThread_type_lock busy; /* held while a batch runs */
+	WorkerQueue *queues;
+	WorkerThread *workers; /* one per thread, the first is unused */
+	WorkerTaskFunc func;
+	void **tasks;
+};
+
+/* Take the next task from the front of the thread's own queue, or else
+ * steal one from the back of another queue. Return NULL when there are no
+ * tasks left
+ */
+static void *
+WorkerPool_next_task(WorkerPool *pool, int thread)
+{
+	WorkerQueue *queue;
+	void *task = NULL;
+	int i, victim;
+
+	for (i = 0; i < pool->threads && task == NULL; i++) {
+		victim = (thread + i) % pool->threads;
+		queue = &pool->queues[victim];
+		PyThread_acquire_lock(queue->lock, WAIT_LOCK);
+		if (queue->head < queue->tail) {
+			if (i == 0)
+				task = pool->tasks[victim + queue->head++ * pool->threads];
+			else
+				task = pool->tasks[victim + --queue->tail * pool->threads];
+		}
+		PyThread_release_lock(queue->lock);
+	}
+	return task;
+}
+
+static void
+WorkerPool_work(WorkerPool *pool, int thread)
+{
+	void *task;
+
+	while ((task = WorkerPool_next_task(pool, thread)) != NULL)
+		pool->func(task, thread);
+}
+
+static void
+WorkerThread_main(void *arg)
+{
+	WorkerThread *worker = (WorkerThread *)arg;
+	WorkerPool *pool = worker->pool;
+
+	for (;;) {
+		PyThread_acquire_lock(worker->start, WAIT_LOCK);
+		if (pool->quit) {
+			PyThread_release_lock(worker->done);
+			return;
+		}
+		WorkerPool_work(pool, worker->thread);
+		PyThread_release_lock(worker->done);
+	}
+}
+
+/* Allocate a lock, acquired if held is true */
+static PyThread_type_lock
+WorkerPool_new_lock(int held)
+{
+	PyThread_type_lock lock = PyThread_allocate_lock();
+
+	if (lock != NULL && held)
+		PyThread_acquire_lock(lock, WAIT_LOCK);
+	return lock;
+}
+
+WorkerPool *
+WorkerPool_new(int threads)
+{
+	WorkerPool *pool;
+	WorkerThread *worker;
+	int i;
+
+	if (threads < 1) {
+		PyErr_SetString(PyExc_ValueError, "threads must be >= 1");
+		return NULL;
+	}
+	pool = (WorkerPool *)PyMem_Malloc(sizeof(WorkerPool));
+	if (pool == NULL) {
+		PyErr_NoMemory();
+		return NULL;
+	}
+	pool->threads = 0;
+	pool->quit = 0;
+	pool->func = NULL;
+	pool->tasks = NULL;
+	pool->busy = PyThread_allocate_lock();
+	pool->queues = (WorkerQueue *)PyMem_Malloc(sizeof(WorkerQueue) * threads);
+	pool->workers = (WorkerThread *)PyMem_Malloc(sizeof(WorkerThread) * threads);
+	if (pool->busy == NULL || pool->queues == NULL || pool->workers == NULL)
+		goto error;
+
+	/* Threads are counted as they start, so WorkerPool_free() stops only
+	 * those started on failure */
+	for (i = 0; i < threads; i++) {
+		pool->queues[i].head = pool->queues[i].tail = 0;
+		pool->queues[i].lock = WorkerPool_new_lock(0);
+		if (pool->queues[i].lock == NULL)
+			goto error;
+		pool->threads = i + 1;
+		worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->thread = i;
+		worker->start = worker->done = NULL;
+		if (i == 0)
+			continue; /* the calling thread */
+		worker->start = WorkerPool_new_lock(1);
+		worker->done = WorkerPool_new_lock(1);
+		if (worker->start == NULL || worker->done == NULL
+			|| PyThread_start_new_thread(WorkerThread_main, worker)
+				== (unsigned long)-1) {
+			if (worker->start != NULL)
+				PyThread_free_lock(worker->start);
+			if (worker->done != NULL)
+				PyThread_free_lock(worker->done);
+			worker->start = worker->done = NULL;
+			goto error;
+		}
+	}
+	return pool;
+
+error:
+	WorkerPool_free(pool);
+	PyErr_SetString(PyExc_RuntimeError, "could not start worker threads");
+	return NULL;
+}
+
+void
+WorkerPool_free(WorkerPool *pool)
+{
+	WorkerThread *worker;
+	int i;
+
+	if (pool == NULL)
+		return;
+	pool->quit = 1;
+	for (i = 0; i < pool->threads; i++) {
+		worker = &pool->workers[i];
+		if (worker->start != NULL) {
+			PyThread_release_lock(worker->start);
+			/* Wait for the thread to exit */
+			Py_BEGIN_ALLOW_THREADS
+			PyThread_acquire_lock(worker->done, WAIT_LOCK);
+			Py_END_ALLOW_THREADS
+			PyThread_free_lock(worker->start);
+			PyThread_free_lock(worker->done);
+		}
+		PyThread_free_lock(pool->queues[i].lock);
+	}
+	if (pool->busy != NULL)
+		PyThread_free_lock(pool->busy);
+	PyMem_Free(pool->queues);
+	PyMem_Free(pool->workers);
+	PyMem_Free(pool);
+}
+
+int
+WorkerPool_threads(WorkerPool *pool)
+{
+	return pool->threads;
+}
+
+void
+WorkerPool_run(WorkerPool *pool, WorkerTaskFunc func, void **tasks,
+	unsigned long count)
+{
+	unsigned long threads = pool->threads;
+	int i;
+
+	if (count == 0)
+		return;
+	PyThread_acquire_lock(pool->busy, WAIT_LOCK);
+	pool->func = func;
+	pool->tasks = tasks;
+	for (i = 0; i < pool->threads; i++) {
+		pool->queues[i].head = 0;
+		pool->queues[i].tail = (count + threads - 1 - i) / threads;
+	}
+	for (i = 1; i < pool->threads; i++)
+		PyThread_release_lock(pool->workers[i].start);
+	WorkerPool_work(pool, 0);
+	for (i = 1; i < pool->threads; i++)
+		PyThread_acquire_lock(pool->workers[i].done, WAIT_LOCK);
+	pool->func = NULL;
+	pool->tasks = NULL;
+	PyThread_release_lock(pool->busy);
+}
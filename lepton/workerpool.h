@@ -0,0 +1,47 @@
+/* Native worker thread pool
+ *
+ * Runs batches of independent native tasks on a fixed set of threads, without
+ * the GIL. Tasks are dealt out to per-thread queues, and threads that run out
+ * of their own tasks steal from the back of the other queues, so that a few
+ * long tasks balance against many short ones.
+ *
+ * $Id$
+ */
+
+#include <Python.h>
+
+#ifndef _WORKERPOOL_H_
+#define _WORKERPOOL_H_
+
+/* Task function, called with one of the tasks passed to WorkerPool_run()
+ * and the number of the thread running it. It must not use the Python API
+ */
+typedef void (*WorkerTaskFunc)(void *task, int thread);
+
+typedef struct WorkerPool WorkerPool;
+
+/* Create a pool running tasks on threads threads in total, including the
+ * thread calling WorkerPool_run(). Return NULL with an exception set on
+ * failure
+ */
+WorkerPool *
+WorkerPool_new(int threads);
+
+/* Stop the pool's threads and free it */
+void
+WorkerPool_free(WorkerPool *pool);
+
+/* Return the number of threads the pool runs tasks on */
+int
+WorkerPool_threads(WorkerPool *pool);
+
+/* Run func for each of count tasks, and return when all are done. Tasks are
+ * dealt out in order, so pass the longest first for the best balance. The
+ * Python API is not used, so release the GIL around it to let other Python
+ * threads run meanwhile. Batches run on a pool one at a time
+ */
+void
+WorkerPool_run(WorkerPool *pool, WorkerTaskFunc func, void **tasks,
+	unsigned long count);
+
+#endif
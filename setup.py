@@ -105,34 +105,40 @@ You can download binary releases or browse the source code at our Google code si
     ext_modules=[
         make_ext(
             'lepton.group',
-            ['lepton/group.c', 'lepton/groupmodule.c'],
+            ['lepton/group.c', 'lepton/groupmodule.c',
+             'lepton/workerpool.c', 'lepton/simd.c'],
         ),
         make_ext(
             'lepton.renderer',
             ['lepton/group.c', 'lepton/renderermodule.c',
              'lepton/controllermodule.c', 'lepton/groupmodule.c',
+             'lepton/workerpool.c', 'lepton/simd.c',
              'glew/src/glew.c'],
         ),
         make_ext(
             'lepton._texturizer',
             ['lepton/group.c', 'lepton/texturizermodule.c',
              'lepton/renderermodule.c', 'lepton/controllermodule.c',
-             'lepton/groupmodule.c', 'glew/src/glew.c'],
+             'lepton/groupmodule.c', 'lepton/workerpool.c',
+             'lepton/simd.c', 'glew/src/glew.c'],
         ),
         make_ext(
             'lepton._controller',
             ['lepton/group.c', 'lepton/groupmodule.c',
+             'lepton/workerpool.c', 'lepton/simd.c',
              'lepton/controllermodule.c'],
         ),
         make_ext(
             'lepton.emitter',
             ['lepton/group.c', 'lepton/groupmodule.c',
-             'lepton/fastrng.c', 'lepton/emittermodule.c'],
+             'lepton/workerpool.c', 'lepton/simd.c', 'lepton/fastrng.c',
+             'lepton/emittermodule.c'],
         ),
         make_ext(
             'lepton._domain',
             ['lepton/group.c', 'lepton/groupmodule.c',
-             'lepton/fastrng.c', 'lepton/domainmodule.c'],
+             'lepton/workerpool.c', 'lepton/simd.c', 'lepton/fastrng.c',
+             'lepton/domainmodule.c'],
         ),
     ],
 )
@@ -50,6 +50,22 @@ class DummyPlaneDomain(object):
         return False
 
 
+class PythonDomain(object):
+    """Wraps a built-in domain so controllers use it through its methods"""
+
+    def __init__(self, domain):
+        self.domain = domain
+
+    def __contains__(self, point):
+        return point in self.domain
+
+    def intersect(self, start_pt, end_pt):
+        return self.domain.intersect(start_pt, end_pt)
+
+    def closest_point_to(self, point):
+        return self.domain.closest_point_to(point)
+
+
 class ControllerTestBase(unittest.TestCase):
 
     def assertVector(self, vec3, exp, tolerance=0.00001):
@@ -69,9 +85,11 @@ class ControllerTestBase(unittest.TestCase):
 
 class ControllerTest(ControllerTestBase):
 
+    layout = 'aos'
+
     def _make_group(self):
         from lepton import Particle, ParticleGroup
-        g = ParticleGroup()
+        g = ParticleGroup(layout=self.layout)
         g.new(Particle((0, 0, 0), (0, 0, 0)))
         g.new(Particle((0, 0, 0), (1, 1, 1), size=(2, 2, 2)))
         g.new(Particle((1, 1, 1), (-2, -2, -2), size=(3, 2, 0)))
@@ -88,9 +106,120 @@ class ControllerTest(ControllerTestBase):
         self.assertVector(p[1].velocity, (1.05, 1.1, 1.2))
         self.assertVector(p[2].velocity, (-1.95, -1.9, -1.8))
 
+    def test_missing_attribute(self):
+        from lepton import controller, ParticleGroup
+        g = ParticleGroup(attributes=('position', 'color'), layout=self.layout)
+        g.new(position=(1, 2, 3))
+        g.update(0)
+        self.assertRaises(ValueError, controller.Gravity((0, 0, 1)), 1, g)
+        self.assertRaises(ValueError, controller.Growth(1), 1, g)
+        controller.Fader(fade_in_end=1)(0, g)
+        controller.Lifetime(1)(0, g)
+
+    def _fused_controllers(self):
+        from lepton import controller
+        return [
+            controller.Gravity((0, -1, 0)),
+            controller.Movement(damping=0.9, max_velocity=50),
+            controller.Fader(fade_in_end=1, fade_out_start=2, fade_out_end=3),
+            controller.ColorBlender([(0, (1, 0, 0, 1)), (3, (0, 0, 1, 1))]),
+            controller.Growth(0.5, damping=0.9),
+            controller.Lifetime(2.5),
+        ]
+
+    def test_fused_controllers(self):
+        from lepton import ParticleGroup
+        fused = self._fused_controllers()
+        sequential = self._fused_controllers()
+        record = lambda td, group: None
+        g1 = ParticleGroup(controllers=fused, layout=self.layout)
+        g2 = ParticleGroup(layout=self.layout)
+        for g in (g1, g2):
+            for i in range(1000):
+                g.new(position=(i, 0, 0), velocity=(i % 7, i % 5, 0),
+                    age=(i % 31) * 0.1)
+        for i in range(7):
+            if i == 6:
+                # A Python controller between them splits the pass
+                g1.bind_controller(record, fused[0])
+                sequential += [record, sequential[0]]
+            g1.update(0.2)
+            g2.update(0.2)
+            for ctrl in sequential:
+                ctrl(0.2, g2)
+            self.assertEqual(len(g1), len(g2))
+            for attr in ('position', 'velocity', 'color', 'size'):
+                self.assertEqual(g1.get_attribute(attr).tolist(),
+                    g2.get_attribute(attr).tolist())
+
+    def test_fused_controller_repeated(self):
+        # The second run of a controller sees the state its first run left
+        from lepton import ParticleGroup, controller
+        growth = controller.Growth(1.0, damping=0.5)
+        sequential = controller.Growth(1.0, damping=0.5)
+        g1 = ParticleGroup(controllers=(growth, growth), layout=self.layout)
+        g2 = ParticleGroup(layout=self.layout)
+        for g in (g1, g2):
+            g.new(size=(0, 0, 0))
+        g1.update(1.0)
+        g2.update(1.0)
+        sequential(1.0, g2)
+        sequential(1.0, g2)
+        self.assertEqual(g1.get_attribute('size').tolist(), [[1.5] * 3])
+        self.assertEqual(g1.get_attribute('size').tolist(),
+            g2.get_attribute('size').tolist())
+
+    _simd_script = """if 1:
+        from lepton import ParticleGroup, controller
+        g = ParticleGroup(layout=%r, controllers=(
+            controller.Gravity((0, -1, 0.5)),
+            controller.Movement(damping=(0.9, 0.8, 1)),
+            controller.Movement(),
+            controller.Growth((0.5, 0.25, 1))))
+        for i in range(101):
+            g.new(position=(i, -i, 0), velocity=(i %% 7, i %% 5, 1),
+                rotation=(0, i %% 3, 1), size=(1, 1, 1))
+        for i in range(5):
+            g.update(0.1)
+        print([g.get_attribute(attr).tolist()
+            for attr in ('position', 'velocity', 'up', 'size')])
+        """
+
+    def test_simd_kernels(self):
+        import os
+        import subprocess
+        import lepton
+        self.assertTrue(lepton.simd_level() in ('scalar', 'sse2', 'avx2', 'neon'))
+        script = self._simd_script % self.layout
+        env = dict(os.environ, PYTHONPATH=os.pathsep.join(sys.path))
+        results = []
+        for level in (lepton.simd_level(), 'scalar'):
+            env['LEPTON_SIMD'] = level
+            results.append(subprocess.check_output(
+                [sys.executable, '-c', script], env=env))
+        self.assertEqual(results[0], results[1])
+
+    def test_fused_missing_attribute(self):
+        from lepton import controller, ParticleGroup
+        g = ParticleGroup(attributes=('position', 'velocity'), layout=self.layout)
+        g.new(position=(1, 2, 3))
+        g.update(0)
+        g.bind_controller(controller.Gravity((0, 0, 1)), controller.Fader())
+        self.assertRaises(ValueError, g.update, 1)
+        # The controller preceding the failed one still ran
+        self.assertVector(list(g)[0].velocity, (0, 0, 1))
+
+    def test_Movement_controller_no_rotation(self):
+        from lepton import controller, ParticleGroup
+        g = ParticleGroup(attributes=('position', 'velocity'), layout=self.layout)
+        g.new(position=(1, 2, 3), velocity=(1, 0, -1))
+        g.update(0)
+        controller.Movement()(2, g)
+        self.assertVector(list(g)[0].position, (3, 2, 1))
+
     def test_Lifetime_controller(self):
         from lepton import controller, Particle, ParticleGroup
-        g = ParticleGroup()
+        g = ParticleGroup(layout=self.layout)
         g.new(Particle(age=0))
         g.new(Particle(age=0.8))
         g.new(Particle(age=1.0))
@@ -247,9 +376,11 @@ class ControllerTest(ControllerTestBase):
 
 class BounceControllerTest(ControllerTestBase):
 
+    layout = 'aos'
+
     def _make_group(self):
         from lepton import Particle, ParticleGroup
-        g = ParticleGroup()
+        g = ParticleGroup(layout=self.layout)
         g.new(Particle(position=(0, 1, 0), velocity=(0, -1, 0))),
         g.new(Particle(position=(0, 1, 0), velocity=(0, -1.5, 0))),
         g.new(Particle(position=(-1, -1, 1), velocity=(2, 2, 0))),
@@ -351,9 +482,11 @@ class BounceControllerTest(ControllerTestBase):
 
 class MagnetControllerTest(ControllerTestBase):
 
+    layout = 'aos'
+
     def _make_group(self):
         from lepton import Particle, ParticleGroup
-        g = ParticleGroup()
+        g = ParticleGroup(layout=self.layout)
         g.new(Particle(position=(0, 1.0, 0), velocity=(0, 0, 0))),
         g.new(Particle(position=(0, 0, 1.0), velocity=(0, 0, 0))),
         g.update(0)
@@ -382,5 +515,203 @@ class MagnetControllerTest(ControllerTestBase):
         self.assertVector(p[1].velocity, (0, 0.0, -4.0), tolerance=0.0001)
 
 
+class NativeDomainControllerTest(ControllerTestBase):
+    """Built-in domains are called natively, and must give the same results
+    as calling them through their methods"""
+
+    layout = 'aos'
+
+    def _make_group(self, count=3000):
+        # Large enough to be updated in parallel
+        import random
+        from lepton import Particle, ParticleGroup
+        rand = random.Random(42)
+        g = ParticleGroup(layout=self.layout)
+        for i in range(count):
+            g.new(Particle(
+                position=(rand.uniform(-2, 2), rand.uniform(-2, 2), rand.uniform(-2, 2)),
+                velocity=(rand.uniform(-3, 3), rand.uniform(-3, 3), rand.uniform(-3, 3)),
+                mass=1.0))
+        g.update(0)
+        for p in g:
+            p.position = (p.position.x + p.velocity.x * 0.5,
+                p.position.y + p.velocity.y * 0.5,
+                p.position.z + p.velocity.z * 0.5)
+        return g
+
+    def assertGroupsEqual(self, group1, group2):
+        self.assertEqual(len(group1), len(group2))
+        for p1, p2 in zip(group1, group2):
+            self.assertVector(p1.position, tuple(p2.position), tolerance=0.0001)
+            self.assertVector(p1.velocity, tuple(p2.velocity), tolerance=0.0001)
+
+    def _compare(self, make_controller, domain, td=0.1):
+        native_group = self._make_group()
+        python_group = self._make_group()
+        make_controller(domain)(td, native_group)
+        make_controller(PythonDomain(domain))(td, python_group)
+        self.assertGroupsEqual(native_group, python_group)
+        return native_group
+
+    def test_Collector_native_domain(self):
+        from lepton import controller, domain
+        group = self._compare(controller.Collector, domain.Sphere((0, 0, 0), 1.5))
+        self.failUnless(0 < len(group) < 3000, len(group))
+        self._compare(lambda d: controller.Collector(d, collect_inside=False),
+            domain.AABox((-1, -1, -1), (1, 1, 1)))
+
+    def test_Collector_native_domain_callback(self):
+        from lepton import controller, domain
+        collected = []
+
+        def callback(particle, group, collector):
+            collected.append(tuple(particle.position))
+
+        sphere = domain.Sphere((0, 0, 0), 1.5)
+        group = self._make_group()
+        collector = controller.Collector(sphere, callback=callback)
+        collector(0, group)
+        self.assertEqual(len(collected), collector.collected_count)
+        self.assertEqual(len(group), 3000 - len(collected))
+        for point in collected:
+            self.failUnless(point in sphere, point)
+
+    def test_Bounce_native_domain(self):
+        from lepton import controller, domain
+        for d in [domain.Plane((0, 0, 0), (0, 1, 0)),
+                  domain.AABox((-1, -1, -1), (1, 1, 1)),
+                  domain.Sphere((0, 0, 0), 1.5, 0.5)]:
+            self._compare(lambda d: controller.Bounce(d, bounce=0.8, friction=0.1), d)
+
+    def test_composite_native_domain(self):
+        from lepton import controller, domain
+        union = domain.Union(domain.Sphere((0, 0, 0), 1),
+            domain.Cylinder((0, 0, -1.5), (0, 0, 1.5), 0.5))
+        diff = domain.Difference(domain.Sphere((0, 0, 0), 1.5),
+            domain.Sphere((1, 0, 0), 1))
+        for d in [union, diff]:
+            group = self._compare(controller.Collector, d)
+            self.failUnless(0 < len(group) < 3000, len(group))
+            self._compare(lambda d: controller.Bounce(d, bounce=0.8, friction=0.1), d)
+
+    def test_obstacle_set_native_domain(self):
+        from lepton import controller, domain
+        obstacles = domain.ObstacleSet(
+            [domain.AABox((x - 0.5, -0.5, -0.5), (x + 0.5, 0.5, 0.5))
+             for x in (-1.5, -0.5, 0.5, 1.5)]
+            + [domain.Sphere((0, y, 0), 0.5) for y in (-1.5, 1.5)])
+        self._compare(lambda d: controller.Bounce(d, bounce=0.8, friction=0.1),
+            obstacles)
+        group = self._compare(controller.Collector, obstacles)
+        self.failUnless(0 < len(group) < 3000, len(group))
+
+    def test_triangle_mesh_native_domain(self):
+        from lepton import controller, domain
+        # An octahedron
+        mesh = domain.TriangleMesh(
+            [(1.5, 0, 0), (-1.5, 0, 0), (0, 1.5, 0), (0, -1.5, 0),
+             (0, 0, 1.5), (0, 0, -1.5)],
+            [(0, 2, 4), (2, 1, 4), (1, 3, 4), (3, 0, 4),
+             (2, 0, 5), (1, 2, 5), (3, 1, 5), (0, 3, 5)])
+        self._compare(lambda d: controller.Bounce(d, bounce=0.8, friction=0.1),
+            mesh)
+        self._compare(lambda d: controller.Magnet(d, charge=10, epsilon=0.1,
+            outer_cutoff=2), mesh)
+
+    def test_sdf_volume_native_domain(self):
+        import math
+        from array import array
+        from lepton import controller, domain
+        distances = array('f', [
+            math.sqrt((i * 0.25 - 2) ** 2 + (j * 0.25 - 2) ** 2 + (k * 0.25 - 2) ** 2)
+            - 1.5 for i in range(17) for j in range(17) for k in range(17)])
+        volume = domain.SDFVolume(distances, (-2, -2, -2), 0.25, (17, 17, 17))
+        group = self._compare(controller.Collector, volume)
+        self.failUnless(0 < len(group) < 3000, len(group))
+        self._compare(lambda d: controller.Bounce(d, bounce=0.8, friction=0.1),
+            volume)
+        self._compare(lambda d: controller.Magnet(d, charge=10, epsilon=0.1,
+            outer_cutoff=2), volume)
+
+    def test_Bounce_native_domain_callback(self):
+        from lepton import controller, domain
+        collisions = []
+
+        def callback(particle, group, controller, point, normal):
+            collisions.append(point)
+
+        group = self._make_group()
+        bounce = controller.Bounce(domain.Plane((0, 0, 0), (0, 1, 0)),
+            callback=callback)
+        bounce(0, group)
+        self.failUnless(collisions)
+        for point in collisions:
+            self.assertAlmostEqual(point[1], 0, 5)
+
+    def test_native_domain_callback_matches_python(self):
+        # Only the particles hit are handed back to the callback
+        from lepton import controller, domain
+        def compare(make_controller, d):
+            calls = {}
+            def callback(particle, group, *args):
+                calls[group] = calls.get(group, 0) + 1
+            native_group = self._make_group()
+            python_group = self._make_group()
+            make_controller(d, callback)(0.1, native_group)
+            make_controller(PythonDomain(d), callback)(0.1, python_group)
+            self.assertGroupsEqual(native_group, python_group)
+            self.failUnless(calls.get(native_group))
+            self.assertEqual(calls[native_group], calls[python_group])
+        compare(lambda d, cb: controller.Bounce(d, bounce=0.8, callback=cb),
+            domain.Sphere((0, 0, 0), 1.5))
+        compare(lambda d, cb: controller.Collector(d, callback=cb),
+            domain.AABox((-1, -1, -1), (1, 1, 1)))
+
+    def test_Bounce_native_domain_callback_error(self):
+        from lepton import controller, domain
+
+        def callback(*args):
+            raise ValueError("bounced")
+
+        group = self._make_group()
+        bounce = controller.Bounce(domain.Plane((0, 0, 0), (0, 1, 0)),
+            callback=callback)
+        self.assertRaises(ValueError, bounce, 0, group)
+
+    def test_Magnet_native_domain(self):
+        from lepton import controller, domain
+        for d in [domain.Sphere((0, 0, 0), 1),
+                  domain.AABox((-1, -1, -1), (1, 1, 1)),
+                  domain.Line((-1, 0, 0), (1, 0, 0))]:
+            self._compare(lambda d: controller.Magnet(d, charge=10, epsilon=0.1, outer_cutoff=2), d)
+
+    def test_Drag_native_domain(self):
+        from lepton import controller, domain
+        self._compare(
+            lambda d: controller.Drag(0.5, 0.1, (1, 0, 0), domain=d),
+            domain.Sphere((0, 0, 0), 1.5))
+
+
+class SoAControllerTest(ControllerTest):
+    """Run the controller tests against struct-of-arrays groups"""
+
+    layout = 'soa'
+
+
+class SoABounceControllerTest(BounceControllerTest):
+
+    layout = 'soa'
+
+
+class SoAMagnetControllerTest(MagnetControllerTest):
+
+    layout = 'soa'
+
+
+class SoANativeDomainControllerTest(NativeDomainControllerTest):
+
+    layout = 'soa'
+
+
 if __name__ == '__main__':
     unittest.main()
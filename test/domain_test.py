@@ -236,6 +236,19 @@ class DomainTest(unittest.TestCase):
             self.assertEqual(
                 box.intersect(start, end), (None, None))
 
+    def test_AABox_closest_point_to(self):
+        from lepton.domain import AABox
+        box = AABox((-3, -1, 0), (-2, 1, 3))
+        for point, closest, normal in [
+                ((-4, 0, 1), (-3, 0, 1), (-1, 0, 0)),
+                ((-2.5, 3, 2), (-2.5, 1, 2), (0, 1, 0)),
+                ((-2.5, 0, -2), (-2.5, 0, 0), (0, 0, -1)),
+                ((-2.5, 0.5, 1), (-2.5, 0.5, 1), (0, 0, 0)),
+        ]:
+            p, N = box.closest_point_to(point)
+            self.assertVector(p, closest)
+            self.assertVector(N, normal)
+
     def test_solid_Sphere_generate_contains(self):
         from lepton.domain import Sphere
         sphere = Sphere((0, 1, 2), 2)
@@ -252,6 +265,612 @@ class DomainTest(unittest.TestCase):
         self.failIf((2.1, 1, 2) in sphere)
         self.failIf((-2.1, 1, 2) in sphere)
 
+    def test_generate_many(self):
+        from array import array
+        from lepton.domain import Sphere, AABox, Cone, seed
+        for domain in (Sphere((0, 1, 2), 2), AABox((0, 0, 0), (1, 2, 3)),
+                       Cone((0, 0, 0), (0, 3, 0), 1)):
+            points = domain.generate_many(10)
+            self.assertEqual(points.shape, (10, 3))
+            for point in points.tolist():
+                self.failUnless(tuple(point) in domain, point)
+            out = array('d', [0.0] * 30)
+            self.failUnless(domain.generate_many(10, out=out) is out)
+            for i in range(10):
+                self.failUnless(tuple(out[i * 3:i * 3 + 3]) in domain)
+        sphere = Sphere((0, 1, 2), 2)
+        seed(5)
+        expected = [sphere.generate() for i in range(3)]
+        seed(5)
+        for point, generated in zip(sphere.generate_many(3).tolist(), expected):
+            self.assertVector(point, generated)
+        self.assertEqual(sphere.generate_many(0).tolist(), [])
+        self.assertRaises(ValueError, sphere.generate_many, 4, array('f', [0.0] * 11))
+        self.assertRaises(TypeError, sphere.generate_many, 1, array('i', [0] * 3))
+
+    def test_point_generate_many(self):
+        from array import array
+        from lepton.domain import Point
+        point = Point((1, 2, 3))
+        self.assertEqual(point.generate_many(2).tolist(), [[1, 2, 3], [1, 2, 3]])
+        out = array('f', [0.0] * 3)
+        self.failUnless(point.generate_many(1, out) is out)
+        self.assertEqual(list(out), [1, 2, 3])
+        self.assertRaises(ValueError, point.generate_many, 2, out)
+
+    def _segments(self, count):
+        import random
+        from array import array
+        rand = random.Random(7)
+        starts = array('f', [rand.uniform(-3, 3) for i in range(count * 3)])
+        ends = array('f', [c + rand.uniform(-2, 2) for c in starts])
+        return starts, ends
+
+    def test_contains_many(self):
+        from lepton.domain import Line, Plane, AABox, Sphere, Disc, Cylinder, Cone
+        points, ends = self._segments(500)
+        for domain in (Line((0, 0, 0), (1, 1, 1)), Plane((0, 1, 0), (0, 1, 1)),
+                       AABox((-1, -1, -1), (1, 2, 1)), Sphere((0, 1, 0), 2, 1),
+                       Disc((0, 0, 0), (0, 1, 0), 2), Cylinder((0, 0, 0), (0, 1, 0), 1),
+                       Cone((0, 0, 0), (0, 2, 0), 2)):
+            expected = [tuple(points[i:i + 3]) in domain for i in range(0, 1500, 3)]
+            self.assertEqual(domain.contains_many(points).tolist(), expected)
+            rows = memoryview(points).cast('B').cast('f', (500, 3))
+            self.assertEqual(domain.contains_many(rows).tolist(), expected)
+
+    def test_contains_many_strided(self):
+        from lepton import ParticleGroup, Particle
+        from lepton.domain import Sphere
+        for layout in ('aos', 'soa'):
+            group = ParticleGroup(layout=layout)
+            for x in range(-2, 3):
+                group.new(Particle(position=(x, 0, 0)))
+            group.update(0)
+            mask = Sphere((0, 0, 0), 1.5).contains_many(group.view('position'))
+            self.assertEqual(mask.tolist(), [False, True, True, True, False])
+
+    def test_intersect_many(self):
+        from lepton.domain import Line, Plane, AABox, Sphere, Disc, Cylinder, Cone
+        starts, ends = self._segments(500)
+        for domain in (Line((0, 0, 0), (1, 1, 1)), Plane((0, 1, 0), (0, 1, 1)),
+                       AABox((-1, -1, -1), (1, 2, 1)), Sphere((0, 1, 0), 2, 1),
+                       Sphere((1, 0, 0), 1.5), Disc((0, 0, 0), (0, 1, 0), 2),
+                       Cylinder((0, 0, 0), (0, 1, 0), 1), Cone((0, 0, 0), (0, 2, 0), 2)):
+            hits, points, normals = domain.intersect_many(starts, ends)
+            self.assertEqual(points.shape, (500, 3))
+            self.assertEqual(normals.shape, (500, 3))
+            hits, points, normals = hits.tolist(), points.tolist(), normals.tolist()
+            for i in range(500):
+                point, normal = domain.intersect(
+                    tuple(starts[i * 3:i * 3 + 3]), tuple(ends[i * 3:i * 3 + 3]))
+                self.assertEqual(hits[i], point is not None, (domain, i))
+                if point is None:
+                    point = normal = (0, 0, 0)
+                self.assertVector(points[i], point)
+                self.assertVector(normals[i], normal)
+
+    def test_query_many_errors(self):
+        from array import array
+        from lepton.domain import AABox
+        box = AABox((0, 0, 0), (1, 1, 1))
+        self.assertEqual(box.contains_many(array('f')).tolist(), [])
+        self.assertEqual([a.tolist() for a in box.intersect_many(array('f'), array('f'))],
+                         [[], [], []])
+        self.assertRaises(TypeError, box.contains_many, array('d', [0.0] * 3))
+        self.assertRaises(ValueError, box.contains_many, array('f', [0.0] * 4))
+        self.assertRaises(ValueError, box.intersect_many,
+                          array('f', [0.0] * 3), array('f', [0.0] * 6))
+
+    def test_point_query_many(self):
+        from array import array
+        from lepton.domain import Point
+        point = Point((1, 2, 3))
+        self.assertEqual(point.contains_many(array('f', [1, 2, 3, 0, 0, 0])).tolist(),
+                         [True, False])
+        hits, points, normals = point.intersect_many(
+            array('f', [0, 0, 0]), array('f', [2, 4, 6]))
+        self.assertEqual(hits.tolist(), [False])
+        self.assertEqual(points.tolist(), [[0, 0, 0]])
+        self.assertRaises(ValueError, point.contains_many, array('f', [0.0] * 2))
+
+    def test_union_contains_generate(self):
+        from lepton.domain import Union, Sphere, AABox
+        union = Union(Sphere((0, 0, 0), 1), AABox((0, -1, -1), (2, 1, 1)))
+        self.failUnless((-0.5, 0, 0) in union)
+        self.failUnless((1.5, 0.5, 0.5) in union)
+        self.failIf((-0.5, 0.9, 0) in union)
+        self.failIf((2.5, 0, 0) in union)
+        right = 0
+        for i in range(1000):
+            point = union.generate()
+            self.failUnless(point in union, point)
+            right += point[0] > 0
+        # The box holds 8 of the 8 + 2/3pi volume, spread evenly
+        self.failUnless(750 < right < 900, right)
+
+    def test_intersection_contains_generate(self):
+        from lepton.domain import Intersection, Sphere, AABox
+        sect = Intersection(Sphere((0, 0, 0), 1), AABox((0, -1, -1), (2, 1, 1)))
+        self.failUnless((0.5, 0, 0) in sect)
+        self.failIf((-0.5, 0, 0) in sect)
+        self.failIf((1.5, 0, 0) in sect)
+        for i in range(1000):
+            point = sect.generate()
+            self.failUnless(point in sect, point)
+
+    def test_difference_contains_generate(self):
+        from lepton.domain import Difference, Sphere, Cylinder
+        diff = Difference(Sphere((0, 0, 0), 1), Cylinder((0, 0, -2), (0, 0, 2), 0.5))
+        self.failUnless((0.75, 0, 0) in diff)
+        self.failIf((0.25, 0, 0) in diff)
+        self.failIf((1.5, 0, 0) in diff)
+        for i in range(1000):
+            point = diff.generate()
+            self.failUnless(point in diff, point)
+
+    def test_composite_intersect(self):
+        from lepton.domain import Union, Intersection, Difference, Sphere, Cylinder
+        a = Sphere((0, 0, 0), 1)
+        b = Sphere((1, 0, 0), 1)
+        for domain, start, end, point, normal in [
+                (Union(a, b), (-3, 0, 0), (3, 0, 0), (-1, 0, 0), (-1, 0, 0)),
+                (Union(a, b), (3, 0, 0), (-3, 0, 0), (2, 0, 0), (1, 0, 0)),
+                (Union(a, b), (0.5, 0, 0), (3, 0, 0), (2, 0, 0), (-1, 0, 0)),
+                (Intersection(a, b), (-3, 0, 0), (3, 0, 0), (0, 0, 0), (-1, 0, 0)),
+                (Intersection(a, b), (3, 0, 0), (-3, 0, 0), (1, 0, 0), (1, 0, 0)),
+                (Difference(a, b), (3, 0, 0), (-3, 0, 0), (0, 0, 0), (1, 0, 0)),
+                (Difference(a, b), (-3, 0, 0), (3, 0, 0), (-1, 0, 0), (-1, 0, 0)),
+                (Difference(Union(a, b), Cylinder((0.5, 0, -2), (0.5, 0, 2), 0.5)),
+                 (0.5, 0, 0), (3, 0, 0), (1, 0, 0), (-1, 0, 0)),
+        ]:
+            p, N = domain.intersect(start, end)
+            self.assertVector(p, point)
+            self.assertVector(N, normal)
+        self.assertEqual(Union(a, b).intersect((-0.5, 0, 0), (1.5, 0, 0)), (None, None))
+        self.assertEqual(Intersection(a, b).intersect((-3, 1, 0), (3, 1, 0)), (None, None))
+
+    def test_composite_intersect_crosses_surface(self):
+        import random
+        from lepton.domain import Union, Intersection, Difference, Sphere, Cylinder
+        a = Sphere((0, 0, 0), 1, 0.5)
+        b = Sphere((1, 0, 0), 0.8)
+        c = Cylinder((0, 0, -2), (0, 0, 2), 0.5)
+        rand = random.Random(3)
+        for domain in (Union(a, b), Intersection(a, b), Difference(a, b),
+                       Difference(Union(a, b), c), Intersection(Union(a, b), c)):
+            for i in range(1000):
+                start = tuple(rand.uniform(-2.5, 2.5) for j in range(3))
+                end = tuple(rand.uniform(-2.5, 2.5) for j in range(3))
+                if (start in domain) != (end in domain):
+                    p, N = domain.intersect(start, end)
+                    self.failIf(p is None, (domain, start, end))
+
+    def test_composite_closest_pt_to(self):
+        from lepton.domain import Union, Intersection, Difference, Sphere, Cylinder
+        a = Sphere((0, 0, 0), 1)
+        b = Sphere((1, 0, 0), 1)
+        for domain, point, closest, normal in [
+                (Union(a, b), (5, 0, 0), (2, 0, 0), (1, 0, 0)),
+                (Union(a, b), (0, 3, 0), (0, 1, 0), (0, 1, 0)),
+                (Union(a, b), (0.5, 0, 0), (0.5, 0, 0), (0, 0, 0)),
+                (Intersection(a, b), (-3, 0, 0), (0, 0, 0), (-1, 0, 0)),
+                (Intersection(a, b), (0.5, 0, 0), (0.5, 0, 0), (0, 0, 0)),
+                (Difference(a, Cylinder((0, 0, -2), (0, 0, 2), 0.5)),
+                 (0.2, 0, 0), (0.5, 0, 0), (-1, 0, 0)),
+                (Difference(a, b), (-3, 0, 0), (-1, 0, 0), (-1, 0, 0)),
+        ]:
+            p, N = domain.closest_point_to(point)
+            self.assertVector(p, closest)
+            self.assertVector(N, normal)
+
+    def test_composite_domains_refit(self):
+        from lepton.domain import Union, Intersection, Sphere, AABox
+        sphere = Sphere((0, 0, 0), 1)
+        box = AABox((2, 2, 2), (3, 3, 3))
+        union = Union(sphere, Intersection(box))
+        self.assertEqual(union.domains[0], sphere)
+        self.failIf((2.5, 2.5, 2.5) in Intersection(sphere, union))
+        self.failIf((5, 0, 0) in union)
+        # Moving a child requires the cached bounds to be updated
+        sphere.center = (5, 0, 0)
+        union.refit()
+        self.failUnless((5, 0, 0) in union)
+        box.min_point = (-3, -3, -3)
+        union.refit()
+        self.failUnless((0, 0, 0) in union)
+
+    def test_composite_errors(self):
+        from lepton.domain import Union, Difference, Sphere, Point
+        self.assertRaises(TypeError, Union)
+        self.assertRaises(TypeError, Union, Sphere((0, 0, 0), 1), Point((0, 0, 0)))
+        self.assertRaises(TypeError, Difference, Sphere((0, 0, 0), 1), None)
+        union = Union(Sphere((0, 0, 0), 1))
+        self.assertRaises(TypeError, union.__init__, union)
+
+    def _assert_uninitialized(self, cls):
+        # Instances made without calling __init__ raise instead of crashing
+        from lepton import ParticleGroup, controller
+        domain = cls.__new__(cls)
+        self.assertRaises(ValueError, lambda: (0, 0, 0) in domain)
+        self.assertRaises(ValueError, domain.generate)
+        self.assertRaises(ValueError, domain.closest_point_to, (0, 0, 0))
+        self.assertRaises(ValueError, domain.intersect, (0, 0, 0), (1, 1, 1))
+        if hasattr(domain, 'generate_many'):
+            self.assertRaises(ValueError, domain.generate_many, 3)
+            self.assertRaises(ValueError, domain.contains_many, [(0, 0, 0)])
+        group = ParticleGroup()
+        group.new(position=(0, 0, 0))
+        group.update(0)
+        self.assertRaises(ValueError, controller.Collector(domain), 0, group)
+        return domain
+
+    def test_composite_uninitialized(self):
+        from lepton.domain import Union, Intersection, Difference
+        for cls in (Union, Intersection, Difference):
+            domain = self._assert_uninitialized(cls)
+            self.assertRaises(ValueError, domain.refit)
+            self.assertEqual(domain.domains, ())
+
+    def test_composite_query_many(self):
+        from lepton.domain import Union, Sphere, Cylinder
+        union = Union(Sphere((0, 0, 0), 1), Cylinder((0, 0, -2), (0, 0, 2), 0.5))
+        points, ends = self._segments(200)
+        mask = union.contains_many(points).tolist()
+        for i in range(200):
+            self.assertEqual(mask[i], tuple(points[i * 3:i * 3 + 3]) in union)
+
+    def test_obstacle_set_uninitialized(self):
+        from lepton.domain import ObstacleSet
+        obstacles = self._assert_uninitialized(ObstacleSet)
+        self.assertRaises(ValueError, obstacles.refit)
+        self.assertEqual(obstacles.obstacles, ())
+        self.assertEqual(len(obstacles), 0)
+
+    def _obstacles(self, count):
+        import random
+        from lepton.domain import AABox, Sphere, Cylinder, Cone, Disc
+        rand = random.Random(5)
+        obstacles = []
+        for i in range(count):
+            x, y, z = [rand.uniform(-20, 20) for j in range(3)]
+            obstacles.append([
+                AABox((x - 1, y - 1, z - 1), (x + 1, y + 2, z + 1)),
+                Sphere((x, y, z), rand.uniform(0.5, 2), rand.uniform(0, 0.4)),
+                Cylinder((x, y, z), (x + 1, y + 2, z), 1),
+                Cone((x, y, z), (x, y + 2, z + 1), 1.5),
+                Disc((x, y, z), (0, 1, 1), 2)][i % 5])
+        return obstacles
+
+    def _nearest_hit(self, obstacles, start, end):
+        best = (None, None)
+        best_t = None
+        seg = [e - s for s, e in zip(start, end)]
+        for obstacle in obstacles:
+            p, N = obstacle.intersect(start, end)
+            if p is None:
+                continue
+            t = sum((c - s) * d for c, s, d in zip(p, start, seg))
+            if t >= 0 and (best_t is None or t < best_t):
+                best, best_t = (p, N), t
+        return best
+
+    def test_obstacle_set_intersect(self):
+        import random
+        from lepton.domain import ObstacleSet
+        obstacles = self._obstacles(200)
+        obstacle_set = ObstacleSet(obstacles)
+        self.assertEqual(len(obstacle_set), 200)
+        self.assertEqual(obstacle_set.obstacles, tuple(obstacles))
+        rand = random.Random(9)
+        hits = 0
+        for i in range(1000):
+            start = tuple(rand.uniform(-25, 25) for j in range(3))
+            end = tuple(c + rand.uniform(-10, 10) for c in start)
+            p, N = obstacle_set.intersect(start, end)
+            expected, normal = self._nearest_hit(obstacles, start, end)
+            if expected is None:
+                self.assertEqual(p, None)
+            else:
+                hits += 1
+                self.assertVector(p, expected)
+                self.assertVector(N, normal)
+        self.failUnless(hits > 50, hits)
+
+    def test_obstacle_set_contains_closest_pt_to(self):
+        import random
+        from lepton.domain import ObstacleSet
+        obstacles = self._obstacles(100)
+        obstacle_set = ObstacleSet(obstacles)
+        rand = random.Random(11)
+        for i in range(500):
+            point = tuple(rand.uniform(-25, 25) for j in range(3))
+            self.assertEqual(point in obstacle_set,
+                any(point in obstacle for obstacle in obstacles))
+            p, N = obstacle_set.closest_point_to(point)
+            dists = [sum((c - q) ** 2 for c, q in zip(
+                obstacle.closest_point_to(point)[0], point))
+                for obstacle in obstacles]
+            self.assertAlmostEqual(
+                sum((c - q) ** 2 for c, q in zip(p, point)), min(dists), 3)
+        for i in range(500):
+            point = obstacle_set.generate()
+            self.failUnless(point in obstacle_set, point)
+
+    def test_obstacle_set_refit(self):
+        from lepton.domain import ObstacleSet, Sphere, AABox
+        spheres = [Sphere((x * 3, 0, 0), 1) for x in range(20)]
+        box = AABox((-1, 5, -1), (1, 6, 1))
+        obstacle_set = ObstacleSet(spheres + [box])
+        self.failIf((30, 10, 0) in obstacle_set)
+        spheres[7].center = (30, 10, 0)
+        box.max_point = (1, 8, 1)
+        obstacle_set.refit()
+        self.failUnless((30, 10, 0) in obstacle_set)
+        self.failIf((21, 0, 0) in obstacle_set)
+        p, N = obstacle_set.intersect((0, 10, 0), (0, 0, 0))
+        self.assertVector(p, (0, 8, 0))
+        self.assertVector(N, (0, 1, 0))
+
+    def test_obstacle_set_errors(self):
+        from lepton.domain import ObstacleSet, Sphere, Plane, Point
+        self.assertRaises(ValueError, ObstacleSet, [])
+        self.assertRaises(TypeError, ObstacleSet, [Plane((0, 0, 0), (0, 1, 0))])
+        self.assertRaises(TypeError, ObstacleSet, [Point((0, 0, 0))])
+        self.assertRaises(TypeError, ObstacleSet, None)
+        obstacle_set = ObstacleSet([Sphere((0, 0, 0), 1)])
+        self.assertRaises(TypeError, obstacle_set.__init__, [obstacle_set])
+
+    def _sphere_mesh(self, rings=12, segments=16):
+        vertices = [(0, 1, 0), (0, -1, 0)]
+        for i in range(1, rings):
+            a = math.pi * i / rings
+            for j in range(segments):
+                b = 2 * math.pi * j / segments
+                vertices.append((math.sin(a) * math.cos(b), math.cos(a),
+                                 math.sin(a) * math.sin(b)))
+        def ring(i, j):
+            return 2 + (i - 1) * segments + j % segments
+        triangles = []
+        for j in range(segments):
+            triangles.append((0, ring(1, j), ring(1, j + 1)))
+            triangles.append((1, ring(rings - 1, j + 1), ring(rings - 1, j)))
+            for i in range(1, rings - 1):
+                triangles.append((ring(i, j), ring(i + 1, j), ring(i + 1, j + 1)))
+                triangles.append((ring(i, j), ring(i + 1, j + 1), ring(i, j + 1)))
+        return vertices, triangles
+
+    def test_triangle_mesh_cube(self):
+        from lepton.domain import TriangleMesh
+        vertices = [(x, y, z) for x in (0, 1) for y in (0, 1) for z in (0, 1)]
+        triangles = [
+            (0, 2, 3), (0, 3, 1), (4, 6, 7), (4, 7, 5), (0, 4, 5), (0, 5, 1),
+            (2, 6, 7), (2, 7, 3), (0, 4, 6), (0, 6, 2), (1, 5, 7), (1, 7, 3)]
+        cube = TriangleMesh(vertices, triangles)
+        self.assertEqual(len(cube), 12)
+        self.assertEqual(cube.vertex_count, 8)
+        self.assertAlmostEqual(cube.area, 6.0, 5)
+        self.failUnless((0.5, 0.5, 0) in cube)
+        self.failUnless((1, 0.25, 0.75) in cube)
+        self.failIf((0.5, 0.5, 0.5) in cube)
+        for start, end, point, normal in [
+                ((0.5, 0.5, -1), (0.5, 0.5, 2), (0.5, 0.5, 0), (0, 0, -1)),
+                ((0.5, 0.5, 0.5), (0.5, 0.5, 2), (0.5, 0.5, 1), (0, 0, -1)),
+                ((3, 0.25, 0.5), (-3, 0.25, 0.5), (1, 0.25, 0.5), (1, 0, 0))]:
+            p, N = cube.intersect(start, end)
+            self.assertVector(p, point)
+            self.assertVector(N, normal)
+        self.assertEqual(cube.intersect((2, 2, 2), (3, 3, 3)), (None, None))
+        self.assertEqual(cube.intersect((0.2, 0.2, 0.2), (0.8, 0.8, 0.8)),
+            (None, None))
+        for point, closest, normal in [
+                ((0.5, 0.5, 3), (0.5, 0.5, 1), (0, 0, 1)),
+                ((0.5, 0.4, 0.5), (0.5, 0, 0.5), (0, 1, 0)),
+                ((0.25, 0.5, 0.5), (0, 0.5, 0.5), (1, 0, 0)),
+                ((0.5, 0.5, 0), (0.5, 0.5, 0), (0, 0, 0))]:
+            p, N = cube.closest_point_to(point)
+            self.assertVector(p, closest)
+            self.assertVector(N, normal)
+
+    def test_triangle_mesh_matches_triangles(self):
+        import random
+        from lepton.domain import TriangleMesh
+        vertices, triangles = self._sphere_mesh()
+        mesh = TriangleMesh(vertices, triangles)
+        singles = [TriangleMesh(vertices, [t]) for t in triangles]
+        self.assertAlmostEqual(mesh.area, sum(t.area for t in singles), 4)
+        rand = random.Random(13)
+        for i in range(300):
+            start = tuple(rand.uniform(-2, 2) for j in range(3))
+            end = tuple(rand.uniform(-2, 2) for j in range(3))
+            p, N = mesh.intersect(start, end)
+            hits = [t.intersect(start, end) for t in singles]
+            hits = [h for h in hits if h[0] is not None]
+            if not hits:
+                self.assertEqual(p, None)
+                continue
+            dist = lambda h: sum((c - s) ** 2 for c, s in zip(h[0], start))
+            self.assertVector(p, min(hits, key=dist)[0])
+            q, N = mesh.closest_point_to(start)
+            closest = min([t.closest_point_to(start) for t in singles], key=dist)
+            self.assertAlmostEqual(dist((q,)), dist(closest), 4)
+
+    def test_triangle_mesh_generate(self):
+        from array import array
+        from lepton.domain import TriangleMesh
+        # Two triangles, the second with three times the area
+        mesh = TriangleMesh(array('f', [0, 0, 0, 1, 0, 0, 0, 1, 0,
+                                        0, 0, 5, 3, 0, 5, 0, 1, 5]),
+                            array('i', [0, 1, 2, 3, 4, 5]))
+        on_second = 0
+        for i in range(2000):
+            point = mesh.generate()
+            self.failUnless(point in mesh, point)
+            on_second += point[2] > 1
+        self.failUnless(1400 < on_second < 1600, on_second)
+
+    def test_triangle_mesh_update_vertices(self):
+        from lepton.domain import TriangleMesh
+        vertices, triangles = self._sphere_mesh()
+        mesh = TriangleMesh(vertices, triangles)
+        self.assertVector(mesh.intersect((0, 5, 0), (0, 0, 0))[0], (0, 1, 0))
+        mesh.update_vertices([(x * 2, y * 2 + 10, z * 2) for x, y, z in vertices])
+        self.assertVector(mesh.intersect((0, 15, 0), (0, 0, 0))[0], (0, 12, 0))
+        self.assertEqual(mesh.intersect((0, 5, 0), (0, 0, 0)), (None, None))
+        self.assertRaises(ValueError, mesh.update_vertices, vertices[:-1])
+
+    def test_triangle_mesh_errors(self):
+        from lepton.domain import TriangleMesh
+        vertices = [(0, 0, 0), (1, 0, 0), (0, 1, 0)]
+        self.assertRaises(ValueError, TriangleMesh, vertices, [])
+        self.assertRaises(ValueError, TriangleMesh, vertices, [0, 1])
+        self.assertRaises(ValueError, TriangleMesh, vertices, [(0, 1)])
+        self.assertRaises(IndexError, TriangleMesh, vertices, [0, 1, 3])
+        self.assertRaises(IndexError, TriangleMesh, vertices, [(0, -1, 2)])
+        self.assertRaises(TypeError, TriangleMesh, [(0, 0)], [0, 0, 0])
+        self.assertRaises(TypeError, TriangleMesh, vertices, [0, 1, 'a'])
+        mesh = TriangleMesh(vertices, [0, 1, 2])
+        self.assertRaises(TypeError, mesh.__init__, vertices, [0, 1, 2])
+
+    def test_triangle_mesh_uninitialized(self):
+        from lepton.domain import TriangleMesh
+        mesh = self._assert_uninitialized(TriangleMesh)
+        self.assertRaises(ValueError, mesh.update_vertices, [(0, 0, 0)])
+        self.assertEqual(len(mesh), 0)
+        self.assertEqual(mesh.area, 0)
+
+    def _sphere_sdf(self, radius=1.2, n=33, cell=0.125):
+        from array import array
+        o = -(n - 1) * cell / 2
+        return array('f', [
+            math.sqrt((o + i * cell) ** 2 + (o + j * cell) ** 2 + (o + k * cell) ** 2)
+            - radius for i in range(n) for j in range(n) for k in range(n)])
+
+    def test_sdf_volume_sphere(self):
+        import random
+        from lepton.domain import SDFVolume, Sphere
+        volume = SDFVolume(self._sphere_sdf(), (-2, -2, -2), 0.125, (33, 33, 33))
+        self.assertEqual(volume.shape, (33, 33, 33))
+        self.assertEqual(tuple(volume.origin), (-2, -2, -2))
+        self.assertEqual(volume.cell_size, 0.125)
+        sphere = Sphere((0, 0, 0), 1.2)
+        rand = random.Random(3)
+        for i in range(500):
+            point = tuple(rand.uniform(-2.5, 2.5) for j in range(3))
+            if abs(math.sqrt(sum(c * c for c in point)) - 1.2) > 0.01:
+                self.assertEqual(point in volume, point in sphere, point)
+            if point in sphere or max(abs(c) for c in point) > 2:
+                continue
+            p, N = volume.closest_point_to(point)
+            q, M = sphere.closest_point_to(point)
+            self.assertVector(p, q, 0.02)
+            self.assertVector(N, M, 0.02)
+        for i in range(500):
+            point = volume.generate()
+            self.failUnless(point in volume, point)
+        self.assertEqual(volume.closest_point_to((0.5, 0, 0)),
+            ((0.5, 0, 0), (0, 0, 0)))
+
+    def test_sdf_volume_intersect(self):
+        from lepton.domain import SDFVolume
+        volume = SDFVolume(self._sphere_sdf(), (-2, -2, -2), 0.125, (33, 33, 33))
+        for start, end, point, normal in [
+                ((-3, 0, 0), (3, 0, 0), (-1.2, 0, 0), (-1, 0, 0)),
+                ((0, 3, 0), (0, -3, 0), (0, 1.2, 0), (0, 1, 0)),
+                ((0, 0, 0), (0, 0, 3), (0, 0, 1.2), (0, 0, -1)),
+                ((1, 1, 1), (0, 0, 0), (0.69, 0.69, 0.69),
+                 (0.57735, 0.57735, 0.57735))]:
+            p, N = volume.intersect(start, end)
+            self.assertVector(p, point, 0.01)
+            self.assertVector(N, normal, 0.01)
+        self.assertEqual(volume.intersect((-3, 1.5, 0), (3, 1.5, 0)), (None, None))
+        self.assertEqual(volume.intersect((-3, 0, 0), (-1.5, 0, 0)), (None, None))
+        self.assertEqual(volume.intersect((0, 0, 0), (0.5, 0, 0)), (None, None))
+        self.assertEqual(volume.intersect((-3, 5, 0), (3, 5, 0)), (None, None))
+
+    def test_sdf_volume_grid_faces(self):
+        from array import array
+        from lepton.domain import SDFVolume
+        # Everything inside, so the grid's faces are the surface
+        volume = SDFVolume(array('f', [-1] * 8), (0, 0, 0), 2.0, (2, 2, 2))
+        self.failUnless((1, 1, 1) in volume)
+        self.failIf((3, 1, 1) in volume)
+        p, N = volume.intersect((5, 1, 1), (1, 1, 1))
+        self.assertVector(p, (2, 1, 1))
+        self.assertVector(N, (1, 0, 0))
+        p, N = volume.intersect((1, 1, 1), (1, -5, 1))
+        self.assertVector(p, (1, 0, 1))
+        self.assertVector(N, (0, 1, 0))
+        # Moving the grid moves the volume
+        volume.origin = (10, 0, 0)
+        self.failUnless((11, 1, 1) in volume)
+        self.failIf((1, 1, 1) in volume)
+
+    def test_sdf_volume_refit(self):
+        from array import array
+        from lepton.domain import SDFVolume
+        distances = array('f', [1] * 27)
+        volume = SDFVolume(distances, (0, 0, 0), 1.0, (3, 3, 3))
+        self.failIf((1, 1, 1) in volume)
+        distances[13] = -1
+        self.failUnless((1, 1, 1) in volume)
+        volume.refit()
+        for i in range(100):
+            x, y, z = volume.generate()
+            self.failUnless(0 <= x <= 2 and 0 <= y <= 2 and 0 <= z <= 2)
+
+    def test_load_sdf(self):
+        import os
+        import tempfile
+        from lepton.domain import load_sdf, Sphere
+        distances = self._sphere_sdf(n=17, cell=0.25)
+        fd, filename = tempfile.mkstemp()
+        try:
+            with os.fdopen(fd, 'wb') as f:
+                f.write(b'head')
+                distances.tofile(f)
+            volume = load_sdf(filename, (17, 17, 17), (-2, -2, -2), 0.25, offset=4)
+            self.assertEqual(volume.shape, (17, 17, 17))
+            self.failUnless((0, 0, 0) in volume)
+            self.failIf((1.5, 0, 0) in volume)
+            p, N = volume.intersect((-3, 0, 0), (0, 0, 0))
+            self.assertVector(p, (-1.2, 0, 0), 0.01)
+            self.assertRaises(ValueError, load_sdf, filename, (18, 17, 17))
+            del volume
+        finally:
+            os.remove(filename)
+
+    def test_sdf_volume_errors(self):
+        from array import array
+        from lepton.domain import SDFVolume
+        self.assertRaises(ValueError, SDFVolume, array('f', [0] * 8))
+        self.assertRaises(ValueError, SDFVolume, array('f', [0] * 8), shape=(2, 2, 3))
+        self.assertRaises(ValueError, SDFVolume, array('f', [0] * 4), shape=(1, 2, 2))
+        self.assertRaises(ValueError, SDFVolume, array('f', [0] * 8),
+            cell_size=0, shape=(2, 2, 2))
+        self.assertRaises(TypeError, SDFVolume, array('d', [0] * 8), shape=(2, 2, 2))
+        self.assertRaises(TypeError, SDFVolume, None)
+        volume = SDFVolume(array('f', [0] * 8), shape=(2, 2, 2))
+        self.assertRaises(TypeError, volume.__init__, array('f', [0] * 8),
+            shape=(2, 2, 2))
+
+    def test_sdf_volume_uninitialized(self):
+        from array import array
+        from lepton.domain import SDFVolume
+        volume = self._assert_uninitialized(SDFVolume)
+        self.assertRaises(ValueError, volume.refit)
+        # As is one whose __init__ failed
+        self.assertRaises(ValueError, volume.__init__, array('f', [0] * 8),
+            shape=(2, 2, 3))
+        self.assertRaises(ValueError, volume.generate)
+
+    def test_seed_generate(self):
+        from lepton.domain import Sphere, seed
+        sphere = Sphere((0, 1, 2), 2)
+        seed(5)
+        expected = [sphere.generate() for i in range(10)]
+        seed(5)
+        self.assertEqual([sphere.generate() for i in range(10)], expected)
+
     def test_shell_Sphere_generate_contains(self):
         from lepton.domain import Sphere
         sphere = Sphere((1, -2, 4), 3, 2)
@@ -72,6 +72,9 @@ class StaticEmitterTest(EmitterTestBase, unittest.TestCase):
         self.assertVector(particle.position, (1, 1, 1))
         self.assertVector(particle.velocity, (0, 5, 2))
         self.assertColor(particle.color, (0.5, 0.5, 0.5, 1.0))
+        self.assertVector(emitter.template.position, (1, 1, 1))
+        emitter.template.velocity = (1, 2, 3)
+        self.assertVector(emitter.template.velocity, (1, 2, 3))
 
     def test_StaticEmitter_invalid_rate(self):
         from lepton import Particle, ParticleGroup
@@ -188,6 +191,39 @@ class StaticEmitterTest(EmitterTestBase, unittest.TestCase):
         group.update(0)
         self.assertEqual(len(group), 10)
 
+    def test_StaticEmitter_emit_burst(self):
+        from lepton import Particle, ParticleGroup
+        from lepton.emitter import StaticEmitter
+
+        emitter = StaticEmitter(template=Particle(position=(1, 2, 3)))
+        group = ParticleGroup()
+        emitter.emit(10000, group)
+        # The slots for the burst are allocated at once
+        self.assertEqual(group.capacity, 10000)
+        group.update(0)
+        self.assertEqual(len(group), 10000)
+        for p in group:
+            self.assertVector(p.position, (1, 2, 3))
+
+    def test_StaticEmitter_emit_failure(self):
+        from lepton import ParticleGroup
+        from lepton.emitter import StaticEmitter
+
+        class Domain:
+            count = 0
+            def generate(self):
+                self.count += 1
+                if self.count > 3:
+                    raise RuntimeError()
+                return (1, 1, 1)
+
+        emitter = StaticEmitter(position=Domain())
+        group = ParticleGroup()
+        self.assertRaises(RuntimeError, emitter.emit, 10, group)
+        group.update(0)
+        self.assertEqual(len(group), 3)
+        self.assertEqual(group.killed_count(), 0)
+
     def test_StaticEmitter_discrete(self):
         from lepton import Particle, ParticleGroup
         from lepton.emitter import StaticEmitter
@@ -234,6 +270,55 @@ class StaticEmitterTest(EmitterTestBase, unittest.TestCase):
         for particle in group:
             self.assertVector(particle.position, expected)
 
+    def _seeded_particles(self, emitter, count=20):
+        from lepton import ParticleGroup
+        group = ParticleGroup()
+        emitter(count, group)
+        group.update(0)
+        return [(tuple(p.position), tuple(p.velocity), tuple(p.color), p.mass)
+            for p in group]
+
+    def test_StaticEmitter_seed(self):
+        from lepton import Particle
+        from lepton.emitter import StaticEmitter
+
+        def make(seed):
+            return StaticEmitter(rate=1, seed=seed,
+                template=Particle(position=(1, 2, 3), color=(0.5, 0.5, 0.5, 1)),
+                deviation=Particle(position=(1, 1, 1), color=(0.2, 0.2, 0.2, 0)),
+                mass=(1.0, 2.0, 3.0, 4.0), velocity=((1, 0, 0), (0, 1, 0)))
+        expected = self._seeded_particles(make(42))
+        self.assertEqual(self._seeded_particles(make(42)), expected)
+        self.assertNotEqual(self._seeded_particles(make(43)), expected)
+        emitter = make(7)
+        self._seeded_particles(emitter)
+        emitter.seed(42)
+        self.assertEqual(self._seeded_particles(emitter), expected)
+
+    def test_StaticEmitter_native_domain(self):
+        from lepton import ParticleGroup
+        from lepton.domain import Sphere, AABox
+        from lepton.emitter import StaticEmitter
+
+        sphere = Sphere((1, 2, 3), 2)
+        box = AABox((0, 0, 0), (0.5, 0.5, 0.5))
+        emitter = StaticEmitter(
+            rate=1, seed=3, position=sphere, velocity=box, color=box)
+        group = ParticleGroup()
+        emitter(50, group)
+        group.update(0)
+        self.assertEqual(len(group), 50)
+        for particle in group:
+            self.failUnless(tuple(particle.position) in sphere)
+            self.failUnless(tuple(particle.velocity) in box)
+            self.failUnless(tuple(particle.color)[:3] in box)
+            self.assertEqual(particle.color[3], 1.0)
+        # Native domains draw from the emitter's stream
+        expected = self._seeded_particles(emitter)
+        emitter.seed(3)
+        emitter(50, ParticleGroup())
+        self.assertEqual(self._seeded_particles(emitter), expected)
+
 
 class PerParticleEmitterTest(EmitterTestBase, unittest.TestCase):
 
@@ -298,6 +383,21 @@ class PerParticleEmitterTest(EmitterTestBase, unittest.TestCase):
         group.update(0)
         self.assertEqual(len(group), expected)
 
+    def test_PerParticleEmitter_emit_into_source(self):
+        from lepton import ParticleGroup
+        from lepton.emitter import PerParticleEmitter
+
+        group = ParticleGroup()
+        for i in range(50):
+            group.new(position=(i, 0, 0))
+        group.update(0)
+        emitter = PerParticleEmitter(group)
+        emitter.emit(3, group)
+        group.update(0)
+        self.assertEqual(len(group), 200)
+        positions = sorted(p.position.x for p in group)
+        self.assertEqual(positions, sorted(list(range(50)) * 4))
+
     def test_PerParticleEmitter_emit_empty_source(self):
         from lepton import ParticleGroup
         from lepton.emitter import PerParticleEmitter
@@ -353,5 +453,47 @@ class PerParticleEmitterTest(EmitterTestBase, unittest.TestCase):
         group.update(0)
         self.assertEqual(len(group), len(source_group))
 
+class RandomFillTest(unittest.TestCase):
+
+    def _mean_var(self, values):
+        mean = sum(values) / len(values)
+        return mean, sum((v - mean) ** 2 for v in values) / len(values)
+
+    def test_fill_uniform(self):
+        from array import array
+        from lepton.emitter import fill_uniform
+        out = array('f', [0.0] * 1001)
+        fill_uniform(out)
+        self.failUnless(min(out) > 0 and max(out) <= 1.0)
+        mean, var = self._mean_var(out)
+        self.assertAlmostEqual(mean, 0.5, 1)
+        self.assertAlmostEqual(var, 1.0 / 12.0, 1)
+
+    def test_fill_normal(self):
+        from array import array
+        from lepton.emitter import fill_normal
+        out = array('f', [0.0] * 2001)
+        fill_normal(out, 3.0, sigma=2.0)
+        mean, var = self._mean_var(out)
+        self.failUnless(abs(mean - 3.0) < 0.2, mean)
+        self.failUnless(abs(math.sqrt(var) - 2.0) < 0.2, var)
+
+    def test_fill_exponential(self):
+        from array import array
+        from lepton.emitter import fill_exponential
+        out = array('f', [0.0] * 2000)
+        fill_exponential(out, mu=2.0)
+        self.failUnless(min(out) >= 0)
+        mean, var = self._mean_var(out)
+        self.failUnless(abs(mean - 2.0) < 0.2, mean)
+
+    def test_fill_invalid_buffer(self):
+        from array import array
+        from lepton.emitter import fill_uniform, fill_normal
+        self.assertRaises(TypeError, fill_uniform, array('d', [0.0] * 4))
+        self.assertRaises(BufferError, fill_normal, b'1234')
+        self.assertRaises(TypeError, fill_uniform, None)
+
+
 if __name__ == '__main__':
     unittest.main()
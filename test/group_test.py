@@ -378,6 +378,547 @@ class GroupTest(unittest.TestCase):
         self.failUnless(ctrl2.group is group)
         self.assertAlmostEqual(ctrl2.time_delta, 0.33)
 
+    def test_update_native_controllers(self):
+        from lepton import ParticleGroup, ParticleSystem
+        from lepton import controller
+        velocities = []
+        def record(td, group):
+            velocities.append(list(group)[0].velocity.x)
+        gravity = controller.Gravity((1, 0, 0))
+        self.assertTrue(hasattr(controller.Gravity, '_native_controller'))
+        system = ParticleSystem((gravity, record))
+        group = ParticleGroup(system=system, controllers=(record, gravity))
+        group.new(velocity=(0, 0, 0))
+        group.update(1)
+        self.assertEqual(velocities, [1, 1])
+        # Changing either controller tuple is seen at the next update
+        group.unbind_controller(gravity)
+        system.add_global_controller(controller.Gravity((10, 0, 0)))
+        del velocities[:]
+        group.update(1)
+        self.assertEqual(velocities, [3, 13])
+        group.bind_controller(controller.Gravity((-100, 0, 0)))
+        group.update(1)
+        self.assertEqual(list(group)[0].velocity.x, -76)
+
+    def test_update_with_threads(self):
+        import threading
+        from lepton import ParticleGroup, controller
+        group = ParticleGroup(controllers=(
+            controller.Gravity((0, -1, 0)), controller.Movement()))
+        group.reserve(20000)
+        for i in range(20000):
+            group.new(position=(i, 0, 0))
+        group.update(0)
+        added = [0]
+        stop = []
+        def add_particles():
+            while not stop:
+                group.new(velocity=(1, 0, 0))
+                added[0] += 1
+        thread = threading.Thread(target=add_particles)
+        thread.start()
+        try:
+            for i in range(20):
+                group.update(0.01)
+        finally:
+            stop.append(True)
+            thread.join()
+        group.update(0)
+        self.assertEqual(len(group), 20000 + added[0])
+
+    def _kernel_update(self, layout):
+        from lepton import ParticleGroup, controller
+        group = ParticleGroup(layout=layout, controllers=(
+            controller.Gravity((0, -1, 0)), controller.Movement(),
+            controller.Lifetime(0.35), controller.Drag(0.1),
+            controller.Fader(fade_out_start=0.1, fade_out_end=0.4)))
+        for i in range(5000):
+            group.new(position=(i, 0, 0), velocity=(i % 7, 1, 0),
+                age=(i % 11) * 0.01, color=(1, 1, 1, 1), mass=1)
+        for i in range(30):
+            group.update(0.02)
+            if i % 10 == 0:
+                group.new(position=(i, i, i), color=(1, 1, 1, 1), mass=1)
+        return [group.get_attribute(name).tolist()
+            for name in ('position', 'velocity', 'color', 'age')]
+
+    def test_update_kernel_threads(self):
+        from lepton import group
+        self.assertEqual(group.get_kernel_threads(), (1, 16384))
+        serial = [self._kernel_update(layout) for layout in ('aos', 'soa')]
+        group.set_kernel_threads(4, min_chunk=64)
+        try:
+            self.assertEqual(group.get_kernel_threads(), (4, 64))
+            parallel = [self._kernel_update(layout) for layout in ('aos', 'soa')]
+        finally:
+            group.set_kernel_threads(1)
+        self.assertEqual(parallel, serial)
+        self.assertRaises(ValueError, group.set_kernel_threads, 0)
+        self.assertRaises(ValueError, group.set_kernel_threads, 2, 0)
+
+    def test_reserve(self):
+        from lepton import ParticleGroup
+        group = ParticleGroup()
+        self.assertEqual(group.capacity, 100)
+        group.reserve(5000)
+        self.assertEqual(group.capacity, 5000)
+        group.reserve(10)
+        self.assertEqual(group.capacity, 5000)
+        self.assertRaises(ValueError, group.reserve, -1)
+        for i in range(5000):
+            group.new(position=(i, 0, 0))
+        self.assertEqual(group.capacity, 5000)
+        group.update(0)
+        self.assertEqual(len(group), 5000)
+
+    def test_shrink_to_fit(self):
+        from lepton import ParticleGroup
+        group = ParticleGroup()
+        for i in range(1000):
+            group.new(mass=i)
+        group.update(0)
+        for p in group:
+            if p.mass >= 500:
+                group.kill(p)
+        group.update(0)
+        self.assertTrue(group.capacity >= 1000)
+        group.shrink_to_fit()
+        self.assertEqual(group.capacity, 500)
+        self.assertEqual(sorted(p.mass for p in group), list(range(500)))
+        group.new(mass=500)
+        group.update(0)
+        self.assertEqual(len(group), 501)
+        for p in group:
+            group.kill(p)
+        group.update(0)
+        group.shrink_to_fit()
+        self.assertEqual(group.capacity, 100)
+
+    def test_paged_storage(self):
+        from lepton import ParticleGroup
+        self.assertEqual(ParticleGroup().max_particles, None)
+        self.assertRaises(ValueError, ParticleGroup, max_particles=0)
+        for layout in ('aos', 'soa'):
+            group = ParticleGroup(max_particles=5000, layout=layout)
+            self.assertEqual(group.max_particles, 5000)
+            for i in range(4000):
+                group.new(position=(i, 0, 0), mass=i)
+            group.update(0)
+            group.reserve(5000)
+            self.assertEqual(group.capacity, 5000)
+            for i in range(4000, 5000):
+                group.new(position=(i, 0, 0), mass=i)
+            self.assertRaises(MemoryError, group.new, mass=5000)
+            self.assertRaises(MemoryError, group.reserve, 5001)
+            group.update(0)
+            self.assertEqual(len(group), 5000)
+            for i, p in enumerate(group):
+                self.assertEqual(p.mass, i)
+                if i >= 10:
+                    group.kill(p)
+            group.update(0)
+            group.shrink_to_fit()
+            self.assertEqual(group.capacity, 100)
+            self.assertEqual([p.mass for p in group], list(range(10)))
+            self.assertEqual(
+                [p.position.x for p in group], list(range(10)))
+
+    def test_paged_storage_small(self):
+        from lepton import ParticleGroup
+        group = ParticleGroup(max_particles=10)
+        self.assertEqual(group.capacity, 10)
+        for i in range(10):
+            group.new(mass=i)
+        self.assertRaises(MemoryError, group.new, mass=10)
+        group.update(0)
+        self.assertEqual(len(group), 10)
+
+    def _fragmented_group(self, **kw):
+        from lepton import ParticleGroup
+        group = ParticleGroup(**kw)
+        for i in range(100):
+            group.new(mass=i)
+        group.update(0)
+        for p in group:
+            if p.mass % 4 != 0:
+                group.kill(p)
+        return group
+
+    def test_fragmentation(self):
+        from lepton import ParticleGroup
+        self.assertEqual(ParticleGroup().fragmentation(), 0.0)
+        group = self._fragmented_group()
+        self.assertEqual(group.compaction, 'lazy')
+        self.assertEqual(group.killed_count(), 75)
+        self.assertAlmostEqual(group.fragmentation(), 0.75)
+        group.update(0)
+        # Only the trailing killed particles are reclaimed
+        self.assertEqual(group.killed_count(), 72)
+        self.assertAlmostEqual(group.fragmentation(), 72.0 / 97.0)
+
+    def test_compaction_always(self):
+        for preserve_order in (True, False):
+            group = self._fragmented_group(
+                compaction='always', preserve_order=preserve_order)
+            self.assertEqual(group.preserve_order, preserve_order)
+            group.update(0)
+            self.assertEqual(group.killed_count(), 0)
+            self.assertEqual(group.fragmentation(), 0.0)
+            self.assertEqual(len(group), 25)
+            masses = [p.mass for p in group]
+            if preserve_order:
+                self.assertEqual(masses, list(range(0, 100, 4)))
+            else:
+                self.assertEqual(sorted(masses), list(range(0, 100, 4)))
+
+    def test_compaction_threshold(self):
+        group = self._fragmented_group(
+            compaction='threshold', compaction_threshold=0.8)
+        self.assertAlmostEqual(group.compaction_threshold, 0.8)
+        group.update(0)
+        self.assertEqual(group.killed_count(), 72)
+        group.compaction_threshold = 0.5
+        group.update(0)
+        self.assertEqual(group.killed_count(), 0)
+        self.assertEqual([p.mass for p in group], list(range(0, 100, 4)))
+
+    def test_compaction_invalid(self):
+        from lepton import ParticleGroup
+        self.assertRaises(ValueError, ParticleGroup, compaction='eager')
+        self.assertRaises(ValueError, ParticleGroup, compaction_threshold=-1)
+        group = ParticleGroup()
+        group.compaction = 'always'
+        self.assertEqual(group.compaction, 'always')
+        def set_compaction():
+            group.compaction = 'sometimes'
+        self.assertRaises(ValueError, set_compaction)
+
+    def test_view(self):
+        from lepton import ParticleGroup
+        for layout in ('aos', 'soa'):
+            group = ParticleGroup(layout=layout)
+            for i in range(5):
+                group.new(position=(i, i * 2, 3), color=(i, 0, 0), mass=i)
+            group.update(0)
+            position = group.view('position')
+            self.assertEqual(position.shape, (5, 3))
+            self.assertEqual(position.format, 'f')
+            self.assertFalse(position.readonly)
+            self.assertEqual(position.tolist(),
+                [[i, i * 2, 3] for i in range(5)])
+            self.assertEqual(group.view('color').shape, (5, 4))
+            mass = group.view('mass')
+            self.assertEqual(mass.shape, (5,))
+            self.assertEqual(mass.tolist(), list(range(5)))
+            # Views write through to the particles
+            position[1, 2] = 7.5
+            mass[4] = 10
+            particles = list(group)
+            self.assertEqual(tuple(particles[1].position), (1, 2, 7.5))
+            self.assertEqual(particles[4].mass, 10)
+            self.assertRaises(ValueError, group.view, 'spin')
+
+    def test_view_unstored_attribute(self):
+        from lepton import ParticleGroup
+        group = ParticleGroup(attributes=('position',))
+        self.assertRaises(ValueError, group.view, 'velocity')
+
+    def test_view_prevents_resize(self):
+        from lepton import ParticleGroup
+        group = ParticleGroup()
+        group.reserve(10)
+        view = group.view('position')
+        for i in range(group.capacity):
+            group.new()
+        self.assertRaises(BufferError, group.new)
+        self.assertRaises(BufferError, group.reserve, 1000)
+        view.release()
+        group.new()
+        # Paged storage does not move, so it may grow while viewed
+        group = ParticleGroup(max_particles=1000)
+        view = group.view('age')
+        for i in range(500):
+            group.new()
+        self.assertTrue(group.capacity >= 500)
+
+    def test_view_prevents_paged_shrink(self):
+        from lepton import ParticleGroup
+        from lepton.domain import Sphere
+        group = ParticleGroup(max_particles=200000, compaction='always')
+        for i in range(100000):
+            group.new(position=(5, 0, 0) if i < 10 else (0, 0, 0))
+        group.update(0)
+        view = group.view('position')
+        group.kill_where(Sphere((0, 0, 0), 1))
+        group.update(0)
+        self.assertEqual(len(group), 10)
+        capacity = group.capacity
+        # Decommitting pages the view covers would leave it dangling
+        self.assertRaises(BufferError, group.shrink_to_fit)
+        self.assertEqual(group.capacity, capacity)
+        view[99000, 0]
+        view.release()
+        group.shrink_to_fit()
+        self.assertTrue(group.capacity < capacity)
+
+    def test_get_attribute(self):
+        from array import array
+        from lepton import ParticleGroup
+        for layout in ('aos', 'soa'):
+            group = ParticleGroup(layout=layout)
+            self.assertEqual(len(group.get_attribute('position')), 0)
+            for i in range(6):
+                group.new(position=(i, i * 2, 3), mass=i)
+            group.update(0)
+            group.kill(list(group)[2])
+            positions = group.get_attribute('position')
+            self.assertEqual(positions.shape, (5, 3))
+            self.assertEqual(positions.tolist(),
+                [[i, i * 2, 3] for i in (0, 1, 3, 4, 5)])
+            self.assertEqual(group.get_attribute('mass').tolist(), [0, 1, 3, 4, 5])
+            self.assertEqual(
+                len(group.get_attribute('mass', alive_only=False)), 6)
+            out = array('d', [0] * 20)
+            self.assertTrue(group.get_attribute('color', out=out) is out)
+            out = array('f', [0] * 5)
+            group.get_attribute('mass', out)
+            self.assertEqual(list(out), [0, 1, 3, 4, 5])
+            self.assertRaises(ValueError, group.get_attribute, 'position', out)
+            self.assertRaises(TypeError, group.get_attribute, 'mass',
+                out=array('i', [0] * 5))
+            self.assertRaises(ValueError, group.get_attribute, 'spin')
+
+    def test_set_attribute(self):
+        from array import array
+        from lepton import ParticleGroup
+        for layout in ('aos', 'soa'):
+            group = ParticleGroup(layout=layout)
+            for i in range(4):
+                group.new(mass=i)
+            group.update(0)
+            group.set_attribute('position', array('f', range(12)))
+            self.assertEqual([tuple(p.position) for p in group],
+                [(0, 1, 2), (3, 4, 5), (6, 7, 8), (9, 10, 11)])
+            group.set_attribute('color', array('d', [1, 0, 0, 0.5]))
+            self.assertEqual([tuple(p.color) for p in group],
+                [(1, 0, 0, 0.5)] * 4)
+            group.set_attribute('mass', array('f', [10, 11, 12, 13]),
+                mask=bytes([1, 0, 0, 1]))
+            self.assertEqual([p.mass for p in group], [10, 1, 2, 13])
+            self.assertRaises(ValueError, group.set_attribute, 'mass',
+                array('f', [1, 2]))
+            self.assertRaises(ValueError, group.set_attribute, 'mass',
+                array('f', [1]), mask=bytes([1]))
+            self.assertRaises(TypeError, group.set_attribute, 'mass', b'abcd')
+
+    def test_set_attribute_age_kills(self):
+        from array import array
+        from lepton import ParticleGroup
+        group = ParticleGroup()
+        for i in range(10):
+            group.new(mass=i)
+        group.update(0)
+        group.set_attribute('age', array('f', [1.0, -1.0] * 5))
+        self.assertEqual(len(group), 5)
+        self.assertEqual(sorted(p.mass for p in group), [0, 2, 4, 6, 8])
+        group.set_attribute('age', array('f', [-1.0]))
+        group.update(0)
+        self.assertEqual(len(group), 0)
+        self.assertEqual(list(group), [])
+
+    def test_age_view_readonly(self):
+        from lepton import ParticleGroup
+        group = ParticleGroup()
+        group.new(age=1.0)
+        group.update(0)
+        age = group.view('age')
+        self.assertTrue(age.readonly)
+        self.assertEqual(age.tolist(), [1.0])
+        self.assertRaises(TypeError, age.__setitem__, 0, -1.0)
+        self.assertTrue(memoryview(group).readonly)
+        self.assertEqual(len(group), 1)
+
+    def test_where(self):
+        from lepton import ParticleGroup
+        from lepton.domain import AABox
+        group = ParticleGroup()
+        for i in range(10):
+            group.new(position=(i, 0, 0), age=i * 0.5, mass=i)
+        group.update(0)
+        box = AABox((-0.5, -1, -1), (4.5, 1, 1))
+        self.assertEqual(group.count_where(), 10)
+        self.assertEqual(group.count_where(domain=box), 5)
+        self.assertEqual(group.count_where(domain=box, inside=False), 5)
+        self.assertEqual(group.count_where(min_age=1.0, max_age=2.0), 3)
+        self.assertEqual(group.indices_where(domain=box, min_age=1.0), [2, 3, 4])
+        self.assertEqual(group.kill_where(domain=box, inside=False), 5)
+        self.assertEqual(len(group), 5)
+        self.assertEqual(group.count_where(), 5)
+        self.assertEqual(group.kill_where(max_age=0.5), 2)
+        self.assertEqual(sorted(p.mass for p in group), [2, 3, 4])
+        group.update(0)
+        self.assertEqual(group.killed_count(), 2)
+
+    def test_where_python_domain(self):
+        from lepton import ParticleGroup
+        class Domain:
+            def __contains__(self, point):
+                return point[0] > 2
+        group = ParticleGroup(attributes=('position',))
+        for i in range(5):
+            group.new(position=(i, 0, 0))
+        group.update(0)
+        self.assertEqual(group.indices_where(domain=Domain()), [3, 4])
+        self.assertEqual(group.kill_where(domain=[]), 0)
+        group = ParticleGroup(attributes=('color',))
+        self.assertRaises(ValueError, group.count_where, domain=Domain())
+
+    def test_where_native_domain(self):
+        from lepton import ParticleGroup
+        from lepton.domain import Sphere
+        sphere = Sphere((0, 0, 0), 2.5)
+        class Domain:
+            def __contains__(self, point):
+                return point in sphere
+        groups = []
+        for d in (sphere, Domain()):
+            group = ParticleGroup(attributes=('position',))
+            for i in range(-5, 6):
+                group.new(position=(i, 0, 0))
+            group.update(0)
+            self.assertEqual(group.indices_where(domain=d), [3, 4, 5, 6, 7])
+            self.assertEqual(group.count_where(domain=d, inside=False), 6)
+            self.assertEqual(group.kill_where(domain=d), 5)
+            self.assertEqual(len(group), 6)
+            groups.append([tuple(p.position) for p in group])
+        self.assertEqual(groups[0], groups[1])
+
+    def test_buffer(self):
+        from lepton import ParticleGroup
+        group = ParticleGroup()
+        group.new(position=(1, 2, 3), mass=4)
+        group.update(0)
+        records = memoryview(group)
+        self.assertEqual(records.shape, (1, 36))
+        self.assertEqual(records.tolist()[0][:3], [1, 2, 3])
+        self.assertEqual(records[0, 33], 4)
+        records.release()
+        group = ParticleGroup(attributes=('position', 'mass'))
+        self.assertEqual(memoryview(group).shape, (0, 8))
+        self.assertRaises(BufferError, memoryview, ParticleGroup(layout='soa'))
+
+    def test_stable_handles(self):
+        for preserve_order in (True, False):
+            group = self._fragmented_group(stable_handles=True,
+                compaction='always', preserve_order=preserve_order)
+            self.assertTrue(group.stable_handles)
+            handles = dict((p.mass, p.handle) for p in group)
+            self.assertEqual(len(handles), 25)
+            group.update(0)
+            self.assertEqual(group.killed_count(), 0)
+            for mass, handle in handles.items():
+                self.assertEqual(group.get(handle).mass, mass)
+            self.assertEqual(list(group.handles()),
+                [handles[m] for m in group.get_attribute('mass').tolist()])
+
+    def test_stable_handle_reuse(self):
+        from lepton import ParticleGroup
+        group = ParticleGroup(stable_handles=True)
+        group.new(mass=1)
+        group.new(mass=2)
+        group.update(0)
+        first, second = [p.handle for p in group]
+        group.kill(group.get(first))
+        self.assertTrue(group.get(first) is None)
+        self.assertEqual(list(group.handles()), [second])
+        self.assertEqual(list(group.handles(alive_only=False)),
+            [0xFFFFFFFF, second])
+        group.update(0)
+        group.new(mass=3)
+        group.update(0)
+        self.assertTrue(group.get(first) is None)
+        self.assertEqual(group.get(second).mass, 2)
+        third = [p.handle for p in group if p.mass == 3][0]
+        # The slot in the handle table is reused with a new generation
+        self.assertEqual(third & 0xFFFFFF, first & 0xFFFFFF)
+        self.assertNotEqual(third, first)
+        self.assertTrue(group.get(0xFFFFFFFF) is None)
+
+    def test_stable_handles_disabled(self):
+        from lepton import ParticleGroup
+        group = ParticleGroup()
+        group.new(mass=1)
+        group.update(0)
+        self.assertFalse(group.stable_handles)
+        self.assertRaises(ValueError, group.get, 0)
+        self.assertRaises(ValueError, group.handles)
+        self.assertTrue(list(group)[0].handle is None)
+
+    def test_layout(self):
+        from lepton import ParticleGroup
+        self.assertEqual(ParticleGroup().layout, 'aos')
+        self.assertEqual(ParticleGroup(layout='aos').layout, 'aos')
+        self.assertEqual(ParticleGroup(layout='soa').layout, 'soa')
+        self.assertRaises(ValueError, ParticleGroup, layout='columns')
+
+    def test_soa_particles(self):
+        from lepton import ParticleGroup
+        group = ParticleGroup(layout='soa')
+        count = 543
+        for i in range(count):
+            group.new(position=(i, -i, 1), color=(0, 0, 1), mass=i)
+        group.update(0)
+        self.assertEqual(len(group), count)
+        for i, p in enumerate(group):
+            self.assertEqual(tuple(p.position), (i, -i, 1))
+            self.assertEqual(tuple(p.last_position), (i, -i, 1))
+            self.assertEqual(tuple(p.color), (0, 0, 1, 1))
+            self.assertEqual(p.mass, i)
+            if i % 2:
+                group.kill(p)
+        p.velocity = (1, 2, 3)
+        p.color.a = 0.5
+        self.assertEqual(tuple(p.velocity), (1, 2, 3))
+        self.assertEqual(p.color.a, 0.5)
+        self.assertEqual(len(group), count // 2 + 1)
+        group.update(0)
+        self.assertEqual([p.mass for p in group], list(range(0, count, 2)))
+
+    def test_attributes(self):
+        from lepton import ParticleGroup
+        group = ParticleGroup()
+        self.assertEqual(group.attributes, (
+            'position', 'color', 'velocity', 'size', 'up', 'rotation',
+            'last_position', 'last_velocity', 'age', 'mass'))
+        # age is always stored
+        group = ParticleGroup(attributes=('velocity', 'position'))
+        self.assertEqual(group.attributes, ('position', 'velocity', 'age'))
+        self.assertRaises(ValueError, ParticleGroup, attributes=('spin',))
+
+    def test_compact_particles(self):
+        from lepton import ParticleGroup
+        for layout in ('aos', 'soa'):
+            group = ParticleGroup(
+                attributes=('position', 'color', 'mass'), layout=layout)
+            for i in range(250):
+                group.new(position=(i, 0, 0), velocity=(1, 1, 1), mass=i)
+            group.update(0.5)
+            self.assertEqual(len(group), 250)
+            for i, p in enumerate(group):
+                self.assertEqual(tuple(p.position), (i, 0, 0))
+                self.assertEqual(p.mass, i)
+                self.assertEqual(p.age, 0.5)
+                p.color = (1, 0, 0)
+                self.assertEqual(tuple(p.color), (1, 0, 0, 1))
+                self.assertRaises(AttributeError, getattr, p, 'velocity')
+                self.assertRaises(AttributeError, getattr, p, 'last_position')
+                self.assertRaises(AttributeError, setattr, p, 'size', (1, 1, 1))
+                if i >= 100:
+                    group.kill(p)
+            group.update(0)
+            self.assertEqual([p.mass for p in group], list(range(100)))
+
     def test_draw(self):
         group, particles = self.test_new_particle()
         renderer = TestRenderer()
@@ -107,6 +107,90 @@ class SystemTest(unittest.TestCase):
 		self.failUnless(group1.updated)
 		self.failUnless(group2.updated)
 	
+	def _threaded_system(self, threads):
+		from lepton import ParticleSystem, ParticleGroup, controller
+		system = ParticleSystem((controller.Gravity((0, -1, 0)),), threads=threads)
+		calls = []
+		def record(td, group):
+			calls.append(len(group))
+		for size in (10, 5000, 1, 0, 300, 2000):
+			group = ParticleGroup(system=system, controllers=(
+				controller.Movement(damping=0.99), controller.Lifetime(0.35),
+				record, controller.Growth(0.1)))
+			for i in range(size):
+				group.new(velocity=(i % 13, 0, 0), age=(i % 10) * 0.05)
+		test_group = TestGroup()
+		system.add_group(test_group)
+		return system, calls, test_group
+
+	def test_update_threads(self):
+		serial, serial_calls, serial_test_group = self._threaded_system(1)
+		threaded, threaded_calls, threaded_test_group = self._threaded_system(4)
+		self.assertEqual(threaded.threads, 4)
+		for i in range(5):
+			serial.update(0.1)
+			threaded.update(0.1)
+		self.assertEqual(serial_calls, threaded_calls)
+		self.assertEqual(threaded_test_group.updated, 5)
+		for group1, group2 in zip(list(serial)[:-1], list(threaded)[:-1]):
+			for attr in ('position', 'velocity', 'size', 'age'):
+				self.assertEqual(group1.get_attribute(attr).tolist(),
+					group2.get_attribute(attr).tolist())
+
+	def _damped_growth_system(self, threads):
+		from lepton import ParticleSystem, ParticleGroup, controller
+		system = ParticleSystem(
+			(controller.Growth(1.0, damping=0.5),), threads=threads)
+		for i in range(8):
+			group = ParticleGroup(system=system)
+			for j in range(100 * (i + 1)):
+				group.new(size=(1, 1, 1))
+		return system
+
+	def test_update_threads_shared_growth(self):
+		# The damping of a global Growth is applied once per group, in order
+		serial = self._damped_growth_system(1)
+		threaded = self._damped_growth_system(8)
+		for i in range(3):
+			serial.update(1.0)
+			threaded.update(1.0)
+		for group1, group2 in zip(serial, threaded):
+			self.assertEqual(group1.get_attribute('size').tolist(),
+				group2.get_attribute('size').tolist())
+
+	def test_update_threads_cross_group_order(self):
+		# Every group is consolidated before any Python controller runs, so
+		# particles added to a later group wait for its next update
+		from lepton import ParticleSystem, ParticleGroup
+		lengths = []
+		for threads in (1, 2):
+			system = ParticleSystem(threads=threads)
+			a = ParticleGroup(system=system)
+			b = ParticleGroup(system=system)
+			a.bind_controller(lambda td, group: b.new(position=(0, 0, 0)))
+			for i in range(3):
+				system.update(0.1)
+			lengths.append(len(b))
+		self.assertEqual(lengths, [3, 2])
+
+	def test_update_threads_invalid(self):
+		from lepton import ParticleSystem, ParticleGroup
+		self.assertRaises(ValueError, ParticleSystem, threads=0)
+		system = ParticleSystem(threads=2)
+		group = ParticleGroup(system=system)
+		system.add_group(group)
+		self.assertRaises(ValueError, system.update, 0.1)
+
+	def test_update_pool_uninitialized(self):
+		from lepton import ParticleGroup
+		from lepton.group import UpdatePool
+		pool = UpdatePool.__new__(UpdatePool)
+		self.assertRaises(ValueError, getattr, pool, 'threads')
+		self.assertRaises(ValueError, pool.update, [ParticleGroup()], 0.1)
+		pool = UpdatePool.__new__(UpdatePool)
+		self.assertRaises(ValueError, pool.__init__, 0)
+		self.assertRaises(ValueError, pool.update, [ParticleGroup()], 0.1)
+
 	def test_run_ahead(self):
 		from lepton import ParticleSystem
 		system = ParticleSystem()